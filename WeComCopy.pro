@@ -19,7 +19,7 @@ DESTDIR = bin
 unix:UI_DIR = ../tmp/ui
 win32:UI_DIR = tmp/ui
 
-INCLUDEPATH += include
+INCLUDEPATH += include common
 
 SOURCES += source/main.cpp\
         source/wecomwnd.cpp \
@@ -53,7 +53,13 @@ SOURCES += source/main.cpp\
     source/appreciatedlg.cpp \
     source/carouselpane.cpp \
     source/serverlogindlg.cpp \
-    source/calldialog.cpp
+    source/calldialog.cpp \
+    common/framedecoder.cpp \
+    common/wirecodec.cpp \
+    common/ackranges.cpp \
+    common/framecompression.cpp \
+    common/batchenvelope.cpp \
+    common/framebatcher.cpp
 
 HEADERS  += include/wecomwnd.h \
     include/navpane.h \
@@ -87,7 +93,13 @@ HEADERS  += include/wecomwnd.h \
     include/appreciatedlg.h \
     include/carouselpane.h \
     include/serverlogindlg.h \
-    include/calldialog.h
+    include/calldialog.h \
+    common/framedecoder.h \
+    common/wirecodec.h \
+    common/ackranges.h \
+    common/framecompression.h \
+    common/batchenvelope.h \
+    common/framebatcher.h
 
 FORMS    += ui/wecomwnd.ui \
     ui/userprofiles.ui \
@@ -0,0 +1,88 @@
+#-------------------------------------------------
+#
+# WeCompany Server Benchmarks
+# Usage: WeCompanyBench <benchmark> [--option=value ...]
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = WeCompanyBench
+CONFIG += console c++11
+CONFIG -= app_bundle
+TEMPLATE = app
+DESTDIR = bin
+
+INCLUDEPATH += server/include server/bench common
+
+SOURCES += server/bench/benchmain.cpp \
+    server/bench/bench_framing.cpp \
+    server/bench/bench_broadcast.cpp \
+    server/bench/bench_registry.cpp \
+    server/bench/bench_transport.cpp \
+    server/bench/bench_codec.cpp \
+    server/bench/bench_tls.cpp \
+    server/bench/bench_media.cpp \
+    server/bench/bench_mix.cpp \
+    server/source/tcpserver.cpp \
+    server/source/serverworker.cpp \
+    server/source/clientregistry.cpp \
+    server/source/outboundqueue.cpp \
+    server/source/broadcastengine.cpp \
+    server/source/timingwheel.cpp \
+    server/source/tokenbucket.cpp \
+    server/source/transport.cpp \
+    server/source/qttransport.cpp \
+    server/source/tlscontext.cpp \
+    server/source/messagedispatcher.cpp \
+    server/source/sessionlog.cpp \
+    server/source/videocallserver.cpp \
+    server/source/audiomixer.cpp \
+    server/source/mediarelay.cpp \
+    server/source/jitterbuffer.cpp \
+    common/framedecoder.cpp \
+    common/wirecodec.cpp \
+    common/ackranges.cpp \
+    common/mediapacket.cpp \
+    common/framecompression.cpp \
+    common/batchenvelope.cpp
+
+HEADERS += server/bench/bench.h \
+    server/include/tcpserver.h \
+    server/include/serverworker.h \
+    server/include/clientregistry.h \
+    server/include/outboundqueue.h \
+    server/include/broadcastengine.h \
+    server/include/timingwheel.h \
+    server/include/tokenbucket.h \
+    server/include/transport.h \
+    server/include/qttransport.h \
+    server/include/tlscontext.h \
+    server/include/messagedispatcher.h \
+    server/include/sessionlog.h \
+    server/include/videocallserver.h \
+    server/include/audiomixer.h \
+    server/include/mediarelay.h \
+    server/include/jitterbuffer.h \
+    common/framedecoder.h \
+    common/wirecodec.h \
+    common/ackranges.h \
+    common/mediapacket.h \
+    common/framecompression.h \
+    common/batchenvelope.h
+
+# Server-side TLS session resumption: all sockets share one OpenSSL context
+# through Qt 5's private network API. Opt in with CONFIG+=tls_resumption
+# (needs the Qt private headers, e.g. qtbase5-private-dev); without it every
+# TLS connection does a full handshake.
+tls_resumption {
+    QT += network-private
+    DEFINES += TLS_SHARED_CONTEXT
+}
+
+# Edge-triggered epoll transport (--transport epoll)
+linux {
+    SOURCES += server/source/epolltransport.cpp
+    HEADERS += server/include/epolltransport.h
+}
@@ -0,0 +1,42 @@
+#-------------------------------------------------
+#
+# WeCompany Load Generator
+# Usage: WeCompanyLoadGen [--clients=N --threads=T ...]
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = WeCompanyLoadGen
+CONFIG += console c++11
+CONFIG -= app_bundle
+TEMPLATE = app
+DESTDIR = bin
+
+INCLUDEPATH += server/include server/loadgen common
+
+SOURCES += server/loadgen/loadgenmain.cpp \
+    server/loadgen/loadworker.cpp \
+    server/loadgen/loadclient.cpp \
+    server/loadgen/loadshared.cpp \
+    server/loadgen/latencyhistogram.cpp \
+    common/framedecoder.cpp \
+    common/wirecodec.cpp \
+    common/ackranges.cpp \
+    common/mediapacket.cpp \
+    common/framecompression.cpp \
+    common/batchenvelope.cpp \
+    common/framebatcher.cpp
+
+HEADERS += server/loadgen/loadworker.h \
+    server/loadgen/loadclient.h \
+    server/loadgen/loadshared.h \
+    server/loadgen/latencyhistogram.h \
+    common/framedecoder.h \
+    common/wirecodec.h \
+    common/ackranges.h \
+    common/mediapacket.h \
+    common/framecompression.h \
+    common/batchenvelope.h \
+    common/framebatcher.h
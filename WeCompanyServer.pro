@@ -14,20 +14,83 @@ CONFIG -= app_bundle
 TEMPLATE = app
 DESTDIR = bin
 
-INCLUDEPATH += server/include
+INCLUDEPATH += server/include common
 
 SOURCES += server/source/servermain.cpp \
     server/source/tcpserver.cpp \
+    server/source/serverworker.cpp \
+    server/source/clientregistry.cpp \
+    server/source/outboundqueue.cpp \
+    server/source/broadcastengine.cpp \
+    server/source/timingwheel.cpp \
+    server/source/tokenbucket.cpp \
+    server/source/transport.cpp \
+    server/source/qttransport.cpp \
+    server/source/tlscontext.cpp \
+    server/source/messagedispatcher.cpp \
+    server/source/sessionlog.cpp \
     server/source/videocallserver.cpp \
+    server/source/audiomixer.cpp \
+    server/source/mediarelay.cpp \
+    server/source/jitterbuffer.cpp \
+    server/source/textrouter.cpp \
+    server/source/offlinestore.cpp \
+    server/source/filetransferserver.cpp \
     server/source/authmanager.cpp \
+    server/source/authservice.cpp \
     server/source/databasemanager.cpp \
-    server/source/agoramanager.cpp
+    server/source/agoramanager.cpp \
+    common/framedecoder.cpp \
+    common/wirecodec.cpp \
+    common/ackranges.cpp \
+    common/mediapacket.cpp \
+    common/framecompression.cpp \
+    common/batchenvelope.cpp
 
 HEADERS += server/include/tcpserver.h \
+    server/include/serverworker.h \
+    server/include/clientregistry.h \
+    server/include/outboundqueue.h \
+    server/include/broadcastengine.h \
+    server/include/timingwheel.h \
+    server/include/tokenbucket.h \
+    server/include/transport.h \
+    server/include/qttransport.h \
+    server/include/tlscontext.h \
+    server/include/messagedispatcher.h \
+    server/include/sessionlog.h \
     server/include/videocallserver.h \
+    server/include/audiomixer.h \
+    server/include/mediarelay.h \
+    server/include/jitterbuffer.h \
+    server/include/textrouter.h \
+    server/include/offlinestore.h \
+    server/include/filetransferserver.h \
     server/include/authmanager.h \
+    server/include/authservice.h \
     server/include/databasemanager.h \
-    server/include/agoramanager.h
+    server/include/agoramanager.h \
+    common/framedecoder.h \
+    common/wirecodec.h \
+    common/ackranges.h \
+    common/mediapacket.h \
+    common/framecompression.h \
+    common/batchenvelope.h
+
+# Server-side TLS session resumption: all sockets share one OpenSSL context
+# through Qt 5's private network API. Opt in with CONFIG+=tls_resumption
+# (needs the Qt private headers, e.g. qtbase5-private-dev); without it every
+# TLS connection does a full handshake.
+tls_resumption {
+    QT += network-private
+    DEFINES += TLS_SHARED_CONTEXT
+}
+
+# Edge-triggered epoll transport (--transport epoll)
+linux {
+    SOURCES += server/source/epolltransport.cpp
+    HEADERS += server/include/epolltransport.h
+}
 
 # MySQL driver check
 !contains(QT_SQL_DRIVERS, mysql) {
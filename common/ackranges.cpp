@@ -0,0 +1,141 @@
+#include "ackranges.h"
+#include "wirecodec.h"
+
+void AckRanges::insert(quint64 first, quint64 last)
+{
+    if (first > last) {
+        return;
+    }
+
+    // First range that ends at or after first - 1, it may touch the new one
+    int i = 0;
+    while (i < m_ranges.size() && m_ranges.at(i).last + 1 < first) {
+        ++i;
+    }
+
+    // Swallow every range that overlaps or touches [first, last]
+    int end = i;
+    while (end < m_ranges.size() && m_ranges.at(end).first <= last + 1) {
+        first = qMin(first, m_ranges.at(end).first);
+        last = qMax(last, m_ranges.at(end).last);
+        ++end;
+    }
+
+    Range merged = { first, last };
+    if (end > i) {
+        m_ranges[i] = merged;
+        m_ranges.remove(i + 1, end - i - 1);
+    } else {
+        m_ranges.insert(i, merged);
+    }
+}
+
+void AckRanges::remove(quint64 first, quint64 last)
+{
+    if (first > last) {
+        return;
+    }
+
+    QVector<Range> kept;
+    kept.reserve(m_ranges.size() + 1);
+    for (const Range &range : m_ranges) {
+        if (range.last < first || range.first > last) {
+            kept.append(range);
+            continue;
+        }
+        if (range.first < first) {
+            Range head = { range.first, first - 1 };
+            kept.append(head);
+        }
+        if (range.last > last) {
+            Range tail = { last + 1, range.last };
+            kept.append(tail);
+        }
+    }
+    m_ranges.swap(kept);
+}
+
+void AckRanges::removeUpTo(quint64 sequence)
+{
+    int drop = 0;
+    while (drop < m_ranges.size() && m_ranges.at(drop).last <= sequence) {
+        ++drop;
+    }
+    m_ranges.remove(0, drop);
+
+    if (!m_ranges.isEmpty() && m_ranges.first().first <= sequence) {
+        m_ranges.first().first = sequence + 1;
+    }
+}
+
+bool AckRanges::contains(quint64 sequence) const
+{
+    for (const Range &range : m_ranges) {
+        if (sequence < range.first) {
+            return false;
+        }
+        if (sequence <= range.last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+quint64 AckRanges::advance(quint64 cumulative)
+{
+    removeUpTo(cumulative);
+    while (!m_ranges.isEmpty() && m_ranges.first().first == cumulative + 1) {
+        cumulative = m_ranges.first().last;
+        m_ranges.removeFirst();
+    }
+    return cumulative;
+}
+
+QByteArray AckRanges::encodeAck(quint64 cumulative, const AckRanges &selective)
+{
+    int count = 0;
+    for (const Range &range : selective.m_ranges) {
+        if (range.first > cumulative + 1 && ++count == MAX_RANGES) {
+            break;
+        }
+    }
+
+    QByteArray message;
+    WireWriter writer(message);
+    writer.writeByte(MESSAGE_TYPE).writeVarint(cumulative).writeVarint(static_cast<quint64>(count));
+
+    quint64 previous = cumulative;
+    for (const Range &range : selective.m_ranges) {
+        if (count == 0) {
+            break;
+        }
+        if (range.first <= cumulative + 1) {
+            continue;   // Covered by the cumulative ack or continuing it
+        }
+        writer.writeVarint(range.first - previous).writeVarint(range.last - range.first);
+        previous = range.last;
+        --count;
+    }
+    return message;
+}
+
+bool AckRanges::decodeAck(WireReader &reader, quint64 &cumulative, AckRanges &selective)
+{
+    quint64 count = 0;
+    if (!reader.readVarint(cumulative) || !reader.readVarint(count) || count > MAX_RANGES) {
+        return false;
+    }
+
+    quint64 previous = cumulative;
+    for (quint64 i = 0; i < count; ++i) {
+        quint64 gap = 0;
+        quint64 length = 0;
+        if (!reader.readVarint(gap) || !reader.readVarint(length) || gap == 0
+                || gap > ~previous || length > ~(previous + gap)) {
+            return false;
+        }
+        selective.insert(previous + gap, previous + gap + length);
+        previous += gap + length;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef ACKRANGES_H
+#define ACKRANGES_H
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QVector>
+#include <QtGlobal>
+
+class WireReader;
+
+// Sorted, disjoint, inclusive ranges of message sequence numbers. Receivers
+// collect what arrived out of order above their cumulative ack, senders use
+// it to retire delivered messages in bulk.
+//   [0x0E][Cumulative]([RangeCount]([Gap][Length]) × RangeCount)
+// Each range starts Gap past the end of the previous one (the first past
+// Cumulative) and spans Length + 1 sequences. Peers only send acks after
+// announcing CAPABILITY_ACK at login.
+class AckRanges
+{
+public:
+    static const quint8 MESSAGE_TYPE = 0x0E;
+    static const quint8 CAPABILITY_ACK = 0x04;
+    // Selective ranges carried by one ack, further ones wait for the next
+    static const int MAX_RANGES = 32;
+
+    struct Range {
+        quint64 first;
+        quint64 last;
+    };
+
+    void insert(quint64 first, quint64 last);
+    void insert(quint64 sequence) { insert(sequence, sequence); }
+    void remove(quint64 first, quint64 last);
+    void removeUpTo(quint64 sequence);
+    void clear() { m_ranges.clear(); }
+
+    bool contains(quint64 sequence) const;
+    bool isEmpty() const { return m_ranges.isEmpty(); }
+    int count() const { return m_ranges.size(); }
+    const QVector<Range> &ranges() const { return m_ranges; }
+
+    // Raises 'cumulative' through the ranges that continue it and drops
+    // everything it now covers
+    quint64 advance(quint64 cumulative);
+
+    static QByteArray encodeAck(quint64 cumulative, const AckRanges &selective);
+    // Reads the payload after the message type
+    static bool decodeAck(WireReader &reader, quint64 &cumulative, AckRanges &selective);
+
+private:
+    QVector<Range> m_ranges;
+};
+
+Q_DECLARE_METATYPE(AckRanges)
+
+#endif // ACKRANGES_H
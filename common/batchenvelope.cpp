@@ -0,0 +1,30 @@
+#include "batchenvelope.h"
+#include "framecompression.h"
+
+void BatchEnvelope::appendEntry(QByteArray &envelope, const char *body, int size)
+{
+    WireWriter(envelope).writeBytes(body, size);
+}
+
+BatchReader::BatchReader(const FrameView &frame)
+    : m_reader(frame.data + 1, qMax(0, frame.size - 1))
+{
+}
+
+bool BatchReader::next(FrameView &entry)
+{
+    if (m_reader.atEnd()) {
+        return false;
+    }
+
+    // A compressed envelope is still an envelope, the flag must not hide it
+    WireView body;
+    if (!m_reader.readBytes(body) || body.size == 0
+            || (static_cast<quint8>(body.data[0]) & ~FrameCompression::COMPRESSED_FLAG) == BatchEnvelope::MESSAGE_TYPE) {
+        return false;
+    }
+
+    entry.data = body.data;
+    entry.size = body.size;
+    return true;
+}
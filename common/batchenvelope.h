@@ -0,0 +1,44 @@
+#ifndef BATCHENVELOPE_H
+#define BATCHENVELOPE_H
+
+#include <QByteArray>
+#include <QtGlobal>
+#include "framedecoder.h"
+#include "wirecodec.h"
+
+// Many small messages packed into one frame, unpacked in order:
+//   [0x0C]([varint body length][MessageType][Payload]) × N
+// Envelopes never nest, not even compressed ones. Peers only receive them after announcing
+// CAPABILITY_BATCH at login; the server accepts them from anyone logged in.
+
+class BatchEnvelope
+{
+public:
+    static const quint8 MESSAGE_TYPE = 0x0C;
+    static const quint8 CAPABILITY_BATCH = 0x02;
+    // Bodies above this size keep a frame of their own
+    static const int MAX_ENTRY_SIZE = 1024;
+
+    static bool isBatchable(int bodySize) { return bodySize > 0 && bodySize <= MAX_ENTRY_SIZE; }
+    static int entrySize(int bodySize) { return WireWriter::varintSize(static_cast<quint64>(bodySize)) + bodySize; }
+
+    // Appends one [varint length][body] entry to an envelope under construction
+    static void appendEntry(QByteArray &envelope, const char *body, int size);
+};
+
+// Walks the entries of a received envelope as views into it, nothing is copied
+class BatchReader
+{
+public:
+    // 'frame' is the whole envelope body, including the MSG_BATCH type byte
+    explicit BatchReader(const FrameView &frame);
+
+    // False at the end, or on a malformed or nested entry
+    bool next(FrameView &entry);
+    bool isValid() const { return m_reader.isValid(); }
+
+private:
+    WireReader m_reader;
+};
+
+#endif // BATCHENVELOPE_H
@@ -0,0 +1,85 @@
+#include "framebatcher.h"
+#include "framedecoder.h"
+#include "batchenvelope.h"
+#include <QIODevice>
+#include <QTimer>
+
+FrameBatcher::FrameBatcher(QIODevice *device, QObject *parent)
+    : QObject(parent)
+    , m_device(device)
+    , m_timer(new QTimer(this))
+    , m_pendingBytes(0)
+    , m_envelope(false)
+{
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(DEFAULT_WINDOW_MS);
+    connect(m_timer, &QTimer::timeout, this, &FrameBatcher::flush);
+}
+
+void FrameBatcher::setWindow(int milliseconds)
+{
+    m_timer->setInterval(qMax(0, milliseconds));
+}
+
+void FrameBatcher::send(const QByteArray &body)
+{
+    if (body.isEmpty()) {
+        return;
+    }
+
+    m_pending.append(body);
+    m_pendingBytes += body.size();
+
+    if (m_pendingBytes >= MAX_PENDING_BYTES) {
+        flush();
+    } else if (!m_timer->isActive()) {
+        // The window opens with the first message, later ones do not extend it
+        m_timer->start();
+    }
+}
+
+void FrameBatcher::flush()
+{
+    m_timer->stop();
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    QByteArray out;
+    out.reserve(m_pendingBytes + m_pending.size() * (FrameDecoder::HEADER_SIZE + 2));
+
+    for (int i = 0; i < m_pending.size(); ) {
+        const QByteArray &body = m_pending.at(i);
+        bool pack = m_envelope && i + 1 < m_pending.size()
+                && BatchEnvelope::isBatchable(body.size())
+                && BatchEnvelope::isBatchable(m_pending.at(i + 1).size());
+
+        if (!pack) {
+            out.append(FrameDecoder::encode(body));
+            ++i;
+            continue;
+        }
+
+        // [Length][0x0C] then entries, the length is patched at the end
+        int start = out.size();
+        out.resize(start + FrameDecoder::HEADER_SIZE);
+        out.append(static_cast<char>(BatchEnvelope::MESSAGE_TYPE));
+        while (i < m_pending.size() && BatchEnvelope::isBatchable(m_pending.at(i).size())) {
+            BatchEnvelope::appendEntry(out, m_pending.at(i).constData(), m_pending.at(i).size());
+            ++i;
+        }
+        FrameDecoder::writeHeader(out.data() + start,
+                                  static_cast<quint32>(out.size() - start - FrameDecoder::HEADER_SIZE));
+    }
+
+    m_pending.clear();
+    m_pendingBytes = 0;
+    m_device->write(out);
+}
+
+void FrameBatcher::clear()
+{
+    m_timer->stop();
+    m_pending.clear();
+    m_pendingBytes = 0;
+}
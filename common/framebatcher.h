@@ -0,0 +1,45 @@
+#ifndef FRAMEBATCHER_H
+#define FRAMEBATCHER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+
+class QIODevice;
+class QTimer;
+
+// Client send path. Bodies passed to send() within one short window are
+// written with a single call, runs of small ones packed into MSG_BATCH
+// envelopes once the server accepted CAPABILITY_BATCH.
+class FrameBatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int DEFAULT_WINDOW_MS = 2;
+    // Pending bytes that flush without waiting for the window
+    static const int MAX_PENDING_BYTES = 64 * 1024;
+
+    explicit FrameBatcher(QIODevice *device, QObject *parent = nullptr);
+
+    void setWindow(int milliseconds);
+    void setEnvelopeEnabled(bool enabled) { m_envelope = enabled; }
+    bool isEnvelopeEnabled() const { return m_envelope; }
+
+    // Body is [MessageType][Payload], framed here
+    void send(const QByteArray &body);
+
+public slots:
+    void flush();
+    // Drops anything not written yet, e.g. after a disconnect
+    void clear();
+
+private:
+    QIODevice *m_device;
+    QTimer *m_timer;
+    QList<QByteArray> m_pending;
+    int m_pendingBytes;
+    bool m_envelope;
+};
+
+#endif // FRAMEBATCHER_H
@@ -0,0 +1,44 @@
+#include "framecompression.h"
+#include <QtEndian>
+
+bool FrameCompression::compress(const QByteArray &body, QByteArray &out, int level)
+{
+    if (body.size() < 2) {
+        return false;
+    }
+    
+    QByteArray packed = qCompress(reinterpret_cast<const uchar*>(body.constData() + 1), body.size() - 1, level);
+    if (packed.isEmpty() || packed.size() + 1 >= body.size()) {
+        return false;
+    }
+    
+    out.reserve(packed.size() + 1);
+    out.resize(0);
+    out.append(static_cast<char>(static_cast<quint8>(body.at(0)) | COMPRESSED_FLAG));
+    out.append(packed);
+    return true;
+}
+
+bool FrameCompression::decompress(const char *data, int size, int maxSize, QByteArray &out)
+{
+    // Type byte plus the 4 byte size header of qCompress()
+    if (size < 5) {
+        return false;
+    }
+    
+    quint32 payloadSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data + 1));
+    if (payloadSize == 0 || payloadSize >= static_cast<quint32>(maxSize)) {
+        return false;
+    }
+    
+    QByteArray payload = qUncompress(reinterpret_cast<const uchar*>(data + 1), size - 1);
+    if (payload.size() != static_cast<int>(payloadSize)) {
+        return false;
+    }
+    
+    out.reserve(payload.size() + 1);
+    out.resize(0);
+    out.append(static_cast<char>(static_cast<quint8>(data[0]) & ~COMPRESSED_FLAG));
+    out.append(payload);
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef FRAMECOMPRESSION_H
+#define FRAMECOMPRESSION_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// Optional payload compression, negotiated per connection at login. A
+// compressed frame body sets the high bit of the message type:
+//   [MessageType | 0x80][Uncompressed payload size (4 bytes, big-endian)][zlib data]
+// which is the type byte followed by qCompress() output. Each frame is
+// compressed on its own, so dropping a queued frame never breaks the stream.
+
+class FrameCompression
+{
+public:
+    // Capability bits exchanged in the login request and the auth response
+    static const quint8 CAPABILITY_COMPRESSION = 0x01;
+
+    static const quint8 COMPRESSED_FLAG = 0x80;
+    static const int DEFAULT_THRESHOLD = 512;
+
+    static bool isCompressed(quint8 type) { return (type & COMPRESSED_FLAG) != 0; }
+
+    // Fills 'out' and returns true only if the result is smaller than the body
+    static bool compress(const QByteArray &body, QByteArray &out, int level = -1);
+    // Restores the original body. Fails on corrupt data or when the announced
+    // size is above maxSize, before anything is inflated.
+    static bool decompress(const char *data, int size, int maxSize, QByteArray &out);
+};
+
+#endif // FRAMECOMPRESSION_H
@@ -0,0 +1,131 @@
+#include "framedecoder.h"
+#include <QIODevice>
+#include <QtEndian>
+#include <cstring>
+
+FrameDecoder::FrameDecoder(int maxFrameSize)
+    : m_readPos(0), m_appendBase(0), m_maxFrameSize(maxFrameSize)
+{
+}
+
+void FrameDecoder::compact()
+{
+    // Only the unconsumed tail (usually a partial frame) is moved
+    if (m_readPos == 0) {
+        return;
+    }
+
+    int remaining = m_buffer.size() - m_readPos;
+    if (remaining == 0) {
+        // Idle connections hold no buffer between reads
+        m_buffer.clear();
+        m_readPos = 0;
+        return;
+    }
+
+    if (remaining > 0) {
+        memmove(m_buffer.data(), m_buffer.constData() + m_readPos, remaining);
+    }
+    m_buffer.resize(remaining);
+    m_readPos = 0;
+}
+
+qint64 FrameDecoder::readFrom(QIODevice *device)
+{
+    compact();
+
+    qint64 available = device->bytesAvailable();
+    if (available <= 0) {
+        return 0;
+    }
+
+    int oldSize = m_buffer.size();
+    m_buffer.resize(oldSize + static_cast<int>(available));
+    qint64 bytesRead = device->read(m_buffer.data() + oldSize, available);
+    m_buffer.resize(oldSize + static_cast<int>(qMax<qint64>(bytesRead, 0)));
+
+    return bytesRead;
+}
+
+void FrameDecoder::append(const char *data, int size)
+{
+    compact();
+    m_buffer.append(data, size);
+}
+
+char *FrameDecoder::prepareAppend(int size)
+{
+    compact();
+
+    // Reserved capacity keeps the later shrink in commitAppend() from reallocating
+    m_appendBase = m_buffer.size();
+    m_buffer.reserve(m_appendBase + size);
+    m_buffer.resize(m_appendBase + size);
+    return m_buffer.data() + m_appendBase;
+}
+
+void FrameDecoder::commitAppend(int size)
+{
+    int newSize = m_appendBase + qMax(0, size);
+    if (newSize == 0) {
+        // clear() rather than resize(0), which would keep the reserved capacity
+        m_buffer.clear();
+        return;
+    }
+    m_buffer.resize(newSize);
+}
+
+FrameDecoder::Status FrameDecoder::next(FrameView &frame)
+{
+    int available = m_buffer.size() - m_readPos;
+    if (available < HEADER_SIZE) {
+        return NeedMoreData;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar*>(m_buffer.constData() + m_readPos);
+    quint32 bodySize = qFromBigEndian<quint32>(header);
+    if (bodySize > static_cast<quint32>(m_maxFrameSize)) {
+        return FrameTooLarge;
+    }
+
+    if (static_cast<quint32>(available - HEADER_SIZE) < bodySize) {
+        // Reserve room for the rest of the frame so the next read lands in
+        // place, large frames grow with the data actually received
+        int reserve = qMin(static_cast<int>(bodySize), available - HEADER_SIZE + MAX_RESERVE_AHEAD);
+        m_buffer.reserve(m_readPos + HEADER_SIZE + reserve);
+        return NeedMoreData;
+    }
+
+    frame.data = m_buffer.constData() + m_readPos + HEADER_SIZE;
+    frame.size = static_cast<int>(bodySize);
+    m_readPos += HEADER_SIZE + frame.size;
+
+    return FrameReady;
+}
+
+void FrameDecoder::trim()
+{
+    if (m_readPos > 0 && m_readPos == m_buffer.size()) {
+        m_buffer.clear();
+        m_readPos = 0;
+    }
+}
+
+void FrameDecoder::clear()
+{
+    m_buffer.clear();
+    m_readPos = 0;
+}
+
+QByteArray FrameDecoder::encode(const QByteArray &body)
+{
+    QByteArray frame(HEADER_SIZE + body.size(), Qt::Uninitialized);
+    writeHeader(frame.data(), static_cast<quint32>(body.size()));
+    memcpy(frame.data() + HEADER_SIZE, body.constData(), body.size());
+    return frame;
+}
+
+void FrameDecoder::writeHeader(char *dest, quint32 bodySize)
+{
+    qToBigEndian<quint32>(bodySize, reinterpret_cast<uchar*>(dest));
+}
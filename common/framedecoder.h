@@ -0,0 +1,67 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+class QIODevice;
+
+// Wire framing shared by client and server:
+//   [Body length (4 bytes, big-endian)][Body]
+// where Body is [MessageType (1 byte)][Payload].
+
+struct FrameView {
+    const char *data;   // Points into the decoder buffer, valid until the next read
+    int size;
+};
+
+class FrameDecoder
+{
+public:
+    enum Status {
+        NeedMoreData = 0,   // No complete frame buffered yet
+        FrameReady = 1,     // A frame was returned
+        FrameTooLarge = 2   // Peer announced a frame above the limit, stream is unusable
+    };
+
+    static const int HEADER_SIZE = 4;
+    static const int DEFAULT_MAX_FRAME_SIZE = 16 * 1024 * 1024;
+    // Most a partial frame reserves ahead; the header alone is no reason
+    // to allocate up to the frame limit for a peer that may never send it
+    static const int MAX_RESERVE_AHEAD = 64 * 1024;
+
+    explicit FrameDecoder(int maxFrameSize = DEFAULT_MAX_FRAME_SIZE);
+
+    // Reads everything the device has buffered straight into the decoder
+    qint64 readFrom(QIODevice *device);
+    void append(const char *data, int size);
+
+    // For raw sockets: reserve room at the tail, read into it, then commit
+    // the number of bytes actually read
+    char *prepareAppend(int size);
+    void commitAppend(int size);
+
+    // Returns the next complete frame body without copying it. The view stays
+    // valid until the next call into the decoder.
+    Status next(FrameView &frame);
+
+    // Frees the buffer once every frame has been consumed, so idle
+    // connections hold no memory. Invalidates outstanding views.
+    void trim();
+    void clear();
+    int bufferedBytes() const { return m_buffer.size() - m_readPos; }
+    int maxFrameSize() const { return m_maxFrameSize; }
+
+    static QByteArray encode(const QByteArray &body);
+    static void writeHeader(char *dest, quint32 bodySize);
+
+private:
+    void compact();
+
+    QByteArray m_buffer;
+    int m_readPos;
+    int m_appendBase;
+    int m_maxFrameSize;
+};
+
+#endif // FRAMEDECODER_H
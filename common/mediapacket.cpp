@@ -0,0 +1,85 @@
+#include "mediapacket.h"
+#include <QMessageAuthenticationCode>
+#include <QRandomGenerator>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+    QByteArray tagOf(const char *data, int size, const QByteArray &key)
+    {
+        QMessageAuthenticationCode mac(QCryptographicHash::Sha256, key);
+        mac.addData(data, size);
+        return mac.result().left(MediaPacket::TAG_SIZE);
+    }
+}
+
+QByteArray MediaPacket::seal(quint32 sessionId, quint8 party, quint32 sequence, const QByteArray &key,
+                             const char *media, int mediaSize)
+{
+    QByteArray packet(HEADER_SIZE + mediaSize, Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar*>(packet.data());
+    qToBigEndian<quint32>(sessionId, out);
+    out[4] = party;
+    qToBigEndian<quint32>(sequence, out + 5);
+    if (mediaSize > 0) {
+        memcpy(out + HEADER_SIZE, media, mediaSize);
+    }
+    packet.append(tagOf(packet.constData(), packet.size(), key));
+    return packet;
+}
+
+bool MediaPacket::parse(const char *data, int size, MediaPacket &packet)
+{
+    if (size < OVERHEAD) {
+        return false;
+    }
+    const uchar *in = reinterpret_cast<const uchar*>(data);
+    packet.sessionId = qFromBigEndian<quint32>(in);
+    packet.party = in[4];
+    packet.sequence = qFromBigEndian<quint32>(in + 5);
+    packet.media = data + HEADER_SIZE;
+    packet.mediaSize = size - OVERHEAD;
+    return packet.party <= PARTY_CALLEE;
+}
+
+bool MediaPacket::verify(const char *data, int size, const QByteArray &key)
+{
+    if (size < OVERHEAD) {
+        return false;
+    }
+    QByteArray expected = tagOf(data, size - TAG_SIZE, key);
+    // Constant time, a mismatch position must not show in the timing
+    const char *tag = data + size - TAG_SIZE;
+    char diff = 0;
+    for (int i = 0; i < TAG_SIZE; ++i) {
+        diff |= expected.at(i) ^ tag[i];
+    }
+    return diff == 0;
+}
+
+QByteArray MediaPacket::generateKey()
+{
+    QByteArray key(KEY_SIZE, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(key.data()), KEY_SIZE / 4);
+    return key;
+}
+
+bool ReplayWindow::accept(quint32 sequence)
+{
+    if (sequence == 0) {
+        return false;
+    }
+    if (sequence > m_highest) {
+        quint32 shift = sequence - m_highest;
+        m_seen = (shift >= 64) ? 1 : ((m_seen << shift) | 1);
+        m_highest = sequence;
+        return true;
+    }
+
+    quint32 age = m_highest - sequence;
+    if (age >= 64 || (m_seen & (Q_UINT64_C(1) << age))) {
+        return false;
+    }
+    m_seen |= Q_UINT64_C(1) << age;
+    return true;
+}
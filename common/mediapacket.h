@@ -0,0 +1,57 @@
+#ifndef MEDIAPACKET_H
+#define MEDIAPACKET_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// Call media sent over UDP to the server's relay port instead of the TCP
+// connection, so a lost packet only loses itself:
+//   [SessionId (4 bytes)][Party (1 byte)][Sequence (4 bytes)][Media][Tag (8 bytes)]
+// Integers are big-endian. Party is 0 for the caller and 1 for the callee,
+// each counts its own sequence from 1. The tag is HMAC-SHA256 over
+// everything before it, keyed with the call key and cut to 8 bytes. Both
+// sides and the relay share the key, the relay forwards packets unchanged.
+// An empty media part only tells the relay where a party listens.
+class MediaPacket
+{
+public:
+    static const int HEADER_SIZE = 9;
+    static const int TAG_SIZE = 8;
+    static const int OVERHEAD = HEADER_SIZE + TAG_SIZE;
+    static const int KEY_SIZE = 16;
+    static const quint8 PARTY_CALLER = 0;
+    static const quint8 PARTY_CALLEE = 1;
+
+    quint32 sessionId;
+    quint8 party;
+    quint32 sequence;
+    const char *media;   // Points into the parsed datagram
+    int mediaSize;
+
+    MediaPacket() : sessionId(0), party(0), sequence(0), media(nullptr), mediaSize(0) {}
+
+    static QByteArray seal(quint32 sessionId, quint8 party, quint32 sequence, const QByteArray &key,
+                           const char *media, int mediaSize);
+    // Reads the header only, the session it names holds the key for verify()
+    static bool parse(const char *data, int size, MediaPacket &packet);
+    static bool verify(const char *data, int size, const QByteArray &key);
+    static QByteArray generateKey();
+};
+
+// Sliding window over the last 64 sequences of one sender. Rejects replays
+// and packets too late to be of any use.
+class ReplayWindow
+{
+public:
+    ReplayWindow() : m_highest(0), m_seen(0) {}
+
+    // Marks the sequence as seen, false if it already was or fell out of the window
+    bool accept(quint32 sequence);
+    void reset() { m_highest = 0; m_seen = 0; }
+
+private:
+    quint32 m_highest;
+    quint64 m_seen;      // Bit n set: m_highest - n was accepted
+};
+
+#endif // MEDIAPACKET_H
@@ -0,0 +1,141 @@
+#include "wirecodec.h"
+#include <cstring>
+
+namespace {
+    const int MAX_VARINT_BYTES = 10;
+}
+
+bool WireView::equals(const QByteArray &utf8) const
+{
+    return size == utf8.size() && (size == 0 || memcmp(data, utf8.constData(), size) == 0);
+}
+
+WireWriter &WireWriter::writeByte(quint8 value)
+{
+    m_out.append(static_cast<char>(value));
+    return *this;
+}
+
+WireWriter &WireWriter::writeVarint(quint64 value)
+{
+    char buffer[MAX_VARINT_BYTES];
+    int length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = static_cast<char>(value);
+    m_out.append(buffer, length);
+    return *this;
+}
+
+WireWriter &WireWriter::writeString(const QString &value)
+{
+    return writeUtf8(value.toUtf8());
+}
+
+WireWriter &WireWriter::writeUtf8(const QByteArray &utf8)
+{
+    return writeBytes(utf8.constData(), utf8.size());
+}
+
+WireWriter &WireWriter::writeBytes(const char *data, int size)
+{
+    writeVarint(static_cast<quint64>(size));
+    m_out.append(data, size);
+    return *this;
+}
+
+WireWriter &WireWriter::writeRaw(const char *data, int size)
+{
+    m_out.append(data, size);
+    return *this;
+}
+
+int WireWriter::varintSize(quint64 value)
+{
+    int length = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++length;
+    }
+    return length;
+}
+
+WireReader::WireReader(const char *data, int size)
+    : m_data(data), m_size(size), m_pos(0), m_error(false)
+{
+}
+
+WireReader::WireReader(const FrameView &view)
+    : m_data(view.data), m_size(view.size), m_pos(0), m_error(false)
+{
+}
+
+bool WireReader::readByte(quint8 &value)
+{
+    if (m_error || m_pos >= m_size) {
+        m_error = true;
+        return false;
+    }
+    value = static_cast<quint8>(m_data[m_pos++]);
+    return true;
+}
+
+bool WireReader::readVarint(quint64 &value)
+{
+    if (m_error) {
+        return false;
+    }
+    
+    quint64 result = 0;
+    for (int shift = 0, i = 0; i < MAX_VARINT_BYTES && m_pos < m_size; ++i, shift += 7) {
+        quint8 byte = static_cast<quint8>(m_data[m_pos++]);
+        result |= static_cast<quint64>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            value = result;
+            return true;
+        }
+    }
+    
+    // Truncated or longer than 64 bits
+    m_error = true;
+    return false;
+}
+
+bool WireReader::readBytes(WireView &value)
+{
+    quint64 length;
+    if (!readVarint(length)) {
+        return false;
+    }
+    if (length > static_cast<quint64>(m_size - m_pos)) {
+        m_error = true;
+        return false;
+    }
+    
+    value.data = m_data + m_pos;
+    value.size = static_cast<int>(length);
+    m_pos += value.size;
+    return true;
+}
+
+bool WireReader::readString(QString &value)
+{
+    WireView view;
+    if (!readBytes(view)) {
+        return false;
+    }
+    value = view.toString();
+    return true;
+}
+
+WireView WireReader::remaining() const
+{
+    WireView view;
+    if (!m_error && m_pos < m_size) {
+        view.data = m_data + m_pos;
+        view.size = m_size - m_pos;
+    }
+    return view;
+}
@@ -0,0 +1,76 @@
+#ifndef WIRECODEC_H
+#define WIRECODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+#include "framedecoder.h"
+
+// Payload encoding shared by client and server:
+//   varint   unsigned LEB128, one byte for values below 128
+//   string   [varint byte length][UTF-8 bytes]
+//   bytes    [varint length][raw bytes]
+// Compared to QDataStream a QString costs its UTF-8 size plus one length
+// byte instead of twice its length plus four.
+
+// Points into the buffer being decoded, valid as long as that buffer is
+struct WireView {
+    const char *data;
+    int size;
+
+    WireView() : data(nullptr), size(0) {}
+
+    QString toString() const { return QString::fromUtf8(data, size); }
+    QByteArray toByteArray() const { return QByteArray(data, size); }
+    // Shares the underlying buffer, must not outlive it
+    QByteArray rawData() const { return QByteArray::fromRawData(data, size); }
+    bool equals(const QByteArray &utf8) const;
+};
+
+class WireWriter
+{
+public:
+    // Appends to 'out', which may already hold a message type or header
+    explicit WireWriter(QByteArray &out) : m_out(out) {}
+
+    WireWriter &writeByte(quint8 value);
+    WireWriter &writeVarint(quint64 value);
+    WireWriter &writeString(const QString &value);
+    WireWriter &writeUtf8(const QByteArray &utf8);   // Already encoded string
+    WireWriter &writeBytes(const char *data, int size);
+    WireWriter &writeBytes(const QByteArray &data) { return writeBytes(data.constData(), data.size()); }
+    // No length prefix, for a trailing payload that runs to the end of the frame
+    WireWriter &writeRaw(const char *data, int size);
+
+    static int varintSize(quint64 value);
+
+private:
+    QByteArray &m_out;
+};
+
+// Decodes without allocating. A failed read leaves the reader invalid and
+// every later read fails too, so a message can be parsed first and checked once.
+class WireReader
+{
+public:
+    WireReader(const char *data, int size);
+    explicit WireReader(const FrameView &view);
+
+    bool readByte(quint8 &value);
+    bool readVarint(quint64 &value);
+    bool readBytes(WireView &value);    // Also reads strings, as a UTF-8 view
+    bool readString(QString &value);    // Allocating convenience for stored values
+
+    // Everything not read yet, for trailing payloads
+    WireView remaining() const;
+    bool atEnd() const { return m_pos >= m_size; }
+    bool isValid() const { return !m_error; }
+
+private:
+    const char *m_data;
+    int m_size;
+    int m_pos;
+    bool m_error;
+};
+
+#endif // WIRECODEC_H
@@ -8,6 +8,11 @@
 #include <QCheckBox>
 #include <QTcpSocket>
 #include "basedlg.h"
+#include "framedecoder.h"
+#include "ackranges.h"
+
+class FrameBatcher;
+class QTimer;
 
 class ServerLoginDlg : public CBaseDlg
 {
@@ -20,10 +25,22 @@ public:
     QString getToken() const { return m_token; }
     QString getUserId() const { return m_userId; }
     QString getUsername() const { return m_username; }
+    // FrameCompression capability bits the server accepted
+    int getCapabilities() const { return m_capabilities; }
+    // Send path of the logged-in connection, batches small messages
+    FrameBatcher *getBatcher() const { return m_batcher; }
+    // Sequence of the last message received, presented when resuming. With
+    // acks negotiated everything up to it has arrived.
+    quint64 getLastSequence() const { return m_lastSequence; }
+
+public slots:
+    // Reconnects with the token, the server replays what was missed
+    void resumeSession();
 
 signals:
     void loginSuccessful(const QString &token, const QString &userId, const QString &username);
     void loginFailed(const QString &error);
+    void sessionResumed();
 
 private slots:
     void onLoginClicked();
@@ -32,13 +49,18 @@ private slots:
     void onServerDisconnected();
     void onServerReadyRead();
     void onServerError(QAbstractSocket::SocketError error);
+    void sendAck();
+    void sendHeartbeat();
 
 private:
     void createUI();
     void connectToServer();
     void sendLoginRequest();
     void sendRegisterRequest();
-    void processServerResponse(const QByteArray &data);
+    void sendResumeRequest();
+    void processServerResponse(const FrameView &frame);
+    void noteReceived(quint64 sequence);
+    void noteReceivedThrough(quint64 sequence);
 
     // UI Components
     QLabel *m_labTitle;
@@ -54,6 +76,8 @@ private:
 
     // Connection
     QTcpSocket *m_socket;
+    FrameBatcher *m_batcher;
+    FrameDecoder m_decoder;
     QString m_serverHost;
     quint16 m_serverPort;
 
@@ -62,6 +86,16 @@ private:
     QString m_userId;
     QString m_username;
     bool m_isRegistering;
+    bool m_isResuming;
+    int m_capabilities;
+    quint64 m_lastSequence;
+
+    // Received above m_lastSequence, acknowledged selectively
+    AckRanges m_received;
+    QTimer *m_ackTimer;
+    bool m_ackPending;
+    // Keeps an idle session ahead of the server's idle timeout
+    QTimer *m_heartbeatTimer;
 };
 
 #endif // SERVERLOGINDLG_H
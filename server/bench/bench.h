@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QString>
+#include <QStringList>
+#include <QElapsedTimer>
+
+class TcpServer;
+
+// Each benchmark receives the remaining command line arguments and
+// returns the process exit code.
+typedef int (*BenchFunction)(const QStringList &args);
+
+struct BenchEntry {
+    const char *name;
+    const char *description;
+    BenchFunction run;
+};
+
+// Reads "--name=value" from the argument list
+int benchIntArg(const QStringList &args, const QString &name, int defaultValue);
+QString benchStringArg(const QStringList &args, const QString &name, const QString &defaultValue);
+
+void benchReport(const QString &label, qint64 operations, qint64 elapsedNs);
+
+// Benchmark servers have no AuthService: a login frame carries the userId
+// itself and binds the connection to it without credentials or a reply
+void benchAcceptLogins(TcpServer *server);
+QByteArray benchLoginFrame(const QByteArray &userId);
+
+// Benchmarks
+int benchFraming(const QStringList &args);
+int benchBroadcast(const QStringList &args);
+int benchRegistry(const QStringList &args);
+int benchTransport(const QStringList &args);
+int benchCodec(const QStringList &args);
+int benchTls(const QStringList &args);
+int benchMedia(const QStringList &args);
+int benchMix(const QStringList &args);
+
+#endif // BENCH_H
@@ -0,0 +1,203 @@
+#include "bench.h"
+#include "tcpserver.h"
+#include "broadcastengine.h"
+#include "framedecoder.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QDebug>
+#include <QAtomicInt>
+#include <cstdio>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+// Plain sockets on the client side, 50k QTcpSockets would measure Qt rather than the server
+class LoopbackClients : public QThread
+{
+public:
+    LoopbackClients(quint16 port, int count, TcpServer *server, int expectedBytes)
+        : m_port(port), m_count(count), m_server(server), m_expectedBytes(expectedBytes)
+        , m_connected(0), m_completed(0), m_failed(false), m_epoll(-1)
+    {
+    }
+
+    ~LoopbackClients()
+    {
+        for (int fd : m_fds) {
+            ::close(fd);
+        }
+        if (m_epoll >= 0) {
+            ::close(m_epoll);
+        }
+    }
+
+    int connected() const { return m_connected.load(); }
+    int completed() const { return m_completed.load(); }
+    bool failed() const { return m_failed.load() != 0; }
+
+protected:
+    void run() override
+    {
+        m_epoll = epoll_create1(0);
+        m_received.assign(m_count, 0);
+
+        for (int i = 0; i < m_count; ++i) {
+            if (!connectOne(i)) {
+                m_failed.store(1);
+                return;
+            }
+            m_connected.store(i + 1);
+
+            // Keep within the listen backlog of the accepting thread
+            while (i + 1 - m_server->onlineUserCount() > 32) {
+                usleep(100);
+            }
+        }
+
+        std::vector<epoll_event> events(1024);
+        char buffer[4096];
+        while (m_completed.load() < m_count) {
+            int ready = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), 100);
+            for (int e = 0; e < ready; ++e) {
+                int index = events[e].data.u32;
+                ssize_t n;
+                while ((n = ::read(m_fds[index], buffer, sizeof(buffer))) > 0) {
+                    int before = m_received[index];
+                    m_received[index] += static_cast<int>(n);
+                    if (before < m_expectedBytes && m_received[index] >= m_expectedBytes) {
+                        m_completed.ref();
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    bool connectOne(int index)
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            qWarning() << "socket() failed at client" << index << ":" << strerror(errno)
+                       << "(raise the open file limit with ulimit -n)";
+            return false;
+        }
+
+        // Spread clients over 127.0.0.x sources, one address has ~28k ephemeral ports
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + index / 20000);
+        ::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+
+        sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons(m_port);
+        remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) < 0) {
+            qWarning() << "connect() failed at client" << index << ":" << strerror(errno);
+            ::close(fd);
+            return false;
+        }
+
+        QByteArray frame = benchLoginFrame(QByteArray("bench-") + QByteArray::number(index));
+        if (::write(fd, frame.constData(), frame.size()) != frame.size()) {
+            ::close(fd);
+            return false;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u32 = static_cast<quint32>(index);
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+
+        m_fds.push_back(fd);
+        return true;
+    }
+
+    quint16 m_port;
+    int m_count;
+    TcpServer *m_server;
+    int m_expectedBytes;
+    QAtomicInt m_connected;
+    QAtomicInt m_completed;
+    QAtomicInt m_failed;
+    int m_epoll;
+    std::vector<int> m_fds;
+    std::vector<int> m_received;
+};
+
+int benchBroadcast(const QStringList &args)
+{
+    int clients = benchIntArg(args, "clients", 50000);
+    int threads = benchIntArg(args, "threads", QThread::idealThreadCount());
+    int payloadSize = benchIntArg(args, "payload", 256);
+
+    TcpServer server;
+    server.setWorkerThreads(threads);
+    if (!server.startServer(0)) {
+        return 1;
+    }
+    benchAcceptLogins(&server);
+
+    QByteArray body(payloadSize + 1, 'b');
+    body[0] = static_cast<char>(MSG_TEXT);
+    int frameSize = body.size() + FrameDecoder::HEADER_SIZE;
+
+    printf("Connecting %d loopback clients to %d worker threads...\n", clients, threads);
+    fflush(stdout);
+
+    LoopbackClients loopback(server.serverPort(), clients, &server, frameSize);
+    loopback.start();
+
+    while (server.onlineUserCount() < clients && !loopback.failed()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    if (loopback.failed()) {
+        loopback.wait();
+        return 1;
+    }
+
+    qint64 enqueueNs = 0;
+    QElapsedTimer timer;
+    QObject::connect(server.broadcastEngine(), &BroadcastEngine::broadcastFinished,
+                     [&](quint64, int delivered, int failed) {
+        enqueueNs = timer.nsecsElapsed();
+        printf("Queued for %d clients, %d failed\n", delivered, failed);
+    });
+
+    timer.start();
+    server.broadcastMessage(body);
+
+    while (loopback.completed() < clients) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 1);
+    }
+    qint64 deliveryNs = timer.nsecsElapsed();
+
+    benchReport("broadcast queued on all workers", clients, enqueueNs);
+    benchReport("broadcast full delivery", clients, deliveryNs);
+
+    loopback.wait();
+    server.stopServer();
+    return 0;
+}
+
+#else
+
+int benchBroadcast(const QStringList &args)
+{
+    Q_UNUSED(args);
+    qWarning() << "The broadcast benchmark needs Linux epoll";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "bench.h"
+#include "wirecodec.h"
+#include <QDataStream>
+#include <QUuid>
+#include <QDebug>
+#include <cstdio>
+
+// A call request as VideoCallServer sends it: [type][callId][caller][isVideo]
+static QByteArray encodeDataStream(const QString &callId, const QString &caller)
+{
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_9);
+    stream << static_cast<quint8>(2) << callId << caller << static_cast<quint8>(1);
+    return message;
+}
+
+static QByteArray encodeWire(const QString &callId, const QString &caller)
+{
+    QByteArray message;
+    WireWriter(message).writeByte(2).writeString(callId).writeString(caller).writeByte(1);
+    return message;
+}
+
+int benchCodec(const QStringList &args)
+{
+    int iterations = benchIntArg(args, "iterations", 1000000);
+
+    QString callId = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    QString caller = QUuid::createUuid().toString(QUuid::WithoutBraces);
+
+    QByteArray streamMessage = encodeDataStream(callId, caller);
+    QByteArray wireMessage = encodeWire(callId, caller);
+    printf("Call request size: QDataStream %d bytes, wire codec %d bytes\n",
+           streamMessage.size(), wireMessage.size());
+
+    QElapsedTimer timer;
+    qint64 checksum = 0;
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        checksum += encodeDataStream(callId, caller).size();
+    }
+    benchReport("QDataStream encode", iterations, timer.nsecsElapsed());
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        checksum += encodeWire(callId, caller).size();
+    }
+    benchReport("wire codec encode", iterations, timer.nsecsElapsed());
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        QByteArray data = QByteArray::fromRawData(streamMessage.constData(), streamMessage.size());
+        QDataStream stream(data);
+        stream.setVersion(QDataStream::Qt_5_9);
+        quint8 type, isVideo;
+        QString id, from;
+        stream >> type >> id >> from >> isVideo;
+        checksum += id.size() + from.size() + isVideo;
+    }
+    benchReport("QDataStream decode", iterations, timer.nsecsElapsed());
+
+    // Views only, what a handler that routes by id needs
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        WireReader reader(wireMessage.constData(), wireMessage.size());
+        quint8 type, isVideo;
+        WireView id, from;
+        reader.readByte(type);
+        reader.readBytes(id);
+        reader.readBytes(from);
+        reader.readByte(isVideo);
+        checksum += id.size + from.size + isVideo;
+    }
+    benchReport("wire codec decode (views)", iterations, timer.nsecsElapsed());
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        WireReader reader(wireMessage.constData(), wireMessage.size());
+        quint8 type, isVideo;
+        QString id, from;
+        reader.readByte(type);
+        reader.readString(id);
+        reader.readString(from);
+        reader.readByte(isVideo);
+        checksum += id.size() + from.size() + isVideo;
+    }
+    benchReport("wire codec decode (QString)", iterations, timer.nsecsElapsed());
+
+    if (checksum == 0) qWarning() << "unexpected checksum";
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "bench.h"
+#include "framedecoder.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QEventLoop>
+#include <QTimer>
+#include <QDebug>
+#include <cstdio>
+
+static QByteArray makeFrames(int frameCount, int payloadSize)
+{
+    QByteArray body(payloadSize + 1, 'x');
+    body[0] = 0;  // MSG_TEXT
+
+    QByteArray frames;
+    frames.reserve(frameCount * (body.size() + FrameDecoder::HEADER_SIZE));
+    QByteArray frame = FrameDecoder::encode(body);
+    for (int i = 0; i < frameCount; ++i) {
+        frames.append(frame);
+    }
+    return frames;
+}
+
+// Decoder only: feed read-sized chunks, as a socket would hand them over
+static void benchDecoder(int frameCount, int payloadSize, int chunkSize)
+{
+    QByteArray stream = makeFrames(frameCount, payloadSize);
+    FrameDecoder decoder;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 frames = 0;
+    qint64 checksum = 0;
+    for (int offset = 0; offset < stream.size(); offset += chunkSize) {
+        decoder.append(stream.constData() + offset, qMin(chunkSize, stream.size() - offset));
+
+        FrameView frame;
+        while (decoder.next(frame) == FrameDecoder::FrameReady) {
+            checksum += frame.size;
+            ++frames;
+        }
+    }
+
+    benchReport(QString("decoder (%1 B chunks)").arg(chunkSize), frames, timer.nsecsElapsed());
+    if (checksum != static_cast<qint64>(frameCount) * (payloadSize + 1)) {
+        qWarning() << "Decoder checksum mismatch";
+    }
+}
+
+// Loopback: a client writes frames as fast as it can, the server side counts
+// how many frames each readyRead (one read syscall) delivers.
+static void benchLoopback(int frameCount, int payloadSize)
+{
+    QTcpServer server;
+    if (!server.listen(QHostAddress::LocalHost, 0)) {
+        qWarning() << "Cannot listen on loopback:" << server.errorString();
+        return;
+    }
+
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!client.waitForConnected(5000) || !server.waitForNewConnection(5000)) {
+        qWarning() << "Loopback connection failed";
+        return;
+    }
+    QTcpSocket *peer = server.nextPendingConnection();
+
+    FrameDecoder decoder;
+    qint64 frames = 0;
+    qint64 reads = 0;
+    QEventLoop loop;
+
+    QObject::connect(peer, &QTcpSocket::readyRead, [&]() {
+        ++reads;
+        decoder.readFrom(peer);
+
+        FrameView frame;
+        while (decoder.next(frame) == FrameDecoder::FrameReady) {
+            ++frames;
+        }
+        if (frames >= frameCount) {
+            loop.quit();
+        }
+    });
+
+    QByteArray stream = makeFrames(frameCount, payloadSize);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Write in 64 KB bursts so the kernel is free to merge or split frames
+    const int burst = 64 * 1024;
+    for (int offset = 0; offset < stream.size(); offset += burst) {
+        client.write(stream.constData() + offset, qMin(burst, stream.size() - offset));
+    }
+
+    QTimer::singleShot(60000, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    qint64 elapsed = timer.nsecsElapsed();
+    benchReport(QString("loopback (%1 B payload)").arg(payloadSize), frames, elapsed);
+    printf("%-40s %12lld reads %10.1f frames/read\n", "", static_cast<long long>(reads),
+           reads > 0 ? static_cast<double>(frames) / reads : 0.0);
+}
+
+int benchFraming(const QStringList &args)
+{
+    int frameCount = benchIntArg(args, "frames", 1000000);
+    int payloadSize = benchIntArg(args, "payload", 32);
+
+    benchDecoder(frameCount, payloadSize, 1500);
+    benchDecoder(frameCount, payloadSize, 64 * 1024);
+    benchLoopback(frameCount, payloadSize);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "tcpserver.h"
+#include "videocallserver.h"
+#include "framedecoder.h"
+#include <QCoreApplication>
+#include <QTcpSocket>
+#include <QThread>
+#include <QDebug>
+#include <functional>
+#include <cstdio>
+
+// One side of the benchmark call, a plain QTcpSocket counting media frames
+class MediaPeer
+{
+public:
+    MediaPeer(const QByteArray &userId, quint16 port)
+        : m_received(0)
+    {
+        QObject::connect(&m_socket, &QTcpSocket::readyRead, [this]() { onReadyRead(); });
+        m_socket.connectToHost(QStringLiteral("127.0.0.1"), port);
+
+        m_socket.write(benchLoginFrame(userId));
+    }
+
+    qint64 received() const { return m_received; }
+
+private:
+    void onReadyRead()
+    {
+        m_decoder.readFrom(&m_socket);
+        FrameView frame;
+        while (m_decoder.next(frame) == FrameDecoder::FrameReady) {
+            if (frame.size > 0 && static_cast<quint8>(frame.data[0]) == MSG_MEDIA_DATA) {
+                ++m_received;
+            }
+        }
+        m_decoder.trim();
+    }
+
+    QTcpSocket m_socket;
+    FrameDecoder m_decoder;
+    qint64 m_received;
+};
+
+// Relays 'packets' media packets from caller to callee through 'send' and
+// reports what reached the callee. At most 'window' packets are in flight,
+// below the media budget of the outbound queue so none are dropped as stale.
+static void runRelay(const QString &label, int packets, int window, const MediaPeer &callee,
+                     const std::function<void()> &send)
+{
+    qint64 start = callee.received();
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < packets; ++i) {
+        while (i - (callee.received() - start) >= window) {
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 1);
+        }
+        send();
+    }
+    // Whatever is left, a dropped packet would never arrive
+    QElapsedTimer drain;
+    drain.start();
+    while (callee.received() - start < packets && drain.elapsed() < 5000) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 1);
+    }
+
+    benchReport(label, callee.received() - start, timer.nsecsElapsed());
+}
+
+int benchMedia(const QStringList &args)
+{
+    int packets = benchIntArg(args, "packets", 500000);
+    int payloadSize = benchIntArg(args, "payload", 960);
+    int threads = benchIntArg(args, "threads", 1);
+    int window = benchIntArg(args, "window", qMax(1, OutboundLimits().mediaBudget / (2 * (payloadSize + 64))));
+
+    TcpServer server;
+    server.setWorkerThreads(threads);
+    server.setIdleTimeout(0);
+    if (!server.startServer(0)) {
+        return 1;
+    }
+    benchAcceptLogins(&server);
+    VideoCallServer calls(&server);
+
+    const QString caller = QStringLiteral("bench-caller");
+    const QString callee = QStringLiteral("bench-callee");
+    MediaPeer callerPeer(caller.toUtf8(), server.serverPort());
+    MediaPeer calleePeer(callee.toUtf8(), server.serverPort());
+
+    QElapsedTimer setup;
+    setup.start();
+    while (server.onlineUserCount() < 2 && setup.elapsed() < 5000) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    if (server.onlineUserCount() < 2 || !calls.initiateCall(caller, callee, true)) {
+        qWarning() << "Could not set up the benchmark call";
+        return 1;
+    }
+    QString callId = calls.getActiveCalls().first()->callId;
+    calls.acceptCall(callId);
+
+    SessionHandle callerSession = server.sessionOf(caller);
+    QByteArray media(payloadSize, 'm');
+    printf("Relaying %d media packets of %d bytes, %d in flight, %d worker threads\n",
+           packets, payloadSize, window, threads);
+    fflush(stdout);
+
+    // What onMediaData did for every packet: look the call up by id, encode
+    // [0x06][CallId] and copy the payload behind it
+    runRelay("relayMediaData (lookup, encode, copy)", packets, window, calleePeer, [&]() {
+        calls.relayMediaData(callId, caller, QByteArray::fromRawData(media.constData(), media.size()));
+    });
+
+    // Route by session, the header from call setup, the payload buffer shared
+    runRelay("forwardMedia (route, shared buffers)", packets, window, calleePeer, [&]() {
+        calls.forwardMedia(callerSession, media);
+    });
+
+    calls.endCall(callId);
+    server.stopServer();
+    return 0;
+}
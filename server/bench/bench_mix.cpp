@@ -0,0 +1,94 @@
+#include "bench.h"
+#include "audiomixer.h"
+#include <QVector>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+
+static QByteArray randomFrame(int samples)
+{
+    // Speech level noise, loud enough that a full room clips
+    QByteArray frame(samples * 2, Qt::Uninitialized);
+    qint16 *pcm = reinterpret_cast<qint16*>(frame.data());
+    for (int i = 0; i < samples; ++i) {
+        pcm[i] = static_cast<qint16>(QRandomGenerator::global()->bounded(-8000, 8000));
+    }
+    return frame;
+}
+
+// Queues a frame for the first 'speakers' participants and mixes one tick
+static qint64 mixTick(AudioMixer &mixer, const QVector<QString> &users, const QVector<QByteArray> &frames,
+                      int speakers)
+{
+    for (int i = 0; i < speakers; ++i) {
+        mixer.pushFrame(users.at(i), frames.at(i));
+    }
+    qint64 bytes = 0;
+    for (const AudioMixer::Output &output : mixer.mix()) {
+        bytes += output.pcm.size();
+    }
+    return bytes;
+}
+
+int benchMix(const QStringList &args)
+{
+    int participants = qMax(2, benchIntArg(args, "participants", 50));
+    int speakers = qBound(1, benchIntArg(args, "speakers", 3), participants);
+    int frameMs = benchIntArg(args, "frame", 20);
+    int ticks = benchIntArg(args, "ticks", 2000);
+
+    AudioMixer mixer(frameMs);
+    int samples = mixer.frameSamples();
+    QVector<QString> users;
+    QVector<QByteArray> frames;
+    for (int i = 0; i < participants; ++i) {
+        users.append(QString("user-%1").arg(i));
+        frames.append(randomFrame(samples));
+        mixer.addParticipant(users.last());
+    }
+    printf("Mixing %d ms frames (%d samples) for %d participants, %d ticks\n",
+           frameMs, samples, participants, ticks);
+    printf("Operations are participants served per tick, a tick must stay well below %d ms\n", frameMs);
+
+    QElapsedTimer timer;
+    qint64 checksum = 0;
+
+    // Per listener, add up everyone else with 16-bit saturation: N-1 passes each
+    QVector<qint16> out(samples);
+    timer.start();
+    for (int tick = 0; tick < ticks; ++tick) {
+        for (int listener = 0; listener < participants; ++listener) {
+            std::fill(out.begin(), out.end(), 0);
+            for (int speaker = 0; speaker < participants; ++speaker) {
+                if (speaker == listener) {
+                    continue;
+                }
+                const qint16 *pcm = reinterpret_cast<const qint16*>(frames.at(speaker).constData());
+                for (int i = 0; i < samples; ++i) {
+                    out[i] = static_cast<qint16>(qBound(-32768, out[i] + pcm[i], 32767));
+                }
+            }
+            checksum += out.at(listener % samples);
+        }
+    }
+    benchReport("per-listener sum, all speaking", qint64(ticks) * participants, timer.nsecsElapsed());
+
+    // Sum once, subtract each listener's own frame
+    timer.start();
+    for (int tick = 0; tick < ticks; ++tick) {
+        checksum += mixTick(mixer, users, frames, participants);
+    }
+    benchReport("mix-minus, all speaking", qint64(ticks) * participants, timer.nsecsElapsed());
+
+    // The usual meeting: a few talk, the silent majority shares one frame
+    timer.start();
+    for (int tick = 0; tick < ticks; ++tick) {
+        checksum += mixTick(mixer, users, frames, speakers);
+    }
+    benchReport(QString("mix-minus, %1 speaking").arg(speakers), qint64(ticks) * participants,
+                timer.nsecsElapsed());
+
+    if (checksum == 0) qWarning() << "unexpected checksum";
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "bench.h"
+#include "clientregistry.h"
+#include <QMap>
+#include <QUuid>
+#include <QVector>
+#include <QDebug>
+#include <algorithm>
+#include <random>
+
+// Baseline: the QMap<QString, ClientInfo*> routing table TcpServer used to keep
+static void benchQMap(const QVector<QString> &userIds, const QVector<int> &order)
+{
+    QMap<QString, ClientInfo*> clients;
+    QVector<ClientInfo> records(userIds.size());
+    for (int i = 0; i < userIds.size(); ++i) {
+        records[i].userId = userIds.at(i);
+        records[i].connectionId = static_cast<quint64>(i);
+        clients.insert(userIds.at(i), &records[i]);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    quint64 checksum = 0;
+    for (int i : order) {
+        ClientInfo *info = clients.value(userIds.at(i), nullptr);
+        checksum += info ? info->connectionId : 0;
+    }
+    benchReport("QMap<QString> lookup", order.size(), timer.nsecsElapsed());
+    if (checksum == 0) qWarning() << "unexpected checksum";
+}
+
+int benchRegistry(const QStringList &args)
+{
+    int sessions = benchIntArg(args, "sessions", 100000);
+    int lookups = benchIntArg(args, "lookups", 2000000);
+
+    QVector<QString> userIds;
+    userIds.reserve(sessions);
+    for (int i = 0; i < sessions; ++i) {
+        userIds.append(QUuid::createUuid().toString(QUuid::WithoutBraces));
+    }
+
+    std::mt19937 rng(42);
+    QVector<int> order(lookups);
+    for (int i = 0; i < lookups; ++i) {
+        order[i] = static_cast<int>(rng() % sessions);
+    }
+
+    benchQMap(userIds, order);
+
+    ClientRegistry registry;
+    QVector<SessionHandle> handles(sessions);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < sessions; ++i) {
+        ClientInfo info;
+        info.userId = userIds.at(i);
+        info.worker = nullptr;
+        info.connectionId = static_cast<quint64>(i);
+        info.handle = INVALID_SESSION;
+        info.port = 0;
+        info.isOnline = true;
+        handles[i] = registry.registerClient(info);
+    }
+    benchReport("registry register", sessions, timer.nsecsElapsed());
+
+    quint64 checksum = 0;
+    timer.restart();
+    for (int i : order) {
+        checksum += registry.handleOf(userIds.at(i));
+    }
+    benchReport("registry userId -> handle", lookups, timer.nsecsElapsed());
+
+    // Routing: resolve the owning worker and connection for a send
+    ClientInfo info;
+    timer.restart();
+    for (int i : order) {
+        if (registry.lookup(userIds.at(i), info)) {
+            checksum += info.connectionId;
+        }
+    }
+    benchReport("registry route by userId", lookups, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i : order) {
+        if (registry.lookup(handles.at(i), info)) {
+            checksum += info.connectionId;
+        }
+    }
+    benchReport("registry route by handle", lookups, timer.nsecsElapsed());
+
+    timer.restart();
+    for (int i = 0; i < sessions; ++i) {
+        registry.unregisterClient(handles.at(i));
+    }
+    benchReport("registry unregister", sessions, timer.nsecsElapsed());
+
+    if (checksum == 0) qWarning() << "unexpected checksum";
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "bench.h"
+#include "tcpserver.h"
+#include "tlscontext.h"
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QProcess>
+#include <QSslSocket>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+#include <QDebug>
+#include <functional>
+#include <cstdio>
+
+// Self-signed certificate for localhost, made by the openssl command line tool
+static bool generateCertificate(const QString &dir, int bits, QString &certificatePath, QString &keyPath)
+{
+    certificatePath = dir + "/cert.pem";
+    keyPath = dir + "/key.pem";
+    
+    QProcess openssl;
+    openssl.start("openssl", QStringList() << "req" << "-x509" << "-nodes"
+                  << "-newkey" << QString("rsa:%1").arg(bits)
+                  << "-keyout" << keyPath << "-out" << certificatePath
+                  << "-days" << "1" << "-subj" << "/CN=localhost");
+    if (!openssl.waitForFinished(60000) || openssl.exitStatus() != QProcess::NormalExit
+            || openssl.exitCode() != 0) {
+        qWarning() << "Could not run openssl to create a certificate, pass --cert and --key instead:"
+                   << openssl.errorString() << openssl.readAllStandardError();
+        return false;
+    }
+    return true;
+}
+
+// The bench pins TLS 1.2, whose ticket is part of the handshake; 1.3 tickets
+// arrive afterwards and are handled differently across Qt 5 releases
+static QSslConfiguration clientConfiguration(const QByteArray &sessionTicket, bool keepSession)
+{
+    QSslConfiguration config = QSslConfiguration::defaultConfiguration();
+    config.setPeerVerifyMode(QSslSocket::VerifyNone);
+    config.setProtocol(QSsl::TlsV1_2);
+    if (keepSession || !sessionTicket.isEmpty()) {
+        config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    }
+    if (!sessionTicket.isEmpty()) {
+        config.setSessionTicket(sessionTicket);
+    }
+    return config;
+}
+
+// One full handshake that keeps its session for the resumed round
+static QByteArray fetchSessionTicket(quint16 port)
+{
+    QSslSocket socket;
+    socket.setSslConfiguration(clientConfiguration(QByteArray(), true));
+    
+    QEventLoop loop;
+    QObject::connect(&socket, &QSslSocket::encrypted, &loop, &QEventLoop::quit);
+    QObject::connect(&socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+                     &loop, &QEventLoop::quit);
+    QTimer::singleShot(5000, &loop, &QEventLoop::quit);
+    socket.connectToHostEncrypted("127.0.0.1", port);
+    loop.exec();
+    
+    QByteArray ticket = socket.isEncrypted() ? socket.sslConfiguration().sessionTicket() : QByteArray();
+    socket.abort();
+    return ticket;
+}
+
+// Keeps 'concurrency' client handshakes in flight until 'total' are done,
+// returns the number that completed
+static int runHandshakes(quint16 port, int total, int concurrency, const QByteArray &sessionTicket)
+{
+    QSslConfiguration config = clientConfiguration(sessionTicket, false);
+    int started = 0;
+    int completed = 0;
+    int failed = 0;
+    QEventLoop loop;
+    
+    std::function<void()> startOne;
+    auto finish = [&](QSslSocket *socket, bool ok) {
+        if (ok) {
+            ++completed;
+        } else if (++failed == 1) {
+            qWarning() << "Handshake failed:" << socket->errorString();
+        }
+        socket->disconnect();
+        socket->abort();
+        socket->deleteLater();
+        if (completed + failed == total) {
+            loop.quit();
+        } else {
+            startOne();
+        }
+    };
+    
+    startOne = [&]() {
+        if (started == total) return;
+        ++started;
+        QSslSocket *socket = new QSslSocket;
+        socket->setSslConfiguration(config);
+        QObject::connect(socket, &QSslSocket::encrypted, [&finish, socket]() { finish(socket, true); });
+        QObject::connect(socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+                         [&finish, socket](QAbstractSocket::SocketError) { finish(socket, false); });
+        socket->connectToHostEncrypted("127.0.0.1", port);
+    };
+    
+    for (int i = 0; i < qMin(concurrency, total); ++i) {
+        startOne();
+    }
+    if (total > 0) {
+        loop.exec();
+    }
+    return completed;
+}
+
+static void reportServerSide(const QString &label, const TlsStatistics &before, const TlsStatistics &after)
+{
+    qint64 handshakes = after.handshakes - before.handshakes;
+    double avgUs = handshakes > 0 ? (after.handshakeNs - before.handshakeNs) / 1000.0 / handshakes : 0.0;
+    printf("%-40s %12lld done %10lld failed %14.1f us avg on the server\n",
+           qPrintable(label), static_cast<long long>(handshakes),
+           static_cast<long long>(after.failedHandshakes - before.failedHandshakes), avgUs);
+    fflush(stdout);
+}
+
+int benchTls(const QStringList &args)
+{
+    int connections = benchIntArg(args, "connections", 2000);
+    int concurrency = benchIntArg(args, "concurrency", 32);
+    int threads = benchIntArg(args, "threads", qMax(1, QThread::idealThreadCount()));
+    int bits = benchIntArg(args, "bits", 2048);
+    QString certificatePath = benchStringArg(args, "cert", QString());
+    QString keyPath = benchStringArg(args, "key", QString());
+    
+    if (!QSslSocket::supportsSsl()) {
+        qWarning() << "No TLS backend available";
+        return 1;
+    }
+    
+    QTemporaryDir dir;
+    if (certificatePath.isEmpty() || keyPath.isEmpty()) {
+        printf("Generating a %d-bit self-signed certificate...\n", bits);
+        fflush(stdout);
+        if (!dir.isValid() || !generateCertificate(dir.path(), bits, certificatePath, keyPath)) {
+            return 1;
+        }
+    }
+    
+    TlsContext tls;
+    QString error;
+    if (!tls.load(certificatePath, keyPath, &error)) {
+        qWarning() << error;
+        return 1;
+    }
+    if (!tls.resumesSessions()) {
+        printf("Built without CONFIG+=tls_resumption, resumed handshakes will be full ones\n");
+    }
+    
+    TcpServer server;
+    server.setWorkerThreads(threads);
+    server.setIdleTimeout(0);
+    server.setTls(tls);
+    if (!server.startServer(0)) {
+        return 1;
+    }
+    quint16 port = server.serverPort();
+    
+    // Warms up the workers and OpenSSL, and yields the session to resume
+    QByteArray ticket = fetchSessionTicket(port);
+    
+    TlsStatistics before = server.tlsStatistics();
+    QElapsedTimer timer;
+    timer.start();
+    int full = runHandshakes(port, connections, concurrency, QByteArray());
+    benchReport("full handshakes", full, timer.nsecsElapsed());
+    TlsStatistics after = server.tlsStatistics();
+    reportServerSide("full handshakes", before, after);
+    
+    if (ticket.isEmpty()) {
+        qWarning() << "The server issued no session, skipping resumed handshakes";
+        server.stopServer();
+        return full == connections ? 0 : 1;
+    }
+    
+    before = after;
+    timer.restart();
+    int resumed = runHandshakes(port, connections, concurrency, ticket);
+    benchReport("resumed handshakes", resumed, timer.nsecsElapsed());
+    reportServerSide("resumed handshakes", before, server.tlsStatistics());
+    
+    server.stopServer();
+    return (full == connections && resumed == connections) ? 0 : 1;
+}
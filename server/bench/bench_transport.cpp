@@ -0,0 +1,255 @@
+#include "bench.h"
+#include "tcpserver.h"
+#include "framedecoder.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QDebug>
+#include <QAtomicInt>
+#include <cstdio>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+static qint64 residentBytes()
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+    long pages = 0;
+    long resident = 0;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(file);
+    return static_cast<qint64>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// Registers 'count' idle clients, then lets the first 'senders' of them
+// stream 'messages' frames each
+class TransportClients : public QThread
+{
+public:
+    TransportClients(quint16 port, int count, TcpServer *server)
+        : m_port(port), m_count(count), m_server(server), m_senders(0), m_messages(0)
+        , m_failed(0), m_start(0)
+    {
+    }
+
+    ~TransportClients()
+    {
+        for (int fd : m_fds) {
+            ::close(fd);
+        }
+    }
+
+    bool failed() const { return m_failed.load() != 0; }
+
+    void startSending(int senders, int messages, const QByteArray &body)
+    {
+        m_senders = qMin(senders, static_cast<int>(m_fds.size()));
+        m_messages = messages;
+        m_body = body;
+        m_start.store(1);
+    }
+
+protected:
+    void run() override
+    {
+        for (int i = 0; i < m_count; ++i) {
+            if (!connectOne(i)) {
+                m_failed.store(1);
+                return;
+            }
+            // Keep within the listen backlog of the accepting thread
+            while (i + 1 - m_server->onlineUserCount() > 32) {
+                usleep(100);
+            }
+        }
+
+        while (!m_start.load()) {
+            usleep(1000);
+        }
+
+        // Many frames per write, the server sees them coalesced like a busy client would send
+        QByteArray frame = FrameDecoder::encode(m_body);
+        const int framesPerWrite = qMax(1, 65536 / frame.size());
+        QByteArray chunk;
+        for (int f = 0; f < framesPerWrite; ++f) {
+            chunk.append(frame);
+        }
+
+        std::vector<int> remaining(m_senders, m_messages);
+        bool pending = true;
+        while (pending) {
+            pending = false;
+            for (int i = 0; i < m_senders; ++i) {
+                if (remaining[i] == 0) continue;
+                int frames = qMin(remaining[i], framesPerWrite);
+                if (!writeAll(m_fds[i], chunk.constData(), frames * frame.size())) {
+                    m_failed.store(1);
+                    return;
+                }
+                remaining[i] -= frames;
+                pending = pending || remaining[i] > 0;
+            }
+        }
+    }
+
+private:
+    static bool writeAll(int fd, const char *data, int size)
+    {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= static_cast<int>(n);
+        }
+        return true;
+    }
+
+    bool connectOne(int index)
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            qWarning() << "socket() failed at client" << index << ":" << strerror(errno)
+                       << "(raise the open file limit with ulimit -n)";
+            return false;
+        }
+
+        // Spread clients over 127.0.0.x sources, one address has ~28k ephemeral ports
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + index / 20000);
+        ::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+
+        sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons(m_port);
+        remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) < 0) {
+            qWarning() << "connect() failed at client" << index << ":" << strerror(errno);
+            ::close(fd);
+            return false;
+        }
+
+        QByteArray frame = benchLoginFrame(QByteArray("bench-") + QByteArray::number(index));
+        if (!writeAll(fd, frame.constData(), frame.size())) {
+            ::close(fd);
+            return false;
+        }
+
+        m_fds.push_back(fd);
+        return true;
+    }
+
+    quint16 m_port;
+    int m_count;
+    TcpServer *m_server;
+    int m_senders;
+    int m_messages;
+    QByteArray m_body;
+    QAtomicInt m_failed;
+    QAtomicInt m_start;
+    std::vector<int> m_fds;
+};
+
+static int runTransport(TransportType type, const QStringList &args)
+{
+    int clients = benchIntArg(args, "clients", 10000);
+    int senders = benchIntArg(args, "senders", 100);
+    int messages = benchIntArg(args, "messages", 10000);
+    int threads = benchIntArg(args, "threads", 1);
+    int payloadSize = benchIntArg(args, "payload", 32);
+    const char *name = (type == TRANSPORT_EPOLL) ? "epoll" : "qt";
+
+    TcpServer server;
+    server.setWorkerThreads(threads);
+    server.setTransport(type);
+    server.setIdleTimeout(0);
+    if (!server.startServer(0)) {
+        return 1;
+    }
+    benchAcceptLogins(&server);
+
+    QAtomicInt received(0);
+    server.dispatcher()->registerHandler(MSG_TEXT, [&received](const MessageHeader &, const FrameView &) {
+        received.ref();
+    });
+
+    printf("[%s] Connecting %d idle clients...\n", name, clients);
+    fflush(stdout);
+
+    qint64 rssBefore = residentBytes();
+    TransportClients loopback(server.serverPort(), clients, &server);
+    loopback.start();
+
+    while (server.onlineUserCount() < clients && !loopback.failed()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    if (loopback.failed()) {
+        loopback.wait();
+        return 1;
+    }
+    // Let the workers finish with the login frames
+    for (int i = 0; i < 10; ++i) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        QThread::msleep(10);
+    }
+
+    qint64 rssDelta = residentBytes() - rssBefore;
+    printf("%-40s %12d conns %10.0f bytes/conn resident\n",
+           qPrintable(QString("%1 idle connections").arg(name)), clients,
+           clients > 0 ? static_cast<double>(rssDelta) / clients : 0.0);
+
+    QByteArray body(payloadSize + 1, 'm');
+    body[0] = static_cast<char>(MSG_TEXT);
+    qint64 expected = static_cast<qint64>(qMin(senders, clients)) * messages;
+
+    received.store(0);
+    QElapsedTimer timer;
+    timer.start();
+    loopback.startSending(senders, messages, body);
+
+    while (received.load() < expected && !loopback.failed()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 1);
+    }
+    benchReport(QString("%1 messages received").arg(name), received.load(), timer.nsecsElapsed());
+
+    loopback.wait();
+    server.stopServer();
+    return loopback.failed() ? 1 : 0;
+}
+
+int benchTransport(const QStringList &args)
+{
+    QString transport = benchStringArg(args, "transport", "both");
+
+    // Run one backend per process for the cleanest memory numbers
+    int result = 0;
+    if (transport == "qt" || transport == "both") {
+        result |= runTransport(TRANSPORT_QT, args);
+    }
+    if (transport == "epoll" || transport == "both") {
+        result |= runTransport(TRANSPORT_EPOLL, args);
+    }
+    return result;
+}
+
+#else
+
+int benchTransport(const QStringList &args)
+{
+    Q_UNUSED(args);
+    qWarning() << "The transport benchmark needs Linux epoll";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <cstdio>
+#include "bench.h"
+#include "tcpserver.h"
+#include "framedecoder.h"
+
+static const BenchEntry s_benchmarks[] = {
+    { "framing", "Length-prefixed frame decoding, frames per read over loopback", benchFraming },
+    { "broadcast", "Serialize-once broadcast to 50k loopback connections", benchBroadcast },
+    { "registry", "Session registry lookup and routing at 100k sessions", benchRegistry },
+    { "transport", "Qt vs epoll transport, memory per idle connection and messages/s", benchTransport },
+    { "codec", "Wire codec vs QDataStream encode/decode of a call request", benchCodec },
+    { "tls", "TLS handshakes/s on the workers, full vs resumed, self-signed certificate", benchTls },
+    { "media", "Call media relay packets/s, per-packet encode vs per-call header and shared payload", benchMedia },
+    { "mix", "N-1 audio mixing cost per participant, per-listener sums vs SSE2 mix-minus", benchMix },
+};
+
+static const int s_benchmarkCount = sizeof(s_benchmarks) / sizeof(s_benchmarks[0]);
+
+int benchIntArg(const QStringList &args, const QString &name, int defaultValue)
+{
+    QString value = benchStringArg(args, name, QString());
+    bool ok = false;
+    int result = value.toInt(&ok);
+    return ok ? result : defaultValue;
+}
+
+QString benchStringArg(const QStringList &args, const QString &name, const QString &defaultValue)
+{
+    QString prefix = "--" + name + "=";
+    for (const QString &arg : args) {
+        if (arg.startsWith(prefix)) {
+            return arg.mid(prefix.size());
+        }
+    }
+    return defaultValue;
+}
+
+void benchReport(const QString &label, qint64 operations, qint64 elapsedNs)
+{
+    double seconds = elapsedNs / 1e9;
+    double perSecond = seconds > 0 ? operations / seconds : 0;
+    double nsPerOp = operations > 0 ? static_cast<double>(elapsedNs) / operations : 0;
+
+    printf("%-40s %12lld ops %10.3f s %14.0f ops/s %10.1f ns/op\n",
+           qPrintable(label), static_cast<long long>(operations), seconds, perSecond, nsPerOp);
+    fflush(stdout);
+}
+
+void benchAcceptLogins(TcpServer *server)
+{
+    server->dispatcher()->registerHandler(MSG_LOGIN_REQUEST, [server](const MessageHeader &header,
+                                                                      const FrameView &payload) {
+        server->completeLogin(header.connectionId, QString::fromUtf8(payload.data, payload.size), QByteArray());
+    });
+}
+
+QByteArray benchLoginFrame(const QByteArray &userId)
+{
+    // [MSG_LOGIN_REQUEST][userId]
+    QByteArray body;
+    body.append(static_cast<char>(MSG_LOGIN_REQUEST));
+    body.append(userId);
+    return FrameDecoder::encode(body);
+}
+
+static void printUsage()
+{
+    printf("Usage: WeCompanyBench <benchmark> [--option=value ...]\n\nBenchmarks:\n");
+    for (int i = 0; i < s_benchmarkCount; ++i) {
+        printf("  %-16s %s\n", s_benchmarks[i].name, s_benchmarks[i].description);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    if (args.size() < 2) {
+        printUsage();
+        return 1;
+    }
+
+    QString name = args.at(1);
+    QStringList benchArgs = args.mid(2);
+
+    for (int i = 0; i < s_benchmarkCount; ++i) {
+        if (name == QLatin1String(s_benchmarks[i].name)) {
+            return s_benchmarks[i].run(benchArgs);
+        }
+    }
+
+    qWarning() << "Unknown benchmark:" << name;
+    printUsage();
+    return 1;
+}
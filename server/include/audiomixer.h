@@ -0,0 +1,73 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+
+// N-1 mixing of 48 kHz mono 16-bit PCM for audio rooms. Every tick each
+// participant gets one frame holding everyone else. The room is summed
+// once in 32 bits, a listener's frame is that sum minus its own frame,
+// saturated back to 16 bits, so a listener costs one pass over the frame
+// however many speak. Listeners that did not speak this tick all get the
+// same frame.
+class AudioMixer
+{
+public:
+    static const int SAMPLE_RATE = 48000;
+    static const int MAX_QUEUED_FRAMES = 3;   // Per participant, beyond that the oldest is dropped
+
+    enum PushResult {
+        Queued,
+        DroppedOldest,      // Queued, the participant's oldest frame made room
+        Rejected            // Wrong frame size or not a participant
+    };
+
+    struct Output {
+        QString userId;
+        QByteArray pcm;     // Shared by the listeners that hear the same mix
+    };
+
+    // frameMs is the tick, 10 or 20 ms of audio per frame
+    explicit AudioMixer(int frameMs = 20);
+
+    int frameMs() const { return m_frameMs; }
+    int frameSamples() const { return m_frameSamples; }
+    int frameBytes() const { return m_frameSamples * 2; }
+
+    void addParticipant(const QString &userId);
+    void removeParticipant(const QString &userId);
+    int participantCount() const { return m_participants.size(); }
+
+    // Keeps the buffer, a frame that arrived in its own buffer is not copied
+    PushResult pushFrame(const QString &userId, const QByteArray &pcm);
+    bool hasPendingFrames() const { return m_pendingFrames > 0; }
+
+    // One tick: takes the oldest queued frame of every participant and
+    // returns a frame for each listener that hears at least one other
+    QVector<Output> mix();
+
+    // The kernels, SSE2 where the compiler targets it. accumulate() adds the
+    // samples to a 32-bit sum; mixMinus() writes sum - own saturated to 16
+    // bits, own may be null.
+    static void accumulate(qint32 *sum, const qint16 *pcm, int samples);
+    static void mixMinus(const qint32 *sum, const qint16 *own, qint16 *out, int samples);
+
+private:
+    struct Participant {
+        QString userId;
+        QList<QByteArray> queued;
+        QByteArray current;     // This tick's frame, empty when silent
+    };
+
+    int m_frameMs;
+    int m_frameSamples;
+    QVector<Participant> m_participants;
+    QHash<QString, int> m_index;    // userId -> index into m_participants
+    QVector<qint32> m_sum;
+    int m_pendingFrames;
+};
+
+#endif // AUDIOMIXER_H
@@ -7,6 +7,7 @@
 #include <QDateTime>
 #include <QCryptographicHash>
 #include <QUuid>
+#include <QMutex>
 
 struct UserCredentials {
     QString userId;
@@ -25,6 +26,10 @@ struct AuthToken {
     bool isValid;
 };
 
+// Thread-safe: the maps are guarded by a mutex, password hashing runs outside
+// of it so concurrent logins on the auth pool only serialize on map updates.
+// The mutex is not recursive, public methods lock it once and share the
+// *Locked helpers; signals are emitted after it is released.
 class AuthManager : public QObject
 {
     Q_OBJECT
@@ -35,7 +40,7 @@ public:
 
     // User registration and authentication
     bool registerUser(const QString &username, const QString &password, QString &userId);
-    QString authenticateUser(const QString &username, const QString &password);
+    QString authenticateUser(const QString &username, const QString &password, QString *userId = nullptr);
     bool validateToken(const QString &token);
     QString getUserIdFromToken(const QString &token);
     
@@ -50,12 +55,18 @@ public:
     
     // User management
     bool userExists(const QString &username);
+    bool isRegistered(const QString &userId) const;
     UserCredentials* getUserCredentials(const QString &userId);
 
 private:
     QString generateUserId();
     bool isTokenExpired(const AuthToken &token);
+    // Callers hold m_mutex
+    QString generateTokenLocked(const QString &userId, QString *revokedUserId);
+    bool validateTokenLocked(AuthToken *authToken);
+    AuthToken *revokeTokenLocked(const QString &token);
     
+    mutable QMutex m_mutex;
     QMap<QString, UserCredentials*> m_users;        // userId -> UserCredentials
     QMap<QString, QString> m_usernameToId;          // username -> userId
     QMap<QString, AuthToken*> m_tokens;             // token -> AuthToken
@@ -0,0 +1,60 @@
+#ifndef AUTHSERVICE_H
+#define AUTHSERVICE_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include "messagedispatcher.h"
+
+class TcpServer;
+class AuthManager;
+class WireReader;
+
+// Handles MSG_LOGIN_REQUEST and MSG_REGISTER_REQUEST. Hashing runs on a small
+// dedicated pool, the MSG_AUTH_RESPONSE is routed back to the connection
+// when it finishes, so a login storm never blocks the network threads.
+// MSG_RESUME_REQUEST only looks up the token and is answered right away.
+class AuthService : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Requests beyond this many in flight are answered "busy" right away
+    static const int DEFAULT_MAX_PENDING = 1024;
+
+    AuthService(TcpServer *tcpServer, AuthManager *authManager, QObject *parent = nullptr);
+    ~AuthService();
+
+    // 0 picks half of the cores, at least one thread
+    void setMaxThreads(int count);
+    void setMaxPending(int count) { m_maxPending = qMax(1, count); }
+
+    int pendingRequests() const { return m_pending; }
+    qint64 completedRequests() const { return m_completed; }
+    qint64 rejectedRequests() const { return m_rejected; }
+    qint64 resumedSessions() const { return m_resumed; }
+
+private slots:
+    // Back on the server thread once a pool job is done
+    void onAuthFinished(quint64 connectionId, bool success, const QString &userId,
+                        const QString &token, const QString &error, int capabilities);
+
+private:
+    void onAuthRequest(const MessageHeader &header, const FrameView &payload);
+    void onResumeRequest(const MessageHeader &header, const FrameView &payload);
+    int readCapabilities(WireReader &reader) const;
+    void sendResponse(quint64 connectionId, bool success, const QString &userId,
+                      const QString &token, const QString &error, int capabilities,
+                      qint64 resumeFrom = -1);
+
+    TcpServer *m_tcpServer;
+    AuthManager *m_authManager;
+    QThreadPool m_pool;
+    int m_maxPending;
+    int m_pending;
+    qint64 m_completed;
+    qint64 m_rejected;
+    qint64 m_resumed;
+};
+
+#endif // AUTHSERVICE_H
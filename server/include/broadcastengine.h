@@ -0,0 +1,55 @@
+#ifndef BROADCASTENGINE_H
+#define BROADCASTENGINE_H
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include <QStringList>
+#include "clientregistry.h"
+
+class TcpServer;
+
+// Fans one frame out to many clients. The frame is encoded once into an
+// implicitly shared buffer; delivery is split into batches posted to the
+// worker that owns each connection, so workers enqueue in parallel and
+// keep serving reads between batches.
+class BroadcastEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BroadcastEngine(TcpServer *server, QObject *parent = nullptr);
+
+    // Returns the broadcast id used in progress reports, 0 if nobody is online
+    quint64 broadcast(const QByteArray &data);
+    quint64 broadcastTo(const QStringList &userIds, const QByteArray &data);
+
+    void setBatchSize(int connections) { m_batchSize = qMax(1, connections); }
+    int batchSize() const { return m_batchSize; }
+    int pendingBroadcasts() const { return m_pending.size(); }
+
+public slots:
+    // Reported by workers once a batch has been queued
+    void onBatchDelivered(quint64 broadcastId, int delivered, int failed);
+
+private:
+    struct Progress {
+        int total;
+        int delivered;
+        int failed;
+        int pendingBatches;
+    };
+
+    quint64 dispatch(const QList<ClientInfo> &targets, const QByteArray &data);
+
+    TcpServer *m_server;
+    int m_batchSize;
+    quint64 m_nextBroadcastId;
+    QHash<quint64, Progress> m_pending;   // broadcastId -> Progress
+
+signals:
+    void broadcastProgress(quint64 broadcastId, int delivered, int failed, int total);
+    void broadcastFinished(quint64 broadcastId, int delivered, int failed);
+};
+
+#endif // BROADCASTENGINE_H
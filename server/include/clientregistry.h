@@ -0,0 +1,86 @@
+#ifndef CLIENTREGISTRY_H
+#define CLIENTREGISTRY_H
+
+#include <QString>
+#include <QVector>
+#include <QList>
+#include <QReadWriteLock>
+
+class ServerWorker;
+
+// Session handle: slot index in the low 32 bits, slot generation in the high
+// 32 bits. A handle kept after its session ended never matches a reused slot.
+typedef quint64 SessionHandle;
+static const SessionHandle INVALID_SESSION = 0;
+
+struct ClientInfo {
+    QString userId;
+    ServerWorker *worker;     // Worker thread owning the connection
+    quint64 connectionId;     // Connection id inside that worker
+    SessionHandle handle;
+    QString ipAddress;
+    quint16 port;
+    bool isOnline;
+};
+
+// Thread-safe routing table shared by all workers. Sessions live in one
+// contiguous slot array addressed by integer handles; userId lookups go
+// through an open-addressing index that compares cached hashes before it
+// touches a string.
+class ClientRegistry
+{
+public:
+    ClientRegistry();
+
+    // Returns the new session's handle. A userId that is already registered
+    // is re-pointed at the new session; the old session stays valid until
+    // its own connection unregisters it.
+    SessionHandle registerClient(const ClientInfo &info);
+    // Returns true if the session still owned its userId route
+    bool unregisterClient(SessionHandle handle);
+
+    // userId-based API
+    bool lookup(const QString &userId, ClientInfo &info) const;
+    SessionHandle handleOf(const QString &userId) const;
+    bool unregisterClient(const QString &userId, quint64 connectionId);
+
+    // Handle-based API, no hashing or string compares
+    bool lookup(SessionHandle handle, ClientInfo &info) const;
+
+    QList<QString> onlineUsers() const;
+    QList<ClientInfo> clients() const;
+    int count() const;
+
+    static quint32 slotOf(SessionHandle handle) { return static_cast<quint32>(handle & 0xFFFFFFFFu); }
+    static quint32 generationOf(SessionHandle handle) { return static_cast<quint32>(handle >> 32); }
+
+private:
+    struct Slot {
+        ClientInfo info;
+        quint32 generation;   // Bumped on every release, never 0
+        bool used;
+    };
+
+    struct IndexEntry {
+        uint hash;
+        quint32 slot;         // EMPTY_ENTRY when free
+    };
+
+    static const quint32 EMPTY_ENTRY = 0xFFFFFFFFu;
+
+    const Slot *slotFor(SessionHandle handle) const;
+    int findIndex(const QString &userId, uint hash) const;
+    void insertIndex(uint hash, quint32 slot);
+    void eraseIndexAt(int pos);
+    void rehash(int capacity);
+    void releaseSlot(quint32 slot);
+
+    mutable QReadWriteLock m_lock;
+    QVector<Slot> m_slots;          // Contiguous session records
+    QVector<quint32> m_freeSlots;
+    QVector<IndexEntry> m_index;    // Linear probing, load factor <= 1/2
+    int m_indexMask;
+    int m_count;
+};
+
+#endif // CLIENTREGISTRY_H
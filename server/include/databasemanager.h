@@ -38,7 +38,11 @@ struct OfflineMessage {
     QString messageType;  // text, image, file, etc.
     QDateTime sentAt;
     bool delivered;
+    quint64 sequence;     // Recipient's SessionLog sequence, orders and acks the backlog
+
+    OfflineMessage() : delivered(false), sequence(0) {}
 };
+Q_DECLARE_METATYPE(OfflineMessage)
 
 class DatabaseManager : public QObject
 {
@@ -49,8 +53,10 @@ public:
     ~DatabaseManager();
 
     // Connection management
+    // A named connection is needed to use a second DatabaseManager on another thread
     bool connectToDatabase(const QString &host, int port, const QString &dbName,
-                          const QString &user, const QString &password);
+                          const QString &user, const QString &password,
+                          const QString &connectionName = QString());
     void disconnectFromDatabase();
     bool isConnected() const;
     
@@ -77,8 +83,15 @@ public:
     
     // Message management
     bool saveOfflineMessage(const OfflineMessage &message);
-    QList<OfflineMessage> getOfflineMessages(const QString &userId, int limit = 100);
+    // One transaction, row by row if that fails; returns the rows saved
+    int saveOfflineMessages(const QList<OfflineMessage> &messages);
+    // Undelivered messages in sequence order, starting after afterSequence
+    QList<OfflineMessage> getOfflineMessages(const QString &userId, int limit = 100,
+                                             quint64 afterSequence = 0);
     bool markMessagesAsDelivered(const QString &userId);
+    bool markMessagesAsDelivered(const QStringList &messageIds);
+    // Everything for userId with a sequence in [first, last], one statement per range
+    bool markMessagesAsDelivered(const QString &userId, quint64 first, quint64 last);
     bool deleteOldMessages(int daysOld = 30);
 
 private:
@@ -86,6 +99,7 @@ private:
     QString generateId();
     
     QSqlDatabase m_db;
+    QString m_connectionName;
     bool m_connected;
 
 signals:
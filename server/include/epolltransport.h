@@ -0,0 +1,54 @@
+#ifndef EPOLLTRANSPORT_H
+#define EPOLLTRANSPORT_H
+
+#include <QObject>
+#include <QHash>
+#include "transport.h"
+
+class QSocketNotifier;
+
+// Edge-triggered epoll over raw descriptors. The epoll descriptor itself is
+// watched by a QSocketNotifier, so events are handled on the worker's event
+// loop and a connection costs no QObject. Reads go straight into the frame
+// decoder, writes go to the kernel first and only the remainder is buffered.
+class EpollTransport : public QObject, public Transport
+{
+    Q_OBJECT
+
+public:
+    // Sent bytes at the front of a send buffer that trigger dropping them
+    static const int COMPACT_THRESHOLD = 64 * 1024;
+
+    explicit EpollTransport(TransportHandler *handler, QObject *parent = nullptr);
+    ~EpollTransport();
+
+    bool isValid() const { return m_epoll >= 0; }
+
+    bool adopt(Connection *conn, qintptr socketDescriptor) override;
+    void write(Connection *conn, const QByteArray &data) override;
+    qint64 pendingWriteBytes(const Connection *conn) const override;
+    void close(Connection *conn) override;
+    void closeGracefully(Connection *conn) override;
+    void setReadPaused(Connection *conn, bool paused) override;
+    const char *name() const override { return "epoll"; }
+
+private slots:
+    void onEvents();
+    void closeById(quint64 connectionId);
+
+private:
+    // Reads until EAGAIN, clears 'open' on EOF or error
+    qint64 readAll(Connection *conn, bool *open);
+    // Returns false once the connection has to be closed
+    bool flush(Connection *conn);
+    // Drops the part of the send buffer the kernel already took
+    void compact(Connection *conn);
+    void failWrite(Connection *conn);
+
+    TransportHandler *m_handler;
+    int m_epoll;
+    QSocketNotifier *m_notifier;
+    QHash<quint64, Connection*> m_connections;
+};
+
+#endif // EPOLLTRANSPORT_H
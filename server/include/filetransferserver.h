@@ -0,0 +1,147 @@
+#ifndef FILETRANSFERSERVER_H
+#define FILETRANSFERSERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include "messagedispatcher.h"
+
+class TcpServer;
+class AuthManager;
+class QFile;
+class QTimer;
+class WireReader;
+
+// MSG_FILE subtypes, the byte following the message type
+enum FileFrameType {
+    FILE_OFFER = 0,     // [TransferId][PeerId][FileName][Size]
+    FILE_ACCEPT = 1,    // [TransferId][Offset], receiver wants the data from Offset on
+    FILE_CHUNK = 2,     // [TransferId][Offset][Data to the end of the frame]
+    FILE_ACK = 3,       // [TransferId][Offset], everything below Offset is stored
+    FILE_CANCEL = 4     // [TransferId][Reason]
+};
+
+enum FileTransferMode {
+    TRANSFER_RELAY = 0,     // Both sides online, chunks pass straight through
+    TRANSFER_SPOOL = 1,     // Recipient offline, chunks are written to a spool file
+    TRANSFER_DELIVER = 2    // Spool complete, the server streams it to the recipient
+};
+
+struct FileTransfer {
+    QString transferId;
+    QString sender;
+    QString recipient;
+    QString fileName;
+    qint64 size;
+    FileTransferMode mode;
+    qint64 received;    // Next offset expected from the sender
+    qint64 acked;       // Everything below is stored at the recipient or in the spool
+    qint64 sent;        // Deliver mode: next offset read from the spool
+    qint64 spoolBase;   // File offset of the first spooled byte
+    qint64 reserved;    // Spool bytes counted against the quotas
+    qint64 lastActivityMs;
+    QFile *spool;       // Only open while chunks are written or read
+
+    FileTransfer()
+        : size(0), mode(TRANSFER_RELAY), received(0), acked(0), sent(0)
+        , spoolBase(0), reserved(0), lastActivityMs(0), spool(nullptr) {}
+};
+
+// Chunked MSG_FILE transfers. The sender may run at most WINDOW_SIZE bytes
+// ahead of the last FILE_ACK, so neither the server nor the outbound queues
+// ever hold more than one window of a transfer, whatever the file size.
+// Either side resumes after a reconnect: the sender repeats its FILE_OFFER
+// and is told where to continue, the receiver answers an offer with the
+// offset it already has.
+//
+// A spool reserves its whole remaining size up front against a per-sender
+// and a total quota, so a transfer that would not fit is refused before it
+// writes anything. Transfers without any activity for the expiry time are
+// dropped together with their spool, whoever never came back for them.
+class FileTransferServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int CHUNK_SIZE = 32 * 1024;
+    static const int WINDOW_SIZE = 8 * CHUNK_SIZE;
+    static const qint64 DEFAULT_MAX_FILE_SIZE = Q_INT64_C(4) * 1024 * 1024 * 1024;
+    static const int MAX_TRANSFERS_PER_SENDER = 16;
+    static const int MAX_TRANSFERS = 4096;
+    static const qint64 DEFAULT_SENDER_SPOOL_QUOTA = Q_INT64_C(8) * 1024 * 1024 * 1024;
+    static const qint64 DEFAULT_SPOOL_QUOTA = Q_INT64_C(64) * 1024 * 1024 * 1024;
+    static const int DEFAULT_EXPIRY = 7 * 24 * 3600;   // Seconds
+
+    explicit FileTransferServer(TcpServer *tcpServer, QObject *parent = nullptr);
+    ~FileTransferServer();
+
+    // Partial files left by a previous run are removed, their index is gone
+    bool setSpoolDirectory(const QString &path);
+    QString spoolDirectory() const { return m_spoolDirectory; }
+    void setMaxFileSize(qint64 bytes) { m_maxFileSize = bytes; }
+    qint64 maxFileSize() const { return m_maxFileSize; }
+    // Spool bytes all transfers together and those of one sender may reserve
+    void setSpoolQuota(qint64 total, qint64 perSender);
+    void setExpiry(int seconds) { m_expiryMs = qMax(0, seconds) * Q_INT64_C(1000); }
+    // Offers to ids it does not know are refused, null accepts any recipient
+    void setAuthManager(AuthManager *authManager) { m_authManager = authManager; }
+
+    int activeTransfers() const { return m_transfers.size(); }
+    qint64 relayedBytes() const { return m_relayedBytes; }
+    qint64 spooledBytes() const { return m_spooledBytes; }
+    qint64 deliveredBytes() const { return m_deliveredBytes; }
+    qint64 completedTransfers() const { return m_completed; }
+    qint64 reservedSpoolBytes() const { return m_spoolReserved; }
+    qint64 expiredTransfers() const { return m_expired; }
+
+private slots:
+    void onClientConnected(const QString &userId);
+    void onClientDisconnected(const QString &userId);
+    void expireTransfers();
+
+private:
+    void onFileMessage(const MessageHeader &header, const FrameView &payload);
+    void onOffer(const QString &userId, const QString &transferId, WireReader &reader);
+    void onAccept(const QString &userId, FileTransfer *transfer, qint64 offset);
+    void onChunk(const QString &userId, FileTransfer *transfer, qint64 offset, const char *data, int size);
+    void onAck(const QString &userId, FileTransfer *transfer, qint64 offset);
+    void onCancel(const QString &userId, FileTransfer *transfer, const QString &reason);
+
+    void startSpool(FileTransfer *transfer, qint64 base);
+    bool reserveSpool(FileTransfer *transfer, qint64 bytes);
+    void releaseSpool(FileTransfer *transfer);
+    void startDelivery(FileTransfer *transfer);
+    void pump(FileTransfer *transfer);
+    void finish(FileTransfer *transfer, bool completed);
+    void abort(FileTransfer *transfer, const QString &reason);
+
+    bool openSpool(FileTransfer *transfer, bool write);
+    void closeSpool(FileTransfer *transfer);
+    QString spoolPath(const FileTransfer &transfer) const;
+
+    bool isOnline(const QString &userId) const;
+    void sendOffer(const QString &userId, const FileTransfer &transfer, const QString &peerId);
+    void sendOffset(const QString &userId, FileFrameType type, const QString &transferId, qint64 offset);
+    void sendCancel(const QString &userId, const QString &transferId, const QString &reason);
+
+    TcpServer *m_tcpServer;
+    AuthManager *m_authManager;
+    QHash<QString, FileTransfer*> m_transfers;   // transferId -> FileTransfer
+    QHash<QString, int> m_senderTransfers;       // sender -> transfers it has open
+    QHash<QString, qint64> m_senderSpool;        // sender -> spool bytes reserved
+    QString m_spoolDirectory;
+    qint64 m_maxFileSize;
+    qint64 m_spoolQuota;
+    qint64 m_senderSpoolQuota;
+    qint64 m_spoolReserved;
+    qint64 m_expiryMs;
+    QTimer *m_expiryTimer;
+
+    qint64 m_relayedBytes;
+    qint64 m_spooledBytes;
+    qint64 m_deliveredBytes;
+    qint64 m_completed;
+    qint64 m_expired;
+};
+
+#endif // FILETRANSFERSERVER_H
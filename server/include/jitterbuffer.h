@@ -0,0 +1,78 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QtGlobal>
+
+// One sender's side of a call, as the relay saw it
+struct JitterStatistics {
+    double jitterMs;        // Interarrival jitter, estimated as in RFC 3550
+    double periodMs;        // Sender's packet interval, learned from arrivals
+    int targetDelayMs;      // What the buffer currently holds packets for
+    double averageDelayMs;  // Time released packets spent in the buffer
+    int maxDelayMs;
+    qint64 released;
+    qint64 late;            // Arrived after their slot was played out, dropped
+    qint64 skipped;         // Missing when their slot came, the stream went on without them
+    int buffered;
+
+    JitterStatistics()
+        : jitterMs(0), periodMs(0), targetDelayMs(0), averageDelayMs(0), maxDelayMs(0)
+        , released(0), late(0), skipped(0), buffered(0) {}
+};
+
+// Adaptive jitter buffer and pacer for one media stream. Packets are put
+// back in sequence order and released on the sender's media clock: one
+// packet interval apart, after a delay that follows the measured jitter
+// and never exceeds maxDelayMs. A stream arriving evenly is barely held, a
+// bursty one is smoothed out. Holds at most CAPACITY packets; a sequence
+// that far ahead restarts the stream.
+class JitterBuffer
+{
+public:
+    static const int CAPACITY = 64;
+
+    explicit JitterBuffer(int maxDelayMs = 0);
+
+    // Takes a packet of the stream, false when it came too late for its slot
+    bool push(quint32 sequence, const QByteArray &packet, qint64 nowMs);
+    // The next packet if its time has come
+    bool pop(qint64 nowMs, QByteArray &packet);
+    // When pop() has something next, -1 when empty
+    qint64 nextDueMs() const;
+    bool isEmpty() const { return m_count == 0; }
+
+    JitterStatistics statistics() const;
+
+private:
+    struct Slot {
+        quint32 sequence;
+        qint64 arrivedMs;
+        QByteArray packet;      // Null when the slot is free
+
+        Slot() : sequence(0), arrivedMs(0) {}
+    };
+
+    void updateJitter(quint32 sequence, qint64 nowMs);
+    void restart(quint32 sequence, qint64 nowMs);
+    int targetDelayMs() const;
+
+    int m_maxDelayMs;
+    QVector<Slot> m_slots;      // By sequence % CAPACITY
+    int m_count;
+    quint32 m_nextSequence;     // Next to release, 0 before the first packet
+    qint64 m_nextDueMs;         // When it is released
+    double m_periodMs;
+    double m_jitterMs;
+    quint32 m_lastSequence;     // Newest arrival, for the jitter estimate
+    qint64 m_lastArrivalMs;
+
+    qint64 m_released;
+    qint64 m_late;
+    qint64 m_skipped;
+    qint64 m_delaySumMs;
+    int m_maxHeldMs;
+};
+
+#endif // JITTERBUFFER_H
@@ -0,0 +1,147 @@
+#ifndef MEDIARELAY_H
+#define MEDIARELAY_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QHostAddress>
+#include <QThread>
+#include <QTimer>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+#include "mediapacket.h"
+#include "jitterbuffer.h"
+
+class QUdpSocket;
+class TcpServer;
+
+struct RelayStatistics {
+    qint64 packets;         // Datagrams received on the relay port
+    qint64 forwarded;       // Sent on over UDP
+    qint64 viaTcp;          // Peer without a known UDP address, sent over its connection
+    qint64 rejected;        // Unknown session or wrong tag
+    qint64 replayed;        // Duplicate or too old
+    qint64 dropped;         // Simulated loss or a full socket buffer
+    qint64 late;            // Too late for the jitter buffer
+    int sessions;
+
+    RelayStatistics()
+        : packets(0), forwarded(0), viaTcp(0), rejected(0), replayed(0), dropped(0), late(0), sessions(0) {}
+};
+
+struct CallJitterStatistics {
+    QString callId;
+    JitterStatistics parties[2];    // By sender, MediaPacket::PARTY_CALLER/PARTY_CALLEE
+};
+
+// Relays call media between the two parties of a call over UDP, see
+// MediaPacket. Runs on its own thread; what the socket cannot take right
+// away is dropped. A party learns the relay port
+// and call key with the call accept and is known by address once its first
+// authenticated packet arrives. Until both sides are, media goes out over
+// the recipient's TCP connection, as does media sent over TCP. With a
+// jitter buffer each direction of a call is reordered and paced, see
+// JitterBuffer, before it goes out either way.
+class MediaRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Session {
+        quint32 id;
+        QByteArray key;
+    };
+
+    // Moves itself to its own thread on start(), so it takes no parent
+    explicit MediaRelay(TcpServer *tcpServer);
+    ~MediaRelay();
+
+    bool start(quint16 port);
+    void stop();
+    bool isRunning() const { return m_port != 0; }
+    quint16 port() const { return m_port; }
+
+    // Thread-safe. The session is usable once the relay thread picked it up,
+    // a packet arriving before that is rejected like any unknown one.
+    Session openSession(const QString &callId, const QString &caller, const QString &callee);
+    void closeSession(quint32 sessionId);
+
+    // Share of forwarded packets dropped on purpose, to watch calls under loss
+    void setSimulatedLoss(double ratio) { m_lossPerMille.store(qBound(0, qRound(ratio * 1000), 1000)); }
+    double simulatedLoss() const { return m_lossPerMille.load() / 1000.0; }
+
+    // Holds media up to maxDelayMs to reorder and pace it, 0 forwards it as
+    // it arrives. Applies to sessions opened afterwards.
+    void setJitterBuffer(int maxDelayMs) { m_jitterMaxMs.store(qMax(0, maxDelayMs)); }
+    int jitterBufferMs() const { return m_jitterMaxMs.load(); }
+
+    RelayStatistics statistics() const;
+    // Thread-safe, refreshed about once a second while calls are paced
+    QVector<CallJitterStatistics> jitterStatistics() const;
+
+private slots:
+    void addSession(quint32 sessionId, const QByteArray &key, const QString &callId,
+                    const QString &caller, const QString &callee);
+    void removeSession(quint32 sessionId);
+    void onReadyRead();
+    void closeSocket();
+    void pump();
+
+private:
+    struct Party {
+        QString userId;
+        QHostAddress address;   // Null until a packet from the party arrived
+        quint16 port;
+        ReplayWindow window;
+        JitterBuffer buffer;    // What the party sent, on its way to the other one
+
+        Party() : port(0) {}
+    };
+
+    struct RelaySession {
+        QByteArray key;
+        QString callId;
+        bool paced;
+        Party parties[2];       // Indexed by MediaPacket::PARTY_CALLER/PARTY_CALLEE
+
+        RelaySession() : paced(false) {}
+    };
+
+    void relay(const QByteArray &datagram, const QHostAddress &sender, quint16 senderPort);
+    void deliver(const RelaySession &session, quint8 fromParty, const QByteArray &datagram);
+    void sendOverTcp(const RelaySession &session, const Party &recipient, const MediaPacket &packet);
+    void schedulePump(qint64 dueMs);
+    void refreshJitterStatistics();
+
+    TcpServer *m_tcpServer;
+    QUdpSocket *m_socket;
+    QThread m_thread;
+    quint16 m_port;
+    QHash<quint32, RelaySession> m_sessions;    // Relay thread only
+    QAtomicInteger<quint32> m_nextSessionId;
+    QAtomicInt m_lossPerMille;
+    QAtomicInt m_jitterMaxMs;
+
+    // Relay thread only: the streams holding packets, (session id << 1) | sending party
+    QSet<quint64> m_pacedStreams;
+    QTimer *m_pumpTimer;
+    qint64 m_pumpAtMs;
+    QElapsedTimer m_clock;
+    qint64 m_statisticsAtMs;
+
+    mutable QMutex m_statisticsMutex;
+    QVector<CallJitterStatistics> m_jitterStatistics;
+
+    QAtomicInteger<qint64> m_packets;
+    QAtomicInteger<qint64> m_forwarded;
+    QAtomicInteger<qint64> m_viaTcp;
+    QAtomicInteger<qint64> m_rejected;
+    QAtomicInteger<qint64> m_replayed;
+    QAtomicInteger<qint64> m_dropped;
+    QAtomicInteger<qint64> m_late;
+    QAtomicInt m_sessionCount;
+};
+
+#endif // MEDIARELAY_H
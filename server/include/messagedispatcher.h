@@ -0,0 +1,79 @@
+#ifndef MESSAGEDISPATCHER_H
+#define MESSAGEDISPATCHER_H
+
+#include <QObject>
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+#include <QMetaType>
+#include <functional>
+#include "framedecoder.h"
+#include "clientregistry.h"
+
+// Decoded part of an inbound frame, shared by every handler
+struct MessageHeader {
+    quint8 type;
+    QString userId;
+    SessionHandle session;
+    quint64 connectionId;
+    // The payload as a buffer of its own, only set for media handed over
+    // from a worker thread. Handlers may keep it without copying.
+    QByteArray payloadBuffer;
+
+    MessageHeader() : type(0), session(INVALID_SESSION), connectionId(0) {}
+};
+
+// The payload view (bytes after the type, or after the registration prefix)
+// is only valid during the call, handlers copy what they keep.
+typedef std::function<void(const MessageHeader &header, const FrameView &payload)> MessageHandler;
+
+struct DispatchStatistics {
+    qint64 calls;
+    qint64 totalNs;
+    qint64 maxNs;
+
+    DispatchStatistics() : calls(0), totalNs(0), maxNs(0) {}
+};
+
+// Messages a worker thread received during one event loop pass, handed to
+// the dispatcher's thread in a single queued call
+struct InboundBatch {
+    QVector<MessageHeader> headers;
+    QVector<int> ends;       // Payload i spans [ends[i-1], ends[i]) of payloads, unless it has a payloadBuffer
+    QByteArray payloads;
+};
+Q_DECLARE_METATYPE(InboundBatch)
+
+// Routes inbound messages to the handlers registered for their type.
+// Handlers run on the dispatcher's thread (the server thread): directly from
+// the worker when it shares that thread, otherwise once per worker batch.
+class MessageDispatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int TYPE_COUNT = 256;
+
+    explicit MessageDispatcher(QObject *parent = nullptr);
+
+    // Register from the dispatcher's thread, typically before startServer()
+    void registerHandler(int type, const MessageHandler &handler);
+    bool hasHandler(int type) const;
+
+    // Must be called on the dispatcher's thread
+    void dispatch(const MessageHeader &header, const FrameView &payload);
+
+    DispatchStatistics statistics(int type) const;
+    // Messages of a type nobody registered for
+    qint64 unhandledMessages() const { return m_unhandled; }
+
+public slots:
+    void dispatchBatch(const InboundBatch &batch);
+
+private:
+    QVector<MessageHandler> m_handlers[TYPE_COUNT];
+    DispatchStatistics m_statistics[TYPE_COUNT];
+    qint64 m_unhandled;
+};
+
+#endif // MESSAGEDISPATCHER_H
@@ -0,0 +1,47 @@
+#ifndef OFFLINESTORE_H
+#define OFFLINESTORE_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include "databasemanager.h"
+#include "ackranges.h"
+
+// Background persistence stage for offline messages. Lives on its own thread
+// with its own database connection, so SQL never blocks the network loop.
+// All slots are meant to be invoked queued.
+class OfflineStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Rows read per query when a user comes back online
+    static const int BACKLOG_CHUNK = 500;
+
+    explicit OfflineStore(QObject *parent = nullptr);
+    ~OfflineStore();
+
+public slots:
+    void open(const QString &host, int port, const QString &dbName,
+              const QString &user, const QString &password);
+    void close();
+    void saveMessages(const QList<OfflineMessage> &messages);
+    // Streams everything undelivered for the user in sequence order. With
+    // markDelivered the rows are retired as they are read, otherwise they
+    // stay until the client acknowledges them
+    void loadBacklog(const QString &userId, bool markDelivered);
+    // Delivered sequence ranges, one update per range
+    void retire(const QString &userId, const AckRanges &ranges);
+
+signals:
+    // Outcome of one saveMessages() call
+    void messagesSaved(int saved, int failed);
+    void backlogLoaded(const QString &userId, const QList<OfflineMessage> &messages);
+    // lastSequence is the highest sequence loaded, 0 if there was nothing
+    void backlogFinished(const QString &userId, quint64 lastSequence);
+
+private:
+    DatabaseManager *m_database;
+};
+
+#endif // OFFLINESTORE_H
@@ -0,0 +1,159 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include "framedecoder.h"
+
+// What happens to a frame that arrives while the receiver is backed up
+enum OverflowPolicy {
+    OverflowKeep = 0,        // Signaling, the frame is never dropped, past the hard limit the receiver is
+    OverflowDropStale = 1,   // Media, older queued frames of the same kind are dropped first
+    OverflowDisconnect = 2   // Everything else, past the hard limit the receiver is dropped
+};
+
+// Send priority. A lane is only served once every lane above it is empty,
+// so call signaling never waits behind queued media or file chunks.
+enum OutboundLane {
+    LaneControl = 0,   // Call signaling, heartbeats, login replies
+    LaneNormal = 1,    // Chat and everything not listed elsewhere
+    LaneBulk = 2,      // Media, file chunks, offline backlog
+    LANE_COUNT = 3
+};
+
+struct OutboundLimits {
+    int lowWatermark;     // Socket backlog at which draining resumes
+    int highWatermark;    // Socket backlog at which the connection counts as congested
+    int mediaBudget;      // Media bytes kept queued while congested
+    int hardLimit;        // Queued bytes after which a slow receiver is disconnected
+    int maxBatchBytes;    // Upper bound of one coalesced socket write
+    // Socket backlog up to which bulk frames are handed to the transport. Keeps
+    // what a control frame can still get stuck behind well below highWatermark.
+    int bulkWatermark;
+    // Media bytes one stream may keep queued, so a single busy publisher in a
+    // room cannot take the whole media budget of a subscriber
+    int streamBudget;
+
+    OutboundLimits()
+        : lowWatermark(64 * 1024)
+        , highWatermark(512 * 1024)
+        , mediaBudget(256 * 1024)
+        , hardLimit(8 * 1024 * 1024)
+        , maxBatchBytes(64 * 1024)
+        , bulkWatermark(128 * 1024)
+        , streamBudget(64 * 1024)
+    {}
+};
+
+// Time frames of one lane spent queued before going to the transport
+struct LaneStatistics {
+    qint64 sentFrames;
+    qint64 waitNs;
+    qint64 maxWaitNs;
+
+    LaneStatistics() : sentFrames(0), waitNs(0), maxWaitNs(0) {}
+
+    void add(qint64 wait)
+    {
+        ++sentFrames;
+        waitNs += wait;
+        maxWaitNs = qMax(maxWaitNs, wait);
+    }
+    qint64 averageWaitNs() const { return sentFrames > 0 ? waitNs / sentFrames : 0; }
+};
+
+struct QueueStatistics {
+    qint64 queuedBytes;
+    qint64 queuedFrames;
+    qint64 droppedFrames;
+    qint64 overflowDisconnects;
+    int congestedConnections;
+    LaneStatistics lanes[LANE_COUNT];
+
+    QueueStatistics()
+        : queuedBytes(0), queuedFrames(0), droppedFrames(0)
+        , overflowDisconnects(0), congestedConnections(0)
+    {}
+};
+
+// Per-connection queue of frame bodies waiting for the socket, one FIFO per
+// OutboundLane. Bodies are implicitly shared, so queueing the same broadcast
+// buffer for many connections does not copy it.
+class OutboundQueue
+{
+public:
+    enum EnqueueResult {
+        Queued = 0,
+        DroppedStale = 1,   // Queued, but older media had to be dropped
+        DroppedNew = 2,     // The frame itself was dropped
+        Overflow = 3        // Hard limit exceeded, the receiver should be dropped
+    };
+
+    explicit OutboundQueue(const OutboundLimits &limits = OutboundLimits());
+
+    EnqueueResult enqueue(const QByteArray &body);
+    // Body of 'prefix' followed by 'body', both shared as-is and only joined
+    // when copied into the socket batch. Relayed media keeps one header per
+    // call this way, the payload is the buffer it arrived in. Media of a
+    // non-zero 'stream' is also bounded by OutboundLimits::streamBudget.
+    EnqueueResult enqueue(const QByteArray &prefix, const QByteArray &body, quint32 stream = 0);
+    // Frame that already carries its length prefix, shared as-is
+    EnqueueResult enqueueEncoded(const QByteArray &frame);
+
+    // Appends length-prefixed frames to batch, at least one, until maxBatchBytes,
+    // higher lanes first. Without 'bulk' the bulk lane is left alone. With
+    // 'envelope' runs of small frames are packed into MSG_BATCH frames. The
+    // queueing time of every frame taken is added to 'sent' (LANE_COUNT entries).
+    int takeBatch(QByteArray &batch, bool envelope = false, bool bulk = true,
+                  LaneStatistics *sent = nullptr);
+
+    bool isEmpty() const { return m_frameCount == 0; }
+    // Anything queued outside the bulk lane
+    bool hasPriorityFrames() const { return m_frameCount > m_lanes[LaneBulk].size(); }
+    qint64 queuedBytes() const { return m_bytes; }
+    int queuedFrames() const { return m_frameCount; }
+    int queuedFrames(OutboundLane lane) const { return m_lanes[lane].size(); }
+    qint64 droppedFrames() const { return m_dropped; }
+    const OutboundLimits &limits() const { return m_limits; }
+
+    static OverflowPolicy policyFor(quint8 msgType);
+    static bool isMedia(quint8 msgType) { return policyFor(msgType) == OverflowDropStale; }
+    // Compressed frames go to the lane of the type they carry
+    static OutboundLane laneFor(quint8 msgType);
+
+private:
+    struct Frame {
+        QByteArray prefix;  // Start of the body, empty for most frames
+        QByteArray data;
+        quint8 type;
+        quint32 stream;   // Media stream for the per-stream budget, 0 for none
+        bool encoded;     // data already starts with the length prefix, never with a prefix
+        qint64 queuedAt;  // Monotonic ns
+
+        int wireSize() const { return prefix.size() + data.size() + (encoded ? 0 : FrameDecoder::HEADER_SIZE); }
+        int bodySize() const { return prefix.size() + data.size() - (encoded ? FrameDecoder::HEADER_SIZE : 0); }
+        // Copies prefix and data, without any length prefix, to bodySize() bytes at 'out'
+        void copyBody(char *out) const;
+    };
+
+    EnqueueResult append(const QByteArray &prefix, const QByteArray &data, quint8 type, bool encoded,
+                         quint32 stream);
+    void dropStaleMedia(qint64 incoming);
+    void dropStaleStream(quint32 stream, qint64 incoming);
+    // Takes the frame out of the byte counts, not out of its lane
+    void release(const Frame &frame);
+    int takeLane(QByteArray &batch, int lane, bool envelope, qint64 now, LaneStatistics *sent);
+    int takeEnvelope(QByteArray &batch, int lane, qint64 now, LaneStatistics *sent);
+    void removeFirst(int lane, qint64 now, LaneStatistics *sent);
+
+    OutboundLimits m_limits;
+    QList<Frame> m_lanes[LANE_COUNT];
+    int m_frameCount;
+    qint64 m_bytes;
+    qint64 m_mediaBytes;
+    QHash<quint32, qint64> m_streamBytes;   // Queued bytes per non-zero stream
+    qint64 m_dropped;
+};
+
+#endif // OUTBOUNDQUEUE_H
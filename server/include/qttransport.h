@@ -0,0 +1,55 @@
+#ifndef QTTRANSPORT_H
+#define QTTRANSPORT_H
+
+#include <QObject>
+#include <QHash>
+#include <QAbstractSocket>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include "transport.h"
+
+class QTcpSocket;
+
+// One QTcpSocket per connection, Qt owns the read and write buffers. With
+// TLS enabled the sockets are QSslSockets and the handshake runs here, on
+// the worker's thread; the connection only turns readable once encrypted.
+class QtTransport : public QObject, public Transport
+{
+    Q_OBJECT
+
+public:
+    QtTransport(TransportHandler *handler, const TlsContext &tls, QObject *parent = nullptr);
+    ~QtTransport();
+
+    bool adopt(Connection *conn, qintptr socketDescriptor) override;
+    void write(Connection *conn, const QByteArray &data) override;
+    qint64 pendingWriteBytes(const Connection *conn) const override;
+    void close(Connection *conn) override;
+    void closeGracefully(Connection *conn) override;
+    void setReadPaused(Connection *conn, bool paused) override;
+    const char *name() const override { return m_tls.isEnabled() ? "qt+tls" : "qt"; }
+    TlsStatistics tlsStatistics() const override;
+
+private slots:
+    void onEncrypted();
+    void onReadyRead();
+    void onBytesWritten(qint64 bytes);
+    void onDisconnected();
+    void onError(QAbstractSocket::SocketError error);
+
+private:
+    void release(QTcpSocket *socket);
+
+    TransportHandler *m_handler;
+    TlsContext m_tls;
+    QHash<QTcpSocket*, Connection*> m_connections;
+
+    // Sockets still in the handshake, with the time they were adopted
+    QHash<QTcpSocket*, qint64> m_handshakes;
+    QElapsedTimer m_clock;
+    QAtomicInteger<qint64> m_completedHandshakes;
+    QAtomicInteger<qint64> m_failedHandshakes;
+    QAtomicInteger<qint64> m_handshakeNs;
+};
+
+#endif // QTTRANSPORT_H
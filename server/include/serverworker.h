@@ -0,0 +1,227 @@
+#ifndef SERVERWORKER_H
+#define SERVERWORKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include "framedecoder.h"
+#include "framecompression.h"
+#include "outboundqueue.h"
+#include "timingwheel.h"
+#include "tokenbucket.h"
+#include "clientregistry.h"
+#include "transport.h"
+#include "messagedispatcher.h"
+
+class QTimer;
+class QTcpSocket;
+
+struct WorkerSettings {
+    int maxFrameSize;
+    OutboundLimits outboundLimits;
+    int idleTimeoutSeconds;   // 0 disables the idle reaper
+    TransportType transport;
+    int compressionThreshold; // Smallest body compressed for clients that asked, 0 disables
+    TlsContext tls;           // Disabled unless a certificate was loaded
+    RateLimits rateLimits;    // Inbound limits per connection, off by default
+
+    WorkerSettings()
+        : maxFrameSize(FrameDecoder::DEFAULT_MAX_FRAME_SIZE)
+        , idleTimeoutSeconds(90)
+        , transport(TRANSPORT_QT)
+        , compressionThreshold(FrameCompression::DEFAULT_THRESHOLD)
+    {}
+};
+
+struct CompressionStatistics {
+    qint64 compressedFrames;
+    qint64 uncompressedBytes;   // Bodies before compression
+    qint64 compressedBytes;     // Same bodies on the wire
+    qint64 compressNs;
+    qint64 decompressedFrames;
+    qint64 decompressNs;
+    qint64 corruptFrames;
+
+    CompressionStatistics()
+        : compressedFrames(0), uncompressedBytes(0), compressedBytes(0), compressNs(0)
+        , decompressedFrames(0), decompressNs(0), corruptFrames(0)
+    {}
+
+    double ratio() const { return compressedBytes > 0 ? double(uncompressedBytes) / compressedBytes : 1.0; }
+};
+
+struct RateLimitStatistics {
+    qint64 readPauses;      // Times a connection stopped being read
+    qint64 pausedMs;        // Summed over all pauses
+    qint64 frameLimitHits;
+    qint64 byteLimitHits;
+    qint64 typeLimitHits[RateLimits::MAX_TYPE_LIMITS];   // Indexed like RateLimits::types
+    int pausedConnections;
+
+    RateLimitStatistics()
+        : readPauses(0), pausedMs(0), frameLimitHits(0), byteLimitHits(0), pausedConnections(0)
+    {
+        for (int i = 0; i < RateLimits::MAX_TYPE_LIMITS; ++i) typeLimitHits[i] = 0;
+    }
+};
+
+struct Connection {
+    quint64 id;
+    QString peerAddress;
+    quint16 peerPort;
+    QTcpSocket *socket;   // Qt transport only
+    int fd;               // epoll transport only
+    QByteArray sendBuffer;   // epoll transport: bytes the kernel did not take yet
+    int sendOffset;
+    bool writeFailed;
+    FrameDecoder decoder;
+    OutboundQueue outbound;
+    QString userId;       // Empty until the first frame registers the client
+    int capabilities;     // FrameCompression capability bits agreed at login
+    SessionHandle session;
+    TimerNode idleTimer;  // Re-armed by any inbound traffic
+    bool flushScheduled;
+    bool congested;       // Socket backlog above the high watermark
+    bool bulkDeferred;    // Bulk frames wait for the backlog to fall below the bulk watermark
+    bool readPaused;      // Over a rate limit, the transport leaves the socket unread
+    TokenBucket frameBucket;
+    TokenBucket byteBucket;
+    QVector<TokenBucket> typeBuckets;   // Indexed like RateLimits::types, sized on first use
+
+    Connection(int maxFrameSize, const OutboundLimits &limits)
+        : id(0), peerPort(0), socket(nullptr), fd(-1), sendOffset(0), writeFailed(false)
+        , decoder(maxFrameSize), outbound(limits), capabilities(0), session(INVALID_SESSION)
+        , flushScheduled(false), congested(false), bulkDeferred(false), readPaused(false) {}
+};
+
+// Owns a share of the client connections and runs their I/O on its own thread
+// through the configured transport. All slots must be invoked through the
+// worker's event loop (queued) when called from another thread.
+class ServerWorker : public QObject, public TransportHandler
+{
+    Q_OBJECT
+
+public:
+    ServerWorker(int index, ClientRegistry *registry, MessageDispatcher *dispatcher,
+                 const WorkerSettings &settings, QObject *parent = nullptr);
+    ~ServerWorker();
+
+    int index() const { return m_index; }
+    int connectionCount() const { return m_connectionCount.load(); }
+    // Safe to call from any thread
+    QueueStatistics queueStatistics() const;
+    qint64 idleTimeouts() const { return m_idleTimeouts.load(); }
+    CompressionStatistics compressionStatistics() const;
+    RateLimitStatistics rateLimitStatistics() const;
+    const char *transportName() const { return m_transport->name(); }
+    TlsStatistics tlsStatistics() const { return m_transport->tlsStatistics(); }
+
+public slots:
+    void addConnection(qintptr socketDescriptor);
+    void sendToConnection(quint64 connectionId, const QByteArray &data);
+    // Body of prefix then data, see OutboundQueue::enqueue(prefix, body, stream)
+    void sendToConnection(quint64 connectionId, const QByteArray &prefix, const QByteArray &data,
+                          quint32 stream);
+    // Binds an authenticated connection to userId, queues the reply, then
+    // enables the negotiated capabilities. resumeFrom is the client's last
+    // sequence for a resumed session, -1 for a fresh login.
+    void loginConnection(quint64 connectionId, const QString &userId, const QByteArray &reply,
+                         int capabilities, qint64 resumeFrom);
+    // Queues an already length-prefixed frame for each connection of the batch
+    void deliverBatch(quint64 broadcastId, const QVector<quint64> &connectionIds, const QByteArray &frame);
+    void shutdown();
+
+private slots:
+    void flushPending();
+    void flushInbound();
+    void onIdleTick();
+    void resumeThrottled();
+    void closeConnection(quint64 connectionId);
+
+private:
+    // TransportHandler
+    void onConnectionReadable(Connection *conn) override;
+    void onConnectionWritable(Connection *conn) override;
+    void onConnectionClosed(Connection *conn) override;
+
+    void processFrames(Connection *conn);
+    // inBatch is set for the entries of an envelope, which may not be envelopes themselves
+    void handleMessage(Connection *conn, const FrameView &frame, bool inBatch = false);
+    void charge(Connection *conn, TokenBucket &bucket, const RateLimit &limit, double amount,
+                QAtomicInteger<qint64> &hits);
+    void throttle(Connection *conn);
+    void registerClient(Connection *conn, const QString &userId);
+    void removeConnection(Connection *conn);
+    bool enqueueFrame(Connection *conn, const QByteArray &data, bool encoded = false,
+                      const QByteArray &prefix = QByteArray(), quint32 stream = 0);
+    bool compressFrame(const QByteArray &data, QByteArray &out);
+    bool decompressFrame(const FrameView &frame, QByteArray &out);
+    void scheduleFlush(Connection *conn);
+    void drain(Connection *conn);
+    void setCongested(Connection *conn, bool congested);
+    void updateQueueStatistics(Connection *conn, qint64 oldBytes, int oldFrames, qint64 oldDropped);
+    void updateLaneStatistics(const LaneStatistics *sent);
+
+    int m_index;
+    ClientRegistry *m_registry;
+    MessageDispatcher *m_dispatcher;
+    WorkerSettings m_settings;
+    Transport *m_transport;
+    quint64 m_nextConnectionId;
+    QAtomicInt m_connectionCount;
+    QHash<quint64, Connection*> m_connections;        // connectionId -> Connection
+
+    // Connections with queued frames, drained once per event loop iteration
+    QList<quint64> m_pendingFlush;
+    bool m_flushScheduled;
+    QByteArray m_batch;
+
+    // Messages for a dispatcher on another thread, posted once per pass
+    InboundBatch m_inbound;
+    bool m_inboundScheduled;
+
+    // One wheel tick per second replaces a QTimer per socket
+    TimingWheel m_idleWheel;
+    QTimer *m_idleTimer;
+    QAtomicInteger<qint64> m_idleTimeouts;
+
+    // Connections over a rate limit, with the time their reads resume
+    QHash<quint64, qint64> m_throttled;
+    QTimer *m_throttleTimer;
+    qint64 m_throttleDeadline;
+    QElapsedTimer m_rateClock;
+    QAtomicInteger<qint64> m_readPauses;
+    QAtomicInteger<qint64> m_pausedMs;
+    QAtomicInteger<qint64> m_frameLimitHits;
+    QAtomicInteger<qint64> m_byteLimitHits;
+    QAtomicInteger<qint64> m_typeLimitHits[RateLimits::MAX_TYPE_LIMITS];
+    QAtomicInt m_pausedConnections;
+
+    QAtomicInteger<qint64> m_queuedBytes;
+    QAtomicInteger<qint64> m_queuedFrames;
+    QAtomicInteger<qint64> m_droppedFrames;
+    QAtomicInteger<qint64> m_overflowDisconnects;
+    QAtomicInt m_congestedConnections;
+    QAtomicInteger<qint64> m_laneFrames[LANE_COUNT];
+    QAtomicInteger<qint64> m_laneWaitNs[LANE_COUNT];
+    QAtomicInteger<qint64> m_laneMaxWaitNs[LANE_COUNT];
+
+    QAtomicInteger<qint64> m_compressedFrames;
+    QAtomicInteger<qint64> m_uncompressedBytes;
+    QAtomicInteger<qint64> m_compressedBytes;
+    QAtomicInteger<qint64> m_compressNs;
+    QAtomicInteger<qint64> m_decompressedFrames;
+    QAtomicInteger<qint64> m_decompressNs;
+    QAtomicInteger<qint64> m_corruptFrames;
+
+signals:
+    void clientConnected(const QString &userId);
+    void clientResumed(const QString &userId, quint64 lastSequence);
+    void clientDisconnected(const QString &userId);
+    void batchDelivered(quint64 broadcastId, int delivered, int failed);
+};
+
+#endif // SERVERWORKER_H
@@ -0,0 +1,125 @@
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include "clientregistry.h"
+#include "ackranges.h"
+
+// Per-user sequence numbers and a bounded ring of the last messages sent to
+// the user. A client that reconnects after a short outage presents the last
+// sequence it saw and gets only the gap replayed from memory; the database
+// backlog is needed only when the gap reaches past the ring.
+//
+// Sessions that negotiated AckRanges::CAPABILITY_ACK keep their entries
+// until acknowledged. Unacknowledged entries pushed out of the ring, or left
+// when the session is replaced or expires, are handed back as spills so they
+// can be persisted: every message is then either acked, in the ring or in
+// the database. Other sessions count a message as delivered once sent.
+// Not thread-safe, only used on the server thread.
+class SessionLog
+{
+public:
+    static const int DEFAULT_CAPACITY = 256;          // Messages kept per user
+    static const int DEFAULT_MAX_BYTES = 64 * 1024;   // Frame bytes kept per user
+    static const int DEFAULT_RESUME_WINDOW = 120;     // Seconds a ring outlives its session
+
+    struct Entry {
+        quint64 sequence;
+        QByteArray frame;       // Complete body, replayed as-is
+        SessionHandle session;  // Session it went out on, INVALID_SESSION if none
+        QString messageId;      // Set when the message was also persisted offline
+
+        Entry() : sequence(0), session(INVALID_SESSION) {}
+    };
+
+    // An unacknowledged entry that left memory without being persisted
+    struct Spill {
+        QString userId;
+        Entry entry;
+    };
+
+    SessionLog();
+
+    // 0 entries keeps the sequence numbers but always falls back to the database
+    void setCapacity(int entries, int bytes = DEFAULT_MAX_BYTES);
+    int capacity() const { return m_capacity; }
+    void setResumeWindow(int seconds) { m_resumeWindowMs = qMax(0, seconds) * Q_INT64_C(1000); }
+
+    // Full login: the ring starts empty, returns the sequence the client continues from
+    quint64 reset(const QString &userId, bool acking);
+    // Resumed login: keeps the ring, returns the current sequence
+    quint64 resume(const QString &userId, bool acking);
+    bool contains(const QString &userId) const { return m_logs.contains(userId); }
+    bool isAcking(const QString &userId) const;
+    // Highest sequence that is no longer in the ring
+    quint64 floor(const QString &userId) const;
+
+    // Next sequence for a message to userId. Counters start from the clock, so
+    // they keep growing across server restarts and expired logs. Users without
+    // a log share one clock counter and no log is created for them: a log
+    // only exists once its user logged in.
+    quint64 nextSequence(const QString &userId);
+    void append(const QString &userId, const Entry &entry);
+
+    // Entries after 'after' that did not go out on 'current'. False when part
+    // of the gap is no longer in memory, the entries are then incomplete.
+    bool collect(const QString &userId, quint64 after, SessionHandle current,
+                 QList<Entry> &entries) const;
+    // Drops the entries the database backlog is about to deliver
+    void discardPersisted(const QString &userId);
+
+    // Retires everything up to 'cumulative' and in 'selective'. Ranges that may
+    // still be undelivered in the database are added to 'persisted'.
+    int acknowledge(const QString &userId, quint64 cumulative, const AckRanges &selective,
+                    AckRanges &persisted);
+    // Sequences [first, last] may sit undelivered in the database
+    void notePersisted(const QString &userId, quint64 first, quint64 last);
+
+    // Starts the resume window, expire() drops logs whose window is over
+    void setOffline(const QString &userId, qint64 nowMs);
+    int expire(qint64 nowMs);
+
+    // Spills collected since the last call
+    QList<Spill> takeSpilled();
+
+    int userCount() const { return m_logs.size(); }
+    qint64 bufferedBytes() const { return m_bytes; }
+
+private:
+    struct UserLog {
+        quint64 sequence;       // Last assigned
+        quint64 floor;          // Highest sequence evicted from the ring
+        QList<Entry> entries;   // Oldest first
+        int bytes;
+        qint64 offlineSince;    // 0 while a session is open
+        bool acking;
+        // Window of sequences that may be undelivered in the database
+        bool persisted;
+        quint64 persistedFirst;
+        quint64 persistedLast;
+
+        UserLog()
+            : sequence(0), floor(0), bytes(0), offlineSince(0), acking(false)
+            , persisted(false), persistedFirst(0), persistedLast(0) {}
+    };
+
+    UserLog &logOf(const QString &userId);
+    void clear(const QString &userId, UserLog &log);
+    void removeAt(UserLog &log, int index);
+    void spill(const QString &userId, const UserLog &log, const Entry &entry);
+    void markPersisted(UserLog &log, quint64 first, quint64 last);
+    quint64 clockSequence() const;
+
+    QHash<QString, UserLog> m_logs;
+    QList<Spill> m_spilled;
+    int m_capacity;
+    int m_maxBytes;
+    qint64 m_resumeWindowMs;
+    qint64 m_bytes;
+    quint64 m_sharedSequence;   // Last handed out to a user without a log
+};
+
+#endif // SESSIONLOG_H
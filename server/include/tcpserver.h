@@ -2,9 +2,13 @@
 #define TCPSERVER_H
 
 #include <QTcpServer>
-#include <QTcpSocket>
-#include <QMap>
 #include <QObject>
+#include <QVector>
+#include <QThread>
+#include "clientregistry.h"
+#include "serverworker.h"
+#include "messagedispatcher.h"
+#include "sessionlog.h"
 
 // Message types for communication protocol
 enum MessageType {
@@ -15,16 +19,20 @@ enum MessageType {
     MSG_CALL_REJECT = 4,    // Call rejected
     MSG_CALL_END = 5,       // Call ended
     MSG_MEDIA_DATA = 6,     // Audio/Video media data
-    MSG_HEARTBEAT = 7       // Heartbeat message
+    MSG_HEARTBEAT = 7,      // Heartbeat message
+    MSG_LOGIN_REQUEST = 8,  // Username/password login, first frame of a connection
+    MSG_REGISTER_REQUEST = 9, // New account, first frame of a connection
+    MSG_AUTH_RESPONSE = 10, // Reply to login/register with token and userId
+    MSG_OFFLINE_BATCH = 11, // Text messages queued while the user was offline
+    MSG_BATCH = 12,         // Envelope of small messages, see BatchEnvelope
+    MSG_RESUME_REQUEST = 13, // Token and last seen sequence, replaces a login after a reconnect
+    MSG_ACK = 14,           // Cumulative and selective acks of sequenced messages, see AckRanges
+    MSG_ROOM = 15,          // Room membership and subscriptions, see RoomFrameType
+    MSG_ROOM_MEDIA = 16,    // Media of a room member, fanned out to its subscribers
+    MSG_ROOM_AUDIO = 17     // PCM of a room member in, the mix of everyone else out, see AudioMixer
 };
 
-struct ClientInfo {
-    QString userId;
-    QTcpSocket* socket;
-    QString ipAddress;
-    quint16 port;
-    bool isOnline;
-};
+class BroadcastEngine;
 
 class TcpServer : public QTcpServer
 {
@@ -36,31 +44,104 @@ public:
 
     bool startServer(quint16 port);
     void stopServer();
+    // Thread-safe, may be called from any worker or the main thread
     bool sendMessage(const QString &userId, const QByteArray &data);
+    bool sendMessage(SessionHandle session, const QByteArray &data);
+    // Sends prefix and data as one message without joining them first, so
+    // both buffers stay shared (per-call headers, relayed payloads). Media of
+    // a non-zero stream is also bounded per stream in the outbound queue.
+    bool sendMessage(SessionHandle session, const QByteArray &prefix, const QByteArray &data,
+                     quint32 stream = 0);
+    SessionHandle sessionOf(const QString &userId) const { return m_registry.handleOf(userId); }
+    // Connection-level sends for replies to a not yet registered client
+    bool sendToConnection(quint64 connectionId, const QByteArray &data);
+    // Registers the connection as userId, sends data to it (if any), then enables the
+    // FrameCompression capability bits agreed with the client. With resumeFrom
+    // set the login continues a session, clientResumed is emitted instead of
+    // clientConnected.
+    bool completeLogin(quint64 connectionId, const QString &userId, const QByteArray &data,
+                       int capabilities = 0, qint64 resumeFrom = -1);
     void broadcastMessage(const QByteArray &data);
     QList<QString> getOnlineUsers() const;
+    int onlineUserCount() const { return m_registry.count(); }
+
+    const ClientRegistry *registry() const { return &m_registry; }
+    // Inbound messages go to the handlers registered here, on the server's thread
+    MessageDispatcher *dispatcher() { return &m_dispatcher; }
+    BroadcastEngine *broadcastEngine() const { return m_broadcastEngine; }
+    // Sequence numbers and replay rings per user, server thread only
+    SessionLog *sessionLog() { return &m_sessionLog; }
+
+    // 0 keeps every connection on the server's own thread
+    void setWorkerThreads(int count) { m_workerThreads = qMax(0, count); }
+    int workerThreads() const { return m_workerThreads; }
+
+    // Settings below apply to workers created by the next startServer()
+    void setMaxFrameSize(int bytes) { m_settings.maxFrameSize = bytes; }
+    int maxFrameSize() const { return m_settings.maxFrameSize; }
+
+    // Watermarks and overflow limits of the per-client outbound queues
+    void setOutboundLimits(const OutboundLimits &limits) { m_settings.outboundLimits = limits; }
+    const OutboundLimits &outboundLimits() const { return m_settings.outboundLimits; }
+    QueueStatistics queueStatistics() const;
+
+    // Connections silent for this long are closed, 0 disables the reaper
+    void setIdleTimeout(int seconds) { m_settings.idleTimeoutSeconds = qMax(0, seconds); }
+    int idleTimeout() const { return m_settings.idleTimeoutSeconds; }
+    qint64 idleTimeouts() const;
+
+    // Socket backend of the workers, TRANSPORT_EPOLL falls back to Qt outside Linux
+    void setTransport(TransportType type) { m_settings.transport = type; }
+    TransportType transport() const { return m_settings.transport; }
+
+    // Text, file and offline batch bodies from this size on are compressed for
+    // clients that asked for it at login, 0 turns the capability off
+    void setCompressionThreshold(int bytes) { m_settings.compressionThreshold = qMax(0, bytes); }
+    int compressionThreshold() const { return m_settings.compressionThreshold; }
+    // Capability bits the server offers during login, batching and acks are always on
+    int capabilities() const;
+    CompressionStatistics compressionStatistics() const;
+
+    // Encrypts every connection with the loaded certificate. Handshakes run on
+    // the workers, so without setWorkerThreads() one per core is started.
+    void setTls(const TlsContext &tls) { m_settings.tls = tls; }
+    const TlsContext &tls() const { return m_settings.tls; }
+    TlsStatistics tlsStatistics() const;
+
+    // Inbound limits per connection. A connection over one is still served
+    // the message that crossed it, then its socket is not read until the
+    // bucket refills, so TCP pushes back on the sender.
+    void setRateLimits(const RateLimits &limits) { m_settings.rateLimits = limits; }
+    const RateLimits &rateLimits() const { return m_settings.rateLimits; }
+    RateLimitStatistics rateLimitStatistics() const;
 
 protected:
     void incomingConnection(qintptr socketDescriptor) override;
 
-private slots:
-    void onClientReadyRead();
-    void onClientDisconnected();
-    void onClientError(QAbstractSocket::SocketError error);
-
 private:
-    void handleMessage(QTcpSocket *socket, const QByteArray &data);
-    void registerClient(QTcpSocket *socket, const QString &userId);
-    void removeClient(QTcpSocket *socket);
+    void createWorkers();
+    int threadCount() const;
+    void destroyWorkers();
+    ServerWorker *pickWorker() const;
+    ServerWorker *workerOf(quint64 connectionId) const;
+    bool route(const ClientInfo &client, const QByteArray &data);
+    bool route(const ClientInfo &client, const QByteArray &prefix, const QByteArray &data, quint32 stream);
 
-    QMap<QString, ClientInfo*> m_clients;  // userId -> ClientInfo
-    QMap<QTcpSocket*, QString> m_socketToUserId;  // socket -> userId
+    ClientRegistry m_registry;
+    MessageDispatcher m_dispatcher;
+    SessionLog m_sessionLog;
+    BroadcastEngine *m_broadcastEngine;
+    QVector<ServerWorker*> m_workers;
+    QVector<QThread*> m_threads;
+    int m_workerThreads;
+    WorkerSettings m_settings;
     quint16 m_port;
 
 signals:
     void clientConnected(const QString &userId);
+    // Reconnected with a token, lastSequence is the last message the client saw
+    void clientResumed(const QString &userId, quint64 lastSequence);
     void clientDisconnected(const QString &userId);
-    void messageReceived(const QString &userId, int msgType, const QByteArray &data);
 };
 
 #endif // TCPSERVER_H
@@ -0,0 +1,98 @@
+#ifndef TEXTROUTER_H
+#define TEXTROUTER_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QString>
+#include "messagedispatcher.h"
+#include "databasemanager.h"
+#include "ackranges.h"
+
+class TcpServer;
+class AuthManager;
+class OfflineStore;
+class QThread;
+class QTimer;
+
+// Store-and-forward for MSG_TEXT. Online recipients get the message right
+// away, offline ones through the background OfflineStore. A reconnecting
+// user receives the backlog packed into a few MSG_OFFLINE_BATCH frames.
+// Every message to a logged-in user is numbered and kept in the user's
+// SessionLog ring, so a resumed session is caught up from memory.
+// Sessions that negotiated acks keep their messages undelivered until a
+// MSG_ACK retires them, in ranges, from the ring and the database.
+class TextRouter : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Body size a backlog frame is filled up to
+    static const int MAX_BATCH_FRAME = 60 * 1024;
+
+    explicit TextRouter(TcpServer *tcpServer, QObject *parent = nullptr);
+    ~TextRouter();
+
+    // Without persistence, messages to offline users are dropped
+    void startPersistence(const QString &host, int port, const QString &dbName,
+                          const QString &user, const QString &password);
+    void stopPersistence();
+    bool isPersistent() const { return m_store != nullptr; }
+    // Messages to ids it does not know are dropped, null accepts any recipient
+    void setAuthManager(AuthManager *authManager) { m_authManager = authManager; }
+
+    qint64 deliveredOnline() const { return m_deliveredOnline; }
+    qint64 queuedOffline() const { return m_queuedOffline; }
+    qint64 deliveredFromBacklog() const { return m_deliveredFromBacklog; }
+    qint64 droppedMessages() const { return m_dropped; }
+    qint64 unknownRecipients() const { return m_unknownRecipients; }
+    qint64 replayedMessages() const { return m_replayed; }
+    qint64 resumedFromMemory() const { return m_resumedFromMemory; }
+    qint64 resumedFromDatabase() const { return m_resumedFromDatabase; }
+    qint64 acknowledgedMessages() const { return m_acknowledged; }
+    qint64 spilledMessages() const { return m_spilled; }
+
+private slots:
+    void onClientConnected(const QString &userId);
+    void onClientResumed(const QString &userId, quint64 lastSequence);
+    void onClientDisconnected(const QString &userId);
+    void expireSessionLogs();
+    void onBacklogLoaded(const QString &userId, const QList<OfflineMessage> &messages);
+    void onBacklogFinished(const QString &userId, quint64 lastSequence);
+    void onMessagesSaved(int saved, int failed);
+    void flushOffline();
+
+private:
+    void onTextMessage(const MessageHeader &header, const FrameView &payload);
+    void onAck(const MessageHeader &header, const FrameView &payload);
+    void queueOffline(const OfflineMessage &message);
+    void persistSpilled();
+    void retire(const QString &userId, const AckRanges &ranges);
+    void loadBacklog(const QString &userId);
+    void sendBacklogFrame(const QString &userId, const QByteArray &entries, quint64 through);
+
+    TcpServer *m_tcpServer;
+    AuthManager *m_authManager;
+    QThread *m_storeThread;
+    OfflineStore *m_store;
+    QTimer *m_expiryTimer;
+
+    // Offline messages of one event loop pass, saved in one transaction
+    QList<OfflineMessage> m_pendingOffline;
+    bool m_flushScheduled;
+    // Floor of each acking user's ring while the backlog loads
+    QHash<QString, quint64> m_backlogFloor;
+
+    qint64 m_deliveredOnline;
+    qint64 m_queuedOffline;
+    qint64 m_deliveredFromBacklog;
+    qint64 m_dropped;
+    qint64 m_unknownRecipients;
+    qint64 m_replayed;
+    qint64 m_resumedFromMemory;
+    qint64 m_resumedFromDatabase;
+    qint64 m_acknowledged;
+    qint64 m_spilled;
+};
+
+#endif // TEXTROUTER_H
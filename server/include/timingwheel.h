@@ -0,0 +1,45 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Intrusive timer entry, embedded in the object it times out
+struct TimerNode {
+    TimerNode *prev;
+    TimerNode *next;
+    quint64 id;       // Reported back when the timer expires
+    int rounds;       // Full wheel turns left before expiry
+
+    TimerNode() : prev(nullptr), next(nullptr), id(0), rounds(0) {}
+    bool isArmed() const { return prev != nullptr; }
+};
+
+// Hashed timing wheel: arming, re-arming and cancelling are O(1) list
+// operations, and a tick only visits the entries hashed to one slot.
+// Not thread-safe, each worker drives its own wheel.
+class TimingWheel
+{
+public:
+    explicit TimingWheel(int slotCount = 512);
+
+    // Arms (or re-arms) the node to expire after the given number of ticks
+    void schedule(TimerNode *node, int ticks);
+    void cancel(TimerNode *node);
+
+    // Advances one tick and appends the ids of the timers that expired
+    void tick(QVector<quint64> &expired);
+
+    int count() const { return m_count; }
+    int slotCount() const { return m_slots.size(); }
+
+private:
+    void unlink(TimerNode *node);
+
+    QVector<TimerNode> m_slots;   // Sentinel heads of circular lists, never reallocated
+    int m_mask;
+    int m_cursor;
+    int m_count;
+};
+
+#endif // TIMINGWHEEL_H
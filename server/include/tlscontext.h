@@ -0,0 +1,50 @@
+#ifndef TLSCONTEXT_H
+#define TLSCONTEXT_H
+
+#include <QSharedPointer>
+#include <QSslConfiguration>
+#include <QString>
+
+class QSslSocket;
+class QSslContext;
+
+struct TlsStatistics {
+    qint64 handshakes;        // Completed, full or resumed
+    qint64 failedHandshakes;  // Closed before the handshake finished
+    qint64 handshakeNs;       // Accept to encrypted, summed over completed ones
+
+    TlsStatistics() : handshakes(0), failedHandshakes(0), handshakeNs(0) {}
+};
+
+// Server certificate and key for the TLS mode of the Qt transport. Loaded
+// once on the main thread, then copied into every worker and only read.
+//
+// QSslSocket builds an OpenSSL context per socket, and with it a session
+// cache and ticket keys nobody else knows, so no client could ever resume.
+// Built with CONFIG+=tls_resumption on Qt 5, all sockets share one context
+// instead: a session ID or ticket from any earlier connection, on any
+// worker, resumes without the certificate and key exchange of a full
+// handshake.
+class TlsContext
+{
+public:
+    TlsContext() : m_enabled(false) {}
+
+    // PEM files, the certificate file may hold the whole chain
+    bool load(const QString &certificatePath, const QString &keyPath, QString *error = nullptr);
+    bool isEnabled() const { return m_enabled; }
+    // Whether returning clients can skip the full handshake
+    bool resumesSessions() const;
+    const QSslConfiguration &configuration() const { return m_configuration; }
+
+    // Configures an adopted socket before startServerEncryption(),
+    // safe to call from any worker thread
+    void prepare(QSslSocket *socket) const;
+
+private:
+    QSslConfiguration m_configuration;
+    bool m_enabled;
+    QSharedPointer<QSslContext> m_context;
+};
+
+#endif // TLSCONTEXT_H
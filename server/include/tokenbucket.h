@@ -0,0 +1,57 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Rate and burst of one limit, a zero rate disables it
+struct RateLimit {
+    double rate;    // Tokens per second
+    double burst;   // Bucket size, what an idle client may send at once
+
+    RateLimit(double rate = 0, double burst = 0) : rate(rate), burst(qMax(burst, rate > 0 ? 1.0 : 0.0)) {}
+    bool isEnabled() const { return rate > 0; }
+};
+
+struct TypeRateLimit {
+    quint8 type;
+    RateLimit limit;
+
+    TypeRateLimit(quint8 type = 0, const RateLimit &limit = RateLimit()) : type(type), limit(limit) {}
+};
+
+// Inbound limits applied to every connection of a worker
+struct RateLimits {
+    static const int MAX_TYPE_LIMITS = 8;
+
+    RateLimit frames;               // Messages, each envelope entry counts
+    RateLimit bytes;                // Wire bytes
+    QVector<TypeRateLimit> types;   // Messages of one type, at most MAX_TYPE_LIMITS
+
+    bool isEnabled() const { return frames.isEnabled() || bytes.isEnabled() || !types.isEmpty(); }
+    // Index into 'types', -1 when the type is not limited
+    int indexOf(quint8 type) const;
+};
+
+// Token bucket that may go into debt: the message that empties it is still
+// handled, the connection then stops reading until the debt is paid back.
+// Buckets do not keep their limit, the caller passes the same one each time.
+class TokenBucket
+{
+public:
+    TokenBucket() : m_tokens(0), m_updatedMs(0), m_started(false) {}
+
+    // Takes 'amount' tokens, false when that left the bucket in debt
+    bool consume(const RateLimit &limit, double amount, qint64 nowMs);
+    // Milliseconds until the bucket is out of debt, 0 if it is not in debt
+    qint64 msUntilClear(const RateLimit &limit, qint64 nowMs) const;
+
+private:
+    double tokensAt(const RateLimit &limit, qint64 nowMs) const;
+
+    double m_tokens;
+    qint64 m_updatedMs;
+    bool m_started;     // A new bucket starts full
+};
+
+#endif // TOKENBUCKET_H
@@ -0,0 +1,61 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include "tlscontext.h"
+
+class QObject;
+struct Connection;
+
+enum TransportType {
+    TRANSPORT_QT = 0,       // QTcpSocket per connection, portable
+    TRANSPORT_EPOLL = 1     // Raw descriptors on an edge-triggered epoll set (Linux only)
+};
+
+// Callbacks from a transport into the worker that owns the connections.
+// Always invoked on the worker's thread.
+class TransportHandler
+{
+public:
+    virtual ~TransportHandler() {}
+
+    // New bytes were appended to conn->decoder
+    virtual void onConnectionReadable(Connection *conn) = 0;
+    // Pending write bytes went down, the backlog may be below the low watermark
+    virtual void onConnectionWritable(Connection *conn) = 0;
+    // The connection is gone, the transport no longer references it
+    virtual void onConnectionClosed(Connection *conn) = 0;
+};
+
+// Moves bytes between the sockets and the connections of one worker.
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    // Takes ownership of an accepted descriptor, fills in the peer address
+    virtual bool adopt(Connection *conn, qintptr socketDescriptor) = 0;
+    virtual void write(Connection *conn, const QByteArray &data) = 0;
+    // Bytes accepted by write() but not yet handed to the kernel
+    virtual qint64 pendingWriteBytes(const Connection *conn) const = 0;
+    // Aborts the connection, onConnectionClosed() is called before this returns
+    virtual void close(Connection *conn) = 0;
+    // Flushes what is pending and closes once the peer is done
+    virtual void closeGracefully(Connection *conn) = 0;
+    // Stops taking bytes from the socket, so the peer's TCP window fills up
+    // instead of our buffers; resuming delivers what arrived meanwhile
+    virtual void setReadPaused(Connection *conn, bool paused) = 0;
+
+    virtual const char *name() const = 0;
+    // Safe to call from any thread, all zero without TLS
+    virtual TlsStatistics tlsStatistics() const { return TlsStatistics(); }
+};
+
+// Falls back to the Qt transport where epoll is not available, and for TLS,
+// which only the Qt transport speaks. The returned object is parented to
+// 'parent' so it follows its thread.
+Transport *createTransport(TransportType type, const TlsContext &tls, TransportHandler *handler,
+                           QObject *parent);
+
+#endif // TRANSPORT_H
@@ -3,8 +3,13 @@
 
 #include <QObject>
 #include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QVector>
 #include <QString>
 #include <QByteArray>
+#include <QTimer>
+#include "messagedispatcher.h"
 
 enum CallStatus {
     CALL_IDLE = 0,
@@ -22,15 +27,69 @@ struct CallSession {
     bool isVideoCall;
     qint64 startTime;
     qint64 endTime;
+    quint32 relaySessionId;   // 0 without a UDP relay
+    QByteArray relayKey;
+    SessionHandle callerSession;  // Media routes of the active call, see VideoCallServer::forwardMedia
+    SessionHandle calleeSession;
+};
+
+// MSG_ROOM subtypes, the byte following the message type
+enum RoomFrameType {
+    ROOM_JOIN = 0,        // [RoomId] from a client, [RoomId][UserId] to the other members
+    ROOM_LEAVE = 1,       // Empty from a client, [RoomId][UserId] to the other members
+    ROOM_SUBSCRIBE = 2,   // [All (1 byte)][Count][PublisherId x Count]
+    ROOM_ERROR = 3,       // [RoomId][Reason]
+    ROOM_MEMBERS = 4      // [RoomId][Count][UserId x Count], the members a joiner finds
+};
+
+struct RoomMember {
+    QString userId;
+    QString roomId;
+    SessionHandle session;
+    quint32 stream;             // Outbound queue stream of this member's media at its subscribers
+    QByteArray mediaHeader;     // [0x10][RoomId][UserId], shared by every packet it publishes
+    bool subscribeAll;          // Until the member sends ROOM_SUBSCRIBE
+    QSet<QString> subscriptions;
+    QVector<SessionHandle> subscribers;   // Members receiving this one's media, rebuilt on changes
+
+    RoomMember() : session(INVALID_SESSION), stream(0), subscribeAll(true) {}
+};
+
+class AudioMixer;
+
+struct Room {
+    QString roomId;
+    QHash<QString, RoomMember*> members;   // userId -> member
+    AudioMixer *mixer;          // From the first MSG_ROOM_AUDIO frame on, every member listens
+    QByteArray audioHeader;     // [0x11][RoomId]
+
+    Room() : mixer(nullptr) {}
+};
+
+struct RoomStatistics {
+    int rooms;
+    int members;
+    qint64 mediaPackets;    // Published by members
+    qint64 mediaSends;      // Queued for subscribers
+    qint64 audioFrames;     // PCM frames taken by a mixer
+    qint64 audioDropped;    // Wrong size, or pushed out by newer frames of the same member
+    qint64 mixedFrames;     // Mixed frames sent to listeners
+
+    RoomStatistics()
+        : rooms(0), members(0), mediaPackets(0), mediaSends(0)
+        , audioFrames(0), audioDropped(0), mixedFrames(0) {}
 };
 
 class TcpServer;
+class MediaRelay;
 
 class VideoCallServer : public QObject
 {
     Q_OBJECT
 
 public:
+    static const int MAX_ROOM_MEMBERS = 50;
+
     explicit VideoCallServer(TcpServer *tcpServer, QObject *parent = nullptr);
     ~VideoCallServer();
 
@@ -40,28 +99,89 @@ public:
     bool rejectCall(const QString &callId, const QString &reason);
     bool endCall(const QString &callId);
     
+    // Accepted calls get a UDP relay session from here on, null keeps media on TCP
+    void setMediaRelay(MediaRelay *relay) { m_mediaRelay = relay; }
+    MediaRelay *mediaRelay() const { return m_mediaRelay; }
+
     // Media relay methods
     void relayMediaData(const QString &callId, const QString &fromUser, const QByteArray &mediaData);
+    // Fast path for media from one side of an active call: one lookup by
+    // session, the header encoded when the call was accepted and the payload
+    // queued as-is. False if the session has no route or the peer's is stale.
+    bool forwardMedia(SessionHandle from, const QByteArray &mediaData);
     
     // Query methods
     CallSession* getCallSession(const QString &callId);
     QList<CallSession*> getActiveCalls() const;
     bool isUserInCall(const QString &userId) const;
 
+    // Rooms: multi-party calls where every member publishes one stream and
+    // picks which of the others it receives. Joining a room leaves the
+    // previous one, the last member to leave closes it.
+    bool joinRoom(const QString &roomId, const QString &userId, SessionHandle session);
+    void leaveRoom(const QString &userId);
+    void subscribe(const QString &userId, bool all, const QSet<QString> &publishers);
+    // Queues the media for every subscriber of the publisher. Each gets the
+    // same header and payload buffers, the payload is not copied per send.
+    int publishRoomMedia(SessionHandle from, const QByteArray &mediaData);
+    // Audio rooms: the server mixes and sends each member one frame per
+    // tick. Only 10 and 20 ms are valid, rooms already mixing keep theirs.
+    bool setAudioFrameMs(int frameMs);
+    int audioFrameMs() const { return m_audioFrameMs; }
+    Room *getRoom(const QString &roomId) const { return m_rooms.value(roomId, nullptr); }
+    RoomStatistics roomStatistics() const;
+
 private slots:
-    void onMessageReceived(const QString &userId, int msgType, const QByteArray &data);
     void onClientDisconnected(const QString &userId);
 
 private:
+    // Dispatcher handlers, one per call message type
+    void onCallRequest(const MessageHeader &header, const FrameView &payload);
+    void onCallAccept(const MessageHeader &header, const FrameView &payload);
+    void onCallReject(const MessageHeader &header, const FrameView &payload);
+    void onCallEnd(const MessageHeader &header, const FrameView &payload);
+    void onMediaData(const MessageHeader &header, const FrameView &payload);
+    void onRoom(const MessageHeader &header, const FrameView &payload);
+    void onRoomMedia(const MessageHeader &header, const FrameView &payload);
+    void onRoomAudio(const MessageHeader &header, const FrameView &payload);
+    void onMixTick();
+
     QString generateCallId();
     void sendCallRequest(const QString &callee, const CallSession &session);
-    void sendCallResponse(const QString &userId, const QString &callId, bool accepted, const QString &reason);
+    void sendCallResponse(const QString &userId, const QString &callId, bool accepted, const QString &reason,
+                          const CallSession *session = nullptr, quint8 party = 0);
     void notifyCallEnd(const CallSession &session);
     void cleanupCall(const QString &callId);
 
+    struct MediaRoute {
+        SessionHandle to;
+        QByteArray header;    // [0x06][CallId], shared by every packet of the call
+    };
+
+    void addMediaRoutes(CallSession *session);
+    void removeMediaRoutes(const CallSession &session);
+
+    void rebuildSubscribers(Room *room);
+    void sendRoomMembers(const Room &room, const QString &userId, SessionHandle session);
+    void sendRoomEvent(const Room &room, quint8 event, const QString &userId);
+    void sendRoomError(const QString &userId, const QString &roomId, const QString &reason);
+
     TcpServer *m_tcpServer;
+    MediaRelay *m_mediaRelay;
+    QHash<SessionHandle, MediaRoute> m_mediaRoutes;   // Sender session -> recipient
     QMap<QString, CallSession*> m_callSessions;  // callId -> CallSession
     QMap<QString, QString> m_userToCallId;       // userId -> callId (for active calls)
+    QHash<QString, Room*> m_rooms;               // roomId -> Room
+    QHash<QString, RoomMember*> m_roomMembers;   // userId -> its member entry
+    QHash<SessionHandle, RoomMember*> m_roomPublishers;   // Media sender session -> member
+    quint32 m_nextStreamId;
+    qint64 m_roomMediaPackets;
+    qint64 m_roomMediaSends;
+    QTimer m_mixTimer;          // Runs while any mixer has audio
+    int m_audioFrameMs;
+    qint64 m_audioFrames;
+    qint64 m_audioDropped;
+    qint64 m_mixedFrames;
 
 signals:
     void callInitiated(const QString &callId, const QString &caller, const QString &callee);
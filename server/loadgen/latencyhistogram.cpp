@@ -0,0 +1,78 @@
+#include "latencyhistogram.h"
+#include <cmath>
+
+namespace {
+    const int SUB_BITS = 5;
+    const int SUB_COUNT = 1 << SUB_BITS;
+    // Up to 2^40 us, about 12 days
+    const int MAX_SHIFT = 40 - SUB_BITS;
+    const int BUCKET_COUNT = (MAX_SHIFT + 2) * SUB_COUNT;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : m_buckets(BUCKET_COUNT, 0), m_count(0), m_sum(0), m_max(0)
+{
+}
+
+int LatencyHistogram::indexOf(qint64 micros)
+{
+    if (micros < 2 * SUB_COUNT) {
+        return static_cast<int>(qMax<qint64>(0, micros));
+    }
+
+    int msb = 0;
+    for (quint64 v = static_cast<quint64>(micros); v > 1; v >>= 1) {
+        ++msb;
+    }
+    int shift = qMin(msb - SUB_BITS, MAX_SHIFT);
+    int sub = static_cast<int>(qMin<qint64>(micros >> shift, 2 * SUB_COUNT - 1)) - SUB_COUNT;
+    return (shift + 1) * SUB_COUNT + sub;
+}
+
+qint64 LatencyHistogram::valueOf(int index)
+{
+    if (index < 2 * SUB_COUNT) {
+        return index;
+    }
+
+    // Middle of the bucket
+    int shift = index / SUB_COUNT - 1;
+    qint64 sub = index % SUB_COUNT + SUB_COUNT;
+    return (sub << shift) + ((Q_INT64_C(1) << shift) >> 1);
+}
+
+void LatencyHistogram::record(qint64 micros)
+{
+    micros = qMax<qint64>(0, micros);
+    ++m_buckets[indexOf(micros)];
+    ++m_count;
+    m_sum += micros;
+    m_max = qMax(m_max, micros);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        m_buckets[i] += other.m_buckets.at(i);
+    }
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_max = qMax(m_max, other.m_max);
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+
+    qint64 target = qMax<qint64>(1, static_cast<qint64>(std::ceil(p * m_count)));
+    qint64 seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += m_buckets.at(i);
+        if (seen >= target) {
+            return qMin(valueOf(i), m_max);
+        }
+    }
+    return m_max;
+}
@@ -0,0 +1,35 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Log-linear histogram of latencies in microseconds: exact below 64 us, then
+// 32 buckets per power of two (about 3% error). Fixed size whatever the
+// number of samples, not thread-safe; each load worker keeps its own and
+// they are merged at the end.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 micros);
+    void merge(const LatencyHistogram &other);
+
+    qint64 count() const { return m_count; }
+    qint64 max() const { return m_max; }
+    double mean() const { return m_count > 0 ? static_cast<double>(m_sum) / m_count : 0; }
+    // p in [0, 1], e.g. 0.999
+    qint64 percentile(double p) const;
+
+private:
+    static int indexOf(qint64 micros);
+    static qint64 valueOf(int index);
+
+    QVector<qint64> m_buckets;
+    qint64 m_count;
+    qint64 m_sum;
+    qint64 m_max;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,491 @@
+#include "loadclient.h"
+#include "tcpserver.h"
+#include "wirecodec.h"
+#include "framecompression.h"
+#include "batchenvelope.h"
+#include "framebatcher.h"
+#include <QRandomGenerator>
+#include <QUdpSocket>
+#include <QtEndian>
+
+namespace {
+    const qint64 NS_PER_SECOND = Q_INT64_C(1000000000);
+    // Unanswered call requests are given up after this long
+    const qint64 CALL_TIMEOUT_NS = 5 * NS_PER_SECOND;
+    // Below the server's default idle timeout of 90 s
+    const qint64 HEARTBEAT_NS = 30 * NS_PER_SECOND;
+    // Relay hellos are repeated this often until one comes back
+    const qint64 HELLO_RETRY_NS = NS_PER_SECOND / 5;
+}
+
+LoadClient::LoadClient(int index, LoadShared *shared, LatencyHistogram *histograms, QObject *parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_shared(shared)
+    , m_histograms(histograms)
+    , m_socket(new QTcpSocket(this))
+    , m_batcher(nullptr)
+    , m_state(Idle)
+    , m_registered(false)
+    , m_reconnect(false)
+    , m_authSentNs(0)
+    , m_lastSendNs(0)
+    , m_callState(NoCall)
+    , m_caller(false)
+    , m_callRequestedNs(0)
+    , m_callEndsNs(0)
+    , m_nextMediaNs(0)
+    , m_udp(nullptr)
+    , m_relayPort(0)
+    , m_relaySession(0)
+    , m_party(0)
+    , m_udpSequence(0)
+    , m_udpReady(false)
+    , m_helloSentNs(0)
+{
+    m_username = QString("load-%1-%2").arg(m_shared->config.runId).arg(index);
+
+    if (m_shared->config.capabilities & BatchEnvelope::CAPABILITY_BATCH) {
+        m_batcher = new FrameBatcher(m_socket, this);
+    }
+
+    connect(m_socket, &QTcpSocket::connected, this, &LoadClient::onConnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &LoadClient::onReadyRead);
+    connect(m_socket, &QTcpSocket::disconnected, this, &LoadClient::onDisconnected);
+    connect(m_socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+            this, &LoadClient::onError);
+}
+
+void LoadClient::start()
+{
+    connectToServer();
+}
+
+void LoadClient::stop()
+{
+    m_reconnect = false;
+    m_socket->abort();
+}
+
+void LoadClient::connectToServer()
+{
+    m_state = Connecting;
+    m_decoder.clear();
+    m_socket->connectToHost(m_shared->config.host, m_shared->config.port);
+}
+
+void LoadClient::relogin()
+{
+    // Disconnecting also ends a half-open call on the server side
+    m_reconnect = true;
+    m_socket->disconnectFromHost();
+}
+
+void LoadClient::onConnected()
+{
+    m_shared->counters.connected.ref();
+    m_state = LoggingIn;
+    if (m_batcher) {
+        m_batcher->clear();
+        m_batcher->setEnvelopeEnabled(false);
+    }
+    // The first connection registers the account, reconnects log in
+    sendAuth(m_registered ? MSG_LOGIN_REQUEST : MSG_REGISTER_REQUEST);
+}
+
+void LoadClient::onDisconnected()
+{
+    if (m_state == Ready) {
+        m_shared->peers.clear(m_index);
+        m_shared->counters.online.deref();
+        m_shared->counters.disconnects.ref();
+    }
+    resetCall();
+    m_state = Idle;
+
+    if (m_reconnect) {
+        m_reconnect = false;
+        connectToServer();
+    }
+}
+
+void LoadClient::onError(QAbstractSocket::SocketError error)
+{
+    Q_UNUSED(error);
+    if (m_state == Connecting) {
+        m_shared->counters.connectFailures.ref();
+        m_state = Idle;
+    }
+}
+
+void LoadClient::sendAuth(quint8 type)
+{
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(type)
+        .writeString(m_username)
+        .writeString(QStringLiteral("load-password"))
+        .writeByte(static_cast<quint8>(m_shared->config.capabilities));
+
+    m_authSentNs = m_shared->nowNs();
+    send(message);
+    if (m_batcher) {
+        m_batcher->flush();
+    }
+}
+
+void LoadClient::act()
+{
+    const LoadConfig &config = m_shared->config;
+    int total = config.textWeight + config.callWeight + config.reloginWeight;
+    if (total <= 0 || m_state != Ready) {
+        return;
+    }
+
+    int roll = QRandomGenerator::global()->bounded(total);
+    if (roll < config.textWeight) {
+        sendText();
+    } else if (roll < config.textWeight + config.callWeight) {
+        if (m_callState == NoCall) {
+            requestCall();
+        }
+    } else if (m_callState == NoCall) {
+        relogin();
+    }
+}
+
+void LoadClient::sendText()
+{
+    QString recipient = m_shared->peers.pick(m_index);
+    if (recipient.isEmpty()) {
+        return;
+    }
+
+    // "<send time ns> xxx...", the recipient parses the leading number
+    QByteArray text = QByteArray::number(m_shared->nowNs());
+    text.append(' ');
+    if (text.size() < m_shared->config.textSize) {
+        text.append(QByteArray(m_shared->config.textSize - text.size(), 'x'));
+    }
+
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_TEXT)
+        .writeString(recipient)
+        .writeUtf8(text);
+    send(message);
+    m_shared->counters.textSent.ref();
+}
+
+void LoadClient::requestCall()
+{
+    QString callee = m_shared->peers.pick(m_index);
+    if (callee.isEmpty()) {
+        return;
+    }
+
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_CALL_REQUEST)
+        .writeString(callee)
+        .writeByte(1);
+    send(message);
+
+    m_callState = CallRequested;
+    m_caller = true;
+    m_callRequestedNs = m_shared->nowNs();
+    m_shared->counters.callsRequested.ref();
+}
+
+void LoadClient::sendMedia(qint64 now)
+{
+    // [0x06][Send time (8 bytes, big-endian)][Filler], the server prepends the callId
+    QByteArray message(1 + 8 + qMax(0, m_shared->config.mediaSize - 8), '\0');
+    message[0] = static_cast<char>(MSG_MEDIA_DATA);
+    qToBigEndian<qint64>(now, reinterpret_cast<uchar*>(message.data() + 1));
+    if (m_udpReady) {
+        // Same body without the type byte, the relay knows the call by session
+        sendDatagram(message.constData() + 1, message.size() - 1);
+        m_shared->counters.mediaSentUdp.ref();
+    } else {
+        send(message);
+    }
+    m_shared->counters.mediaSent.ref();
+}
+
+void LoadClient::sendDatagram(const char *media, int size)
+{
+    QByteArray packet = MediaPacket::seal(m_relaySession, m_party, ++m_udpSequence, m_relayKey, media, size);
+    m_udp->writeDatagram(packet, m_socket->peerAddress(), m_relayPort);
+}
+
+void LoadClient::readRelay(WireReader &reader, qint64 now)
+{
+    // [RelayPort][SessionId][Key][Party] after the callId, absent without a relay
+    quint64 port = 0;
+    quint64 session = 0;
+    WireView key;
+    quint8 party = 0;
+    if (!m_shared->config.udpMedia || reader.atEnd() || !reader.readVarint(port) || !reader.readVarint(session)
+            || !reader.readBytes(key) || !reader.readByte(party) || port == 0 || port > 0xFFFF) {
+        return;
+    }
+
+    if (!m_udp) {
+        m_udp = new QUdpSocket(this);
+        connect(m_udp, &QUdpSocket::readyRead, this, &LoadClient::onDatagrams);
+        m_udp->bind();
+    }
+    m_relayPort = static_cast<quint16>(port);
+    m_relaySession = static_cast<quint32>(session);
+    m_relayKey = key.rawData();
+    m_relayKey.detach();
+    m_party = party;
+    m_udpSequence = 0;
+    m_udpReady = false;
+    m_peerWindow.reset();
+    // Media goes over TCP until the hello comes back
+    sendDatagram(nullptr, 0);
+    m_helloSentNs = now;
+}
+
+void LoadClient::onDatagrams()
+{
+    QByteArray datagram;
+    while (m_udp->hasPendingDatagrams()) {
+        datagram.resize(qMax<qint64>(0, m_udp->pendingDatagramSize()));
+        qint64 size = m_udp->readDatagram(datagram.data(), datagram.size());
+        MediaPacket packet;
+        if (size < 0 || m_relayPort == 0 || !MediaPacket::parse(datagram.constData(), static_cast<int>(size), packet)
+                || packet.sessionId != m_relaySession
+                || !MediaPacket::verify(datagram.constData(), static_cast<int>(size), m_relayKey)) {
+            continue;
+        }
+
+        if (packet.party == m_party) {
+            m_udpReady = m_udpReady || packet.mediaSize == 0;
+        } else if (m_peerWindow.accept(packet.sequence)) {
+            if (packet.mediaSize >= 8) {
+                record(LATENCY_MEDIA, qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(packet.media)));
+            }
+            m_shared->counters.mediaReceived.ref();
+            m_shared->counters.mediaReceivedUdp.ref();
+        }
+    }
+}
+
+void LoadClient::tick(qint64 now)
+{
+    if (m_state != Ready) {
+        return;
+    }
+
+    if (m_callState == CallRequested && now - m_callRequestedNs > CALL_TIMEOUT_NS) {
+        // Busy or vanished callee; the server keeps the request open, reconnecting clears it
+        m_shared->counters.callsFailed.ref();
+        relogin();
+        return;
+    }
+
+    if (m_callState == CallActive) {
+        if (m_caller && now >= m_callEndsNs) {
+            QByteArray message;
+            WireWriter(message)
+                .writeByte(MSG_CALL_END)
+                .writeString(m_callId);
+            send(message);
+        } else if (now >= m_nextMediaNs) {
+            sendMedia(now);
+            m_nextMediaNs += NS_PER_SECOND / qMax(1, m_shared->config.mediaFps);
+        }
+        if (m_relayPort != 0 && !m_udpReady && now - m_helloSentNs > HELLO_RETRY_NS) {
+            sendDatagram(nullptr, 0);
+            m_helloSentNs = now;
+        }
+    }
+
+    if (now - m_lastSendNs > HEARTBEAT_NS) {
+        send(QByteArray(1, static_cast<char>(MSG_HEARTBEAT)));
+    }
+}
+
+void LoadClient::send(const QByteArray &body)
+{
+    m_lastSendNs = m_shared->nowNs();
+    m_shared->counters.framesSent.ref();
+    if (m_batcher) {
+        m_batcher->send(body);
+    } else {
+        m_socket->write(FrameDecoder::encode(body));
+    }
+}
+
+void LoadClient::onReadyRead()
+{
+    m_decoder.readFrom(m_socket);
+
+    FrameView frame;
+    FrameDecoder::Status status;
+    while ((status = m_decoder.next(frame)) == FrameDecoder::FrameReady) {
+        handleFrame(frame);
+    }
+
+    if (status == FrameDecoder::FrameTooLarge) {
+        m_socket->abort();
+    }
+}
+
+void LoadClient::handleFrame(const FrameView &received)
+{
+    if (received.size <= 0) return;
+    m_shared->counters.framesReceived.ref();
+
+    FrameView frame = received;
+    QByteArray inflated;
+    if (FrameCompression::isCompressed(static_cast<quint8>(received.data[0]))) {
+        if (!FrameCompression::decompress(received.data, received.size, m_decoder.maxFrameSize(), inflated)) {
+            return;
+        }
+        frame.data = inflated.constData();
+        frame.size = inflated.size();
+    }
+
+    WireReader reader(frame);
+    quint8 type = 0;
+    reader.readByte(type);
+    qint64 now = m_shared->nowNs();
+
+    switch (type) {
+    case MSG_BATCH: {
+        BatchReader batch(frame);
+        FrameView entry;
+        while (batch.next(entry)) {
+            handleFrame(entry);
+        }
+        break;
+    }
+    case MSG_AUTH_RESPONSE:
+        onAuthResponse(reader);
+        break;
+    case MSG_TEXT: {
+        // [0x00][SenderId][Text]
+        WireView sender;
+        WireView text;
+        if (reader.readBytes(sender) && reader.readBytes(text)) {
+            int space = text.rawData().indexOf(' ');
+            bool ok = false;
+            qint64 sentNs = text.rawData().left(space).toLongLong(&ok);
+            if (ok) {
+                record(LATENCY_TEXT, sentNs);
+            }
+            m_shared->counters.textReceived.ref();
+        }
+        break;
+    }
+    case MSG_CALL_REQUEST: {
+        // [0x02][CallId][CallerId][IsVideo], answered right away
+        QString callId;
+        if (!reader.readString(callId)) break;
+        QByteArray message;
+        WireWriter writer(message);
+        if (m_callState == NoCall) {
+            writer.writeByte(MSG_CALL_ACCEPT).writeString(callId);
+            m_callState = CallRinging;
+            m_caller = false;
+            m_callId = callId;
+        } else {
+            writer.writeByte(MSG_CALL_REJECT).writeString(callId).writeString(QStringLiteral("busy"));
+        }
+        send(message);
+        break;
+    }
+    case MSG_CALL_ACCEPT: {
+        // [0x03][CallId] and the UDP relay, if any, sent to both sides
+        QString callId;
+        if (!reader.readString(callId)) break;
+        readRelay(reader, now);
+        if (m_caller && m_callState == CallRequested) {
+            record(LATENCY_CALL_SETUP, m_callRequestedNs);
+            m_shared->counters.callsEstablished.ref();
+            m_shared->counters.activeCalls.ref();
+            m_callEndsNs = now + m_shared->config.callSeconds * NS_PER_SECOND;
+        }
+        m_callId = callId;
+        m_callState = CallActive;
+        m_nextMediaNs = now;
+        break;
+    }
+    case MSG_CALL_REJECT:
+    case MSG_CALL_END: {
+        // [0x04 | 0x05][CallId]...; a caller learns its callId only with the accept
+        QString callId;
+        if (!reader.readString(callId) || (!m_callId.isEmpty() && callId != m_callId)) break;
+        if (type == MSG_CALL_REJECT && m_caller && m_callState == CallRequested) {
+            m_shared->counters.callsFailed.ref();
+        }
+        resetCall();
+        break;
+    }
+    case MSG_MEDIA_DATA: {
+        // [0x06][CallId][Send time (8 bytes)][Filler]
+        WireView callId;
+        if (reader.readBytes(callId)) {
+            WireView media = reader.remaining();
+            if (media.size >= 8) {
+                record(LATENCY_MEDIA, qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(media.data)));
+            }
+            m_shared->counters.mediaReceived.ref();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void LoadClient::onAuthResponse(WireReader &reader)
+{
+    // [0x0A][Success] then [Token][UserId][Capabilities] or [Error]
+    quint8 success = 0;
+    QString token;
+    QString userId;
+    if (!reader.readByte(success) || !success || !reader.readString(token) || !reader.readString(userId)) {
+        m_shared->counters.loginFailures.ref();
+        m_socket->disconnectFromHost();
+        return;
+    }
+
+    quint8 capabilities = 0;
+    if (!reader.atEnd()) {
+        reader.readByte(capabilities);
+    }
+    if (m_batcher) {
+        m_batcher->setEnvelopeEnabled((capabilities & BatchEnvelope::CAPABILITY_BATCH) != 0);
+    }
+
+    record(LATENCY_LOGIN, m_authSentNs);
+    m_registered = true;
+    m_userId = userId;
+    m_state = Ready;
+    m_shared->peers.set(m_index, userId);
+    m_shared->counters.loggedIn.ref();
+    m_shared->counters.online.ref();
+}
+
+void LoadClient::resetCall()
+{
+    if (m_caller && m_callState == CallActive) {
+        m_shared->counters.activeCalls.deref();
+        m_shared->counters.callsEnded.ref();
+    }
+    m_callState = NoCall;
+    m_caller = false;
+    m_callId.clear();
+    m_relayPort = 0;
+    m_udpReady = false;
+}
+
+void LoadClient::record(LatencyKind kind, qint64 sentNs)
+{
+    m_histograms[kind].record((m_shared->nowNs() - sentNs) / 1000);
+}
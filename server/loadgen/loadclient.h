@@ -0,0 +1,94 @@
+#ifndef LOADCLIENT_H
+#define LOADCLIENT_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include "framedecoder.h"
+#include "mediapacket.h"
+#include "loadshared.h"
+#include "latencyhistogram.h"
+
+class FrameBatcher;
+class QUdpSocket;
+class WireReader;
+
+// One simulated user: registers, then texts, calls and streams media as the
+// worker tells it to. Lives on its worker's thread.
+class LoadClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadClient(int index, LoadShared *shared, LatencyHistogram *histograms, QObject *parent = nullptr);
+
+    void start();
+    void stop();
+
+    bool isReady() const { return m_state == Ready; }
+    bool isIdle() const { return m_state == Idle; }
+
+    // One action picked from the configured mix
+    void act();
+    // Media frame while a call is up, call teardown and timeouts
+    void tick(qint64 now);
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onDisconnected();
+    void onError(QAbstractSocket::SocketError error);
+    void onDatagrams();
+
+private:
+    enum State { Idle, Connecting, LoggingIn, Ready };
+    enum CallState { NoCall, CallRequested, CallRinging, CallActive };
+
+    void connectToServer();
+    void relogin();
+    void sendAuth(quint8 type);
+    void sendText();
+    void requestCall();
+    void sendMedia(qint64 now);
+    void sendDatagram(const char *media, int size);
+    void send(const QByteArray &body);
+
+    void handleFrame(const FrameView &frame);
+    void onAuthResponse(WireReader &reader);
+    void readRelay(WireReader &reader, qint64 now);
+    void resetCall();
+    void record(LatencyKind kind, qint64 sentNs);
+
+    int m_index;
+    LoadShared *m_shared;
+    LatencyHistogram *m_histograms;   // LATENCY_KIND_COUNT entries, owned by the worker
+    QTcpSocket *m_socket;
+    FrameBatcher *m_batcher;          // Only with CAPABILITY_BATCH
+    FrameDecoder m_decoder;
+    State m_state;
+    bool m_registered;
+    bool m_reconnect;
+    QString m_username;
+    QString m_userId;
+    qint64 m_authSentNs;
+    qint64 m_lastSendNs;
+
+    CallState m_callState;
+    bool m_caller;
+    QString m_callId;
+    qint64 m_callRequestedNs;
+    qint64 m_callEndsNs;
+    qint64 m_nextMediaNs;
+
+    // UDP relay of the current call, see MediaPacket
+    QUdpSocket *m_udp;                // Created with the first relayed call
+    quint16 m_relayPort;              // 0 while media goes over TCP
+    quint32 m_relaySession;
+    QByteArray m_relayKey;
+    quint8 m_party;
+    quint32 m_udpSequence;
+    bool m_udpReady;                  // The relay echoed our hello
+    qint64 m_helloSentNs;
+    ReplayWindow m_peerWindow;
+};
+
+#endif // LOADCLIENT_H
@@ -0,0 +1,252 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QTimer>
+#include <QDateTime>
+#include <QDebug>
+#include <cstdio>
+#include "loadshared.h"
+#include "loadworker.h"
+#include "framecompression.h"
+#include "batchenvelope.h"
+
+// Counter values at one point in time, rates are differences of two snapshots
+struct LoadSnapshot {
+    qint64 ns;
+    qint64 connected;
+    qint64 framesSent;
+    qint64 framesReceived;
+    qint64 textReceived;
+    qint64 mediaReceived;
+    qint64 callsEstablished;
+
+    static LoadSnapshot take(const LoadShared &shared)
+    {
+        LoadSnapshot s;
+        s.ns = shared.nowNs();
+        s.connected = shared.counters.connected.load();
+        s.framesSent = shared.counters.framesSent.load();
+        s.framesReceived = shared.counters.framesReceived.load();
+        s.textReceived = shared.counters.textReceived.load();
+        s.mediaReceived = shared.counters.mediaReceived.load();
+        s.callsEstablished = shared.counters.callsEstablished.load();
+        return s;
+    }
+};
+
+static double perSecond(qint64 count, qint64 ns)
+{
+    return ns > 0 ? count * 1e9 / ns : 0;
+}
+
+static void printLatency(const char *label, const LatencyHistogram &histogram)
+{
+    if (histogram.count() == 0) {
+        printf("%-12s %10s\n", label, "-");
+        return;
+    }
+    printf("%-12s %10lld %10.0f %10lld %10lld %10lld %10lld\n", label,
+           static_cast<long long>(histogram.count()), histogram.mean(),
+           static_cast<long long>(histogram.percentile(0.50)),
+           static_cast<long long>(histogram.percentile(0.99)),
+           static_cast<long long>(histogram.percentile(0.999)),
+           static_cast<long long>(histogram.max()));
+}
+
+static bool parseMix(const QString &mix, LoadConfig &config)
+{
+    // "text:90,call:5,relogin:5"
+    config.textWeight = config.callWeight = config.reloginWeight = 0;
+    for (const QString &part : mix.split(',', QString::SkipEmptyParts)) {
+        QStringList pair = part.split(':');
+        bool ok = false;
+        int weight = (pair.size() == 2) ? pair.at(1).toInt(&ok) : 0;
+        if (!ok || weight < 0) {
+            return false;
+        }
+        if (pair.at(0) == "text") {
+            config.textWeight = weight;
+        } else if (pair.at(0) == "call") {
+            config.callWeight = weight;
+        } else if (pair.at(0) == "relogin") {
+            config.reloginWeight = weight;
+        } else {
+            return false;
+        }
+    }
+    return config.textWeight + config.callWeight + config.reloginWeight > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("WeCompany Load Generator");
+    app.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Simulates many concurrent WeCompany clients against one server");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption hostOption("host", "Server address (default: 127.0.0.1)", "host", "127.0.0.1");
+    QCommandLineOption portOption(QStringList() << "p" << "port", "Server port (default: 8888)", "port", "8888");
+    QCommandLineOption clientsOption(QStringList() << "c" << "clients", "Simulated clients (default: 1000)", "count", "1000");
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads", "Client threads (default: 4)", "count", "4");
+    QCommandLineOption connectRateOption("connect-rate", "New connections per second during ramp-up (default: 1000)", "rate", "1000");
+    QCommandLineOption durationOption(QStringList() << "d" << "duration", "Seconds of load after ramp-up (default: 30)", "seconds", "30");
+    QCommandLineOption rateOption("rate", "Actions per client per second (default: 1)", "rate", "1");
+    QCommandLineOption mixOption("mix", "Action weights (default: text:90,call:5,relogin:5)", "mix", "text:90,call:5,relogin:5");
+    QCommandLineOption textSizeOption("text-size", "Text message bytes (default: 64)", "bytes", "64");
+    QCommandLineOption mediaSizeOption("media-size", "Media frame bytes (default: 960)", "bytes", "960");
+    QCommandLineOption mediaFpsOption("media-fps", "Media frames per second per call side (default: 50)", "fps", "50");
+    QCommandLineOption callSecondsOption("call-seconds", "Call length before teardown (default: 10)", "seconds", "10");
+    QCommandLineOption compressOption("compress", "Ask the server for frame compression");
+    QCommandLineOption batchOption("batch", "Send and accept MSG_BATCH envelopes");
+    QCommandLineOption udpMediaOption("udp-media", "Send call media through the server's UDP relay when it offers one");
+    parser.addOptions(QList<QCommandLineOption>() << hostOption << portOption << clientsOption << threadsOption
+                      << connectRateOption << durationOption << rateOption << mixOption << textSizeOption
+                      << mediaSizeOption << mediaFpsOption << callSecondsOption << compressOption << batchOption
+                      << udpMediaOption);
+    parser.process(app);
+
+    LoadConfig config;
+    config.host = parser.value(hostOption);
+    config.port = parser.value(portOption).toUShort();
+    config.clients = parser.value(clientsOption).toInt();
+    config.threads = qMax(1, parser.value(threadsOption).toInt());
+    config.connectRate = qMax(1, parser.value(connectRateOption).toInt());
+    config.duration = qMax(1, parser.value(durationOption).toInt());
+    config.actionRate = parser.value(rateOption).toDouble();
+    config.textSize = parser.value(textSizeOption).toInt();
+    config.mediaSize = parser.value(mediaSizeOption).toInt();
+    config.mediaFps = qMax(1, parser.value(mediaFpsOption).toInt());
+    config.callSeconds = qMax(1, parser.value(callSecondsOption).toInt());
+    if (parser.isSet(compressOption)) {
+        config.capabilities |= FrameCompression::CAPABILITY_COMPRESSION;
+    }
+    if (parser.isSet(batchOption)) {
+        config.capabilities |= BatchEnvelope::CAPABILITY_BATCH;
+    }
+    config.udpMedia = parser.isSet(udpMediaOption);
+    config.runId = QString::number(QDateTime::currentMSecsSinceEpoch(), 36);
+
+    if (config.port == 0 || config.clients < 1) {
+        qCritical() << "Invalid port or client count";
+        return 1;
+    }
+    if (!parseMix(parser.value(mixOption), config)) {
+        qCritical() << "Invalid mix, expected e.g. text:90,call:5,relogin:5";
+        return 1;
+    }
+    config.threads = qMin(config.threads, config.clients);
+
+    LoadShared shared(config);
+
+    // Clients are split evenly, each slice on its own event loop
+    QVector<QThread*> threads;
+    QVector<LoadWorker*> workers;
+    int first = 0;
+    for (int i = 0; i < config.threads; ++i) {
+        int count = config.clients / config.threads + (i < config.clients % config.threads ? 1 : 0);
+        LoadWorker *worker = new LoadWorker(first, count, &shared);
+        QThread *thread = new QThread;
+        thread->setObjectName(QString("load-%1").arg(i));
+        worker->moveToThread(thread);
+        thread->start();
+        QMetaObject::invokeMethod(worker, "start", Qt::QueuedConnection);
+        threads.append(thread);
+        workers.append(worker);
+        first += count;
+    }
+
+    printf("Load: %d clients on %d threads against %s:%u, %.2f actions/client/s, mix text:%d call:%d relogin:%d\n",
+           config.clients, config.threads, qPrintable(config.host), config.port, config.actionRate,
+           config.textWeight, config.callWeight, config.reloginWeight);
+    fflush(stdout);
+
+    // Ramp-up ends once every client logged in or failed, or after twice the expected time
+    qint64 rampLimitNs = (static_cast<qint64>(config.clients) * 2000 / config.connectRate + 10000) * 1000000;
+    qint64 rampEndNs = 0;
+    LoadSnapshot steadyStart = LoadSnapshot::take(shared);
+    LoadSnapshot last = steadyStart;
+
+    QTimer reportTimer;
+    QObject::connect(&reportTimer, &QTimer::timeout, [&]() {
+        LoadSnapshot now = LoadSnapshot::take(shared);
+        qint64 interval = now.ns - last.ns;
+        const LoadCounters &c = shared.counters;
+
+        printf("[%5.0fs] online %6d | sent %8.0f/s received %8.0f/s | text %8.0f/s media %8.0f/s | calls %5d active %lld failed\n",
+               now.ns / 1e9, c.online.load(),
+               perSecond(now.framesSent - last.framesSent, interval),
+               perSecond(now.framesReceived - last.framesReceived, interval),
+               perSecond(now.textReceived - last.textReceived, interval),
+               perSecond(now.mediaReceived - last.mediaReceived, interval),
+               c.activeCalls.load(), static_cast<long long>(c.callsFailed.load()));
+        fflush(stdout);
+        last = now;
+
+        if (rampEndNs == 0) {
+            qint64 settled = c.loggedIn.load() + c.loginFailures.load() + c.connectFailures.load();
+            if (settled >= config.clients || now.ns > rampLimitNs) {
+                rampEndNs = now.ns;
+                steadyStart = now;
+                printf("Ramp-up done in %.1f s: %lld logged in, %lld login failures, %lld connect failures\n",
+                       now.ns / 1e9, static_cast<long long>(c.loggedIn.load()),
+                       static_cast<long long>(c.loginFailures.load()),
+                       static_cast<long long>(c.connectFailures.load()));
+            }
+        } else if (now.ns - rampEndNs >= static_cast<qint64>(config.duration) * 1000000000) {
+            app.quit();
+        }
+    });
+    reportTimer.start(1000);
+
+    app.exec();
+    LoadSnapshot end = LoadSnapshot::take(shared);
+
+    for (int i = 0; i < workers.size(); ++i) {
+        QMetaObject::invokeMethod(workers.at(i), "stop", Qt::BlockingQueuedConnection);
+        threads.at(i)->quit();
+        threads.at(i)->wait();
+    }
+
+    LatencyHistogram latency[LATENCY_KIND_COUNT];
+    for (LoadWorker *worker : workers) {
+        for (int kind = 0; kind < LATENCY_KIND_COUNT; ++kind) {
+            latency[kind].merge(worker->histogram(static_cast<LatencyKind>(kind)));
+        }
+    }
+
+    const LoadCounters &c = shared.counters;
+    qint64 steadyNs = end.ns - steadyStart.ns;
+    printf("\n=== Summary ===\n");
+    printf("Connection rate:   %10.0f connections/s (%lld connections, %lld failed, %lld disconnects)\n",
+           perSecond(c.connected.load(), rampEndNs > 0 ? rampEndNs : end.ns),
+           static_cast<long long>(c.connected.load()), static_cast<long long>(c.connectFailures.load()),
+           static_cast<long long>(c.disconnects.load()));
+    printf("Messages sent:     %10.0f frames/s over %.1f s of steady load\n",
+           perSecond(end.framesSent - steadyStart.framesSent, steadyNs), steadyNs / 1e9);
+    printf("Messages received: %10.0f frames/s (text %.0f/s, media %.0f/s)\n",
+           perSecond(end.framesReceived - steadyStart.framesReceived, steadyNs),
+           perSecond(end.textReceived - steadyStart.textReceived, steadyNs),
+           perSecond(end.mediaReceived - steadyStart.mediaReceived, steadyNs));
+    printf("Text:              %10lld sent, %lld received\n",
+           static_cast<long long>(c.textSent.load()), static_cast<long long>(c.textReceived.load()));
+    printf("Media:             %10lld sent (%lld over UDP), %lld received (%lld over UDP)\n",
+           static_cast<long long>(c.mediaSent.load()), static_cast<long long>(c.mediaSentUdp.load()),
+           static_cast<long long>(c.mediaReceived.load()), static_cast<long long>(c.mediaReceivedUdp.load()));
+    printf("Calls:             %10lld requested, %lld established, %lld failed, %lld ended\n",
+           static_cast<long long>(c.callsRequested.load()), static_cast<long long>(c.callsEstablished.load()),
+           static_cast<long long>(c.callsFailed.load()), static_cast<long long>(c.callsEnded.load()));
+
+    printf("\nLatency (us)       samples       mean        p50        p99       p999        max\n");
+    printLatency("login", latency[LATENCY_LOGIN]);
+    printLatency("text", latency[LATENCY_TEXT]);
+    printLatency("call setup", latency[LATENCY_CALL_SETUP]);
+    printLatency("media", latency[LATENCY_MEDIA]);
+
+    qDeleteAll(workers);
+    qDeleteAll(threads);
+    return 0;
+}
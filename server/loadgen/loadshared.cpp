@@ -0,0 +1,26 @@
+#include "loadshared.h"
+#include <QRandomGenerator>
+
+void PeerDirectory::set(int index, const QString &userId)
+{
+    QWriteLocker locker(&m_lock);
+    m_userIds[index] = userId;
+}
+
+QString PeerDirectory::pick(int self) const
+{
+    QReadLocker locker(&m_lock);
+    int size = m_userIds.size();
+    if (size < 2) {
+        return QString();
+    }
+
+    // A few probes, a mostly offline directory is not worth a full scan
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        int index = QRandomGenerator::global()->bounded(size);
+        if (index != self && !m_userIds.at(index).isEmpty()) {
+            return m_userIds.at(index);
+        }
+    }
+    return QString();
+}
@@ -0,0 +1,105 @@
+#ifndef LOADSHARED_H
+#define LOADSHARED_H
+
+#include <QString>
+#include <QVector>
+#include <QReadWriteLock>
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+
+struct LoadConfig {
+    QString host;
+    quint16 port;
+    int clients;
+    int threads;
+    int connectRate;      // New connections per second during the ramp
+    int duration;         // Seconds of steady load after the ramp
+    double actionRate;    // Actions per logged-in client per second
+    int textWeight;       // Action mix, relative weights
+    int callWeight;
+    int reloginWeight;
+    int textSize;
+    int mediaSize;
+    int mediaFps;         // Frames per second each side of a call sends
+    int callSeconds;
+    int capabilities;     // Requested at login, see FrameCompression/BatchEnvelope
+    bool udpMedia;        // Media through the server's UDP relay when a call offers one
+    QString runId;        // Keeps usernames unique across runs against one server
+
+    LoadConfig()
+        : port(8888), clients(1000), threads(4), connectRate(1000), duration(30)
+        , actionRate(1.0), textWeight(90), callWeight(5), reloginWeight(5)
+        , textSize(64), mediaSize(960), mediaFps(50), callSeconds(10), capabilities(0)
+        , udpMedia(false)
+    {}
+};
+
+enum LatencyKind {
+    LATENCY_LOGIN = 0,      // Request sent to MSG_AUTH_RESPONSE
+    LATENCY_TEXT = 1,       // Sender to recipient, end to end
+    LATENCY_CALL_SETUP = 2, // MSG_CALL_REQUEST to MSG_CALL_ACCEPT at the caller
+    LATENCY_MEDIA = 3,      // One side of a call to the other
+    LATENCY_KIND_COUNT = 4
+};
+
+// Counters shared by all load workers, read by the reporter while running
+struct LoadCounters {
+    QAtomicInteger<qint64> connected;
+    QAtomicInteger<qint64> connectFailures;
+    QAtomicInteger<qint64> loggedIn;
+    QAtomicInteger<qint64> loginFailures;
+    QAtomicInteger<qint64> disconnects;
+    QAtomicInteger<qint64> textSent;
+    QAtomicInteger<qint64> textReceived;
+    QAtomicInteger<qint64> callsRequested;
+    QAtomicInteger<qint64> callsEstablished;
+    QAtomicInteger<qint64> callsFailed;
+    QAtomicInteger<qint64> callsEnded;
+    QAtomicInteger<qint64> mediaSent;
+    QAtomicInteger<qint64> mediaReceived;
+    QAtomicInteger<qint64> mediaSentUdp;
+    QAtomicInteger<qint64> mediaReceivedUdp;
+    QAtomicInteger<qint64> framesSent;
+    QAtomicInteger<qint64> framesReceived;
+    QAtomicInteger<int> activeCalls;
+    QAtomicInteger<int> online;
+
+    LoadCounters()
+        : connected(0), connectFailures(0), loggedIn(0), loginFailures(0), disconnects(0)
+        , textSent(0), textReceived(0), callsRequested(0), callsEstablished(0), callsFailed(0)
+        , callsEnded(0), mediaSent(0), mediaReceived(0), mediaSentUdp(0)
+        , mediaReceivedUdp(0), framesSent(0), framesReceived(0)
+        , activeCalls(0), online(0)
+    {}
+};
+
+// Server-assigned userIds of the logged-in clients, so any client can pick a peer
+class PeerDirectory
+{
+public:
+    explicit PeerDirectory(int size) : m_userIds(size) {}
+
+    void set(int index, const QString &userId);
+    void clear(int index) { set(index, QString()); }
+    // Random online peer other than 'self', empty if none was found quickly
+    QString pick(int self) const;
+
+private:
+    mutable QReadWriteLock m_lock;
+    QVector<QString> m_userIds;
+};
+
+// Everything the load workers share. The clock is monotonic and common to all
+// threads, so timestamps carried in payloads give end-to-end latency.
+struct LoadShared {
+    LoadConfig config;
+    LoadCounters counters;
+    PeerDirectory peers;
+    QElapsedTimer clock;
+
+    explicit LoadShared(const LoadConfig &cfg) : config(cfg), peers(cfg.clients) { clock.start(); }
+
+    qint64 nowNs() const { return clock.nsecsElapsed(); }
+};
+
+#endif // LOADSHARED_H
@@ -0,0 +1,84 @@
+#include "loadworker.h"
+#include "loadclient.h"
+#include <QTimer>
+#include <QRandomGenerator>
+
+namespace {
+    const int TICK_MS = 10;
+}
+
+LoadWorker::LoadWorker(int firstIndex, int count, LoadShared *shared, QObject *parent)
+    : QObject(parent)
+    , m_firstIndex(firstIndex)
+    , m_count(count)
+    , m_shared(shared)
+    , m_rampTimer(new QTimer(this))
+    , m_actionTimer(new QTimer(this))
+    , m_started(0)
+    , m_connectBudget(0)
+    , m_actionBudget(0)
+    , m_lastActionNs(0)
+{
+    m_rampTimer->setInterval(TICK_MS);
+    m_actionTimer->setInterval(TICK_MS);
+    connect(m_rampTimer, &QTimer::timeout, this, &LoadWorker::onRampTick);
+    connect(m_actionTimer, &QTimer::timeout, this, &LoadWorker::onActionTick);
+}
+
+void LoadWorker::start()
+{
+    // Created here so the sockets belong to the worker's thread
+    m_clients.reserve(m_count);
+    for (int i = 0; i < m_count; ++i) {
+        m_clients.append(new LoadClient(m_firstIndex + i, m_shared, m_histograms, this));
+    }
+
+    m_lastActionNs = m_shared->nowNs();
+    m_rampTimer->start();
+    m_actionTimer->start();
+}
+
+void LoadWorker::stop()
+{
+    m_rampTimer->stop();
+    m_actionTimer->stop();
+    for (LoadClient *client : m_clients) {
+        client->stop();
+    }
+}
+
+void LoadWorker::onRampTick()
+{
+    // This worker's share of the global connect rate
+    m_connectBudget += static_cast<double>(m_shared->config.connectRate) / m_shared->config.threads
+                       * TICK_MS / 1000.0;
+
+    while (m_connectBudget >= 1.0 && m_started < m_clients.size()) {
+        m_clients.at(m_started++)->start();
+        m_connectBudget -= 1.0;
+    }
+
+    if (m_started == m_clients.size()) {
+        m_rampTimer->stop();
+    }
+}
+
+void LoadWorker::onActionTick()
+{
+    qint64 now = m_shared->nowNs();
+    double elapsed = (now - m_lastActionNs) / 1e9;
+    m_lastActionNs = now;
+
+    // Actions are spread over random clients, on average actionRate per client per second
+    m_actionBudget += m_started * m_shared->config.actionRate * elapsed;
+    int actions = static_cast<int>(m_actionBudget);
+    m_actionBudget -= actions;
+
+    for (int i = 0; i < actions && m_started > 0; ++i) {
+        m_clients.at(QRandomGenerator::global()->bounded(m_started))->act();
+    }
+
+    for (int i = 0; i < m_started; ++i) {
+        m_clients.at(i)->tick(now);
+    }
+}
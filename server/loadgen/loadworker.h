@@ -0,0 +1,46 @@
+#ifndef LOADWORKER_H
+#define LOADWORKER_H
+
+#include <QObject>
+#include <QVector>
+#include "loadshared.h"
+#include "latencyhistogram.h"
+
+class QTimer;
+class LoadClient;
+
+// Drives a slice of the simulated clients on its own thread: ramps up the
+// connections, then spreads actions over them at the configured rate
+class LoadWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadWorker(int firstIndex, int count, LoadShared *shared, QObject *parent = nullptr);
+
+    // Only valid once the worker's thread has stopped
+    const LatencyHistogram &histogram(LatencyKind kind) const { return m_histograms[kind]; }
+
+public slots:
+    void start();
+    void stop();
+
+private slots:
+    void onRampTick();
+    void onActionTick();
+
+private:
+    int m_firstIndex;
+    int m_count;
+    LoadShared *m_shared;
+    QVector<LoadClient*> m_clients;
+    LatencyHistogram m_histograms[LATENCY_KIND_COUNT];
+    QTimer *m_rampTimer;
+    QTimer *m_actionTimer;
+    int m_started;
+    double m_connectBudget;
+    double m_actionBudget;
+    qint64 m_lastActionNs;
+};
+
+#endif // LOADWORKER_H
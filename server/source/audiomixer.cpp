@@ -0,0 +1,153 @@
+#include "audiomixer.h"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+AudioMixer::AudioMixer(int frameMs)
+    : m_frameMs(frameMs)
+    , m_frameSamples(SAMPLE_RATE / 1000 * frameMs)
+    , m_sum(m_frameSamples)
+    , m_pendingFrames(0)
+{
+}
+
+void AudioMixer::addParticipant(const QString &userId)
+{
+    if (m_index.contains(userId)) {
+        return;
+    }
+    m_index.insert(userId, m_participants.size());
+    Participant participant;
+    participant.userId = userId;
+    m_participants.append(participant);
+}
+
+void AudioMixer::removeParticipant(const QString &userId)
+{
+    int index = m_index.value(userId, -1);
+    if (index < 0) {
+        return;
+    }
+
+    m_pendingFrames -= m_participants.at(index).queued.size();
+    m_index.remove(userId);
+    // The last one takes the free slot, order does not matter to the mix
+    int last = m_participants.size() - 1;
+    if (index != last) {
+        m_participants[index] = m_participants.at(last);
+        m_index[m_participants.at(index).userId] = index;
+    }
+    m_participants.removeLast();
+}
+
+AudioMixer::PushResult AudioMixer::pushFrame(const QString &userId, const QByteArray &pcm)
+{
+    int index = m_index.value(userId, -1);
+    if (index < 0 || pcm.size() != frameBytes()) {
+        return Rejected;
+    }
+
+    // A participant that got ahead of the tick loses its oldest audio, the
+    // delay through the mixer stays at MAX_QUEUED_FRAMES frames
+    QList<QByteArray> &queued = m_participants[index].queued;
+    PushResult result = Queued;
+    if (queued.size() >= MAX_QUEUED_FRAMES) {
+        queued.removeFirst();
+        --m_pendingFrames;
+        result = DroppedOldest;
+    }
+    queued.append(pcm);
+    ++m_pendingFrames;
+    return result;
+}
+
+QVector<AudioMixer::Output> AudioMixer::mix()
+{
+    QVector<Output> outputs;
+    memset(m_sum.data(), 0, m_frameSamples * sizeof(qint32));
+
+    int speakers = 0;
+    for (Participant &participant : m_participants) {
+        if (participant.queued.isEmpty()) {
+            participant.current.clear();
+            continue;
+        }
+        participant.current = participant.queued.takeFirst();
+        --m_pendingFrames;
+        ++speakers;
+        accumulate(m_sum.data(), reinterpret_cast<const qint16*>(participant.current.constData()),
+                   m_frameSamples);
+    }
+    if (speakers == 0) {
+        return outputs;
+    }
+
+    outputs.reserve(m_participants.size());
+    QByteArray everyone;    // The whole room, what every silent listener hears
+    for (const Participant &participant : m_participants) {
+        bool speaking = !participant.current.isEmpty();
+        if (speaking && speakers == 1) {
+            continue;   // Would only hear itself
+        }
+
+        Output output;
+        output.userId = participant.userId;
+        if (speaking) {
+            output.pcm = QByteArray(frameBytes(), Qt::Uninitialized);
+            mixMinus(m_sum.constData(), reinterpret_cast<const qint16*>(participant.current.constData()),
+                     reinterpret_cast<qint16*>(output.pcm.data()), m_frameSamples);
+        } else {
+            if (everyone.isNull()) {
+                everyone = QByteArray(frameBytes(), Qt::Uninitialized);
+                mixMinus(m_sum.constData(), nullptr, reinterpret_cast<qint16*>(everyone.data()), m_frameSamples);
+            }
+            output.pcm = everyone;
+        }
+        outputs.append(output);
+    }
+    return outputs;
+}
+
+void AudioMixer::accumulate(qint32 *sum, const qint16 *pcm, int samples)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= samples; i += 8) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + i));
+        // Each sample into both halves of a 32-bit lane, the arithmetic shift
+        // then leaves it sign-extended
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+        __m128i *acc = reinterpret_cast<__m128i*>(sum + i);
+        _mm_storeu_si128(acc, _mm_add_epi32(_mm_loadu_si128(acc), low));
+        _mm_storeu_si128(acc + 1, _mm_add_epi32(_mm_loadu_si128(acc + 1), high));
+    }
+#endif
+    for (; i < samples; ++i) {
+        sum[i] += pcm[i];
+    }
+}
+
+void AudioMixer::mixMinus(const qint32 *sum, const qint16 *own, qint16 *out, int samples)
+{
+    // The sum is never clipped, a loud listener subtracts exactly what it
+    // added; saturation happens once, on the way back to 16 bits
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= samples; i += 8) {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i + 4));
+        if (own) {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(own + i));
+            low = _mm_sub_epi32(low, _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+            high = _mm_sub_epi32(high, _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(low, high));
+    }
+#endif
+    for (; i < samples; ++i) {
+        qint32 value = own ? sum[i] - own[i] : sum[i];
+        out[i] = static_cast<qint16>(qBound(-32768, value, 32767));
+    }
+}
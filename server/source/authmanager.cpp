@@ -49,67 +49,118 @@ bool AuthManager::registerUser(const QString &username, const QString &password,
         return false;
     }
     
-    userId = generateUserId();
+    QString newUserId = generateUserId();
     QString salt = generateSalt();
     QString passwordHash = hashPassword(password, salt);
     
-    UserCredentials *cred = new UserCredentials;
-    cred->userId = userId;
-    cred->username = username;
-    cred->passwordHash = passwordHash;
-    cred->salt = salt;
-    cred->createdAt = QDateTime::currentDateTime();
-    cred->lastLogin = QDateTime();
-    
-    m_users[userId] = cred;
-    m_usernameToId[username] = userId;
+    {
+        QMutexLocker locker(&m_mutex);
+        // Checked again, a concurrent registration may have won while hashing
+        if (m_usernameToId.contains(username)) {
+            qWarning() << "User already exists:" << username;
+            return false;
+        }
+        
+        UserCredentials *cred = new UserCredentials;
+        cred->userId = newUserId;
+        cred->username = username;
+        cred->passwordHash = passwordHash;
+        cred->salt = salt;
+        cred->createdAt = QDateTime::currentDateTime();
+        cred->lastLogin = QDateTime();
+        
+        m_users[newUserId] = cred;
+        m_usernameToId[username] = newUserId;
+    }
     
+    userId = newUserId;
     qInfo() << "User registered:" << username << "ID:" << userId;
     emit userRegistered(userId, username);
     
     return true;
 }
 
-QString AuthManager::authenticateUser(const QString &username, const QString &password)
+QString AuthManager::authenticateUser(const QString &username, const QString &password, QString *userId)
 {
-    if (!userExists(username)) {
-        qWarning() << "User not found:" << username;
-        return QString();
-    }
-    
-    QString userId = m_usernameToId.value(username);
-    UserCredentials *cred = m_users.value(userId);
-    
-    if (!cred) {
-        qWarning() << "User credentials not found for:" << username;
-        return QString();
+    QString id;
+    QString salt;
+    QString expectedHash;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_usernameToId.contains(username)) {
+            qWarning() << "User not found:" << username;
+            return QString();
+        }
+        
+        id = m_usernameToId.value(username);
+        UserCredentials *cred = m_users.value(id);
+        if (!cred) {
+            qWarning() << "User credentials not found for:" << username;
+            return QString();
+        }
+        salt = cred->salt;
+        expectedHash = cred->passwordHash;
     }
     
-    QString passwordHash = hashPassword(password, cred->salt);
+    QString passwordHash = hashPassword(password, salt);
     
-    if (passwordHash != cred->passwordHash) {
+    if (passwordHash != expectedHash) {
         qWarning() << "Invalid password for user:" << username;
         return QString();
     }
     
-    // Update last login time
-    cred->lastLogin = QDateTime::currentDateTime();
+    QString token;
+    QString revokedUserId;
+    {
+        QMutexLocker locker(&m_mutex);
+        UserCredentials *cred = m_users.value(id);
+        if (!cred) {
+            return QString();
+        }
+        
+        // Update last login time
+        cred->lastLogin = QDateTime::currentDateTime();
+        
+        // Generate new token
+        token = generateTokenLocked(id, &revokedUserId);
+    }
+    if (!revokedUserId.isEmpty()) {
+        emit tokenRevoked(revokedUserId);
+    }
     
-    // Generate new token
-    QString token = generateToken(userId);
+    if (userId) {
+        *userId = id;
+    }
     
     qInfo() << "User authenticated:" << username << "Token issued";
-    emit userAuthenticated(userId, token);
+    emit userAuthenticated(id, token);
     
     return token;
 }
 
 QString AuthManager::generateToken(const QString &userId)
+{
+    QString token;
+    QString revokedUserId;
+    {
+        QMutexLocker locker(&m_mutex);
+        token = generateTokenLocked(userId, &revokedUserId);
+    }
+    if (!revokedUserId.isEmpty()) {
+        emit tokenRevoked(revokedUserId);
+    }
+    return token;
+}
+
+QString AuthManager::generateTokenLocked(const QString &userId, QString *revokedUserId)
 {
     // Revoke old token if exists
     QString oldToken = m_userTokens.value(userId);
     if (!oldToken.isEmpty()) {
-        revokeToken(oldToken);
+        AuthToken *revoked = revokeTokenLocked(oldToken);
+        if (revoked && revokedUserId) {
+            *revokedUserId = revoked->userId;
+        }
     }
     
     // Generate new token
@@ -132,8 +183,12 @@ QString AuthManager::generateToken(const QString &userId)
 
 bool AuthManager::validateToken(const QString &token)
 {
-    AuthToken *authToken = m_tokens.value(token, nullptr);
-    
+    QMutexLocker locker(&m_mutex);
+    return validateTokenLocked(m_tokens.value(token, nullptr));
+}
+
+bool AuthManager::validateTokenLocked(AuthToken *authToken)
+{
     if (!authToken) {
         return false;
     }
@@ -152,9 +207,10 @@ bool AuthManager::validateToken(const QString &token)
 
 QString AuthManager::getUserIdFromToken(const QString &token)
 {
+    QMutexLocker locker(&m_mutex);
     AuthToken *authToken = m_tokens.value(token, nullptr);
     
-    if (!authToken || !validateToken(token)) {
+    if (!validateTokenLocked(authToken)) {
         return QString();
     }
     
@@ -163,19 +219,32 @@ QString AuthManager::getUserIdFromToken(const QString &token)
 
 bool AuthManager::revokeToken(const QString &token)
 {
-    AuthToken *authToken = m_tokens.value(token, nullptr);
+    QString userId;
+    {
+        QMutexLocker locker(&m_mutex);
+        AuthToken *authToken = revokeTokenLocked(token);
+        if (!authToken) {
+            return false;
+        }
+        userId = authToken->userId;
+    }
     
+    emit tokenRevoked(userId);
+    return true;
+}
+
+AuthToken *AuthManager::revokeTokenLocked(const QString &token)
+{
+    AuthToken *authToken = m_tokens.value(token, nullptr);
     if (!authToken) {
-        return false;
+        return nullptr;
     }
     
     authToken->isValid = false;
     m_userTokens.remove(authToken->userId);
     
     qInfo() << "Token revoked for user:" << authToken->userId;
-    emit tokenRevoked(authToken->userId);
-    
-    return true;
+    return authToken;
 }
 
 bool AuthManager::isTokenExpired(const AuthToken &token)
@@ -185,6 +254,7 @@ bool AuthManager::isTokenExpired(const AuthToken &token)
 
 void AuthManager::cleanupExpiredTokens()
 {
+    QMutexLocker locker(&m_mutex);
     QList<QString> expiredTokens;
     
     for (auto it = m_tokens.begin(); it != m_tokens.end(); ++it) {
@@ -208,10 +278,18 @@ void AuthManager::cleanupExpiredTokens()
 
 bool AuthManager::userExists(const QString &username)
 {
+    QMutexLocker locker(&m_mutex);
     return m_usernameToId.contains(username);
 }
 
+bool AuthManager::isRegistered(const QString &userId) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_users.contains(userId);
+}
+
 UserCredentials* AuthManager::getUserCredentials(const QString &userId)
 {
+    QMutexLocker locker(&m_mutex);
     return m_users.value(userId, nullptr);
 }
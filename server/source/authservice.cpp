@@ -0,0 +1,195 @@
+#include "authservice.h"
+#include "authmanager.h"
+#include "tcpserver.h"
+#include "wirecodec.h"
+#include <QRunnable>
+#include <QThread>
+#include <QDebug>
+
+namespace {
+    // One login or registration, run on the auth pool
+    class AuthJob : public QRunnable
+    {
+    public:
+        AuthJob(QObject *receiver, AuthManager *authManager, quint64 connectionId, bool registering,
+                const QString &username, const QString &password, int capabilities)
+            : m_receiver(receiver), m_authManager(authManager), m_connectionId(connectionId)
+            , m_registering(registering), m_username(username), m_password(password)
+            , m_capabilities(capabilities)
+        {
+        }
+
+        void run() override
+        {
+            bool success = false;
+            QString userId;
+            QString token;
+            QString error;
+            
+            if (m_registering) {
+                success = m_authManager->registerUser(m_username, m_password, userId);
+                if (success) {
+                    token = m_authManager->generateToken(userId);
+                } else {
+                    error = QString::fromUtf8("注册失败，用户名已存在或无效");
+                }
+            } else {
+                token = m_authManager->authenticateUser(m_username, m_password, &userId);
+                success = !token.isEmpty();
+                if (!success) {
+                    error = QString::fromUtf8("用户名或密码错误");
+                }
+            }
+            
+            QMetaObject::invokeMethod(m_receiver, "onAuthFinished", Qt::QueuedConnection,
+                                      Q_ARG(quint64, m_connectionId), Q_ARG(bool, success),
+                                      Q_ARG(QString, userId), Q_ARG(QString, token), Q_ARG(QString, error),
+                                      Q_ARG(int, m_capabilities));
+        }
+
+    private:
+        QObject *m_receiver;
+        AuthManager *m_authManager;
+        quint64 m_connectionId;
+        bool m_registering;
+        QString m_username;
+        QString m_password;
+        int m_capabilities;
+    };
+}
+
+AuthService::AuthService(TcpServer *tcpServer, AuthManager *authManager, QObject *parent)
+    : QObject(parent)
+    , m_tcpServer(tcpServer)
+    , m_authManager(authManager)
+    , m_maxPending(DEFAULT_MAX_PENDING)
+    , m_pending(0)
+    , m_completed(0)
+    , m_rejected(0)
+    , m_resumed(0)
+{
+    setMaxThreads(0);
+    
+    MessageDispatcher *dispatcher = m_tcpServer->dispatcher();
+    dispatcher->registerHandler(MSG_LOGIN_REQUEST, [this](const MessageHeader &header, const FrameView &payload) {
+        onAuthRequest(header, payload);
+    });
+    dispatcher->registerHandler(MSG_REGISTER_REQUEST, [this](const MessageHeader &header, const FrameView &payload) {
+        onAuthRequest(header, payload);
+    });
+    dispatcher->registerHandler(MSG_RESUME_REQUEST, [this](const MessageHeader &header, const FrameView &payload) {
+        onResumeRequest(header, payload);
+    });
+}
+
+AuthService::~AuthService()
+{
+    // Jobs still running post to us, let them finish first
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void AuthService::setMaxThreads(int count)
+{
+    if (count <= 0) {
+        count = qMax(1, QThread::idealThreadCount() / 2);
+    }
+    m_pool.setMaxThreadCount(count);
+}
+
+void AuthService::onAuthRequest(const MessageHeader &header, const FrameView &payload)
+{
+    // [Username][Password][Capabilities (1 byte, optional)]
+    WireReader reader(payload);
+    QString username;
+    QString password;
+    if (!reader.readString(username) || !reader.readString(password)) {
+        qWarning() << "Malformed auth request on connection" << header.connectionId;
+        return;
+    }
+    
+    int capabilities = readCapabilities(reader);
+    
+    if (m_pending >= m_maxPending) {
+        ++m_rejected;
+        sendResponse(header.connectionId, false, QString(), QString(),
+                     QString::fromUtf8("服务器繁忙，请稍后重试"), 0);
+        return;
+    }
+    
+    ++m_pending;
+    m_pool.start(new AuthJob(this, m_authManager, header.connectionId,
+                             header.type == MSG_REGISTER_REQUEST, username, password, capabilities));
+}
+
+void AuthService::onResumeRequest(const MessageHeader &header, const FrameView &payload)
+{
+    // [Token][LastSequence][Capabilities (1 byte, optional)]
+    WireReader reader(payload);
+    QString token;
+    quint64 lastSequence = 0;
+    if (!reader.readString(token) || !reader.readVarint(lastSequence)) {
+        qWarning() << "Malformed resume request on connection" << header.connectionId;
+        return;
+    }
+    int capabilities = readCapabilities(reader);
+    
+    // No password to hash, the token lookup is cheap enough for this thread
+    QString userId = m_authManager->getUserIdFromToken(token);
+    if (userId.isEmpty()) {
+        sendResponse(header.connectionId, false, QString(), QString(),
+                     QString::fromUtf8("会话已过期，请重新登录"), 0);
+        return;
+    }
+    
+    ++m_resumed;
+    sendResponse(header.connectionId, true, userId, token, QString(), capabilities,
+                 static_cast<qint64>(qMin<quint64>(lastSequence, Q_INT64_C(0x7FFFFFFFFFFFFFFF))));
+}
+
+int AuthService::readCapabilities(WireReader &reader) const
+{
+    // Older clients stop before the capabilities and get no optional features
+    quint8 requested = 0;
+    if (!reader.atEnd()) {
+        reader.readByte(requested);
+    }
+    return requested & m_tcpServer->capabilities();
+}
+
+void AuthService::onAuthFinished(quint64 connectionId, bool success, const QString &userId,
+                                 const QString &token, const QString &error, int capabilities)
+{
+    --m_pending;
+    ++m_completed;
+    sendResponse(connectionId, success, userId, token, error, capabilities);
+}
+
+void AuthService::sendResponse(quint64 connectionId, bool success, const QString &userId,
+                               const QString &token, const QString &error, int capabilities,
+                               qint64 resumeFrom)
+{
+    // [0x0A][Success (1 byte)] then [Token][UserId][Capabilities (1 byte)][Sequence]
+    // on success or [Error] on failure
+    QByteArray response;
+    WireWriter writer(response);
+    writer.writeByte(MSG_AUTH_RESPONSE);
+    writer.writeByte(success ? 1 : 0);
+    if (success) {
+        // A full login starts a fresh replay ring, the backlog comes from the database
+        SessionLog *sessionLog = m_tcpServer->sessionLog();
+        bool acking = (capabilities & AckRanges::CAPABILITY_ACK) != 0;
+        quint64 sequence = (resumeFrom < 0) ? sessionLog->reset(userId, acking)
+                                            : sessionLog->resume(userId, acking);
+        
+        writer.writeString(token);
+        writer.writeString(userId);
+        writer.writeByte(static_cast<quint8>(capabilities));
+        writer.writeVarint(sequence);
+        // Binds the connection to the user before the response goes out
+        m_tcpServer->completeLogin(connectionId, userId, response, capabilities, resumeFrom);
+    } else {
+        writer.writeString(error);
+        m_tcpServer->sendToConnection(connectionId, response);
+    }
+}
@@ -0,0 +1,104 @@
+#include "broadcastengine.h"
+#include "tcpserver.h"
+#include "serverworker.h"
+#include "framedecoder.h"
+#include <QDebug>
+#include <QVector>
+
+BroadcastEngine::BroadcastEngine(TcpServer *server, QObject *parent)
+    : QObject(parent)
+    , m_server(server)
+    , m_batchSize(1024)
+    , m_nextBroadcastId(1)
+{
+}
+
+quint64 BroadcastEngine::broadcast(const QByteArray &data)
+{
+    return dispatch(m_server->registry()->clients(), data);
+}
+
+quint64 BroadcastEngine::broadcastTo(const QStringList &userIds, const QByteArray &data)
+{
+    QList<ClientInfo> targets;
+    for (const QString &userId : userIds) {
+        ClientInfo info;
+        if (m_server->registry()->lookup(userId, info)) {
+            targets.append(info);
+        }
+    }
+    return dispatch(targets, data);
+}
+
+quint64 BroadcastEngine::dispatch(const QList<ClientInfo> &targets, const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return 0;
+    }
+    
+    QHash<ServerWorker*, QVector<quint64> > byWorker;
+    for (const ClientInfo &client : targets) {
+        if (client.isOnline) {
+            byWorker[client.worker].append(client.connectionId);
+        }
+    }
+    
+    if (byWorker.isEmpty()) {
+        return 0;
+    }
+    
+    // Serialized once, every outbound queue holds a reference to this buffer
+    QByteArray frame = FrameDecoder::encode(data);
+    quint64 broadcastId = m_nextBroadcastId++;
+    
+    Progress progress;
+    progress.total = 0;
+    progress.delivered = 0;
+    progress.failed = 0;
+    progress.pendingBatches = 0;
+    for (auto it = byWorker.constBegin(); it != byWorker.constEnd(); ++it) {
+        progress.total += it.value().size();
+        progress.pendingBatches += (it.value().size() + m_batchSize - 1) / m_batchSize;
+    }
+    m_pending.insert(broadcastId, progress);
+    
+    // Always queued, so workers interleave batches with their own socket events
+    for (auto it = byWorker.constBegin(); it != byWorker.constEnd(); ++it) {
+        const QVector<quint64> &connections = it.value();
+        for (int offset = 0; offset < connections.size(); offset += m_batchSize) {
+            QMetaObject::invokeMethod(it.key(), "deliverBatch", Qt::QueuedConnection,
+                                      Q_ARG(quint64, broadcastId),
+                                      Q_ARG(QVector<quint64>, connections.mid(offset, m_batchSize)),
+                                      Q_ARG(QByteArray, frame));
+        }
+    }
+    
+    return broadcastId;
+}
+
+void BroadcastEngine::onBatchDelivered(quint64 broadcastId, int delivered, int failed)
+{
+    auto it = m_pending.find(broadcastId);
+    if (it == m_pending.end()) {
+        return;
+    }
+    
+    Progress &progress = it.value();
+    progress.delivered += delivered;
+    progress.failed += failed;
+    --progress.pendingBatches;
+    
+    emit broadcastProgress(broadcastId, progress.delivered, progress.failed, progress.total);
+    
+    if (progress.pendingBatches <= 0) {
+        int totalDelivered = progress.delivered;
+        int totalFailed = progress.failed;
+        m_pending.erase(it);
+        
+        if (totalFailed > 0) {
+            qWarning() << "Broadcast" << broadcastId << "reached" << totalDelivered
+                       << "clients," << totalFailed << "failed";
+        }
+        emit broadcastFinished(broadcastId, totalDelivered, totalFailed);
+    }
+}
@@ -0,0 +1,241 @@
+#include "clientregistry.h"
+#include <QHash>
+
+static const int INITIAL_INDEX_CAPACITY = 1024;
+
+ClientRegistry::ClientRegistry()
+    : m_indexMask(0), m_count(0)
+{
+    rehash(INITIAL_INDEX_CAPACITY);
+}
+
+SessionHandle ClientRegistry::registerClient(const ClientInfo &info)
+{
+    QWriteLocker locker(&m_lock);
+
+    quint32 slot;
+    if (!m_freeSlots.isEmpty()) {
+        slot = m_freeSlots.takeLast();
+    } else {
+        slot = static_cast<quint32>(m_slots.size());
+        Slot fresh;
+        fresh.generation = 1;
+        fresh.used = false;
+        m_slots.append(fresh);
+    }
+
+    Slot &record = m_slots[slot];
+    record.info = info;
+    record.used = true;
+    record.info.handle = (static_cast<SessionHandle>(record.generation) << 32) | slot;
+
+    uint hash = qHash(info.userId);
+    int pos = findIndex(info.userId, hash);
+    if (pos >= 0) {
+        // Reconnect: route the userId to the newest session
+        m_index[pos].slot = slot;
+    } else {
+        if ((m_count + 1) * 2 > m_index.size()) {
+            rehash(m_index.size() * 2);
+        }
+        insertIndex(hash, slot);
+        ++m_count;
+    }
+
+    return record.info.handle;
+}
+
+bool ClientRegistry::unregisterClient(SessionHandle handle)
+{
+    QWriteLocker locker(&m_lock);
+
+    if (!slotFor(handle)) {
+        return false;
+    }
+
+    quint32 slot = slotOf(handle);
+    const QString &userId = m_slots.at(slot).info.userId;
+    int pos = findIndex(userId, qHash(userId));
+    bool ownedRoute = (pos >= 0 && m_index.at(pos).slot == slot);
+    if (ownedRoute) {
+        eraseIndexAt(pos);
+        --m_count;
+    }
+
+    releaseSlot(slot);
+    return ownedRoute;
+}
+
+bool ClientRegistry::unregisterClient(const QString &userId, quint64 connectionId)
+{
+    SessionHandle handle = INVALID_SESSION;
+    {
+        QReadLocker locker(&m_lock);
+        int pos = findIndex(userId, qHash(userId));
+        if (pos < 0) {
+            return false;
+        }
+        const ClientInfo &info = m_slots.at(m_index.at(pos).slot).info;
+        if (info.connectionId != connectionId) {
+            return false;
+        }
+        handle = info.handle;
+    }
+    return unregisterClient(handle);
+}
+
+bool ClientRegistry::lookup(const QString &userId, ClientInfo &info) const
+{
+    QReadLocker locker(&m_lock);
+
+    int pos = findIndex(userId, qHash(userId));
+    if (pos < 0) {
+        return false;
+    }
+
+    info = m_slots.at(m_index.at(pos).slot).info;
+    return true;
+}
+
+SessionHandle ClientRegistry::handleOf(const QString &userId) const
+{
+    QReadLocker locker(&m_lock);
+
+    int pos = findIndex(userId, qHash(userId));
+    return pos < 0 ? INVALID_SESSION : m_slots.at(m_index.at(pos).slot).info.handle;
+}
+
+bool ClientRegistry::lookup(SessionHandle handle, ClientInfo &info) const
+{
+    QReadLocker locker(&m_lock);
+
+    const Slot *record = slotFor(handle);
+    if (!record) {
+        return false;
+    }
+
+    info = record->info;
+    return true;
+}
+
+QList<QString> ClientRegistry::onlineUsers() const
+{
+    QReadLocker locker(&m_lock);
+
+    QList<QString> users;
+    users.reserve(m_count);
+    for (const IndexEntry &entry : m_index) {
+        if (entry.slot != EMPTY_ENTRY && m_slots.at(entry.slot).info.isOnline) {
+            users.append(m_slots.at(entry.slot).info.userId);
+        }
+    }
+    return users;
+}
+
+QList<ClientInfo> ClientRegistry::clients() const
+{
+    QReadLocker locker(&m_lock);
+
+    QList<ClientInfo> result;
+    result.reserve(m_count);
+    for (const IndexEntry &entry : m_index) {
+        if (entry.slot != EMPTY_ENTRY) {
+            result.append(m_slots.at(entry.slot).info);
+        }
+    }
+    return result;
+}
+
+int ClientRegistry::count() const
+{
+    QReadLocker locker(&m_lock);
+    return m_count;
+}
+
+const ClientRegistry::Slot *ClientRegistry::slotFor(SessionHandle handle) const
+{
+    quint32 slot = slotOf(handle);
+    if (slot >= static_cast<quint32>(m_slots.size())) {
+        return nullptr;
+    }
+
+    const Slot &record = m_slots.at(slot);
+    if (!record.used || record.generation != generationOf(handle)) {
+        return nullptr;
+    }
+    return &record;
+}
+
+int ClientRegistry::findIndex(const QString &userId, uint hash) const
+{
+    int pos = static_cast<int>(hash) & m_indexMask;
+    while (m_index.at(pos).slot != EMPTY_ENTRY) {
+        const IndexEntry &entry = m_index.at(pos);
+        if (entry.hash == hash && m_slots.at(entry.slot).info.userId == userId) {
+            return pos;
+        }
+        pos = (pos + 1) & m_indexMask;
+    }
+    return -1;
+}
+
+void ClientRegistry::insertIndex(uint hash, quint32 slot)
+{
+    int pos = static_cast<int>(hash) & m_indexMask;
+    while (m_index.at(pos).slot != EMPTY_ENTRY) {
+        pos = (pos + 1) & m_indexMask;
+    }
+    m_index[pos].hash = hash;
+    m_index[pos].slot = slot;
+}
+
+void ClientRegistry::eraseIndexAt(int pos)
+{
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    int hole = pos;
+    int next = pos;
+    for (;;) {
+        next = (next + 1) & m_indexMask;
+        if (m_index.at(next).slot == EMPTY_ENTRY) {
+            break;
+        }
+
+        int home = static_cast<int>(m_index.at(next).hash) & m_indexMask;
+        bool staysPut = (hole <= next) ? (hole < home && home <= next)
+                                       : (hole < home || home <= next);
+        if (!staysPut) {
+            m_index[hole] = m_index.at(next);
+            hole = next;
+        }
+    }
+    m_index[hole].slot = EMPTY_ENTRY;
+}
+
+void ClientRegistry::rehash(int capacity)
+{
+    QVector<IndexEntry> old = m_index;
+
+    IndexEntry empty;
+    empty.hash = 0;
+    empty.slot = EMPTY_ENTRY;
+    m_index = QVector<IndexEntry>(capacity, empty);
+    m_indexMask = capacity - 1;
+
+    for (const IndexEntry &entry : old) {
+        if (entry.slot != EMPTY_ENTRY) {
+            insertIndex(entry.hash, entry.slot);
+        }
+    }
+}
+
+void ClientRegistry::releaseSlot(quint32 slot)
+{
+    Slot &record = m_slots[slot];
+    record.info = ClientInfo();
+    record.used = false;
+    // Generation 0 is reserved so that INVALID_SESSION never matches
+    if (++record.generation == 0) {
+        record.generation = 1;
+    }
+    m_freeSlots.append(slot);
+}
@@ -14,9 +14,12 @@ DatabaseManager::~DatabaseManager()
 }
 
 bool DatabaseManager::connectToDatabase(const QString &host, int port, const QString &dbName,
-                                       const QString &user, const QString &password)
+                                       const QString &user, const QString &password,
+                                       const QString &connectionName)
 {
-    m_db = QSqlDatabase::addDatabase("QMYSQL");
+    m_connectionName = connectionName;
+    m_db = connectionName.isEmpty() ? QSqlDatabase::addDatabase("QMYSQL")
+                                    : QSqlDatabase::addDatabase("QMYSQL", connectionName);
     m_db.setHostName(host);
     m_db.setPort(port);
     m_db.setDatabaseName(dbName);
@@ -42,6 +45,13 @@ void DatabaseManager::disconnectFromDatabase()
         m_connected = false;
         qInfo() << "Disconnected from database";
     }
+    
+    // A named connection is removed once no handle refers to it
+    if (!m_connectionName.isEmpty()) {
+        m_db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(m_connectionName);
+        m_connectionName.clear();
+    }
 }
 
 bool DatabaseManager::isConnected() const
@@ -127,7 +137,9 @@ bool DatabaseManager::createTables()
         return false;
     }
     
-    // Offline messages table
+    // Offline messages table. No foreign keys into users: accounts live in
+    // AuthManager, not in this database, so the sender and recipient of a
+    // message never have a users row
     QString createMessagesTable = R"(
         CREATE TABLE IF NOT EXISTS offline_messages (
             message_id VARCHAR(36) PRIMARY KEY,
@@ -137,10 +149,10 @@ bool DatabaseManager::createTables()
             message_type VARCHAR(20) DEFAULT 'text',
             sent_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
             delivered BOOLEAN DEFAULT FALSE,
+            seq BIGINT NOT NULL DEFAULT 0,
             INDEX idx_to_user (to_user_id, delivered),
-            INDEX idx_sent_at (sent_at),
-            FOREIGN KEY (from_user_id) REFERENCES users(user_id) ON DELETE CASCADE,
-            FOREIGN KEY (to_user_id) REFERENCES users(user_id) ON DELETE CASCADE
+            INDEX idx_to_user_seq (to_user_id, delivered, seq),
+            INDEX idx_sent_at (sent_at)
         )
     )";
     
@@ -149,6 +161,46 @@ bool DatabaseManager::createTables()
         return false;
     }
     
+    // Tables created with those foreign keys refuse every offline message
+    query.prepare(R"(
+        SELECT CONSTRAINT_NAME FROM information_schema.REFERENTIAL_CONSTRAINTS
+        WHERE CONSTRAINT_SCHEMA = DATABASE() AND TABLE_NAME = 'offline_messages'
+    )");
+    if (executeQuery(query, "Check offline_messages foreign keys")) {
+        QStringList constraints;
+        while (query.next()) {
+            constraints << query.value(0).toString();
+        }
+        for (const QString &constraint : constraints) {
+            query.prepare(QString("ALTER TABLE offline_messages DROP FOREIGN KEY `%1`").arg(constraint));
+            if (!executeQuery(query, "Drop offline_messages foreign key")) {
+                return false;
+            }
+        }
+    }
+    
+    // Tables from before sequence numbers: existing rows are numbered in send
+    // order, below anything SessionLog hands out since its counters start
+    // from the clock
+    query.prepare("SHOW COLUMNS FROM offline_messages LIKE 'seq'");
+    if (executeQuery(query, "Check offline_messages.seq") && !query.next()) {
+        query.prepare(R"(
+            ALTER TABLE offline_messages
+                ADD COLUMN seq BIGINT NOT NULL DEFAULT 0,
+                ADD INDEX idx_to_user_seq (to_user_id, delivered, seq)
+        )");
+        if (!executeQuery(query, "Add offline_messages.seq")) {
+            return false;
+        }
+        
+        query.prepare("SET @seq := 0");
+        executeQuery(query, "Number existing offline messages");
+        query.prepare("UPDATE offline_messages SET seq = (@seq := @seq + 1) WHERE seq = 0 ORDER BY sent_at, message_id");
+        if (!executeQuery(query, "Number existing offline messages")) {
+            return false;
+        }
+    }
+    
     qInfo() << "Database tables created successfully";
     return true;
 }
@@ -411,31 +463,85 @@ bool DatabaseManager::saveOfflineMessage(const OfflineMessage &message)
 {
     QSqlQuery query(m_db);
     query.prepare(R"(
-        INSERT INTO offline_messages (message_id, from_user_id, to_user_id, content, message_type)
-        VALUES (?, ?, ?, ?, ?)
+        INSERT INTO offline_messages (message_id, from_user_id, to_user_id, content, message_type, seq)
+        VALUES (?, ?, ?, ?, ?, ?)
     )");
     query.addBindValue(message.messageId);
     query.addBindValue(message.fromUserId);
     query.addBindValue(message.toUserId);
     query.addBindValue(message.content);
     query.addBindValue(message.messageType);
+    query.addBindValue(static_cast<qint64>(message.sequence));
     
     return executeQuery(query, "Save offline message");
 }
 
-QList<OfflineMessage> DatabaseManager::getOfflineMessages(const QString &userId, int limit)
+int DatabaseManager::saveOfflineMessages(const QList<OfflineMessage> &messages)
+{
+    if (messages.isEmpty()) {
+        return 0;
+    }
+    
+    // Batched columns, one round trip and one commit for the whole list
+    QVariantList messageIds, fromUserIds, toUserIds, contents, messageTypes, sequences;
+    for (const OfflineMessage &message : messages) {
+        messageIds << message.messageId;
+        fromUserIds << message.fromUserId;
+        toUserIds << message.toUserId;
+        contents << message.content;
+        messageTypes << message.messageType;
+        sequences << static_cast<qint64>(message.sequence);
+    }
+    
+    m_db.transaction();
+    
+    QSqlQuery query(m_db);
+    query.prepare(R"(
+        INSERT INTO offline_messages (message_id, from_user_id, to_user_id, content, message_type, seq)
+        VALUES (?, ?, ?, ?, ?, ?)
+    )");
+    query.addBindValue(messageIds);
+    query.addBindValue(fromUserIds);
+    query.addBindValue(toUserIds);
+    query.addBindValue(contents);
+    query.addBindValue(messageTypes);
+    query.addBindValue(sequences);
+    
+    if (query.execBatch() && m_db.commit()) {
+        return messages.size();
+    }
+    
+    // One bad row must not cost the others: save them one by one instead
+    QString error = "Save offline messages: " + query.lastError().text();
+    qWarning() << error;
+    emit databaseError(error);
+    m_db.rollback();
+    
+    int saved = 0;
+    for (const OfflineMessage &message : messages) {
+        if (saveOfflineMessage(message)) {
+            ++saved;
+        }
+    }
+    return saved;
+}
+
+QList<OfflineMessage> DatabaseManager::getOfflineMessages(const QString &userId, int limit,
+                                                         quint64 afterSequence)
 {
     QList<OfflineMessage> messages;
     
+    // Keyset paging, rows stay undelivered until acknowledged
     QSqlQuery query(m_db);
     query.prepare(R"(
-        SELECT message_id, from_user_id, to_user_id, content, message_type, sent_at, delivered
+        SELECT message_id, from_user_id, to_user_id, content, message_type, sent_at, delivered, seq
         FROM offline_messages
-        WHERE to_user_id = ? AND delivered = FALSE
-        ORDER BY sent_at ASC
+        WHERE to_user_id = ? AND delivered = FALSE AND seq > ?
+        ORDER BY seq ASC
         LIMIT ?
     )");
     query.addBindValue(userId);
+    query.addBindValue(static_cast<qint64>(afterSequence));
     query.addBindValue(limit);
     
     if (executeQuery(query, "Get offline messages")) {
@@ -448,6 +554,7 @@ QList<OfflineMessage> DatabaseManager::getOfflineMessages(const QString &userId,
             msg.messageType = query.value(4).toString();
             msg.sentAt = query.value(5).toDateTime();
             msg.delivered = query.value(6).toBool();
+            msg.sequence = static_cast<quint64>(query.value(7).toLongLong());
             messages.append(msg);
         }
     }
@@ -464,6 +571,44 @@ bool DatabaseManager::markMessagesAsDelivered(const QString &userId)
     return executeQuery(query, "Mark messages as delivered");
 }
 
+bool DatabaseManager::markMessagesAsDelivered(const QStringList &messageIds)
+{
+    if (messageIds.isEmpty()) {
+        return true;
+    }
+    
+    QVariantList ids;
+    for (const QString &messageId : messageIds) {
+        ids << messageId;
+    }
+    
+    QSqlQuery query(m_db);
+    query.prepare("UPDATE offline_messages SET delivered = TRUE WHERE message_id = ?");
+    query.addBindValue(ids);
+    
+    if (!query.execBatch()) {
+        QString error = "Mark messages as delivered: " + query.lastError().text();
+        qWarning() << error;
+        emit databaseError(error);
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::markMessagesAsDelivered(const QString &userId, quint64 first, quint64 last)
+{
+    QSqlQuery query(m_db);
+    query.prepare(R"(
+        UPDATE offline_messages SET delivered = TRUE
+        WHERE to_user_id = ? AND delivered = FALSE AND seq BETWEEN ? AND ?
+    )");
+    query.addBindValue(userId);
+    query.addBindValue(static_cast<qint64>(first));
+    query.addBindValue(static_cast<qint64>(last));
+    
+    return executeQuery(query, "Mark message range as delivered");
+}
+
 bool DatabaseManager::deleteOldMessages(int daysOld)
 {
     QSqlQuery query(m_db);
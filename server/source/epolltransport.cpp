@@ -0,0 +1,269 @@
+#include "epolltransport.h"
+#include "serverworker.h"
+#include <QSocketNotifier>
+#include <QHostAddress>
+#include <QDebug>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+    const int MAX_EVENTS = 256;
+    const quint32 WRITE_EVENTS = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    // Tail room offered to each read(), grows the decoder buffer on demand only
+    const int READ_CHUNK = 16 * 1024;
+}
+
+EpollTransport::EpollTransport(TransportHandler *handler, QObject *parent)
+    : QObject(parent)
+    , m_handler(handler)
+    , m_epoll(epoll_create1(EPOLL_CLOEXEC))
+    , m_notifier(nullptr)
+{
+    if (m_epoll < 0) {
+        qWarning() << "epoll_create1() failed:" << strerror(errno);
+        return;
+    }
+    
+    // The epoll descriptor turns readable whenever one of its sockets has an event
+    m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &EpollTransport::onEvents);
+}
+
+EpollTransport::~EpollTransport()
+{
+    for (Connection *conn : m_connections) {
+        ::close(conn->fd);
+        conn->fd = -1;
+    }
+    
+    delete m_notifier;
+    if (m_epoll >= 0) {
+        ::close(m_epoll);
+    }
+}
+
+bool EpollTransport::adopt(Connection *conn, qintptr socketDescriptor)
+{
+    int fd = static_cast<int>(socketDescriptor);
+    
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    sockaddr_storage peer;
+    socklen_t peerLength = sizeof(peer);
+    if (getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peerLength) == 0) {
+        QHostAddress address(reinterpret_cast<sockaddr*>(&peer));
+        conn->peerAddress = address.toString();
+        conn->peerPort = ntohs(peer.ss_family == AF_INET6
+                               ? reinterpret_cast<sockaddr_in6*>(&peer)->sin6_port
+                               : reinterpret_cast<sockaddr_in*>(&peer)->sin_port);
+    }
+    
+    // Edge-triggered: each readiness change is reported once, so reads and
+    // writes always continue until EAGAIN
+    epoll_event event = {};
+    event.events = EPOLLIN | WRITE_EVENTS;
+    event.data.u64 = conn->id;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+        qWarning() << "epoll_ctl() failed:" << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    
+    conn->fd = fd;
+    m_connections.insert(conn->id, conn);
+    return true;
+}
+
+void EpollTransport::write(Connection *conn, const QByteArray &data)
+{
+    if (conn->writeFailed || data.isEmpty()) {
+        return;
+    }
+    
+    // Nothing queued ahead of us: hand the bytes straight to the kernel
+    int written = 0;
+    if (conn->sendOffset >= conn->sendBuffer.size()) {
+        while (written < data.size()) {
+            ssize_t n = ::send(conn->fd, data.constData() + written, data.size() - written, MSG_NOSIGNAL);
+            if (n > 0) {
+                written += static_cast<int>(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                failWrite(conn);
+                return;
+            }
+        }
+    }
+    
+    if (written < data.size()) {
+        // Kernel buffer is full, keep the rest until EPOLLOUT
+        if (written == 0 && conn->sendBuffer.isEmpty()) {
+            conn->sendBuffer = data;   // Shares the broadcast buffer, no copy
+        } else {
+            compact(conn);
+            conn->sendBuffer.append(data.constData() + written, data.size() - written);
+        }
+    }
+}
+
+qint64 EpollTransport::pendingWriteBytes(const Connection *conn) const
+{
+    return conn->sendBuffer.size() - conn->sendOffset;
+}
+
+void EpollTransport::close(Connection *conn)
+{
+    if (!m_connections.remove(conn->id)) {
+        return;
+    }
+    
+    // Closing the descriptor also removes it from the epoll set
+    ::close(conn->fd);
+    conn->fd = -1;
+    conn->sendBuffer.clear();
+    conn->sendOffset = 0;
+    m_handler->onConnectionClosed(conn);
+}
+
+void EpollTransport::closeGracefully(Connection *conn)
+{
+    flush(conn);
+    // The peer sees EOF, its close is then picked up as EPOLLRDHUP
+    ::shutdown(conn->fd, SHUT_WR);
+}
+
+void EpollTransport::setReadPaused(Connection *conn, bool paused)
+{
+    // Re-adding EPOLLIN re-arms the edge, data that arrived meanwhile is reported again
+    epoll_event event = {};
+    event.events = paused ? WRITE_EVENTS : (EPOLLIN | WRITE_EVENTS);
+    event.data.u64 = conn->id;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+        qWarning() << "epoll_ctl() failed:" << strerror(errno);
+    }
+}
+
+void EpollTransport::onEvents()
+{
+    epoll_event events[MAX_EVENTS];
+    int ready;
+    do {
+        ready = epoll_wait(m_epoll, events, MAX_EVENTS, 0);
+    } while (ready < 0 && errno == EINTR);
+    
+    for (int i = 0; i < ready; ++i) {
+        quint64 connectionId = events[i].data.u64;
+        quint32 flags = events[i].events;
+        
+        // An earlier event of this batch may have closed the connection
+        Connection *conn = m_connections.value(connectionId, nullptr);
+        if (!conn) continue;
+        
+        // A paused connection is read after resuming, unless it failed
+        bool readable = conn->readPaused ? (flags & (EPOLLHUP | EPOLLERR))
+                                         : (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR));
+        if (readable) {
+            bool open = true;
+            if (readAll(conn, &open) > 0) {
+                m_handler->onConnectionReadable(conn);
+            }
+            
+            conn = m_connections.value(connectionId, nullptr);
+            if (!conn) continue;
+            if (!open || (flags & (EPOLLHUP | EPOLLERR))) {
+                close(conn);
+                continue;
+            }
+        }
+        
+        if ((flags & EPOLLOUT) && pendingWriteBytes(conn) > 0) {
+            if (!flush(conn)) {
+                close(conn);
+                continue;
+            }
+            m_handler->onConnectionWritable(conn);
+        }
+    }
+}
+
+void EpollTransport::closeById(quint64 connectionId)
+{
+    Connection *conn = m_connections.value(connectionId, nullptr);
+    if (conn) {
+        close(conn);
+    }
+}
+
+qint64 EpollTransport::readAll(Connection *conn, bool *open)
+{
+    qint64 total = 0;
+    for (;;) {
+        char *tail = conn->decoder.prepareAppend(READ_CHUNK);
+        ssize_t n = ::recv(conn->fd, tail, READ_CHUNK, 0);
+        conn->decoder.commitAppend(n > 0 ? static_cast<int>(n) : 0);
+        
+        if (n > 0) {
+            total += n;
+        } else if (n == 0) {
+            *open = false;   // Orderly shutdown by the peer
+            return total;
+        } else if (errno != EINTR) {
+            *open = (errno == EAGAIN || errno == EWOULDBLOCK);
+            return total;
+        }
+    }
+}
+
+bool EpollTransport::flush(Connection *conn)
+{
+    while (conn->sendOffset < conn->sendBuffer.size()) {
+        ssize_t n = ::send(conn->fd, conn->sendBuffer.constData() + conn->sendOffset,
+                           conn->sendBuffer.size() - conn->sendOffset, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->sendOffset += static_cast<int>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // A peer that never quite catches up never empties the buffer
+            compact(conn);
+            return true;
+        } else {
+            return false;
+        }
+    }
+    
+    // Drained, an idle connection keeps no send buffer
+    conn->sendBuffer.clear();
+    conn->sendOffset = 0;
+    return true;
+}
+
+void EpollTransport::compact(Connection *conn)
+{
+    // Once the sent part is large or most of the buffer, one move is cheaper than carrying it
+    if (conn->sendOffset >= COMPACT_THRESHOLD || conn->sendOffset * 2 >= conn->sendBuffer.size()) {
+        conn->sendBuffer.remove(0, conn->sendOffset);
+        conn->sendOffset = 0;
+    }
+}
+
+void EpollTransport::failWrite(Connection *conn)
+{
+    conn->writeFailed = true;
+    conn->sendBuffer.clear();
+    conn->sendOffset = 0;
+    // Deferred, the caller still holds the connection
+    QMetaObject::invokeMethod(this, "closeById", Qt::QueuedConnection, Q_ARG(quint64, conn->id));
+}
@@ -0,0 +1,611 @@
+#include "filetransferserver.h"
+#include "tcpserver.h"
+#include "authmanager.h"
+#include "wirecodec.h"
+#include <QFile>
+#include <QDir>
+#include <QTimer>
+#include <QDateTime>
+#include <QDebug>
+
+namespace {
+    // Transfer ids name spool files, so only uuid-like ids are accepted
+    bool isValidTransferId(const QString &id)
+    {
+        if (id.isEmpty() || id.size() > 64) {
+            return false;
+        }
+        for (QChar c : id) {
+            if (!(c.isLetterOrNumber() && c.unicode() < 128) && c != QLatin1Char('-')) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+FileTransferServer::FileTransferServer(TcpServer *tcpServer, QObject *parent)
+    : QObject(parent)
+    , m_tcpServer(tcpServer)
+    , m_authManager(nullptr)
+    , m_maxFileSize(DEFAULT_MAX_FILE_SIZE)
+    , m_spoolQuota(DEFAULT_SPOOL_QUOTA)
+    , m_senderSpoolQuota(DEFAULT_SENDER_SPOOL_QUOTA)
+    , m_spoolReserved(0)
+    , m_expiryMs(DEFAULT_EXPIRY * Q_INT64_C(1000))
+    , m_expiryTimer(new QTimer(this))
+    , m_relayedBytes(0)
+    , m_spooledBytes(0)
+    , m_deliveredBytes(0)
+    , m_completed(0)
+    , m_expired(0)
+{
+    setSpoolDirectory(QDir::temp().filePath("wecompany-spool"));
+
+    m_tcpServer->dispatcher()->registerHandler(MSG_FILE, [this](const MessageHeader &header, const FrameView &payload) {
+        onFileMessage(header, payload);
+    });
+    connect(m_tcpServer, &TcpServer::clientConnected, this, &FileTransferServer::onClientConnected);
+    connect(m_tcpServer, &TcpServer::clientDisconnected, this, &FileTransferServer::onClientDisconnected);
+    connect(m_expiryTimer, &QTimer::timeout, this, &FileTransferServer::expireTransfers);
+    m_expiryTimer->start(60 * 1000);
+}
+
+FileTransferServer::~FileTransferServer()
+{
+    // Spool files stay on disk, only the handles are released
+    for (FileTransfer *transfer : m_transfers) {
+        closeSpool(transfer);
+    }
+    qDeleteAll(m_transfers);
+}
+
+bool FileTransferServer::setSpoolDirectory(const QString &path)
+{
+    QDir dir(path);
+    if (!dir.mkpath(".")) {
+        qWarning() << "Cannot create spool directory" << path;
+        return false;
+    }
+
+    QStringList stale = dir.entryList(QStringList() << "*.part", QDir::Files);
+    for (const QString &name : stale) {
+        dir.remove(name);
+    }
+    if (!stale.isEmpty()) {
+        qInfo() << "Removed" << stale.size() << "stale spool files from" << path;
+    }
+
+    m_spoolDirectory = dir.absolutePath();
+    return true;
+}
+
+void FileTransferServer::setSpoolQuota(qint64 total, qint64 perSender)
+{
+    m_spoolQuota = qMax(Q_INT64_C(0), total);
+    m_senderSpoolQuota = qMax(Q_INT64_C(0), perSender);
+}
+
+void FileTransferServer::onFileMessage(const MessageHeader &header, const FrameView &payload)
+{
+    // [Subtype (1 byte)][TransferId] then subtype specific fields
+    WireReader reader(payload);
+    quint8 subtype = 0;
+    QString transferId;
+    if (!reader.readByte(subtype) || !reader.readString(transferId)) {
+        qWarning() << "Malformed file message from" << header.userId;
+        return;
+    }
+
+    if (subtype == FILE_OFFER) {
+        onOffer(header.userId, transferId, reader);
+        return;
+    }
+
+    FileTransfer *transfer = m_transfers.value(transferId, nullptr);
+    if (!transfer) {
+        sendCancel(header.userId, transferId, QString::fromUtf8("未知的文件传输"));
+        return;
+    }
+    if (header.userId == transfer->sender || header.userId == transfer->recipient) {
+        transfer->lastActivityMs = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    quint64 offset = 0;
+    switch (subtype) {
+    case FILE_ACCEPT:
+        if (reader.readVarint(offset)) {
+            onAccept(header.userId, transfer, static_cast<qint64>(offset));
+        }
+        break;
+    case FILE_CHUNK:
+        if (reader.readVarint(offset)) {
+            // The chunk runs to the end of the frame and is never copied before the relay
+            WireView data = reader.remaining();
+            onChunk(header.userId, transfer, static_cast<qint64>(offset), data.data, data.size);
+        }
+        break;
+    case FILE_ACK:
+        if (reader.readVarint(offset)) {
+            onAck(header.userId, transfer, static_cast<qint64>(offset));
+        }
+        break;
+    case FILE_CANCEL: {
+        QString reason;
+        reader.readString(reason);
+        onCancel(header.userId, transfer, reason);
+        break;
+    }
+    default:
+        qWarning() << "Unknown file message subtype" << subtype << "from" << header.userId;
+        break;
+    }
+}
+
+void FileTransferServer::onOffer(const QString &userId, const QString &transferId, WireReader &reader)
+{
+    // [RecipientId][FileName][Size]
+    QString recipient;
+    QString fileName;
+    quint64 size = 0;
+    if (!reader.readString(recipient) || !reader.readString(fileName) || !reader.readVarint(size)) {
+        qWarning() << "Malformed file offer from" << userId;
+        return;
+    }
+
+    FileTransfer *transfer = m_transfers.value(transferId, nullptr);
+    if (transfer) {
+        if (transfer->sender != userId) {
+            sendCancel(userId, transferId, QString::fromUtf8("传输ID已被占用"));
+            return;
+        }
+
+        // The sender reconnected and repeats its offer
+        transfer->lastActivityMs = QDateTime::currentMSecsSinceEpoch();
+        switch (transfer->mode) {
+        case TRANSFER_RELAY:
+            if (isOnline(transfer->recipient)) {
+                // The recipient answers with the offset it already has
+                sendOffer(transfer->recipient, *transfer, transfer->sender);
+            } else {
+                startSpool(transfer, transfer->acked);
+            }
+            break;
+        case TRANSFER_SPOOL:
+            sendOffset(userId, FILE_ACCEPT, transferId, transfer->received);
+            break;
+        case TRANSFER_DELIVER:
+            // Fully spooled already, nothing left to upload
+            sendOffset(userId, FILE_ACK, transferId, transfer->size);
+            break;
+        }
+        return;
+    }
+
+    if (!isValidTransferId(transferId) || recipient.isEmpty() || recipient == userId
+            || size == 0 || size > static_cast<quint64>(m_maxFileSize)) {
+        sendCancel(userId, transferId, QString::fromUtf8("文件传输请求无效"));
+        return;
+    }
+    if (m_authManager && !m_authManager->isRegistered(recipient)) {
+        sendCancel(userId, transferId, QString::fromUtf8("接收者不存在"));
+        return;
+    }
+    if (m_senderTransfers.value(userId) >= MAX_TRANSFERS_PER_SENDER || m_transfers.size() >= MAX_TRANSFERS) {
+        sendCancel(userId, transferId, QString::fromUtf8("同时进行的文件传输过多"));
+        return;
+    }
+
+    transfer = new FileTransfer;
+    transfer->transferId = transferId;
+    transfer->sender = userId;
+    transfer->recipient = recipient;
+    transfer->fileName = fileName;
+    transfer->size = static_cast<qint64>(size);
+    transfer->lastActivityMs = QDateTime::currentMSecsSinceEpoch();
+    m_transfers.insert(transferId, transfer);
+    ++m_senderTransfers[userId];
+
+    qInfo() << "File transfer" << transferId << "from" << userId << "to" << recipient
+            << ":" << fileName << transfer->size << "bytes";
+
+    if (isOnline(recipient)) {
+        transfer->mode = TRANSFER_RELAY;
+        sendOffer(recipient, *transfer, userId);
+    } else {
+        startSpool(transfer, 0);
+    }
+}
+
+void FileTransferServer::onAccept(const QString &userId, FileTransfer *transfer, qint64 offset)
+{
+    if (userId != transfer->recipient || offset < 0 || offset > transfer->size) {
+        return;
+    }
+
+    if (transfer->mode == TRANSFER_RELAY) {
+        // The sender continues from wherever the recipient stands
+        transfer->received = offset;
+        transfer->acked = offset;
+        sendOffset(transfer->sender, FILE_ACCEPT, transfer->transferId, offset);
+    } else if (transfer->mode == TRANSFER_DELIVER) {
+        if (offset < transfer->spoolBase) {
+            abort(transfer, QString::fromUtf8("无法从该位置续传"));
+            return;
+        }
+        transfer->acked = offset;
+        transfer->sent = offset;
+        pump(transfer);
+    }
+}
+
+void FileTransferServer::onChunk(const QString &userId, FileTransfer *transfer, qint64 offset,
+                                 const char *data, int size)
+{
+    if (userId != transfer->sender || transfer->mode == TRANSFER_DELIVER) {
+        return;
+    }
+
+    if (size <= 0 || size > CHUNK_SIZE || offset + size > transfer->size) {
+        abort(transfer, QString::fromUtf8("文件数据块无效"));
+        return;
+    }
+
+    if (offset != transfer->received) {
+        // Duplicate or gap after a mode switch, the ack tells the sender where to continue
+        if (transfer->mode == TRANSFER_SPOOL) {
+            sendOffset(userId, FILE_ACK, transfer->transferId, transfer->received);
+        }
+        return;
+    }
+
+    if (offset + size - transfer->acked > WINDOW_SIZE) {
+        qWarning() << "File transfer" << transfer->transferId << "exceeds its window, chunk dropped";
+        return;
+    }
+
+    if (transfer->mode == TRANSFER_RELAY) {
+        // [0x01][FILE_CHUNK][TransferId][Offset][Data]
+        QByteArray id = transfer->transferId.toUtf8();
+        QByteArray message;
+        message.reserve(2 + WireWriter::varintSize(id.size()) + id.size()
+                        + WireWriter::varintSize(static_cast<quint64>(offset)) + size);
+        WireWriter(message)
+            .writeByte(MSG_FILE)
+            .writeByte(FILE_CHUNK)
+            .writeUtf8(id)
+            .writeVarint(static_cast<quint64>(offset))
+            .writeRaw(data, size);
+
+        // A recipient going offline switches the transfer to the spool and rewinds the sender
+        if (m_tcpServer->sendMessage(transfer->recipient, message)) {
+            transfer->received += size;
+            m_relayedBytes += size;
+        }
+        return;
+    }
+
+    if (!openSpool(transfer, true)
+            || !transfer->spool->seek(offset - transfer->spoolBase)
+            || transfer->spool->write(data, size) != size) {
+        qWarning() << "Spool write failed for" << transfer->transferId;
+        abort(transfer, QString::fromUtf8("服务器存储失败"));
+        return;
+    }
+
+    transfer->received += size;
+    transfer->acked = transfer->received;
+    m_spooledBytes += size;
+    sendOffset(userId, FILE_ACK, transfer->transferId, transfer->received);
+
+    if (transfer->received == transfer->size) {
+        qInfo() << "File transfer" << transfer->transferId << "spooled for" << transfer->recipient;
+        closeSpool(transfer);
+        transfer->mode = TRANSFER_DELIVER;
+        transfer->sent = transfer->spoolBase;
+        transfer->acked = transfer->spoolBase;
+        if (isOnline(transfer->recipient)) {
+            startDelivery(transfer);
+        }
+    }
+}
+
+void FileTransferServer::onAck(const QString &userId, FileTransfer *transfer, qint64 offset)
+{
+    if (userId != transfer->recipient || offset <= transfer->acked || offset > transfer->size) {
+        return;
+    }
+
+    transfer->acked = offset;
+
+    if (transfer->mode == TRANSFER_RELAY) {
+        sendOffset(transfer->sender, FILE_ACK, transfer->transferId, offset);
+    }
+
+    if (offset == transfer->size) {
+        finish(transfer, true);
+        return;
+    }
+
+    if (transfer->mode == TRANSFER_DELIVER) {
+        pump(transfer);
+    }
+}
+
+void FileTransferServer::onCancel(const QString &userId, FileTransfer *transfer, const QString &reason)
+{
+    if (userId != transfer->sender && userId != transfer->recipient) {
+        return;
+    }
+
+    const QString &peer = (userId == transfer->sender) ? transfer->recipient : transfer->sender;
+    if (isOnline(peer)) {
+        sendCancel(peer, transfer->transferId, reason);
+    }
+
+    qInfo() << "File transfer" << transfer->transferId << "cancelled by" << userId << reason;
+    finish(transfer, false);
+}
+
+void FileTransferServer::startSpool(FileTransfer *transfer, qint64 base)
+{
+    // Bytes below base already reached the recipient, only the rest is kept
+    closeSpool(transfer);
+    QFile::remove(spoolPath(*transfer));
+
+    transfer->mode = TRANSFER_SPOOL;
+    transfer->spoolBase = base;
+    transfer->received = base;
+    transfer->acked = base;
+
+    if (!reserveSpool(transfer, transfer->size - base)) {
+        qWarning() << "Spool quota exhausted, refusing" << transfer->transferId << "from" << transfer->sender;
+        abort(transfer, QString::fromUtf8("服务器存储空间不足"));
+        return;
+    }
+    if (!openSpool(transfer, true)) {
+        abort(transfer, QString::fromUtf8("服务器存储失败"));
+        return;
+    }
+
+    if (isOnline(transfer->sender)) {
+        sendOffset(transfer->sender, FILE_ACCEPT, transfer->transferId, base);
+    }
+}
+
+bool FileTransferServer::reserveSpool(FileTransfer *transfer, qint64 bytes)
+{
+    releaseSpool(transfer);
+    qint64 &sender = m_senderSpool[transfer->sender];
+    if (m_spoolReserved + bytes > m_spoolQuota || sender + bytes > m_senderSpoolQuota) {
+        if (sender == 0) {
+            m_senderSpool.remove(transfer->sender);
+        }
+        return false;
+    }
+
+    sender += bytes;
+    m_spoolReserved += bytes;
+    transfer->reserved = bytes;
+    return true;
+}
+
+void FileTransferServer::releaseSpool(FileTransfer *transfer)
+{
+    if (transfer->reserved == 0) {
+        return;
+    }
+
+    QHash<QString, qint64>::iterator it = m_senderSpool.find(transfer->sender);
+    if (it != m_senderSpool.end()) {
+        *it -= transfer->reserved;
+        if (*it <= 0) {
+            m_senderSpool.erase(it);
+        }
+    }
+    m_spoolReserved -= transfer->reserved;
+    transfer->reserved = 0;
+}
+
+void FileTransferServer::startDelivery(FileTransfer *transfer)
+{
+    // The recipient answers with FILE_ACCEPT and its resume offset
+    sendOffer(transfer->recipient, *transfer, transfer->sender);
+}
+
+void FileTransferServer::pump(FileTransfer *transfer)
+{
+    if (!isOnline(transfer->recipient) || !openSpool(transfer, false)) {
+        return;
+    }
+
+    QByteArray id = transfer->transferId.toUtf8();
+
+    // Never more than one window beyond the recipient's last ack
+    while (transfer->sent < transfer->size && transfer->sent - transfer->acked < WINDOW_SIZE) {
+        int size = static_cast<int>(qMin<qint64>(CHUNK_SIZE, transfer->size - transfer->sent));
+
+        // [0x01][FILE_CHUNK][TransferId][Offset][Data], read straight into the message
+        QByteArray message;
+        WireWriter(message)
+            .writeByte(MSG_FILE)
+            .writeByte(FILE_CHUNK)
+            .writeUtf8(id)
+            .writeVarint(static_cast<quint64>(transfer->sent));
+        int headerSize = message.size();
+        message.resize(headerSize + size);
+
+        if (!transfer->spool->seek(transfer->sent - transfer->spoolBase)
+                || transfer->spool->read(message.data() + headerSize, size) != size) {
+            qWarning() << "Spool read failed for" << transfer->transferId;
+            abort(transfer, QString::fromUtf8("服务器存储失败"));
+            return;
+        }
+
+        if (!m_tcpServer->sendMessage(transfer->recipient, message)) {
+            return;
+        }
+        transfer->sent += size;
+        m_deliveredBytes += size;
+    }
+}
+
+void FileTransferServer::finish(FileTransfer *transfer, bool completed)
+{
+    if (completed) {
+        ++m_completed;
+        qInfo() << "File transfer" << transfer->transferId << "completed," << transfer->size << "bytes";
+    }
+
+    closeSpool(transfer);
+    QFile::remove(spoolPath(*transfer));
+    releaseSpool(transfer);
+    if (--m_senderTransfers[transfer->sender] <= 0) {
+        m_senderTransfers.remove(transfer->sender);
+    }
+    m_transfers.remove(transfer->transferId);
+    delete transfer;
+}
+
+void FileTransferServer::abort(FileTransfer *transfer, const QString &reason)
+{
+    if (isOnline(transfer->sender)) {
+        sendCancel(transfer->sender, transfer->transferId, reason);
+    }
+    if (isOnline(transfer->recipient)) {
+        sendCancel(transfer->recipient, transfer->transferId, reason);
+    }
+    finish(transfer, false);
+}
+
+void FileTransferServer::onClientConnected(const QString &userId)
+{
+    for (FileTransfer *transfer : m_transfers) {
+        if (transfer->mode == TRANSFER_DELIVER && transfer->recipient == userId) {
+            startDelivery(transfer);
+        }
+    }
+}
+
+void FileTransferServer::onClientDisconnected(const QString &userId)
+{
+    // Collected first, startSpool() may abort and remove a transfer
+    QList<FileTransfer*> affected;
+    for (FileTransfer *transfer : m_transfers) {
+        if (transfer->sender == userId || transfer->recipient == userId) {
+            affected.append(transfer);
+        }
+    }
+
+    for (FileTransfer *transfer : affected) {
+        if (transfer->mode == TRANSFER_RELAY && transfer->recipient == userId) {
+            // Keep receiving from the sender, the recipient gets the rest later
+            startSpool(transfer, transfer->acked);
+        } else {
+            // Reopened on resume, an idle transfer holds no file handle
+            closeSpool(transfer);
+            if (transfer->mode == TRANSFER_DELIVER && transfer->recipient == userId) {
+                transfer->sent = transfer->acked;
+            }
+        }
+    }
+}
+
+void FileTransferServer::expireTransfers()
+{
+    if (m_expiryMs <= 0) {
+        return;
+    }
+
+    // Collected first, abort() removes the transfer
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<FileTransfer*> stale;
+    for (FileTransfer *transfer : m_transfers) {
+        if (now - transfer->lastActivityMs >= m_expiryMs) {
+            stale.append(transfer);
+        }
+    }
+
+    for (FileTransfer *transfer : stale) {
+        qInfo() << "File transfer" << transfer->transferId << "expired after"
+                << (now - transfer->lastActivityMs) / 1000 << "s without activity";
+        ++m_expired;
+        abort(transfer, QString::fromUtf8("文件传输已过期"));
+    }
+}
+
+bool FileTransferServer::openSpool(FileTransfer *transfer, bool write)
+{
+    if (transfer->spool) {
+        if (write == ((transfer->spool->openMode() & QIODevice::WriteOnly) != 0)) {
+            return true;
+        }
+        closeSpool(transfer);
+    }
+
+    transfer->spool = new QFile(spoolPath(*transfer));
+    if (!transfer->spool->open(write ? QIODevice::ReadWrite : QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open spool file" << transfer->spool->fileName()
+                   << ":" << transfer->spool->errorString();
+        closeSpool(transfer);
+        return false;
+    }
+    return true;
+}
+
+void FileTransferServer::closeSpool(FileTransfer *transfer)
+{
+    delete transfer->spool;
+    transfer->spool = nullptr;
+}
+
+QString FileTransferServer::spoolPath(const FileTransfer &transfer) const
+{
+    return m_spoolDirectory + QLatin1Char('/') + transfer.transferId + QLatin1String(".part");
+}
+
+bool FileTransferServer::isOnline(const QString &userId) const
+{
+    return m_tcpServer->sessionOf(userId) != INVALID_SESSION;
+}
+
+void FileTransferServer::sendOffer(const QString &userId, const FileTransfer &transfer, const QString &peerId)
+{
+    // [0x01][FILE_OFFER][TransferId][SenderId][FileName][Size]
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_FILE)
+        .writeByte(FILE_OFFER)
+        .writeString(transfer.transferId)
+        .writeString(peerId)
+        .writeString(transfer.fileName)
+        .writeVarint(static_cast<quint64>(transfer.size));
+
+    m_tcpServer->sendMessage(userId, message);
+}
+
+void FileTransferServer::sendOffset(const QString &userId, FileFrameType type, const QString &transferId, qint64 offset)
+{
+    // [0x01][FILE_ACCEPT | FILE_ACK][TransferId][Offset]
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_FILE)
+        .writeByte(type)
+        .writeString(transferId)
+        .writeVarint(static_cast<quint64>(offset));
+
+    m_tcpServer->sendMessage(userId, message);
+}
+
+void FileTransferServer::sendCancel(const QString &userId, const QString &transferId, const QString &reason)
+{
+    // [0x01][FILE_CANCEL][TransferId][Reason]
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_FILE)
+        .writeByte(FILE_CANCEL)
+        .writeString(transferId)
+        .writeString(reason);
+
+    m_tcpServer->sendMessage(userId, message);
+}
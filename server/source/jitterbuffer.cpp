@@ -0,0 +1,152 @@
+#include "jitterbuffer.h"
+#include <QtMath>
+
+JitterBuffer::JitterBuffer(int maxDelayMs)
+    : m_maxDelayMs(maxDelayMs)
+    , m_count(0)
+    , m_nextSequence(0)
+    , m_nextDueMs(0)
+    , m_periodMs(20)        // Until learned, what audio codecs typically send
+    , m_jitterMs(0)
+    , m_lastSequence(0)
+    , m_lastArrivalMs(0)
+    , m_released(0)
+    , m_late(0)
+    , m_skipped(0)
+    , m_delaySumMs(0)
+    , m_maxHeldMs(0)
+{
+}
+
+bool JitterBuffer::push(quint32 sequence, const QByteArray &packet, qint64 nowMs)
+{
+    updateJitter(sequence, nowMs);
+
+    if (m_nextSequence == 0) {
+        // Slots only for streams that send, not for every party of every call
+        m_slots.resize(CAPACITY);
+        restart(sequence, nowMs);
+    } else if (sequence < m_nextSequence) {
+        ++m_late;
+        return false;
+    } else if (sequence - m_nextSequence >= static_cast<quint32>(CAPACITY)) {
+        // A jump no buffer of this size bridges, e.g. a sender that restarted
+        restart(sequence, nowMs);
+    } else if (m_count == 0 && nowMs > m_nextDueMs) {
+        // Ran dry and this one is behind the clock: buffer up again from here
+        m_skipped += sequence - m_nextSequence;
+        m_nextSequence = sequence;
+        m_nextDueMs = nowMs + targetDelayMs();
+    }
+
+    Slot &slot = m_slots[sequence % CAPACITY];
+    if (slot.packet.isNull()) {
+        ++m_count;
+    }
+    slot.sequence = sequence;
+    slot.arrivedMs = nowMs;
+    slot.packet = packet;
+    return true;
+}
+
+bool JitterBuffer::pop(qint64 nowMs, QByteArray &packet)
+{
+    while (m_count > 0) {
+        Slot &slot = m_slots[m_nextSequence % CAPACITY];
+        bool present = !slot.packet.isNull();
+        if (present && nowMs - slot.arrivedMs >= m_maxDelayMs) {
+            // Held as long as allowed, the clock goes on from here
+            m_nextDueMs = qMin(m_nextDueMs, nowMs);
+        }
+        if (nowMs < m_nextDueMs) {
+            return false;
+        }
+
+        // More queued than the jitter calls for: release a little faster
+        // until the extra delay is gone, instead of all at once
+        double step = m_periodMs;
+        if (m_count * m_periodMs > targetDelayMs() + m_periodMs) {
+            step *= 0.75;
+        }
+        ++m_nextSequence;
+        m_nextDueMs += qMax<qint64>(1, qRound64(step));
+        if (!present) {
+            ++m_skipped;
+            continue;
+        }
+
+        packet.swap(slot.packet);
+        slot.packet = QByteArray();
+        --m_count;
+        int held = static_cast<int>(nowMs - slot.arrivedMs);
+        m_delaySumMs += held;
+        m_maxHeldMs = qMax(m_maxHeldMs, held);
+        ++m_released;
+        return true;
+    }
+    return false;
+}
+
+qint64 JitterBuffer::nextDueMs() const
+{
+    if (m_count == 0) {
+        return -1;
+    }
+    const Slot &slot = m_slots.at(m_nextSequence % CAPACITY);
+    if (!slot.packet.isNull()) {
+        return qMin(m_nextDueMs, slot.arrivedMs + m_maxDelayMs);
+    }
+    return m_nextDueMs;
+}
+
+void JitterBuffer::updateJitter(quint32 sequence, qint64 nowMs)
+{
+    if (m_lastSequence != 0 && sequence > m_lastSequence) {
+        quint32 gap = sequence - m_lastSequence;
+        double arrivalDelta = nowMs - m_lastArrivalMs;
+        // The packet interval is the long-run spacing of arrivals, a burst
+        // and the pause after it average out
+        if (gap <= 16) {
+            m_periodMs += (qBound(1.0, arrivalDelta / gap, 200.0) - m_periodMs) / 32;
+        }
+        // RFC 3550: how far the spacing of arrivals strays from the media clock
+        double deviation = arrivalDelta - gap * m_periodMs;
+        m_jitterMs += (qAbs(deviation) - m_jitterMs) / 16;
+    }
+    if (sequence > m_lastSequence) {
+        m_lastSequence = sequence;
+        m_lastArrivalMs = nowMs;
+    }
+}
+
+void JitterBuffer::restart(quint32 sequence, qint64 nowMs)
+{
+    for (Slot &slot : m_slots) {
+        slot.packet = QByteArray();
+    }
+    m_skipped += m_count;
+    m_count = 0;
+    m_nextSequence = sequence;
+    m_nextDueMs = nowMs + targetDelayMs();
+}
+
+int JitterBuffer::targetDelayMs() const
+{
+    // Three times the jitter covers nearly all arrivals of a steady stream
+    return qMin(m_maxDelayMs, qCeil(3 * m_jitterMs));
+}
+
+JitterStatistics JitterBuffer::statistics() const
+{
+    JitterStatistics stats;
+    stats.jitterMs = m_jitterMs;
+    stats.periodMs = m_periodMs;
+    stats.targetDelayMs = targetDelayMs();
+    stats.averageDelayMs = m_released > 0 ? static_cast<double>(m_delaySumMs) / m_released : 0;
+    stats.maxDelayMs = m_maxHeldMs;
+    stats.released = m_released;
+    stats.late = m_late;
+    stats.skipped = m_skipped;
+    stats.buffered = m_count;
+    return stats;
+}
@@ -0,0 +1,315 @@
+#include "mediarelay.h"
+#include "tcpserver.h"
+#include "wirecodec.h"
+#include <QUdpSocket>
+#include <QRandomGenerator>
+#include <QMutexLocker>
+#include <QDebug>
+
+MediaRelay::MediaRelay(TcpServer *tcpServer)
+    : QObject(nullptr)
+    , m_tcpServer(tcpServer)
+    , m_socket(nullptr)
+    , m_port(0)
+    , m_nextSessionId(QRandomGenerator::global()->generate())
+    , m_lossPerMille(0)
+    , m_jitterMaxMs(0)
+    , m_pumpTimer(nullptr)
+    , m_pumpAtMs(-1)
+    , m_statisticsAtMs(0)
+    , m_packets(0)
+    , m_forwarded(0)
+    , m_viaTcp(0)
+    , m_rejected(0)
+    , m_replayed(0)
+    , m_dropped(0)
+    , m_late(0)
+    , m_sessionCount(0)
+{
+}
+
+MediaRelay::~MediaRelay()
+{
+    stop();
+}
+
+bool MediaRelay::start(quint16 port)
+{
+    if (isRunning()) {
+        return true;
+    }
+
+    // Bound here so the caller learns about a taken port, the socket then
+    // follows this object to the relay thread
+    m_socket = new QUdpSocket(this);
+    if (!m_socket->bind(QHostAddress::Any, port)) {
+        qWarning() << "Failed to bind the media relay to port" << port << ":" << m_socket->errorString();
+        delete m_socket;
+        m_socket = nullptr;
+        return false;
+    }
+    // Bursts of video packets outrun one scheduling slice of the relay thread
+    m_socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 1024 * 1024);
+    connect(m_socket, &QUdpSocket::readyRead, this, &MediaRelay::onReadyRead);
+    // Releases paced packets; millisecond accuracy is what the media clock needs
+    m_pumpTimer = new QTimer(this);
+    m_pumpTimer->setSingleShot(true);
+    m_pumpTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_pumpTimer, &QTimer::timeout, this, &MediaRelay::pump);
+    m_pumpAtMs = -1;
+    m_clock.start();
+
+    m_port = m_socket->localPort();
+    moveToThread(&m_thread);
+    m_thread.setObjectName(QStringLiteral("media-relay"));
+    m_thread.start();
+    qInfo() << "Media relay listening on UDP port" << m_port;
+    return true;
+}
+
+void MediaRelay::stop()
+{
+    if (!isRunning()) {
+        return;
+    }
+    // The socket notifier must go away on the thread it belongs to
+    QMetaObject::invokeMethod(this, "closeSocket", Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+    m_port = 0;
+}
+
+void MediaRelay::closeSocket()
+{
+    delete m_socket;
+    m_socket = nullptr;
+    delete m_pumpTimer;
+    m_pumpTimer = nullptr;
+    m_sessions.clear();
+    m_pacedStreams.clear();
+    m_sessionCount.store(0);
+    refreshJitterStatistics();
+}
+
+MediaRelay::Session MediaRelay::openSession(const QString &callId, const QString &caller, const QString &callee)
+{
+    Session session;
+    do {
+        session.id = m_nextSessionId.fetchAndAddRelaxed(1);
+    } while (session.id == 0);
+    session.key = MediaPacket::generateKey();
+
+    QMetaObject::invokeMethod(this, "addSession", Qt::QueuedConnection,
+                              Q_ARG(quint32, session.id), Q_ARG(QByteArray, session.key),
+                              Q_ARG(QString, callId), Q_ARG(QString, caller), Q_ARG(QString, callee));
+    return session;
+}
+
+void MediaRelay::closeSession(quint32 sessionId)
+{
+    QMetaObject::invokeMethod(this, "removeSession", Qt::QueuedConnection, Q_ARG(quint32, sessionId));
+}
+
+void MediaRelay::addSession(quint32 sessionId, const QByteArray &key, const QString &callId,
+                            const QString &caller, const QString &callee)
+{
+    RelaySession &session = m_sessions[sessionId];
+    session.key = key;
+    session.callId = callId;
+    session.parties[MediaPacket::PARTY_CALLER].userId = caller;
+    session.parties[MediaPacket::PARTY_CALLEE].userId = callee;
+    int jitterMaxMs = m_jitterMaxMs.load();
+    session.paced = jitterMaxMs > 0;
+    if (session.paced) {
+        session.parties[MediaPacket::PARTY_CALLER].buffer = JitterBuffer(jitterMaxMs);
+        session.parties[MediaPacket::PARTY_CALLEE].buffer = JitterBuffer(jitterMaxMs);
+    }
+    m_sessionCount.store(m_sessions.size());
+}
+
+void MediaRelay::removeSession(quint32 sessionId)
+{
+    // Whatever is still buffered goes with it, pump() forgets the streams
+    QHash<quint32, RelaySession>::const_iterator it = m_sessions.constFind(sessionId);
+    bool paced = it != m_sessions.constEnd() && it->paced;
+    m_sessions.remove(sessionId);
+    m_sessionCount.store(m_sessions.size());
+    if (paced) {
+        refreshJitterStatistics();
+    }
+}
+
+void MediaRelay::onReadyRead()
+{
+    QByteArray datagram;
+    QHostAddress sender;
+    quint16 senderPort = 0;
+    while (m_socket && m_socket->hasPendingDatagrams()) {
+        datagram.resize(qMax<qint64>(0, m_socket->pendingDatagramSize()));
+        qint64 size = m_socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
+        if (size < 0) {
+            break;
+        }
+        datagram.resize(static_cast<int>(size));
+        m_packets.ref();
+        relay(datagram, sender, senderPort);
+    }
+}
+
+void MediaRelay::relay(const QByteArray &datagram, const QHostAddress &sender, quint16 senderPort)
+{
+    MediaPacket packet;
+    QHash<quint32, RelaySession>::iterator it = m_sessions.end();
+    if (MediaPacket::parse(datagram.constData(), datagram.size(), packet)) {
+        it = m_sessions.find(packet.sessionId);
+    }
+    if (it == m_sessions.end() || !MediaPacket::verify(datagram.constData(), datagram.size(), it->key)) {
+        m_rejected.ref();
+        return;
+    }
+
+    Party &from = it->parties[packet.party];
+    if (!from.window.accept(packet.sequence)) {
+        m_replayed.ref();
+        return;
+    }
+    // Authenticated and fresh, so a new address is a NAT rebinding, not a spoof
+    from.address = sender;
+    from.port = senderPort;
+
+    if (packet.mediaSize == 0) {
+        // Echoed so the party knows the UDP path works before switching to it
+        m_socket->writeDatagram(datagram, sender, senderPort);
+        return;
+    }
+
+    int lossPerMille = m_lossPerMille.load();
+    if (lossPerMille > 0 && QRandomGenerator::global()->bounded(1000) < lossPerMille) {
+        m_dropped.ref();
+        return;
+    }
+
+    if (it->paced) {
+        if (!from.buffer.push(packet.sequence, datagram, m_clock.elapsed())) {
+            m_late.ref();
+            return;
+        }
+        m_pacedStreams.insert((static_cast<quint64>(packet.sessionId) << 1) | packet.party);
+        schedulePump(from.buffer.nextDueMs());
+        return;
+    }
+    deliver(*it, packet.party, datagram);
+}
+
+void MediaRelay::deliver(const RelaySession &session, quint8 fromParty, const QByteArray &datagram)
+{
+    const Party &to = session.parties[1 - fromParty];
+    if (to.address.isNull()) {
+        MediaPacket packet;
+        MediaPacket::parse(datagram.constData(), datagram.size(), packet);
+        sendOverTcp(session, to, packet);
+    } else if (m_socket->writeDatagram(datagram, to.address, to.port) == datagram.size()) {
+        m_forwarded.ref();
+    } else {
+        m_dropped.ref();
+    }
+}
+
+void MediaRelay::pump()
+{
+    m_pumpAtMs = -1;
+    qint64 now = m_clock.elapsed();
+    qint64 next = -1;
+    QByteArray datagram;
+    for (QSet<quint64>::iterator it = m_pacedStreams.begin(); it != m_pacedStreams.end(); ) {
+        QHash<quint32, RelaySession>::iterator session = m_sessions.find(static_cast<quint32>(*it >> 1));
+        if (session == m_sessions.end()) {
+            it = m_pacedStreams.erase(it);
+            continue;
+        }
+        
+        quint8 party = static_cast<quint8>(*it & 1);
+        JitterBuffer &buffer = session->parties[party].buffer;
+        while (buffer.pop(now, datagram)) {
+            deliver(*session, party, datagram);
+        }
+        qint64 due = buffer.nextDueMs();
+        if (due < 0) {
+            it = m_pacedStreams.erase(it);
+            continue;
+        }
+        next = (next < 0) ? due : qMin(next, due);
+        ++it;
+    }
+    
+    schedulePump(next);
+    if (now - m_statisticsAtMs >= 1000) {
+        refreshJitterStatistics();
+    }
+}
+
+void MediaRelay::schedulePump(qint64 dueMs)
+{
+    // One timer for all streams, set for the earliest packet due
+    if (dueMs < 0 || !m_pumpTimer || (m_pumpAtMs >= 0 && m_pumpAtMs <= dueMs)) {
+        return;
+    }
+    m_pumpAtMs = dueMs;
+    m_pumpTimer->start(static_cast<int>(qMax<qint64>(0, dueMs - m_clock.elapsed())));
+}
+
+void MediaRelay::refreshJitterStatistics()
+{
+    QVector<CallJitterStatistics> calls;
+    for (QHash<quint32, RelaySession>::const_iterator it = m_sessions.constBegin(); it != m_sessions.constEnd(); ++it) {
+        if (!it->paced) {
+            continue;
+        }
+        CallJitterStatistics call;
+        call.callId = it->callId;
+        call.parties[MediaPacket::PARTY_CALLER] = it->parties[MediaPacket::PARTY_CALLER].buffer.statistics();
+        call.parties[MediaPacket::PARTY_CALLEE] = it->parties[MediaPacket::PARTY_CALLEE].buffer.statistics();
+        calls.append(call);
+    }
+    m_statisticsAtMs = m_clock.isValid() ? m_clock.elapsed() : 0;
+    
+    QMutexLocker locker(&m_statisticsMutex);
+    m_jitterStatistics.swap(calls);
+}
+
+QVector<CallJitterStatistics> MediaRelay::jitterStatistics() const
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    return m_jitterStatistics;
+}
+
+void MediaRelay::sendOverTcp(const RelaySession &session, const Party &recipient, const MediaPacket &packet)
+{
+    // Same frame VideoCallServer relays: [0x06][CallId][Media]
+    QByteArray callIdData = session.callId.toUtf8();
+    QByteArray message;
+    message.reserve(1 + WireWriter::varintSize(callIdData.size()) + callIdData.size() + packet.mediaSize);
+    WireWriter(message)
+        .writeByte(MSG_MEDIA_DATA)
+        .writeUtf8(callIdData)
+        .writeRaw(packet.media, packet.mediaSize);
+    if (m_tcpServer->sendMessage(recipient.userId, message)) {
+        m_viaTcp.ref();
+    } else {
+        m_dropped.ref();
+    }
+}
+
+RelayStatistics MediaRelay::statistics() const
+{
+    RelayStatistics stats;
+    stats.packets = m_packets.load();
+    stats.forwarded = m_forwarded.load();
+    stats.viaTcp = m_viaTcp.load();
+    stats.rejected = m_rejected.load();
+    stats.replayed = m_replayed.load();
+    stats.dropped = m_dropped.load();
+    stats.late = m_late.load();
+    stats.sessions = m_sessionCount.load();
+    return stats;
+}
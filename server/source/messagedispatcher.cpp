@@ -0,0 +1,70 @@
+#include "messagedispatcher.h"
+#include <QElapsedTimer>
+
+MessageDispatcher::MessageDispatcher(QObject *parent)
+    : QObject(parent)
+    , m_unhandled(0)
+{
+    qRegisterMetaType<InboundBatch>("InboundBatch");
+}
+
+void MessageDispatcher::registerHandler(int type, const MessageHandler &handler)
+{
+    if (type < 0 || type >= TYPE_COUNT) {
+        return;
+    }
+    m_handlers[type].append(handler);
+}
+
+bool MessageDispatcher::hasHandler(int type) const
+{
+    return type >= 0 && type < TYPE_COUNT && !m_handlers[type].isEmpty();
+}
+
+void MessageDispatcher::dispatch(const MessageHeader &header, const FrameView &payload)
+{
+    const QVector<MessageHandler> &handlers = m_handlers[header.type];
+    if (handlers.isEmpty()) {
+        ++m_unhandled;
+        return;
+    }
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    for (const MessageHandler &handler : handlers) {
+        handler(header, payload);
+    }
+    
+    qint64 elapsed = timer.nsecsElapsed();
+    DispatchStatistics &stats = m_statistics[header.type];
+    ++stats.calls;
+    stats.totalNs += elapsed;
+    stats.maxNs = qMax(stats.maxNs, elapsed);
+}
+
+void MessageDispatcher::dispatchBatch(const InboundBatch &batch)
+{
+    int start = 0;
+    for (int i = 0; i < batch.headers.size(); ++i) {
+        const MessageHeader &header = batch.headers.at(i);
+        FrameView payload;
+        if (header.payloadBuffer.isNull()) {
+            payload.data = batch.payloads.constData() + start;
+            payload.size = batch.ends.at(i) - start;
+        } else {
+            payload.data = header.payloadBuffer.constData();
+            payload.size = header.payloadBuffer.size();
+        }
+        dispatch(header, payload);
+        start = batch.ends.at(i);
+    }
+}
+
+DispatchStatistics MessageDispatcher::statistics(int type) const
+{
+    if (type < 0 || type >= TYPE_COUNT) {
+        return DispatchStatistics();
+    }
+    return m_statistics[type];
+}
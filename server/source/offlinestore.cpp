@@ -0,0 +1,90 @@
+#include "offlinestore.h"
+#include <QDebug>
+
+OfflineStore::OfflineStore(QObject *parent)
+    : QObject(parent)
+    , m_database(nullptr)
+{
+}
+
+OfflineStore::~OfflineStore()
+{
+    close();
+}
+
+void OfflineStore::open(const QString &host, int port, const QString &dbName,
+                        const QString &user, const QString &password)
+{
+    close();
+    
+    // Created here so the connection belongs to the store's thread
+    m_database = new DatabaseManager(this);
+    if (!m_database->connectToDatabase(host, port, dbName, user, password, "offline-store")) {
+        qWarning() << "Offline store disabled, messages to offline users will be dropped";
+        delete m_database;
+        m_database = nullptr;
+    }
+}
+
+void OfflineStore::close()
+{
+    delete m_database;
+    m_database = nullptr;
+}
+
+void OfflineStore::saveMessages(const QList<OfflineMessage> &messages)
+{
+    if (!m_database) {
+        qWarning() << "Offline store not open, dropping" << messages.size() << "messages";
+        emit messagesSaved(0, messages.size());
+        return;
+    }
+    
+    int saved = m_database->saveOfflineMessages(messages);
+    if (saved < messages.size()) {
+        qWarning() << "Failed to persist" << (messages.size() - saved) << "of" << messages.size()
+                   << "offline messages";
+    }
+    emit messagesSaved(saved, messages.size() - saved);
+}
+
+void OfflineStore::loadBacklog(const QString &userId, bool markDelivered)
+{
+    quint64 lastSequence = 0;
+    
+    // Chunked so a long backlog starts flowing before the last row is read
+    while (m_database) {
+        QList<OfflineMessage> messages = m_database->getOfflineMessages(userId, BACKLOG_CHUNK, lastSequence);
+        if (messages.isEmpty()) {
+            break;
+        }
+        
+        if (markDelivered && !m_database->markMessagesAsDelivered(userId, messages.first().sequence,
+                                                                  messages.last().sequence)) {
+            break;   // Would deliver the same rows again on the next login
+        }
+        
+        lastSequence = messages.last().sequence;
+        emit backlogLoaded(userId, messages);
+        
+        if (messages.size() < BACKLOG_CHUNK) {
+            break;
+        }
+    }
+    
+    emit backlogFinished(userId, lastSequence);
+}
+
+void OfflineStore::retire(const QString &userId, const AckRanges &ranges)
+{
+    if (!m_database) {
+        return;
+    }
+    
+    for (const AckRanges::Range &range : ranges.ranges()) {
+        if (!m_database->markMessagesAsDelivered(userId, range.first, range.last)) {
+            qWarning() << "Failed to retire acknowledged messages of" << userId;
+            return;
+        }
+    }
+}
@@ -0,0 +1,293 @@
+#include "outboundqueue.h"
+#include "framedecoder.h"
+#include "tcpserver.h"
+#include "batchenvelope.h"
+#include "framecompression.h"
+#include <QElapsedTimer>
+#include <cstring>
+
+// Shared by all queues and threads, only read after the first call
+static qint64 monotonicNs()
+{
+    static QElapsedTimer clock;
+    static bool started = (clock.start(), true);
+    Q_UNUSED(started);
+    return clock.nsecsElapsed();
+}
+
+OutboundQueue::OutboundQueue(const OutboundLimits &limits)
+    : m_limits(limits), m_frameCount(0), m_bytes(0), m_mediaBytes(0), m_dropped(0)
+{
+}
+
+OverflowPolicy OutboundQueue::policyFor(quint8 msgType)
+{
+    switch (msgType) {
+        case MSG_CALL_REQUEST:
+        case MSG_CALL_ACCEPT:
+        case MSG_CALL_REJECT:
+        case MSG_CALL_END:
+        case MSG_HEARTBEAT:
+        case MSG_ROOM:
+            return OverflowKeep;
+        case MSG_MEDIA_DATA:
+        case MSG_ROOM_MEDIA:
+        case MSG_ROOM_AUDIO:
+            return OverflowDropStale;
+        default:
+            return OverflowDisconnect;
+    }
+}
+
+OutboundLane OutboundQueue::laneFor(quint8 msgType)
+{
+    switch (msgType & ~FrameCompression::COMPRESSED_FLAG) {
+        case MSG_CALL_REQUEST:
+        case MSG_CALL_ACCEPT:
+        case MSG_CALL_REJECT:
+        case MSG_CALL_END:
+        case MSG_HEARTBEAT:
+        case MSG_AUTH_RESPONSE:
+        case MSG_ROOM:
+            return LaneControl;
+        case MSG_MEDIA_DATA:
+        case MSG_ROOM_MEDIA:
+        case MSG_ROOM_AUDIO:
+        case MSG_FILE:
+        case MSG_OFFLINE_BATCH:
+            return LaneBulk;
+        default:
+            return LaneNormal;
+    }
+}
+
+OutboundQueue::EnqueueResult OutboundQueue::enqueue(const QByteArray &body)
+{
+    if (body.isEmpty()) {
+        return DroppedNew;
+    }
+
+    return append(QByteArray(), body, static_cast<quint8>(body.at(0)), false, 0);
+}
+
+OutboundQueue::EnqueueResult OutboundQueue::enqueue(const QByteArray &prefix, const QByteArray &body,
+                                                    quint32 stream)
+{
+    const QByteArray &head = prefix.isEmpty() ? body : prefix;
+    if (head.isEmpty()) {
+        return DroppedNew;
+    }
+
+    return append(prefix, body, static_cast<quint8>(head.at(0)), false, stream);
+}
+
+OutboundQueue::EnqueueResult OutboundQueue::enqueueEncoded(const QByteArray &frame)
+{
+    if (frame.size() <= FrameDecoder::HEADER_SIZE) {
+        return DroppedNew;
+    }
+
+    return append(QByteArray(), frame, static_cast<quint8>(frame.at(FrameDecoder::HEADER_SIZE)), true, 0);
+}
+
+OutboundQueue::EnqueueResult OutboundQueue::append(const QByteArray &prefix, const QByteArray &data,
+                                                   quint8 type, bool encoded, quint32 stream)
+{
+    qint64 size = prefix.size() + data.size() + (encoded ? 0 : FrameDecoder::HEADER_SIZE);
+    EnqueueResult result = Queued;
+
+    switch (policyFor(type)) {
+        case OverflowKeep:
+        case OverflowDisconnect:
+            // Signaling is never dropped on its own, but a receiver that lets it
+            // pile up past the hard limit is as dead as any other
+            if (m_bytes + size > m_limits.hardLimit) {
+                return Overflow;
+            }
+            break;
+
+        case OverflowDropStale:
+            // The stream first, what it drops may already bring the total under budget
+            if (stream != 0 && m_streamBytes.value(stream) + size > m_limits.streamBudget) {
+                dropStaleStream(stream, size);
+                result = DroppedStale;
+            }
+            if (m_mediaBytes + size > m_limits.mediaBudget) {
+                // A late video frame is worth less than a fresh one; the newest
+                // frame is always kept even when it alone exceeds the budget
+                dropStaleMedia(size);
+                result = DroppedStale;
+            }
+            break;
+    }
+
+    Frame frame;
+    frame.prefix = prefix;
+    frame.data = data;
+    frame.type = type;
+    frame.stream = isMedia(type) ? stream : 0;
+    frame.encoded = encoded;
+    frame.queuedAt = monotonicNs();
+    m_lanes[laneFor(type)].append(frame);
+
+    ++m_frameCount;
+    m_bytes += size;
+    if (isMedia(type)) {
+        m_mediaBytes += size;
+        if (frame.stream != 0) {
+            m_streamBytes[frame.stream] += size;
+        }
+    }
+    return result;
+}
+
+void OutboundQueue::dropStaleMedia(qint64 incoming)
+{
+    QList<Frame> &frames = m_lanes[LaneBulk];
+    for (int i = 0; i < frames.size() && m_mediaBytes + incoming > m_limits.mediaBudget; ) {
+        if (!isMedia(frames.at(i).type)) {
+            ++i;
+            continue;
+        }
+
+        release(frames.at(i));
+        ++m_dropped;
+        frames.removeAt(i);
+    }
+}
+
+void OutboundQueue::dropStaleStream(quint32 stream, qint64 incoming)
+{
+    QList<Frame> &frames = m_lanes[LaneBulk];
+    for (int i = 0; i < frames.size() && m_streamBytes.value(stream) + incoming > m_limits.streamBudget; ) {
+        if (frames.at(i).stream != stream) {
+            ++i;
+            continue;
+        }
+
+        release(frames.at(i));
+        ++m_dropped;
+        frames.removeAt(i);
+    }
+}
+
+void OutboundQueue::release(const Frame &frame)
+{
+    int size = frame.wireSize();
+    m_bytes -= size;
+    --m_frameCount;
+    if (isMedia(frame.type)) {
+        m_mediaBytes -= size;
+    }
+    if (frame.stream != 0) {
+        QHash<quint32, qint64>::iterator it = m_streamBytes.find(frame.stream);
+        if (it != m_streamBytes.end() && (*it -= size) <= 0) {
+            m_streamBytes.erase(it);
+        }
+    }
+}
+
+int OutboundQueue::takeBatch(QByteArray &batch, bool envelope, bool bulk, LaneStatistics *sent)
+{
+    qint64 now = monotonicNs();
+    int lanes = bulk ? LANE_COUNT : LaneBulk;
+    int taken = 0;
+
+    for (int lane = 0; lane < lanes; ++lane) {
+        taken += takeLane(batch, lane, envelope, now, sent);
+        // Full: lower lanes do not get to fill the gap a larger frame left
+        if (!m_lanes[lane].isEmpty()) {
+            break;
+        }
+    }
+
+    return taken;
+}
+
+int OutboundQueue::takeLane(QByteArray &batch, int lane, bool envelope, qint64 now, LaneStatistics *sent)
+{
+    QList<Frame> &frames = m_lanes[lane];
+    int taken = 0;
+
+    while (!frames.isEmpty()) {
+        const Frame &frame = frames.first();
+        int size = frame.wireSize();
+        if (!batch.isEmpty() && batch.size() + size > m_limits.maxBatchBytes) {
+            break;
+        }
+
+        // A lone small frame is cheaper without the envelope
+        if (envelope && frames.size() > 1 && BatchEnvelope::isBatchable(frame.bodySize())
+                && BatchEnvelope::isBatchable(frames.at(1).bodySize())) {
+            taken += takeEnvelope(batch, lane, now, sent);
+            continue;
+        }
+
+        int offset = batch.size();
+        batch.resize(offset + size);
+        if (frame.encoded) {
+            memcpy(batch.data() + offset, frame.data.constData(), size);
+        } else {
+            FrameDecoder::writeHeader(batch.data() + offset, static_cast<quint32>(frame.bodySize()));
+            frame.copyBody(batch.data() + offset + FrameDecoder::HEADER_SIZE);
+        }
+
+        removeFirst(lane, now, sent);
+        ++taken;
+    }
+
+    return taken;
+}
+
+int OutboundQueue::takeEnvelope(QByteArray &batch, int lane, qint64 now, LaneStatistics *sent)
+{
+    // [Length][0x0C] first, the length is patched once the entries are in
+    int start = batch.size();
+    batch.resize(start + FrameDecoder::HEADER_SIZE + 1);
+    batch[start + FrameDecoder::HEADER_SIZE] = static_cast<char>(MSG_BATCH);
+
+    QList<Frame> &frames = m_lanes[lane];
+    int taken = 0;
+    while (!frames.isEmpty()) {
+        const Frame &frame = frames.first();
+        int bodySize = frame.bodySize();
+        if (!BatchEnvelope::isBatchable(bodySize)) {
+            break;
+        }
+        if (taken > 0 && batch.size() + BatchEnvelope::entrySize(bodySize) > m_limits.maxBatchBytes) {
+            break;
+        }
+
+        WireWriter(batch).writeVarint(static_cast<quint64>(bodySize));
+        int offset = batch.size();
+        batch.resize(offset + bodySize);
+        frame.copyBody(batch.data() + offset);
+        removeFirst(lane, now, sent);
+        ++taken;
+    }
+
+    FrameDecoder::writeHeader(batch.data() + start,
+                              static_cast<quint32>(batch.size() - start - FrameDecoder::HEADER_SIZE));
+    return taken;
+}
+
+void OutboundQueue::Frame::copyBody(char *out) const
+{
+    if (encoded) {
+        memcpy(out, data.constData() + FrameDecoder::HEADER_SIZE, data.size() - FrameDecoder::HEADER_SIZE);
+        return;
+    }
+    memcpy(out, prefix.constData(), prefix.size());
+    memcpy(out + prefix.size(), data.constData(), data.size());
+}
+
+void OutboundQueue::removeFirst(int lane, qint64 now, LaneStatistics *sent)
+{
+    QList<Frame> &frames = m_lanes[lane];
+    const Frame &frame = frames.first();
+    release(frame);
+    if (sent) {
+        sent[lane].add(now - frame.queuedAt);
+    }
+    frames.removeFirst();
+}
@@ -0,0 +1,173 @@
+#include "qttransport.h"
+#include "serverworker.h"
+#include <QTcpSocket>
+#include <QSslSocket>
+#include <QHostAddress>
+#include <QDebug>
+
+QtTransport::QtTransport(TransportHandler *handler, const TlsContext &tls, QObject *parent)
+    : QObject(parent)
+    , m_handler(handler)
+    , m_tls(tls)
+    , m_completedHandshakes(0)
+    , m_failedHandshakes(0)
+    , m_handshakeNs(0)
+{
+    m_clock.start();
+}
+
+QtTransport::~QtTransport()
+{
+    // Sockets are children and go with us, without reporting the close
+    for (QTcpSocket *socket : m_connections.keys()) {
+        socket->disconnect(this);
+    }
+}
+
+bool QtTransport::adopt(Connection *conn, qintptr socketDescriptor)
+{
+    QSslSocket *sslSocket = m_tls.isEnabled() ? new QSslSocket(this) : nullptr;
+    QTcpSocket *socket = sslSocket ? sslSocket : new QTcpSocket(this);
+    
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        qWarning() << "Failed to set socket descriptor:" << socket->errorString();
+        delete socket;
+        return false;
+    }
+    
+    conn->socket = socket;
+    conn->peerAddress = socket->peerAddress().toString();
+    conn->peerPort = socket->peerPort();
+    m_connections.insert(socket, conn);
+    
+    connect(socket, &QTcpSocket::readyRead, this, &QtTransport::onReadyRead);
+    connect(socket, &QTcpSocket::disconnected, this, &QtTransport::onDisconnected);
+    connect(socket, &QTcpSocket::bytesWritten, this, &QtTransport::onBytesWritten);
+    connect(socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+            this, &QtTransport::onError);
+    
+    if (sslSocket) {
+        // readyRead only carries decrypted bytes, nothing reaches the decoder before this completes
+        connect(sslSocket, &QSslSocket::encrypted, this, &QtTransport::onEncrypted);
+        m_tls.prepare(sslSocket);
+        m_handshakes.insert(socket, m_clock.nsecsElapsed());
+        sslSocket->startServerEncryption();
+    }
+    return true;
+}
+
+void QtTransport::write(Connection *conn, const QByteArray &data)
+{
+    conn->socket->write(data);
+}
+
+qint64 QtTransport::pendingWriteBytes(const Connection *conn) const
+{
+    if (m_tls.isEnabled()) {
+        // Plaintext not yet encrypted plus ciphertext not yet sent
+        const QSslSocket *socket = static_cast<const QSslSocket*>(conn->socket);
+        return socket->bytesToWrite() + socket->encryptedBytesToWrite();
+    }
+    return conn->socket->bytesToWrite();
+}
+
+TlsStatistics QtTransport::tlsStatistics() const
+{
+    TlsStatistics stats;
+    stats.handshakes = m_completedHandshakes.load();
+    stats.failedHandshakes = m_failedHandshakes.load();
+    stats.handshakeNs = m_handshakeNs.load();
+    return stats;
+}
+
+void QtTransport::close(Connection *conn)
+{
+    QTcpSocket *socket = conn->socket;
+    // Goes through onDisconnected() like any other drop
+    socket->abort();
+    
+    // abort() only emits disconnected() for a connected socket
+    if (m_connections.contains(socket)) {
+        release(socket);
+    }
+}
+
+void QtTransport::closeGracefully(Connection *conn)
+{
+    conn->socket->disconnectFromHost();
+}
+
+void QtTransport::setReadPaused(Connection *conn, bool paused)
+{
+    QTcpSocket *socket = conn->socket;
+    if (paused) {
+        // Qt stops reading from the kernel once its own buffer holds this much
+        socket->setReadBufferSize(qMax<qint64>(1, socket->bytesAvailable()));
+        return;
+    }
+    
+    socket->setReadBufferSize(0);
+    // Bytes Qt buffered while paused raise no new readyRead
+    if (socket->bytesAvailable() > 0) {
+        conn->decoder.readFrom(socket);
+        m_handler->onConnectionReadable(conn);
+    }
+}
+
+void QtTransport::onEncrypted()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!m_handshakes.contains(socket)) return;
+    
+    m_handshakeNs.fetchAndAddRelaxed(m_clock.nsecsElapsed() - m_handshakes.take(socket));
+    m_completedHandshakes.fetchAndAddRelaxed(1);
+}
+
+void QtTransport::onReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    Connection *conn = m_connections.value(socket, nullptr);
+    if (!conn || conn->readPaused) return;
+    
+    conn->decoder.readFrom(socket);
+    m_handler->onConnectionReadable(conn);
+}
+
+void QtTransport::onBytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes);
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    Connection *conn = m_connections.value(socket, nullptr);
+    if (!conn) return;
+    
+    m_handler->onConnectionWritable(conn);
+}
+
+void QtTransport::onDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (m_connections.contains(socket)) {
+        release(socket);
+    }
+}
+
+void QtTransport::onError(QAbstractSocket::SocketError error)
+{
+    Q_UNUSED(error);
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket) return;
+    
+    qWarning() << "Socket error:" << socket->errorString();
+}
+
+void QtTransport::release(QTcpSocket *socket)
+{
+    Connection *conn = m_connections.take(socket);
+    if (m_handshakes.remove(socket) > 0) {
+        m_failedHandshakes.fetchAndAddRelaxed(1);
+    }
+    socket->disconnect(this);
+    socket->deleteLater();
+    conn->socket = nullptr;
+    m_handler->onConnectionClosed(conn);
+}
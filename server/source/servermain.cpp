@@ -7,6 +7,67 @@
 #include "authmanager.h"
 #include "databasemanager.h"
 #include "agoramanager.h"
+#include "textrouter.h"
+#include "authservice.h"
+#include "filetransferserver.h"
+#include "mediarelay.h"
+
+// "rate" or "rate/burst", the burst defaults to two seconds worth
+static bool parseRateLimit(const QString &text, RateLimit *limit)
+{
+    QStringList parts = text.split('/');
+    bool ok = parts.size() <= 2;
+    double rate = ok ? parts.at(0).toDouble(&ok) : 0;
+    double burst = 2 * rate;
+    if (ok && parts.size() == 2) {
+        burst = parts.at(1).toDouble(&ok);
+    }
+    if (!ok || rate < 0 || burst < 0) {
+        return false;
+    }
+    *limit = RateLimit(rate, burst);
+    return true;
+}
+
+// Comma separated "type=rate[/burst]", types by name or number
+static bool parseTypeRateLimits(const QString &text, QVector<TypeRateLimit> *limits)
+{
+    static const struct { const char *name; MessageType type; } typeNames[] = {
+        { "text", MSG_TEXT }, { "file", MSG_FILE }, { "call-request", MSG_CALL_REQUEST },
+        { "call-accept", MSG_CALL_ACCEPT }, { "call-reject", MSG_CALL_REJECT },
+        { "call-end", MSG_CALL_END }, { "media", MSG_MEDIA_DATA }, { "heartbeat", MSG_HEARTBEAT },
+        { "login", MSG_LOGIN_REQUEST }, { "register", MSG_REGISTER_REQUEST },
+        { "resume", MSG_RESUME_REQUEST }, { "ack", MSG_ACK },
+        { "room", MSG_ROOM }, { "room-media", MSG_ROOM_MEDIA }, { "room-audio", MSG_ROOM_AUDIO }
+    };
+    
+    limits->clear();
+    for (const QString &entry : text.split(',', QString::SkipEmptyParts)) {
+        int equals = entry.indexOf('=');
+        if (equals <= 0) {
+            return false;
+        }
+        QString name = entry.left(equals).trimmed();
+        bool ok;
+        int type = name.toInt(&ok);
+        for (const auto &known : typeNames) {
+            if (name == QLatin1String(known.name)) {
+                type = known.type;
+                ok = true;
+            }
+        }
+        
+        RateLimit limit;
+        if (!ok || type < 0 || type >= FrameCompression::COMPRESSED_FLAG
+                || !parseRateLimit(entry.mid(equals + 1).trimmed(), &limit)) {
+            return false;
+        }
+        if (limit.isEnabled()) {
+            limits->append(TypeRateLimit(static_cast<quint8>(type), limit));
+        }
+    }
+    return limits->size() <= RateLimits::MAX_TYPE_LIMITS;
+}
 
 int main(int argc, char *argv[])
 {
@@ -24,6 +85,90 @@ int main(int argc, char *argv[])
                                   "port", "8888");
     parser.addOption(portOption);
     
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+                                     "Network worker threads (default: 0, connections share the main thread)",
+                                     "count", "0");
+    parser.addOption(threadsOption);
+    
+    QCommandLineOption idleTimeoutOption("idle-timeout",
+                                         "Close connections without traffic or heartbeat after N seconds (default: 90, 0 = never)",
+                                         "seconds", "90");
+    parser.addOption(idleTimeoutOption);
+    
+    QCommandLineOption transportOption("transport",
+                                       "Socket backend: qt or epoll (default: qt, epoll is Linux only)",
+                                       "backend", "qt");
+    parser.addOption(transportOption);
+    
+    QCommandLineOption compressOption("compress-threshold",
+                                      "Compress text/file frames from N bytes on for clients that support it (default: 512, 0 = off)",
+                                      "bytes", "512");
+    parser.addOption(compressOption);
+    
+    QCommandLineOption spoolDirOption("spool-dir",
+                                      "Directory for files sent to offline users (default: system temp/wecompany-spool)",
+                                      "path", "");
+    parser.addOption(spoolDirOption);
+    
+    QCommandLineOption spoolQuotaOption("spool-quota",
+                                        "Disk space all spooled files may take, one sender at most 8 GB of it (default: 65536)",
+                                        "MB", "65536");
+    parser.addOption(spoolQuotaOption);
+    
+    QCommandLineOption spoolExpiryOption("spool-expiry",
+                                         "Drop file transfers and their spool after this long without activity (default: 168, 0 = never)",
+                                         "hours", "168");
+    parser.addOption(spoolExpiryOption);
+    
+    QCommandLineOption replayRingOption("replay-ring",
+                                        "Messages kept per user for resumed sessions (default: 256, 0 = always use the database)",
+                                        "messages", "256");
+    parser.addOption(replayRingOption);
+    
+    QCommandLineOption frameRateOption("frame-rate",
+                                       "Messages per second each connection may send, as rate[/burst] (default: 1000, 0 = off)",
+                                       "rate", "1000");
+    parser.addOption(frameRateOption);
+    
+    QCommandLineOption byteRateOption("byte-rate",
+                                      "Bytes per second each connection may send, as rate[/burst] (default: 8388608, 0 = off)",
+                                      "rate", "8388608");
+    parser.addOption(byteRateOption);
+    
+    QCommandLineOption typeRateOption("type-rate",
+                                      "Per-type message rates, as type=rate[/burst],... with types by name or number "
+                                      "(default: text=50,call-request=5)",
+                                      "limits", "text=50,call-request=5");
+    parser.addOption(typeRateOption);
+    
+    QCommandLineOption relayPortOption("relay-port",
+                                       "UDP port relaying call media, TCP stays the fallback (default: 0 = media over TCP only)",
+                                       "port", "0");
+    parser.addOption(relayPortOption);
+    
+    QCommandLineOption relayLossOption("relay-loss",
+                                       "Percentage of relayed UDP media dropped on purpose, for testing (default: 0)",
+                                       "percent", "0");
+    parser.addOption(relayLossOption);
+    
+    QCommandLineOption relayJitterOption("relay-jitter",
+                                         "Hold relayed UDP media up to this many ms to reorder and pace it, 0 forwards it at once (default: 0)",
+                                         "ms", "0");
+    parser.addOption(relayJitterOption);
+    
+    QCommandLineOption audioFrameOption("audio-frame",
+                                        "Milliseconds of audio per mixed frame in audio rooms, 10 or 20 (default: 20)",
+                                        "ms", "20");
+    parser.addOption(audioFrameOption);
+    
+    QCommandLineOption tlsCertOption("tls-cert",
+                                     "PEM certificate (chain) to encrypt all connections with TLS, needs --tls-key",
+                                     "path", "");
+    parser.addOption(tlsCertOption);
+    
+    QCommandLineOption tlsKeyOption("tls-key", "PEM private key matching --tls-cert", "path", "");
+    parser.addOption(tlsKeyOption);
+    
     QCommandLineOption dbHostOption("db-host", "MySQL database host (default: localhost)", "host", "localhost");
     parser.addOption(dbHostOption);
     
@@ -54,8 +199,111 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    int workerThreads = parser.value(threadsOption).toInt(&ok);
+    if (!ok || workerThreads < 0) {
+        qCritical() << "Invalid worker thread count";
+        return 1;
+    }
+
+    int idleTimeout = parser.value(idleTimeoutOption).toInt(&ok);
+    if (!ok || idleTimeout < 0) {
+        qCritical() << "Invalid idle timeout";
+        return 1;
+    }
+
+    int compressThreshold = parser.value(compressOption).toInt(&ok);
+    if (!ok || compressThreshold < 0) {
+        qCritical() << "Invalid compression threshold";
+        return 1;
+    }
+
+    qint64 spoolQuotaMb = parser.value(spoolQuotaOption).toLongLong(&ok);
+    if (!ok || spoolQuotaMb < 0) {
+        qCritical() << "Invalid spool quota";
+        return 1;
+    }
+    
+    int spoolExpiryHours = parser.value(spoolExpiryOption).toInt(&ok);
+    if (!ok || spoolExpiryHours < 0 || spoolExpiryHours > 24 * 365) {
+        qCritical() << "Invalid spool expiry";
+        return 1;
+    }
+
+    int replayRing = parser.value(replayRingOption).toInt(&ok);
+    if (!ok || replayRing < 0) {
+        qCritical() << "Invalid replay ring size";
+        return 1;
+    }
+
+    RateLimits rateLimits;
+    if (!parseRateLimit(parser.value(frameRateOption), &rateLimits.frames)
+            || !parseRateLimit(parser.value(byteRateOption), &rateLimits.bytes)) {
+        qCritical() << "Invalid rate limit, expected rate or rate/burst";
+        return 1;
+    }
+    if (!parseTypeRateLimits(parser.value(typeRateOption), &rateLimits.types)) {
+        qCritical() << "Invalid per-type rate limits, expected at most" << RateLimits::MAX_TYPE_LIMITS
+                    << "entries of type=rate[/burst]";
+        return 1;
+    }
+
+    quint16 relayPort = parser.value(relayPortOption).toUShort(&ok);
+    if (!ok) {
+        qCritical() << "Invalid relay port";
+        return 1;
+    }
+
+    double relayLoss = parser.value(relayLossOption).toDouble(&ok);
+    if (!ok || relayLoss < 0 || relayLoss > 100) {
+        qCritical() << "Invalid relay loss, expected a percentage";
+        return 1;
+    }
+
+    int relayJitter = parser.value(relayJitterOption).toInt(&ok);
+    if (!ok || relayJitter < 0 || relayJitter > 1000) {
+        qCritical() << "Invalid relay jitter buffer, expected 0 to 1000 ms";
+        return 1;
+    }
+
+    int audioFrameMs = parser.value(audioFrameOption).toInt(&ok);
+    if (!ok || (audioFrameMs != 10 && audioFrameMs != 20)) {
+        qCritical() << "Invalid audio frame, expected 10 or 20 ms";
+        return 1;
+    }
+
+    QString transport = parser.value(transportOption);
+    if (transport != "qt" && transport != "epoll") {
+        qCritical() << "Invalid transport, expected qt or epoll";
+        return 1;
+    }
+
+    TlsContext tls;
+    QString tlsCert = parser.value(tlsCertOption);
+    QString tlsKey = parser.value(tlsKeyOption);
+    if (!tlsCert.isEmpty() || !tlsKey.isEmpty()) {
+        QString error;
+        if (tlsCert.isEmpty() || tlsKey.isEmpty()) {
+            qCritical() << "TLS needs both --tls-cert and --tls-key";
+            return 1;
+        }
+        if (!tls.load(tlsCert, tlsKey, &error)) {
+            qCritical() << "Invalid TLS certificate:" << error;
+            return 1;
+        }
+        if (!tls.resumesSessions()) {
+            qWarning() << "TLS sessions will not resume, every reconnect does a full handshake";
+        }
+    }
+
     // Create and start TCP server
     TcpServer tcpServer;
+    tcpServer.setWorkerThreads(workerThreads);
+    tcpServer.setIdleTimeout(idleTimeout);
+    tcpServer.setTransport(transport == "epoll" ? TRANSPORT_EPOLL : TRANSPORT_QT);
+    tcpServer.setCompressionThreshold(compressThreshold);
+    tcpServer.setTls(tls);
+    tcpServer.setRateLimits(rateLimits);
+    tcpServer.sessionLog()->setCapacity(replayRing);
     if (!tcpServer.startServer(port)) {
         qCritical() << "Failed to start TCP server";
         return 1;
@@ -65,6 +313,9 @@ int main(int argc, char *argv[])
     AuthManager authManager;
     qInfo() << "Authentication manager initialized";
 
+    // Login/register frames, hashed on a bounded pool off the network threads
+    AuthService authService(&tcpServer, &authManager);
+
     // Create and connect to database (optional)
     DatabaseManager dbManager;
     QString dbHost = parser.value(dbHostOption);
@@ -115,6 +366,39 @@ int main(int argc, char *argv[])
 
     // Create video call server
     VideoCallServer videoCallServer(&tcpServer);
+    videoCallServer.setAudioFrameMs(audioFrameMs);
+    
+    // Call media over UDP on its own thread, TCP relaying stays available
+    MediaRelay mediaRelay(&tcpServer);
+    if (relayPort != 0) {
+        if (!mediaRelay.start(relayPort)) {
+            qCritical() << "Failed to start the media relay";
+            return 1;
+        }
+        mediaRelay.setSimulatedLoss(relayLoss / 100);
+        mediaRelay.setJitterBuffer(relayJitter);
+        videoCallServer.setMediaRelay(&mediaRelay);
+    }
+
+    // Text messages, persisted for offline users on a background thread
+    TextRouter textRouter(&tcpServer);
+    textRouter.setAuthManager(&authManager);
+    if (dbEnabled) {
+        textRouter.startPersistence(dbHost, dbPort, dbName, dbUser, dbPass);
+    }
+
+    // Chunked file transfers, spooled to disk for offline recipients
+    FileTransferServer fileTransfer(&tcpServer);
+    QString spoolDir = parser.value(spoolDirOption);
+    if (!spoolDir.isEmpty() && !fileTransfer.setSpoolDirectory(spoolDir)) {
+        qCritical() << "Invalid spool directory";
+        return 1;
+    }
+    fileTransfer.setAuthManager(&authManager);
+    qint64 spoolQuota = spoolQuotaMb * 1024 * 1024;
+    qint64 senderSpoolQuota = FileTransferServer::DEFAULT_SENDER_SPOOL_QUOTA;
+    fileTransfer.setSpoolQuota(spoolQuota, qMin(spoolQuota, senderSpoolQuota));
+    fileTransfer.setExpiry(spoolExpiryHours * 3600);
 
     // Connect signals for logging
     QObject::connect(&tcpServer, &TcpServer::clientConnected, [&](const QString &userId) {
@@ -161,9 +445,147 @@ int main(int argc, char *argv[])
     const int ONE_HOUR_MS = 60 * 60 * 1000;  // 1 hour in milliseconds
     tokenCleanupTimer.start(ONE_HOUR_MS);
 
+    // Periodic server statistics
+    QTimer statsTimer;
+    QObject::connect(&statsTimer, &QTimer::timeout, [&]() {
+        QueueStatistics queues = tcpServer.queueStatistics();
+        qInfo() << "Outbound queues:" << queues.queuedFrames << "frames /" << queues.queuedBytes << "bytes,"
+                << queues.congestedConnections << "congested," << queues.droppedFrames << "dropped,"
+                << queues.overflowDisconnects << "overflow disconnects";
+        static const char *const laneNames[LANE_COUNT] = { "control", "normal", "bulk" };
+        for (int lane = 0; lane < LANE_COUNT; ++lane) {
+            const LaneStatistics &stats = queues.lanes[lane];
+            qInfo() << "Outbound lane" << laneNames[lane] << ":" << stats.sentFrames << "frames,"
+                    << (stats.averageWaitNs() / 1000) << "us avg wait,"
+                    << (stats.maxWaitNs / 1000) << "us max";
+        }
+        qInfo() << "Connections:" << tcpServer.onlineUserCount() << "online,"
+                << tcpServer.idleTimeouts() << "closed by idle timeout";
+        
+        CompressionStatistics compression = tcpServer.compressionStatistics();
+        if (compression.compressedFrames > 0 || compression.decompressedFrames > 0) {
+            qInfo() << "Compression:" << compression.compressedFrames << "frames,"
+                    << compression.uncompressedBytes << "->" << compression.compressedBytes << "bytes"
+                    << QString("(ratio %1),").arg(compression.ratio(), 0, 'f', 2)
+                    << (compression.compressNs / 1000000) << "ms deflate,"
+                    << compression.decompressedFrames << "inflated in"
+                    << (compression.decompressNs / 1000000) << "ms,"
+                    << compression.corruptFrames << "corrupt";
+        }
+        
+        if (tcpServer.tls().isEnabled()) {
+            TlsStatistics tlsStats = tcpServer.tlsStatistics();
+            qInfo() << "TLS handshakes:" << tlsStats.handshakes << "completed,"
+                    << (tlsStats.handshakes > 0 ? tlsStats.handshakeNs / tlsStats.handshakes / 1000 : 0)
+                    << "us avg," << tlsStats.failedHandshakes << "failed";
+        }
+        
+        RoomStatistics rooms = videoCallServer.roomStatistics();
+        if (rooms.rooms > 0 || rooms.mediaPackets > 0) {
+            qInfo() << "Rooms:" << rooms.rooms << "open," << rooms.members << "members,"
+                    << rooms.mediaPackets << "media packets published," << rooms.mediaSends << "sent to subscribers,"
+                    << rooms.audioFrames << "audio frames mixed into" << rooms.mixedFrames << "frames,"
+                    << rooms.audioDropped << "audio frames dropped";
+        }
+        
+        if (mediaRelay.isRunning()) {
+            RelayStatistics relay = mediaRelay.statistics();
+            qInfo() << "Media relay:" << relay.sessions << "sessions," << relay.packets << "packets,"
+                    << relay.forwarded << "forwarded," << relay.viaTcp << "over TCP,"
+                    << relay.rejected << "rejected," << relay.replayed << "replayed,"
+                    << relay.dropped << "dropped," << relay.late << "too late";
+            
+            // Per call and direction; the log gets the totals and the worst call
+            QVector<CallJitterStatistics> calls = mediaRelay.jitterStatistics();
+            double jitterSum = 0, delaySum = 0;
+            qint64 skipped = 0;
+            int streams = 0;
+            const CallJitterStatistics *worst = nullptr;
+            int worstParty = 0;
+            for (const CallJitterStatistics &call : calls) {
+                for (int party = 0; party < 2; ++party) {
+                    const JitterStatistics &stats = call.parties[party];
+                    if (stats.released == 0) {
+                        continue;
+                    }
+                    ++streams;
+                    jitterSum += stats.jitterMs;
+                    delaySum += stats.averageDelayMs;
+                    skipped += stats.skipped;
+                    if (!worst || stats.jitterMs > worst->parties[worstParty].jitterMs) {
+                        worst = &call;
+                        worstParty = party;
+                    }
+                }
+            }
+            if (worst) {
+                const JitterStatistics &stats = worst->parties[worstParty];
+                qInfo() << "Relay jitter:" << streams << "streams,"
+                        << QString("%1 ms avg jitter, %2 ms avg delay,").arg(jitterSum / streams, 0, 'f', 1)
+                                                                        .arg(delaySum / streams, 0, 'f', 1)
+                        << skipped << "skipped; worst" << worst->callId << (worstParty == 0 ? "caller" : "callee")
+                        << QString("%1 ms jitter, %2 ms target, %3 ms max delay").arg(stats.jitterMs, 0, 'f', 1)
+                                                                                  .arg(stats.targetDelayMs)
+                                                                                  .arg(stats.maxDelayMs);
+            }
+        }
+        
+        if (rateLimits.isEnabled()) {
+            RateLimitStatistics rates = tcpServer.rateLimitStatistics();
+            QStringList typeHits;
+            for (int i = 0; i < rateLimits.types.size(); ++i) {
+                typeHits << QString("type %1: %2").arg(rateLimits.types.at(i).type).arg(rates.typeLimitHits[i]);
+            }
+            qInfo() << "Rate limits:" << rates.readPauses << "read pauses,"
+                    << rates.pausedMs << "ms paused," << rates.pausedConnections << "paused now,"
+                    << rates.frameLimitHits << "frame limit," << rates.byteLimitHits << "byte limit,"
+                    << qPrintable(typeHits.join(", "));
+        }
+        
+        MessageDispatcher *dispatcher = tcpServer.dispatcher();
+        for (int type = 0; type < MessageDispatcher::TYPE_COUNT; ++type) {
+            DispatchStatistics dispatch = dispatcher->statistics(type);
+            if (dispatch.calls > 0) {
+                qInfo() << "Message type" << type << ":" << dispatch.calls << "calls,"
+                        << (dispatch.totalNs / dispatch.calls / 1000) << "us avg,"
+                        << (dispatch.maxNs / 1000) << "us max";
+            }
+        }
+        qInfo() << "Text messages:" << textRouter.deliveredOnline() << "delivered online,"
+                << textRouter.queuedOffline() << "stored offline,"
+                << textRouter.deliveredFromBacklog() << "delivered from backlog,"
+                << textRouter.droppedMessages() << "dropped,"
+                << textRouter.unknownRecipients() << "to unknown users";
+        qInfo() << "Acknowledgements:" << textRouter.acknowledgedMessages() << "messages acknowledged,"
+                << textRouter.spilledMessages() << "unacknowledged moved to the database";
+        qInfo() << "Resumed sessions:" << textRouter.resumedFromMemory() << "from memory,"
+                << textRouter.resumedFromDatabase() << "from the database,"
+                << textRouter.replayedMessages() << "messages replayed,"
+                << tcpServer.sessionLog()->bufferedBytes() << "bytes buffered for"
+                << tcpServer.sessionLog()->userCount() << "users";
+        qInfo() << "File transfers:" << fileTransfer.activeTransfers() << "active,"
+                << fileTransfer.completedTransfers() << "completed,"
+                << fileTransfer.relayedBytes() << "bytes relayed,"
+                << fileTransfer.spooledBytes() << "spooled,"
+                << fileTransfer.deliveredBytes() << "delivered from spool,"
+                << fileTransfer.reservedSpoolBytes() << "reserved,"
+                << fileTransfer.expiredTransfers() << "expired";
+        qInfo() << "Auth requests:" << authService.completedRequests() << "completed,"
+                << authService.pendingRequests() << "pending,"
+                << authService.rejectedRequests() << "rejected as busy,"
+                << authService.resumedSessions() << "resumed";
+        if (dispatcher->unhandledMessages() > 0) {
+            qInfo() << "Messages without handler:" << dispatcher->unhandledMessages();
+        }
+    });
+    const int ONE_MINUTE_MS = 60 * 1000;
+    statsTimer.start(ONE_MINUTE_MS);
+
     qInfo() << "========================================";
     qInfo() << "WeCompany Server v2.0 started";
     qInfo() << "Port:" << port;
+    qInfo() << "Worker threads:" << workerThreads;
+    qInfo() << "Transport:" << transport;
     qInfo() << "Database:" << (dbEnabled ? "Enabled" : "Disabled");
     qInfo() << "Agora SDK:" << (agoraEnabled ? "Enabled" : "Disabled");
     qInfo() << "========================================";
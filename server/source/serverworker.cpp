@@ -0,0 +1,705 @@
+#include "serverworker.h"
+#include "clientregistry.h"
+#include "tcpserver.h"
+#include "batchenvelope.h"
+#include <QDebug>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QtEndian>
+
+ServerWorker::ServerWorker(int index, ClientRegistry *registry, MessageDispatcher *dispatcher,
+                           const WorkerSettings &settings, QObject *parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_registry(registry)
+    , m_dispatcher(dispatcher)
+    , m_settings(settings)
+    , m_transport(nullptr)
+    , m_nextConnectionId(1)
+    , m_connectionCount(0)
+    , m_flushScheduled(false)
+    , m_inboundScheduled(false)
+    , m_idleTimer(new QTimer(this))
+    , m_idleTimeouts(0)
+    , m_throttleTimer(new QTimer(this))
+    , m_throttleDeadline(0)
+    , m_readPauses(0)
+    , m_pausedMs(0)
+    , m_frameLimitHits(0)
+    , m_byteLimitHits(0)
+    , m_pausedConnections(0)
+    , m_queuedBytes(0)
+    , m_queuedFrames(0)
+    , m_droppedFrames(0)
+    , m_overflowDisconnects(0)
+    , m_congestedConnections(0)
+    , m_compressedFrames(0)
+    , m_uncompressedBytes(0)
+    , m_compressedBytes(0)
+    , m_compressNs(0)
+    , m_decompressedFrames(0)
+    , m_decompressNs(0)
+    , m_corruptFrames(0)
+{
+    // Parented so it moves to the worker thread together with us
+    m_transport = createTransport(m_settings.transport, m_settings.tls, this, this);
+    m_batch.reserve(m_settings.outboundLimits.maxBatchBytes);
+    
+    m_idleTimer->setInterval(1000);
+    connect(m_idleTimer, &QTimer::timeout, this, &ServerWorker::onIdleTick);
+    
+    m_throttleTimer->setSingleShot(true);
+    m_throttleTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_throttleTimer, &QTimer::timeout, this, &ServerWorker::resumeThrottled);
+    m_rateClock.start();
+}
+
+ServerWorker::~ServerWorker()
+{
+    // Closes the remaining sockets without calling back into us
+    delete m_transport;
+    qDeleteAll(m_connections);
+}
+
+void ServerWorker::addConnection(qintptr socketDescriptor)
+{
+    Connection *conn = new Connection(m_settings.maxFrameSize, m_settings.outboundLimits);
+    // Worker index in the high bits keeps ids unique across threads
+    conn->id = (static_cast<quint64>(m_index) << 48) | m_nextConnectionId++;
+    
+    if (!m_transport->adopt(conn, socketDescriptor)) {
+        delete conn;
+        return;
+    }
+    
+    m_connections.insert(conn->id, conn);
+    m_connectionCount.ref();
+    
+    if (m_settings.idleTimeoutSeconds > 0) {
+        conn->idleTimer.id = conn->id;
+        m_idleWheel.schedule(&conn->idleTimer, m_settings.idleTimeoutSeconds);
+        // Started here so the timer runs on the worker's own thread
+        if (!m_idleTimer->isActive()) {
+            m_idleTimer->start();
+        }
+    }
+    
+    qInfo() << "New connection from" << conn->peerAddress
+            << ":" << conn->peerPort << "on worker" << m_index;
+}
+
+void ServerWorker::onConnectionReadable(Connection *conn)
+{
+    if (conn->idleTimer.isArmed()) {
+        m_idleWheel.schedule(&conn->idleTimer, m_settings.idleTimeoutSeconds);
+    }
+    
+    processFrames(conn);
+}
+
+void ServerWorker::processFrames(Connection *conn)
+{
+    const RateLimits &limits = m_settings.rateLimits;
+    
+    // One read may carry several frames, or only part of one. Over a rate
+    // limit the rest waits in the decoder until the reads resume.
+    FrameView frame;
+    FrameDecoder::Status status = FrameDecoder::NeedMoreData;
+    while (!conn->readPaused && (status = conn->decoder.next(frame)) == FrameDecoder::FrameReady) {
+        if (limits.bytes.isEnabled()) {
+            charge(conn, conn->byteBucket, limits.bytes, frame.size + FrameDecoder::HEADER_SIZE,
+                   m_byteLimitHits);
+        }
+        handleMessage(conn, frame);
+    }
+    
+    if (status == FrameDecoder::FrameTooLarge) {
+        qWarning() << "Frame exceeds" << conn->decoder.maxFrameSize() << "bytes, dropping connection"
+                   << conn->peerAddress;
+        m_transport->close(conn);
+        return;
+    }
+    
+    if (conn->readPaused) {
+        throttle(conn);
+    }
+    conn->decoder.trim();
+}
+
+void ServerWorker::onConnectionClosed(Connection *conn)
+{
+    removeConnection(conn);
+}
+
+void ServerWorker::handleMessage(Connection *conn, const FrameView &received, bool inBatch)
+{
+    if (received.size <= 0) return;
+    
+    // Compressed frames are inflated into a local buffer that lives as long as
+    // the view handed to the dispatcher
+    FrameView frame = received;
+    QByteArray inflated;
+    if (FrameCompression::isCompressed(static_cast<quint8>(received.data[0]))) {
+        if (!(conn->capabilities & FrameCompression::CAPABILITY_COMPRESSION)
+                || !decompressFrame(received, inflated)) {
+            qWarning() << "Dropping undecodable compressed frame from" << conn->peerAddress;
+            m_corruptFrames.ref();
+            return;
+        }
+        frame.data = inflated.constData();
+        frame.size = inflated.size();
+    }
+    
+    // [MessageType(1 byte)][Data], the sender is whoever the connection logged in as
+    quint8 msgType = static_cast<quint8>(frame.data[0]);
+    int offset = 1;
+    
+    // Each entry of an envelope takes the same path as a frame of its own, in order
+    // BatchReader already refuses nested envelopes; checked again after
+    // inflating, so recursion is one level deep whatever the client sends
+    if (msgType == MSG_BATCH) {
+        if (conn->userId.isEmpty()) {
+            return;
+        }
+        if (inBatch) {
+            qWarning() << "Dropping nested batch from" << conn->userId;
+            return;
+        }
+        BatchReader batch(frame);
+        FrameView entry;
+        while (batch.next(entry)) {
+            handleMessage(conn, entry, true);
+        }
+        if (!batch.isValid()) {
+            qWarning() << "Malformed batch from" << conn->userId;
+        }
+        return;
+    }
+    
+    // Envelope entries count one by one, packing them buys no extra rate
+    const RateLimits &limits = m_settings.rateLimits;
+    if (limits.isEnabled()) {
+        if (limits.frames.isEnabled()) {
+            charge(conn, conn->frameBucket, limits.frames, 1, m_frameLimitHits);
+        }
+        int index = limits.indexOf(msgType & ~FrameCompression::COMPRESSED_FLAG);
+        if (index >= 0) {
+            if (conn->typeBuckets.isEmpty()) {
+                conn->typeBuckets.resize(limits.types.size());
+            }
+            charge(conn, conn->typeBuckets[index], limits.types.at(index).limit, 1, m_typeLimitHits[index]);
+        }
+    }
+    
+    // Heartbeats only refresh the idle timer (done on read) and are echoed back
+    if (msgType == MSG_HEARTBEAT && !conn->userId.isEmpty() && frame.size == 1) {
+        static const QByteArray heartbeat(1, static_cast<char>(MSG_HEARTBEAT));
+        enqueueFrame(conn, heartbeat);
+        return;
+    }
+    
+    // Login, register and resume frames carry credentials, not a userId. The
+    // connection is bound once AuthService answers (loginConnection)
+    bool authRequest = (msgType == MSG_LOGIN_REQUEST || msgType == MSG_REGISTER_REQUEST
+                        || msgType == MSG_RESUME_REQUEST);
+    
+    // Until then the connection speaks for nobody, anything else is dropped.
+    // Once bound it stays bound: another login would reset whichever user it
+    // names while this connection kept its own identity.
+    if (conn->userId.isEmpty() != authRequest) {
+        return;
+    }
+    
+    MessageHeader header;
+    header.type = msgType;
+    header.userId = conn->userId;
+    header.session = conn->session;
+    header.connectionId = conn->id;
+    
+    if (m_dispatcher->thread() == thread()) {
+        // Same thread as the handlers: no copy, no queued call
+        FrameView payload;
+        payload.data = frame.data + offset;
+        payload.size = frame.size - offset;
+        m_dispatcher->dispatch(header, payload);
+        return;
+    }
+    
+    // The frame view dies with this read, so the payload is copied into the
+    // batch. Media gets a buffer of its own instead, which the relay then
+    // queues for the recipient without another copy.
+    if (msgType == MSG_MEDIA_DATA || msgType == MSG_ROOM_MEDIA || msgType == MSG_ROOM_AUDIO) {
+        header.payloadBuffer = QByteArray(frame.data + offset, frame.size - offset);
+    } else {
+        m_inbound.payloads.append(frame.data + offset, frame.size - offset);
+    }
+    m_inbound.headers.append(header);
+    m_inbound.ends.append(m_inbound.payloads.size());
+    
+    if (!m_inboundScheduled) {
+        m_inboundScheduled = true;
+        QMetaObject::invokeMethod(this, "flushInbound", Qt::QueuedConnection);
+    }
+}
+
+void ServerWorker::charge(Connection *conn, TokenBucket &bucket, const RateLimit &limit, double amount,
+                          QAtomicInteger<qint64> &hits)
+{
+    if (!bucket.consume(limit, amount, m_rateClock.elapsed()) && !conn->readPaused) {
+        // The message is still handled, reading stops after it
+        conn->readPaused = true;
+        hits.ref();
+    }
+}
+
+void ServerWorker::throttle(Connection *conn)
+{
+    // Resumes once every bucket is out of debt
+    const RateLimits &limits = m_settings.rateLimits;
+    qint64 now = m_rateClock.elapsed();
+    qint64 delay = qMax(conn->frameBucket.msUntilClear(limits.frames, now),
+                        conn->byteBucket.msUntilClear(limits.bytes, now));
+    for (int i = 0; i < conn->typeBuckets.size(); ++i) {
+        delay = qMax(delay, conn->typeBuckets.at(i).msUntilClear(limits.types.at(i).limit, now));
+    }
+    delay = qMax<qint64>(1, delay);
+    
+    if (!m_throttled.contains(conn->id)) {
+        m_transport->setReadPaused(conn, true);
+        m_pausedConnections.ref();
+    }
+    m_throttled.insert(conn->id, now + delay);
+    m_readPauses.ref();
+    m_pausedMs.fetchAndAddRelaxed(delay);
+    
+    if (!m_throttleTimer->isActive() || now + delay < m_throttleDeadline) {
+        m_throttleDeadline = now + delay;
+        m_throttleTimer->start(static_cast<int>(delay));
+    }
+}
+
+void ServerWorker::resumeThrottled()
+{
+    qint64 now = m_rateClock.elapsed();
+    QList<quint64> due;
+    for (QHash<quint64, qint64>::iterator it = m_throttled.begin(); it != m_throttled.end(); ) {
+        if (it.value() <= now) {
+            due.append(it.key());
+            it = m_throttled.erase(it);
+            m_pausedConnections.deref();
+        } else {
+            ++it;
+        }
+    }
+    
+    for (quint64 connectionId : due) {
+        Connection *conn = m_connections.value(connectionId, nullptr);
+        if (!conn) continue;
+        
+        // Frames read before the pause come first, they may pause it again
+        conn->readPaused = false;
+        processFrames(conn);
+        conn = m_connections.value(connectionId, nullptr);
+        if (conn && !conn->readPaused) {
+            m_transport->setReadPaused(conn, false);
+        }
+    }
+    
+    if (m_throttleTimer->isActive() || m_throttled.isEmpty()) {
+        return;
+    }
+    qint64 next = -1;
+    for (qint64 resumeAt : m_throttled) {
+        next = (next < 0) ? resumeAt : qMin(next, resumeAt);
+    }
+    m_throttleDeadline = next;
+    m_throttleTimer->start(static_cast<int>(qMax<qint64>(1, next - now)));
+}
+
+void ServerWorker::flushInbound()
+{
+    m_inboundScheduled = false;
+    if (m_inbound.headers.isEmpty()) {
+        return;
+    }
+    
+    QMetaObject::invokeMethod(m_dispatcher, "dispatchBatch", Qt::QueuedConnection,
+                              Q_ARG(InboundBatch, m_inbound));
+    m_inbound = InboundBatch();
+}
+
+void ServerWorker::registerClient(Connection *conn, const QString &userId)
+{
+    conn->userId = userId;
+    
+    ClientInfo info;
+    info.userId = userId;
+    info.worker = this;
+    info.connectionId = conn->id;
+    info.handle = INVALID_SESSION;
+    info.ipAddress = conn->peerAddress;
+    info.port = conn->peerPort;
+    info.isOnline = true;
+    
+    conn->session = m_registry->registerClient(info);
+}
+
+void ServerWorker::removeConnection(Connection *conn)
+{
+    m_connections.remove(conn->id);
+    m_connectionCount.deref();
+    m_idleWheel.cancel(&conn->idleTimer);
+    if (m_throttled.remove(conn->id) > 0) {
+        m_pausedConnections.deref();
+    }
+    
+    // Frames still queued for a dead peer are discarded
+    m_queuedBytes.fetchAndAddRelaxed(-conn->outbound.queuedBytes());
+    m_queuedFrames.fetchAndAddRelaxed(-conn->outbound.queuedFrames());
+    setCongested(conn, false);
+    
+    if (!conn->userId.isEmpty()) {
+        // Only report the user offline if this connection still owned the route
+        if (m_registry->unregisterClient(conn->session)) {
+            qInfo() << "Client disconnected:" << conn->userId;
+            emit clientDisconnected(conn->userId);
+        }
+    }
+    
+    delete conn;
+}
+
+void ServerWorker::sendToConnection(quint64 connectionId, const QByteArray &data)
+{
+    Connection *conn = m_connections.value(connectionId, nullptr);
+    if (!conn) {
+        return;
+    }
+    
+    enqueueFrame(conn, data);
+}
+
+void ServerWorker::sendToConnection(quint64 connectionId, const QByteArray &prefix, const QByteArray &data,
+                                    quint32 stream)
+{
+    Connection *conn = m_connections.value(connectionId, nullptr);
+    if (!conn) {
+        return;
+    }
+    
+    enqueueFrame(conn, data, false, prefix, stream);
+}
+
+void ServerWorker::loginConnection(quint64 connectionId, const QString &userId, const QByteArray &reply,
+                                   int capabilities, qint64 resumeFrom)
+{
+    Connection *conn = m_connections.value(connectionId, nullptr);
+    if (!conn) {
+        return;
+    }
+    
+    bool fresh = conn->userId.isEmpty();
+    if (!fresh && conn->userId != userId) {
+        // A second request that was already on its way when the first bound it
+        return;
+    }
+    if (fresh) {
+        registerClient(conn, userId);
+        qInfo() << (resumeFrom < 0 ? "Client logged in:" : "Client resumed:") << conn->userId;
+    }
+    
+    // The reply itself still goes out plain, and ahead of anything a handler
+    // of the signals below sends right away
+    if (!reply.isEmpty()) {
+        enqueueFrame(conn, reply);
+    }
+    conn->capabilities = capabilities;
+    
+    if (fresh) {
+        if (resumeFrom < 0) {
+            emit clientConnected(conn->userId);
+        } else {
+            emit clientResumed(conn->userId, static_cast<quint64>(resumeFrom));
+        }
+    }
+}
+
+void ServerWorker::deliverBatch(quint64 broadcastId, const QVector<quint64> &connectionIds, const QByteArray &frame)
+{
+    int delivered = 0;
+    int failed = 0;
+    
+    for (quint64 connectionId : connectionIds) {
+        Connection *conn = m_connections.value(connectionId, nullptr);
+        if (conn && !conn->userId.isEmpty() && enqueueFrame(conn, frame, true)) {
+            ++delivered;
+        } else {
+            ++failed;
+        }
+    }
+    
+    emit batchDelivered(broadcastId, delivered, failed);
+}
+
+bool ServerWorker::enqueueFrame(Connection *conn, const QByteArray &data, bool encoded, const QByteArray &prefix,
+                                quint32 stream)
+{
+    qint64 oldBytes = conn->outbound.queuedBytes();
+    int oldFrames = conn->outbound.queuedFrames();
+    qint64 oldDropped = conn->outbound.droppedFrames();
+    
+    // Only chat payloads are worth it, media is already compressed by its codec.
+    // Broadcast frames are shared and length-prefixed, they stay plain, as do
+    // relayed frames in two parts.
+    QByteArray compressed;
+    bool compress = !encoded && prefix.isEmpty()
+            && (conn->capabilities & FrameCompression::CAPABILITY_COMPRESSION)
+            && m_settings.compressionThreshold > 0
+            && data.size() >= m_settings.compressionThreshold;
+    if (compress) {
+        quint8 type = static_cast<quint8>(data.at(0));
+        compress = (type == MSG_TEXT || type == MSG_FILE || type == MSG_OFFLINE_BATCH)
+                && compressFrame(data, compressed);
+    }
+    
+    OutboundQueue::EnqueueResult result = encoded ? conn->outbound.enqueueEncoded(data)
+                                        : !prefix.isEmpty() ? conn->outbound.enqueue(prefix, data, stream)
+                                                  : conn->outbound.enqueue(compress ? compressed : data);
+    updateQueueStatistics(conn, oldBytes, oldFrames, oldDropped);
+    
+    if (result == OutboundQueue::Overflow) {
+        qWarning() << "Outbound queue overflow," << conn->outbound.queuedBytes()
+                   << "bytes pending, dropping slow client" << conn->userId;
+        m_overflowDisconnects.ref();
+        // Deferred, closing here would delete the connection under the caller
+        QMetaObject::invokeMethod(this, "closeConnection", Qt::QueuedConnection,
+                                  Q_ARG(quint64, conn->id));
+        return false;
+    }
+    
+    if (result == OutboundQueue::DroppedNew) {
+        return false;
+    }
+    
+    scheduleFlush(conn);
+    return true;
+}
+
+bool ServerWorker::compressFrame(const QByteArray &data, QByteArray &out)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool smaller = FrameCompression::compress(data, out);
+    m_compressNs.fetchAndAddRelaxed(timer.nsecsElapsed());
+    
+    // Incompressible frames count too, they cost CPU and saved nothing
+    m_compressedFrames.ref();
+    m_uncompressedBytes.fetchAndAddRelaxed(data.size());
+    m_compressedBytes.fetchAndAddRelaxed(smaller ? out.size() : data.size());
+    return smaller;
+}
+
+bool ServerWorker::decompressFrame(const FrameView &frame, QByteArray &out)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = FrameCompression::decompress(frame.data, frame.size, m_settings.maxFrameSize, out);
+    m_decompressNs.fetchAndAddRelaxed(timer.nsecsElapsed());
+    if (ok) {
+        m_decompressedFrames.ref();
+    }
+    return ok;
+}
+
+void ServerWorker::scheduleFlush(Connection *conn)
+{
+    if (!conn->flushScheduled) {
+        conn->flushScheduled = true;
+        m_pendingFlush.append(conn->id);
+    }
+    
+    // Everything queued during this event loop iteration goes out in one pass
+    if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, "flushPending", Qt::QueuedConnection);
+    }
+}
+
+void ServerWorker::flushPending()
+{
+    m_flushScheduled = false;
+    
+    QList<quint64> pending;
+    pending.swap(m_pendingFlush);
+    
+    for (quint64 connectionId : pending) {
+        Connection *conn = m_connections.value(connectionId, nullptr);
+        if (conn) {
+            conn->flushScheduled = false;
+            drain(conn);
+        }
+    }
+}
+
+void ServerWorker::drain(Connection *conn)
+{
+    // A congested connection resumes from onConnectionWritable() once below the low watermark
+    if (conn->congested) {
+        return;
+    }
+    conn->bulkDeferred = false;
+    
+    LaneStatistics sent[LANE_COUNT];
+    while (!conn->outbound.isEmpty()) {
+        qint64 pending = m_transport->pendingWriteBytes(conn);
+        if (pending >= m_settings.outboundLimits.highWatermark) {
+            setCongested(conn, true);
+            break;
+        }
+        
+        // Bulk stays queued while the socket holds enough of it, so a control
+        // frame queued now only waits behind a short backlog
+        bool bulk = pending < m_settings.outboundLimits.bulkWatermark;
+        if (!bulk && !conn->outbound.hasPriorityFrames()) {
+            conn->bulkDeferred = true;
+            break;
+        }
+        
+        qint64 oldBytes = conn->outbound.queuedBytes();
+        int oldFrames = conn->outbound.queuedFrames();
+        
+        m_batch.resize(0);
+        conn->outbound.takeBatch(m_batch, (conn->capabilities & BatchEnvelope::CAPABILITY_BATCH) != 0,
+                                 bulk, sent);
+        updateQueueStatistics(conn, oldBytes, oldFrames, conn->outbound.droppedFrames());
+        
+        m_transport->write(conn, m_batch);
+    }
+    updateLaneStatistics(sent);
+}
+
+void ServerWorker::onIdleTick()
+{
+    QVector<quint64> expired;
+    m_idleWheel.tick(expired);
+    
+    for (quint64 connectionId : expired) {
+        Connection *conn = m_connections.value(connectionId, nullptr);
+        if (!conn) continue;
+        
+        qInfo() << "Idle timeout, closing connection" << conn->userId << conn->peerAddress;
+        m_idleTimeouts.ref();
+        // Goes through onConnectionClosed() like any other drop
+        m_transport->close(conn);
+    }
+}
+
+void ServerWorker::closeConnection(quint64 connectionId)
+{
+    Connection *conn = m_connections.value(connectionId, nullptr);
+    if (conn) {
+        m_transport->close(conn);
+    }
+}
+
+void ServerWorker::onConnectionWritable(Connection *conn)
+{
+    if (!conn->congested && !conn->bulkDeferred) return;
+    
+    qint64 pending = m_transport->pendingWriteBytes(conn);
+    if (conn->congested && pending <= m_settings.outboundLimits.lowWatermark) {
+        setCongested(conn, false);
+        drain(conn);
+    } else if (conn->bulkDeferred && pending < m_settings.outboundLimits.bulkWatermark) {
+        drain(conn);
+    }
+}
+
+void ServerWorker::setCongested(Connection *conn, bool congested)
+{
+    if (conn->congested == congested) {
+        return;
+    }
+    
+    conn->congested = congested;
+    if (congested) {
+        m_congestedConnections.ref();
+    } else {
+        m_congestedConnections.deref();
+    }
+}
+
+void ServerWorker::updateQueueStatistics(Connection *conn, qint64 oldBytes, int oldFrames, qint64 oldDropped)
+{
+    m_queuedBytes.fetchAndAddRelaxed(conn->outbound.queuedBytes() - oldBytes);
+    m_queuedFrames.fetchAndAddRelaxed(conn->outbound.queuedFrames() - oldFrames);
+    m_droppedFrames.fetchAndAddRelaxed(conn->outbound.droppedFrames() - oldDropped);
+}
+
+void ServerWorker::updateLaneStatistics(const LaneStatistics *sent)
+{
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        if (sent[lane].sentFrames == 0) continue;
+        m_laneFrames[lane].fetchAndAddRelaxed(sent[lane].sentFrames);
+        m_laneWaitNs[lane].fetchAndAddRelaxed(sent[lane].waitNs);
+        // Only this thread writes it
+        if (sent[lane].maxWaitNs > m_laneMaxWaitNs[lane].load()) {
+            m_laneMaxWaitNs[lane].store(sent[lane].maxWaitNs);
+        }
+    }
+}
+
+QueueStatistics ServerWorker::queueStatistics() const
+{
+    QueueStatistics stats;
+    stats.queuedBytes = m_queuedBytes.load();
+    stats.queuedFrames = m_queuedFrames.load();
+    stats.droppedFrames = m_droppedFrames.load();
+    stats.overflowDisconnects = m_overflowDisconnects.load();
+    stats.congestedConnections = m_congestedConnections.load();
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        stats.lanes[lane].sentFrames = m_laneFrames[lane].load();
+        stats.lanes[lane].waitNs = m_laneWaitNs[lane].load();
+        stats.lanes[lane].maxWaitNs = m_laneMaxWaitNs[lane].load();
+    }
+    return stats;
+}
+
+CompressionStatistics ServerWorker::compressionStatistics() const
+{
+    CompressionStatistics stats;
+    stats.compressedFrames = m_compressedFrames.load();
+    stats.uncompressedBytes = m_uncompressedBytes.load();
+    stats.compressedBytes = m_compressedBytes.load();
+    stats.compressNs = m_compressNs.load();
+    stats.decompressedFrames = m_decompressedFrames.load();
+    stats.decompressNs = m_decompressNs.load();
+    stats.corruptFrames = m_corruptFrames.load();
+    return stats;
+}
+
+RateLimitStatistics ServerWorker::rateLimitStatistics() const
+{
+    RateLimitStatistics stats;
+    stats.readPauses = m_readPauses.load();
+    stats.pausedMs = m_pausedMs.load();
+    stats.frameLimitHits = m_frameLimitHits.load();
+    stats.byteLimitHits = m_byteLimitHits.load();
+    for (int i = 0; i < RateLimits::MAX_TYPE_LIMITS; ++i) {
+        stats.typeLimitHits[i] = m_typeLimitHits[i].load();
+    }
+    stats.pausedConnections = m_pausedConnections.load();
+    return stats;
+}
+
+void ServerWorker::shutdown()
+{
+    // A graceful close may report the connection closed synchronously and remove entries
+    QList<quint64> connectionIds = m_connections.keys();
+    for (quint64 connectionId : connectionIds) {
+        Connection *conn = m_connections.value(connectionId, nullptr);
+        if (conn) {
+            m_transport->closeGracefully(conn);
+        }
+    }
+}
@@ -0,0 +1,258 @@
+#include "sessionlog.h"
+#include <QDateTime>
+
+SessionLog::SessionLog()
+    : m_capacity(DEFAULT_CAPACITY)
+    , m_maxBytes(DEFAULT_MAX_BYTES)
+    , m_resumeWindowMs(DEFAULT_RESUME_WINDOW * Q_INT64_C(1000))
+    , m_bytes(0)
+    , m_sharedSequence(0)
+{
+}
+
+void SessionLog::setCapacity(int entries, int bytes)
+{
+    m_capacity = qMax(0, entries);
+    m_maxBytes = qMax(0, bytes);
+}
+
+SessionLog::UserLog &SessionLog::logOf(const QString &userId)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it != m_logs.end()) {
+        return *it;
+    }
+
+    // Ahead of anything the shared counter handed out before the user logged in
+    UserLog log;
+    log.sequence = qMax(clockSequence(), m_sharedSequence);
+    log.floor = log.sequence;
+    log.offlineSince = QDateTime::currentMSecsSinceEpoch();
+    return *m_logs.insert(userId, log);
+}
+
+quint64 SessionLog::reset(const QString &userId, bool acking)
+{
+    // The counter survives, so sequences never repeat for a client that kept an old one
+    UserLog &log = logOf(userId);
+    clear(userId, log);
+    log.offlineSince = 0;
+    log.acking = acking;
+    return log.sequence;
+}
+
+quint64 SessionLog::resume(const QString &userId, bool acking)
+{
+    UserLog &log = logOf(userId);
+    log.offlineSince = 0;
+    log.acking = acking;
+    return log.sequence;
+}
+
+bool SessionLog::isAcking(const QString &userId) const
+{
+    QHash<QString, UserLog>::const_iterator it = m_logs.constFind(userId);
+    return it != m_logs.constEnd() && it->acking;
+}
+
+quint64 SessionLog::floor(const QString &userId) const
+{
+    QHash<QString, UserLog>::const_iterator it = m_logs.constFind(userId);
+    return it != m_logs.constEnd() ? it->floor : 0;
+}
+
+quint64 SessionLog::nextSequence(const QString &userId)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it != m_logs.end()) {
+        return ++it->sequence;
+    }
+
+    m_sharedSequence = qMax(clockSequence(), m_sharedSequence + 1);
+    return m_sharedSequence;
+}
+
+quint64 SessionLog::clockSequence() const
+{
+    // 1024 sequences per millisecond of headroom, far more than one user receives
+    return static_cast<quint64>(QDateTime::currentMSecsSinceEpoch()) << 10;
+}
+
+void SessionLog::append(const QString &userId, const Entry &entry)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it == m_logs.end()) {
+        return;
+    }
+
+    UserLog &log = *it;
+    log.entries.append(entry);
+    log.bytes += entry.frame.size();
+    m_bytes += entry.frame.size();
+    if (!entry.messageId.isEmpty()) {
+        markPersisted(log, entry.sequence, entry.sequence);
+    }
+
+    while (!log.entries.isEmpty() && (log.entries.size() > m_capacity || log.bytes > m_maxBytes)) {
+        log.floor = log.entries.first().sequence;
+        spill(userId, log, log.entries.first());
+        removeAt(log, 0);
+    }
+}
+
+bool SessionLog::collect(const QString &userId, quint64 after, SessionHandle current,
+                         QList<Entry> &entries) const
+{
+    QHash<QString, UserLog>::const_iterator it = m_logs.constFind(userId);
+    if (it == m_logs.constEnd()) {
+        return false;
+    }
+
+    for (const Entry &entry : it->entries) {
+        if (entry.sequence > after && entry.session != current) {
+            entries.append(entry);
+        }
+    }
+
+    // A client ahead of the counter kept a sequence from an expired log
+    return after >= it->floor && after <= it->sequence;
+}
+
+void SessionLog::discardPersisted(const QString &userId)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it == m_logs.end()) {
+        return;
+    }
+
+    for (int i = 0; i < it->entries.size(); ) {
+        if (it->entries.at(i).messageId.isEmpty()) {
+            ++i;
+        } else {
+            removeAt(*it, i);
+        }
+    }
+}
+
+int SessionLog::acknowledge(const QString &userId, quint64 cumulative, const AckRanges &selective,
+                            AckRanges &persisted)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it == m_logs.end()) {
+        return 0;
+    }
+
+    UserLog &log = *it;
+    int retired = 0;
+    for (int i = 0; i < log.entries.size(); ) {
+        quint64 sequence = log.entries.at(i).sequence;
+        if (sequence <= cumulative || selective.contains(sequence)) {
+            removeAt(log, i);
+            ++retired;
+        } else {
+            ++i;
+        }
+    }
+
+    if (!log.persisted) {
+        return retired;
+    }
+
+    // Only the part of the ack that overlaps the persisted window costs a database update
+    for (const AckRanges::Range &range : selective.ranges()) {
+        quint64 first = qMax(range.first, log.persistedFirst);
+        quint64 last = qMin(range.last, log.persistedLast);
+        if (first <= last) {
+            persisted.insert(first, last);
+        }
+    }
+    if (cumulative >= log.persistedFirst) {
+        persisted.insert(log.persistedFirst, qMin(cumulative, log.persistedLast));
+        log.persisted = (cumulative < log.persistedLast);
+        log.persistedFirst = cumulative + 1;
+    }
+    return retired;
+}
+
+void SessionLog::notePersisted(const QString &userId, quint64 first, quint64 last)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it != m_logs.end()) {
+        markPersisted(*it, first, last);
+    }
+}
+
+void SessionLog::setOffline(const QString &userId, qint64 nowMs)
+{
+    QHash<QString, UserLog>::iterator it = m_logs.find(userId);
+    if (it != m_logs.end()) {
+        it->offlineSince = qMax(Q_INT64_C(1), nowMs);
+    }
+}
+
+int SessionLog::expire(qint64 nowMs)
+{
+    int expired = 0;
+    for (QHash<QString, UserLog>::iterator it = m_logs.begin(); it != m_logs.end(); ) {
+        if (it->offlineSince == 0 || nowMs - it->offlineSince < m_resumeWindowMs) {
+            ++it;
+            continue;
+        }
+        // The next log starts from the clock again, ahead of this counter
+        clear(it.key(), *it);
+        it = m_logs.erase(it);
+        ++expired;
+    }
+    return expired;
+}
+
+QList<SessionLog::Spill> SessionLog::takeSpilled()
+{
+    QList<Spill> spilled;
+    spilled.swap(m_spilled);
+    return spilled;
+}
+
+void SessionLog::clear(const QString &userId, UserLog &log)
+{
+    for (const Entry &entry : log.entries) {
+        spill(userId, log, entry);
+    }
+    m_bytes -= log.bytes;
+    log.bytes = 0;
+    log.entries.clear();
+    log.floor = log.sequence;
+}
+
+void SessionLog::removeAt(UserLog &log, int index)
+{
+    int size = log.entries.at(index).frame.size();
+    log.bytes -= size;
+    m_bytes -= size;
+    log.entries.removeAt(index);
+}
+
+void SessionLog::spill(const QString &userId, const UserLog &log, const Entry &entry)
+{
+    // Persisted entries are safe already, and without acks sent means delivered
+    if (!log.acking || !entry.messageId.isEmpty()) {
+        return;
+    }
+
+    Spill spill;
+    spill.userId = userId;
+    spill.entry = entry;
+    m_spilled.append(spill);
+}
+
+void SessionLog::markPersisted(UserLog &log, quint64 first, quint64 last)
+{
+    if (!log.persisted) {
+        log.persisted = true;
+        log.persistedFirst = first;
+        log.persistedLast = last;
+        return;
+    }
+    log.persistedFirst = qMin(log.persistedFirst, first);
+    log.persistedLast = qMax(log.persistedLast, last);
+}
@@ -1,188 +1,308 @@
 #include "tcpserver.h"
+#include "broadcastengine.h"
+#include "batchenvelope.h"
 #include <QDebug>
-#include <QDataStream>
 #include <QHostAddress>
+#include <QMetaType>
 
 TcpServer::TcpServer(QObject *parent)
-    : QTcpServer(parent), m_port(0)
+    : QTcpServer(parent)
+    , m_broadcastEngine(nullptr)
+    , m_workerThreads(0)
+    , m_port(0)
 {
+    qRegisterMetaType<qintptr>("qintptr");
+    qRegisterMetaType<quint64>("quint64");
+    qRegisterMetaType<QVector<quint64> >("QVector<quint64>");
+    
+    m_broadcastEngine = new BroadcastEngine(this, this);
 }
 
 TcpServer::~TcpServer()
 {
     stopServer();
-    qDeleteAll(m_clients);
 }
 
 bool TcpServer::startServer(quint16 port)
 {
     m_port = port;
+    createWorkers();
+    
     if (!listen(QHostAddress::Any, port)) {
         qWarning() << "Failed to start server on port" << port << ":" << errorString();
+        destroyWorkers();
         return false;
     }
     
-    qInfo() << "Server started successfully on port" << port;
+    qInfo() << "Server started successfully on port" << port
+            << "with" << m_threads.size() << "worker threads,"
+            << m_workers.first()->transportName() << "transport";
     return true;
 }
 
 void TcpServer::stopServer()
 {
-    // Disconnect all clients
-    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
-        if (it.value()->socket) {
-            it.value()->socket->disconnectFromHost();
-        }
+    if (m_workers.isEmpty()) {
+        return;
     }
     
     close();
+    destroyWorkers();
     qInfo() << "Server stopped";
 }
 
-void TcpServer::incomingConnection(qintptr socketDescriptor)
+void TcpServer::createWorkers()
 {
-    QTcpSocket *socket = new QTcpSocket(this);
+    // Without worker threads a single worker shares the server's event loop
+    int threads = threadCount();
+    int count = qMax(1, threads);
     
-    if (socket->setSocketDescriptor(socketDescriptor)) {
-        connect(socket, &QTcpSocket::readyRead, this, &TcpServer::onClientReadyRead);
-        connect(socket, &QTcpSocket::disconnected, this, &TcpServer::onClientDisconnected);
-        connect(socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
-                this, &TcpServer::onClientError);
+    for (int i = 0; i < count; ++i) {
+        ServerWorker *worker = new ServerWorker(i, &m_registry, &m_dispatcher, m_settings);
+        
+        connect(worker, &ServerWorker::clientConnected, this, &TcpServer::clientConnected);
+        connect(worker, &ServerWorker::clientResumed, this, &TcpServer::clientResumed);
+        connect(worker, &ServerWorker::clientDisconnected, this, &TcpServer::clientDisconnected);
+        connect(worker, &ServerWorker::batchDelivered, m_broadcastEngine, &BroadcastEngine::onBatchDelivered);
         
-        qInfo() << "New connection from" << socket->peerAddress().toString() 
-                << ":" << socket->peerPort();
-    } else {
-        qWarning() << "Failed to set socket descriptor";
-        socket->deleteLater();
+        if (threads > 0) {
+            QThread *thread = new QThread(this);
+            thread->setObjectName(QString("worker-%1").arg(i));
+            worker->moveToThread(thread);
+            connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+            thread->start();
+            m_threads.append(thread);
+        } else {
+            worker->setParent(this);
+        }
+        
+        m_workers.append(worker);
     }
 }
 
-void TcpServer::onClientReadyRead()
+int TcpServer::threadCount() const
 {
-    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
-    if (!socket) return;
-    
-    QByteArray data = socket->readAll();
-    handleMessage(socket, data);
+    // A TLS handshake costs milliseconds of CPU, never spent on the server's thread
+    if (m_workerThreads == 0 && m_settings.tls.isEnabled()) {
+        return qMax(1, QThread::idealThreadCount());
+    }
+    return m_workerThreads;
 }
 
-void TcpServer::onClientDisconnected()
+void TcpServer::destroyWorkers()
 {
-    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
-    if (!socket) return;
+    for (ServerWorker *worker : m_workers) {
+        Qt::ConnectionType type = (worker->thread() == QThread::currentThread())
+                ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+        QMetaObject::invokeMethod(worker, "shutdown", type);
+    }
     
-    QString userId = m_socketToUserId.value(socket, QString());
-    if (!userId.isEmpty()) {
-        qInfo() << "Client disconnected:" << userId;
-        emit clientDisconnected(userId);
+    for (QThread *thread : m_threads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
     }
     
-    removeClient(socket);
-    socket->deleteLater();
+    if (m_threads.isEmpty()) {
+        qDeleteAll(m_workers);
+    }
+    
+    m_threads.clear();
+    m_workers.clear();
 }
 
-void TcpServer::onClientError(QAbstractSocket::SocketError error)
+ServerWorker *TcpServer::pickWorker() const
 {
-    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
-    if (!socket) return;
-    
-    qWarning() << "Socket error:" << socket->errorString();
+    // Least-loaded worker, ties go to the lowest index
+    ServerWorker *best = m_workers.first();
+    for (ServerWorker *worker : m_workers) {
+        if (worker->connectionCount() < best->connectionCount()) {
+            best = worker;
+        }
+    }
+    return best;
 }
 
-void TcpServer::handleMessage(QTcpSocket *socket, const QByteArray &data)
+void TcpServer::incomingConnection(qintptr socketDescriptor)
 {
-    if (data.isEmpty()) return;
-    
-    // Simple protocol: [MessageType(1 byte)][UserId length(2 bytes)][UserId][Data]
-    QDataStream stream(data);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    quint8 msgType;
-    stream >> msgType;
-    
-    QString userId = m_socketToUserId.value(socket, QString());
-    
-    // If not registered, first message should contain userId
-    if (userId.isEmpty()) {
-        quint16 userIdLen;
-        stream >> userIdLen;
-        
-        QByteArray userIdData(userIdLen, 0);
-        stream.readRawData(userIdData.data(), userIdLen);
-        userId = QString::fromUtf8(userIdData);
-        
-        registerClient(socket, userId);
-        qInfo() << "Client registered:" << userId;
-        emit clientConnected(userId);
+    // The worker adopts the descriptor on its own thread
+    QMetaObject::invokeMethod(pickWorker(), "addConnection", Q_ARG(qintptr, socketDescriptor));
+}
+
+bool TcpServer::sendMessage(const QString &userId, const QByteArray &data)
+{
+    ClientInfo client;
+    if (!m_registry.lookup(userId, client) || !client.isOnline) {
+        qWarning() << "Client not found or offline:" << userId;
+        return false;
     }
     
-    // Extract remaining data
-    QByteArray payload;
-    QIODevice *device = stream.device();
-    if (device && device->bytesAvailable() > 0) {
-        payload = device->readAll();
+    return route(client, data);
+}
+
+bool TcpServer::sendMessage(SessionHandle session, const QByteArray &data)
+{
+    // A handle from an ended session fails the generation check
+    ClientInfo client;
+    if (!m_registry.lookup(session, client) || !client.isOnline) {
+        return false;
     }
     
-    emit messageReceived(userId, static_cast<int>(msgType), payload);
+    return route(client, data);
 }
 
-void TcpServer::registerClient(QTcpSocket *socket, const QString &userId)
+bool TcpServer::sendMessage(SessionHandle session, const QByteArray &prefix, const QByteArray &data,
+                            quint32 stream)
 {
-    ClientInfo *info = new ClientInfo;
-    info->userId = userId;
-    info->socket = socket;
-    info->ipAddress = socket->peerAddress().toString();
-    info->port = socket->peerPort();
-    info->isOnline = true;
+    ClientInfo client;
+    if (!m_registry.lookup(session, client) || !client.isOnline) {
+        return false;
+    }
     
-    m_clients[userId] = info;
-    m_socketToUserId[socket] = userId;
+    return route(client, prefix, data, stream);
 }
 
-void TcpServer::removeClient(QTcpSocket *socket)
+bool TcpServer::route(const ClientInfo &client, const QByteArray &data)
 {
-    QString userId = m_socketToUserId.value(socket, QString());
-    if (!userId.isEmpty()) {
-        ClientInfo *info = m_clients.value(userId, nullptr);
-        if (info) {
-            delete info;
-            m_clients.remove(userId);
-        }
-        m_socketToUserId.remove(socket);
-    }
+    // Direct call on the owning thread, queued otherwise
+    return QMetaObject::invokeMethod(client.worker, "sendToConnection",
+                                     Q_ARG(quint64, client.connectionId),
+                                     Q_ARG(QByteArray, data));
 }
 
-bool TcpServer::sendMessage(const QString &userId, const QByteArray &data)
+bool TcpServer::route(const ClientInfo &client, const QByteArray &prefix, const QByteArray &data,
+                      quint32 stream)
 {
-    ClientInfo *client = m_clients.value(userId, nullptr);
-    if (!client || !client->socket || !client->isOnline) {
-        qWarning() << "Client not found or offline:" << userId;
+    return QMetaObject::invokeMethod(client.worker, "sendToConnection",
+                                     Q_ARG(quint64, client.connectionId),
+                                     Q_ARG(QByteArray, prefix),
+                                     Q_ARG(QByteArray, data),
+                                     Q_ARG(quint32, stream));
+}
+
+ServerWorker *TcpServer::workerOf(quint64 connectionId) const
+{
+    // Connection ids carry the worker index in their high bits
+    int index = static_cast<int>(connectionId >> 48);
+    return (index < m_workers.size()) ? m_workers.at(index) : nullptr;
+}
+
+bool TcpServer::sendToConnection(quint64 connectionId, const QByteArray &data)
+{
+    ServerWorker *worker = workerOf(connectionId);
+    if (!worker) {
         return false;
     }
     
-    qint64 written = client->socket->write(data);
-    client->socket->flush();
+    return QMetaObject::invokeMethod(worker, "sendToConnection",
+                                     Q_ARG(quint64, connectionId),
+                                     Q_ARG(QByteArray, data));
+}
+
+bool TcpServer::completeLogin(quint64 connectionId, const QString &userId, const QByteArray &data,
+                              int capabilities, qint64 resumeFrom)
+{
+    ServerWorker *worker = workerOf(connectionId);
+    if (!worker) {
+        return false;
+    }
     
-    return written > 0;
+    return QMetaObject::invokeMethod(worker, "loginConnection",
+                                     Q_ARG(quint64, connectionId),
+                                     Q_ARG(QString, userId),
+                                     Q_ARG(QByteArray, data),
+                                     Q_ARG(int, capabilities),
+                                     Q_ARG(qint64, resumeFrom));
 }
 
 void TcpServer::broadcastMessage(const QByteArray &data)
 {
-    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
-        if (it.value()->socket && it.value()->isOnline) {
-            it.value()->socket->write(data);
-            it.value()->socket->flush();
+    m_broadcastEngine->broadcast(data);
+}
+
+QList<QString> TcpServer::getOnlineUsers() const
+{
+    return m_registry.onlineUsers();
+}
+
+QueueStatistics TcpServer::queueStatistics() const
+{
+    QueueStatistics total;
+    for (ServerWorker *worker : m_workers) {
+        QueueStatistics stats = worker->queueStatistics();
+        total.queuedBytes += stats.queuedBytes;
+        total.queuedFrames += stats.queuedFrames;
+        total.droppedFrames += stats.droppedFrames;
+        total.overflowDisconnects += stats.overflowDisconnects;
+        total.congestedConnections += stats.congestedConnections;
+        for (int lane = 0; lane < LANE_COUNT; ++lane) {
+            total.lanes[lane].sentFrames += stats.lanes[lane].sentFrames;
+            total.lanes[lane].waitNs += stats.lanes[lane].waitNs;
+            total.lanes[lane].maxWaitNs = qMax(total.lanes[lane].maxWaitNs, stats.lanes[lane].maxWaitNs);
         }
     }
+    return total;
 }
 
-QList<QString> TcpServer::getOnlineUsers() const
+int TcpServer::capabilities() const
+{
+    int capabilities = BatchEnvelope::CAPABILITY_BATCH | AckRanges::CAPABILITY_ACK;
+    if (m_settings.compressionThreshold > 0) {
+        capabilities |= FrameCompression::CAPABILITY_COMPRESSION;
+    }
+    return capabilities;
+}
+
+CompressionStatistics TcpServer::compressionStatistics() const
+{
+    CompressionStatistics total;
+    for (ServerWorker *worker : m_workers) {
+        CompressionStatistics stats = worker->compressionStatistics();
+        total.compressedFrames += stats.compressedFrames;
+        total.uncompressedBytes += stats.uncompressedBytes;
+        total.compressedBytes += stats.compressedBytes;
+        total.compressNs += stats.compressNs;
+        total.decompressedFrames += stats.decompressedFrames;
+        total.decompressNs += stats.decompressNs;
+        total.corruptFrames += stats.corruptFrames;
+    }
+    return total;
+}
+
+TlsStatistics TcpServer::tlsStatistics() const
+{
+    TlsStatistics total;
+    for (ServerWorker *worker : m_workers) {
+        TlsStatistics stats = worker->tlsStatistics();
+        total.handshakes += stats.handshakes;
+        total.failedHandshakes += stats.failedHandshakes;
+        total.handshakeNs += stats.handshakeNs;
+    }
+    return total;
+}
+
+RateLimitStatistics TcpServer::rateLimitStatistics() const
 {
-    QList<QString> users;
-    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
-        if (it.value()->isOnline) {
-            users.append(it.key());
+    RateLimitStatistics total;
+    for (ServerWorker *worker : m_workers) {
+        RateLimitStatistics stats = worker->rateLimitStatistics();
+        total.readPauses += stats.readPauses;
+        total.pausedMs += stats.pausedMs;
+        total.frameLimitHits += stats.frameLimitHits;
+        total.byteLimitHits += stats.byteLimitHits;
+        for (int i = 0; i < RateLimits::MAX_TYPE_LIMITS; ++i) {
+            total.typeLimitHits[i] += stats.typeLimitHits[i];
         }
+        total.pausedConnections += stats.pausedConnections;
+    }
+    return total;
+}
+
+qint64 TcpServer::idleTimeouts() const
+{
+    qint64 total = 0;
+    for (ServerWorker *worker : m_workers) {
+        total += worker->idleTimeouts();
     }
-    return users;
+    return total;
 }
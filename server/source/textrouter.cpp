@@ -0,0 +1,407 @@
+#include "textrouter.h"
+#include "offlinestore.h"
+#include "tcpserver.h"
+#include "authmanager.h"
+#include "wirecodec.h"
+#include <QThread>
+#include <QTimer>
+#include <QDateTime>
+#include <QUuid>
+#include <QDebug>
+
+TextRouter::TextRouter(TcpServer *tcpServer, QObject *parent)
+    : QObject(parent)
+    , m_tcpServer(tcpServer)
+    , m_authManager(nullptr)
+    , m_storeThread(nullptr)
+    , m_store(nullptr)
+    , m_expiryTimer(new QTimer(this))
+    , m_flushScheduled(false)
+    , m_deliveredOnline(0)
+    , m_queuedOffline(0)
+    , m_deliveredFromBacklog(0)
+    , m_dropped(0)
+    , m_unknownRecipients(0)
+    , m_replayed(0)
+    , m_resumedFromMemory(0)
+    , m_resumedFromDatabase(0)
+    , m_acknowledged(0)
+    , m_spilled(0)
+{
+    qRegisterMetaType<OfflineMessage>("OfflineMessage");
+    qRegisterMetaType<QList<OfflineMessage> >("QList<OfflineMessage>");
+    qRegisterMetaType<AckRanges>("AckRanges");
+    
+    MessageDispatcher *dispatcher = m_tcpServer->dispatcher();
+    dispatcher->registerHandler(MSG_TEXT, [this](const MessageHeader &header, const FrameView &payload) {
+        onTextMessage(header, payload);
+    });
+    dispatcher->registerHandler(MSG_ACK, [this](const MessageHeader &header, const FrameView &payload) {
+        onAck(header, payload);
+    });
+    connect(m_tcpServer, &TcpServer::clientConnected, this, &TextRouter::onClientConnected);
+    connect(m_tcpServer, &TcpServer::clientResumed, this, &TextRouter::onClientResumed);
+    connect(m_tcpServer, &TcpServer::clientDisconnected, this, &TextRouter::onClientDisconnected);
+    
+    // Rings of users gone for longer than the resume window are emptied
+    connect(m_expiryTimer, &QTimer::timeout, this, &TextRouter::expireSessionLogs);
+    m_expiryTimer->start(30 * 1000);
+}
+
+TextRouter::~TextRouter()
+{
+    stopPersistence();
+}
+
+void TextRouter::startPersistence(const QString &host, int port, const QString &dbName,
+                                  const QString &user, const QString &password)
+{
+    stopPersistence();
+    
+    m_storeThread = new QThread(this);
+    m_storeThread->setObjectName("offline-store");
+    m_store = new OfflineStore;
+    m_store->moveToThread(m_storeThread);
+    connect(m_storeThread, &QThread::finished, m_store, &QObject::deleteLater);
+    connect(m_store, &OfflineStore::backlogLoaded, this, &TextRouter::onBacklogLoaded);
+    connect(m_store, &OfflineStore::backlogFinished, this, &TextRouter::onBacklogFinished);
+    connect(m_store, &OfflineStore::messagesSaved, this, &TextRouter::onMessagesSaved);
+    m_storeThread->start();
+    
+    QMetaObject::invokeMethod(m_store, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, host), Q_ARG(int, port), Q_ARG(QString, dbName),
+                              Q_ARG(QString, user), Q_ARG(QString, password));
+}
+
+void TextRouter::stopPersistence()
+{
+    if (!m_store) {
+        return;
+    }
+    
+    flushOffline();
+    // Queued behind any pending save, so nothing accepted is lost
+    QMetaObject::invokeMethod(m_store, "close", Qt::QueuedConnection);
+    m_storeThread->quit();
+    m_storeThread->wait();
+    delete m_storeThread;
+    m_storeThread = nullptr;
+    m_store = nullptr;
+}
+
+void TextRouter::onTextMessage(const MessageHeader &header, const FrameView &payload)
+{
+    // [RecipientId][Text], the text stays a view into the frame
+    WireReader reader(payload);
+    QString recipientId;
+    WireView text;
+    if (!reader.readString(recipientId) || !reader.readBytes(text)) {
+        qWarning() << "Malformed text message from" << header.userId;
+        return;
+    }
+    
+    // Nobody could ever log in to read it, so it is neither numbered nor stored
+    if (m_authManager && !m_authManager->isRegistered(recipientId)) {
+        ++m_unknownRecipients;
+        return;
+    }
+    
+    // Numbered in the recipient's replay ring, acks and resumes refer to it
+    SessionLog *sessionLog = m_tcpServer->sessionLog();
+    SessionLog::Entry entry;
+    entry.sequence = sessionLog->nextSequence(recipientId);
+    
+    // [0x00][SenderId][Text][Sequence]
+    QByteArray sender = header.userId.toUtf8();
+    QByteArray message;
+    message.reserve(1 + WireWriter::varintSize(sender.size()) + sender.size()
+                    + WireWriter::varintSize(text.size) + text.size
+                    + WireWriter::varintSize(entry.sequence));
+    WireWriter(message)
+        .writeByte(MSG_TEXT)
+        .writeUtf8(sender)
+        .writeBytes(text.data, text.size)
+        .writeVarint(entry.sequence);
+    entry.frame = message;
+    
+    SessionHandle session = m_tcpServer->sessionOf(recipientId);
+    if (session != INVALID_SESSION && m_tcpServer->sendMessage(session, message)) {
+        ++m_deliveredOnline;
+        entry.session = session;
+    } else if (m_store) {
+        OfflineMessage offline;
+        offline.messageId = QUuid::createUuid().toString(QUuid::WithoutBraces);
+        offline.fromUserId = header.userId;
+        offline.toUserId = recipientId;
+        offline.content = text.toString();
+        offline.messageType = "text";
+        offline.sentAt = QDateTime::currentDateTime();
+        offline.delivered = false;
+        offline.sequence = entry.sequence;
+        // Counted once the store reports it saved
+        queueOffline(offline);
+        entry.messageId = offline.messageId;
+    } else {
+        // Without persistence only a resume within the window still gets it
+        ++m_dropped;
+    }
+    
+    sessionLog->append(recipientId, entry);
+    persistSpilled();
+}
+
+void TextRouter::onAck(const MessageHeader &header, const FrameView &payload)
+{
+    // [Cumulative][RangeCount]([Gap][Length]) × RangeCount
+    WireReader reader(payload);
+    quint64 cumulative = 0;
+    AckRanges selective;
+    if (!AckRanges::decodeAck(reader, cumulative, selective)) {
+        qWarning() << "Malformed ack from" << header.userId;
+        return;
+    }
+    
+    AckRanges persisted;
+    m_acknowledged += m_tcpServer->sessionLog()->acknowledge(header.userId, cumulative, selective, persisted);
+    retire(header.userId, persisted);
+}
+
+void TextRouter::queueOffline(const OfflineMessage &message)
+{
+    m_pendingOffline.append(message);
+    if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, "flushOffline", Qt::QueuedConnection);
+    }
+}
+
+void TextRouter::persistSpilled()
+{
+    // Unacknowledged messages that left the ring are stored like offline ones
+    SessionLog *sessionLog = m_tcpServer->sessionLog();
+    QList<SessionLog::Spill> spilled = sessionLog->takeSpilled();
+    for (const SessionLog::Spill &spill : spilled) {
+        if (!m_store) {
+            ++m_dropped;
+            continue;
+        }
+        
+        // [0x00][SenderId][Text][Sequence]
+        const QByteArray &frame = spill.entry.frame;
+        WireReader reader(frame.constData() + 1, frame.size() - 1);
+        QString sender;
+        WireView text;
+        if (!reader.readString(sender) || !reader.readBytes(text)) {
+            continue;
+        }
+        
+        OfflineMessage offline;
+        offline.messageId = QUuid::createUuid().toString(QUuid::WithoutBraces);
+        offline.fromUserId = sender;
+        offline.toUserId = spill.userId;
+        offline.content = text.toString();
+        offline.messageType = "text";
+        offline.sentAt = QDateTime::currentDateTime();
+        offline.delivered = false;
+        offline.sequence = spill.entry.sequence;
+        queueOffline(offline);
+        sessionLog->notePersisted(spill.userId, offline.sequence, offline.sequence);
+        ++m_spilled;
+    }
+}
+
+void TextRouter::retire(const QString &userId, const AckRanges &ranges)
+{
+    if (!m_store || ranges.isEmpty()) {
+        return;
+    }
+    
+    // Queued behind the save of the same rows
+    flushOffline();
+    QMetaObject::invokeMethod(m_store, "retire", Qt::QueuedConnection,
+                              Q_ARG(QString, userId), Q_ARG(AckRanges, ranges));
+}
+
+void TextRouter::onMessagesSaved(int saved, int failed)
+{
+    m_queuedOffline += saved;
+    m_dropped += failed;
+}
+
+void TextRouter::flushOffline()
+{
+    m_flushScheduled = false;
+    if (m_pendingOffline.isEmpty() || !m_store) {
+        return;
+    }
+    
+    QMetaObject::invokeMethod(m_store, "saveMessages", Qt::QueuedConnection,
+                              Q_ARG(QList<OfflineMessage>, m_pendingOffline));
+    m_pendingOffline.clear();
+}
+
+void TextRouter::onClientConnected(const QString &userId)
+{
+    // The login reset the ring: what it held unacknowledged is saved ahead
+    // of the load, and persisted messages come through the backlog
+    persistSpilled();
+    m_tcpServer->sessionLog()->discardPersisted(userId);
+    loadBacklog(userId);
+}
+
+void TextRouter::onClientResumed(const QString &userId, quint64 lastSequence)
+{
+    SessionHandle session = m_tcpServer->sessionOf(userId);
+    if (session == INVALID_SESSION) {
+        return;   // Gone again already
+    }
+    
+    // The resume point doubles as a cumulative ack
+    SessionLog *sessionLog = m_tcpServer->sessionLog();
+    bool acking = sessionLog->isAcking(userId);
+    if (acking) {
+        AckRanges persisted;
+        m_acknowledged += sessionLog->acknowledge(userId, lastSequence, AckRanges(), persisted);
+        retire(userId, persisted);
+    }
+    
+    QList<SessionLog::Entry> missed;
+    bool inMemory = sessionLog->collect(userId, lastSequence, session, missed);
+    
+    // Only unacknowledged entries are left to retransmit, with their sequence
+    AckRanges persisted;
+    for (const SessionLog::Entry &entry : missed) {
+        if (!inMemory && !entry.messageId.isEmpty()) {
+            continue;   // Part of the database backlog below
+        }
+        if (!m_tcpServer->sendMessage(session, entry.frame)) {
+            break;
+        }
+        ++m_replayed;
+        if (!entry.messageId.isEmpty()) {
+            persisted.insert(entry.sequence);
+        }
+    }
+    
+    if (inMemory) {
+        ++m_resumedFromMemory;
+        // Without acks a replayed message counts as delivered
+        if (!acking) {
+            retire(userId, persisted);
+        }
+        return;
+    }
+    
+    // The gap reaches past the ring, whatever was persisted comes from the database
+    ++m_resumedFromDatabase;
+    sessionLog->discardPersisted(userId);
+    loadBacklog(userId);
+}
+
+void TextRouter::onClientDisconnected(const QString &userId)
+{
+    // A resume may have registered a new session in the meantime
+    if (m_tcpServer->sessionOf(userId) == INVALID_SESSION) {
+        m_tcpServer->sessionLog()->setOffline(userId, QDateTime::currentMSecsSinceEpoch());
+    }
+}
+
+void TextRouter::expireSessionLogs()
+{
+    m_tcpServer->sessionLog()->expire(QDateTime::currentMSecsSinceEpoch());
+    persistSpilled();
+}
+
+void TextRouter::loadBacklog(const QString &userId)
+{
+    SessionLog *sessionLog = m_tcpServer->sessionLog();
+    bool acking = sessionLog->isAcking(userId);
+    
+    if (!m_store) {
+        if (acking) {
+            sendBacklogFrame(userId, QByteArray(), sessionLog->floor(userId));
+        }
+        return;
+    }
+    
+    // Everything up to the floor is either acknowledged or in the backlog,
+    // the last backlog frame tells the client so
+    if (acking) {
+        m_backlogFloor.insert(userId, sessionLog->floor(userId));
+    }
+    
+    // Saves still pending for this user are queued ahead of the load
+    flushOffline();
+    QMetaObject::invokeMethod(m_store, "loadBacklog", Qt::QueuedConnection,
+                              Q_ARG(QString, userId), Q_ARG(bool, !acking));
+}
+
+void TextRouter::onBacklogLoaded(const QString &userId, const QList<OfflineMessage> &messages)
+{
+    // [0x0B] then [SenderId][Text] per message up to the end of the frame,
+    // each frame filled up to MAX_BATCH_FRAME. Acking clients get
+    // [0x0B][Through] first, the highest sequence the frame settles.
+    bool acking = m_tcpServer->sessionLog()->isAcking(userId);
+    if (acking && !messages.isEmpty()) {
+        // Undelivered in the database until acknowledged
+        m_tcpServer->sessionLog()->notePersisted(userId, messages.first().sequence,
+                                                 messages.last().sequence);
+    }
+    
+    QByteArray entries;
+    quint64 through = 0;
+    int count = 0;
+    
+    auto sendFrame = [&]() {
+        if (count == 0) return;
+        sendBacklogFrame(userId, entries, acking ? through : 0);
+        m_deliveredFromBacklog += count;
+        count = 0;
+    };
+    
+    for (const OfflineMessage &message : messages) {
+        QByteArray sender = message.fromUserId.toUtf8();
+        QByteArray text = message.content.toUtf8();
+        int entrySize = WireWriter::varintSize(sender.size()) + sender.size()
+                      + WireWriter::varintSize(text.size()) + text.size();
+        
+        if (count > 0 && entries.size() + entrySize > MAX_BATCH_FRAME) {
+            sendFrame();
+        }
+        if (count == 0) {
+            entries = QByteArray();
+            entries.reserve(MAX_BATCH_FRAME);
+        }
+        
+        WireWriter(entries).writeUtf8(sender).writeUtf8(text);
+        through = message.sequence;
+        ++count;
+    }
+    sendFrame();
+}
+
+void TextRouter::onBacklogFinished(const QString &userId, quint64 lastSequence)
+{
+    if (!m_backlogFloor.contains(userId)) {
+        return;
+    }
+    
+    // Settles the sequences below the floor that had nothing left to deliver
+    quint64 floor = m_backlogFloor.take(userId);
+    if (floor > lastSequence) {
+        sendBacklogFrame(userId, QByteArray(), floor);
+    }
+}
+
+void TextRouter::sendBacklogFrame(const QString &userId, const QByteArray &entries, quint64 through)
+{
+    QByteArray frame;
+    frame.reserve(1 + WireWriter::varintSize(through) + entries.size());
+    WireWriter writer(frame);
+    writer.writeByte(MSG_OFFLINE_BATCH);
+    if (through != 0) {
+        writer.writeVarint(through);
+    }
+    writer.writeRaw(entries.constData(), entries.size());
+    m_tcpServer->sendMessage(userId, frame);
+}
@@ -0,0 +1,73 @@
+#include "timingwheel.h"
+
+static int roundUpToPowerOfTwo(int value)
+{
+    int result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+TimingWheel::TimingWheel(int slotCount)
+    : m_slots(roundUpToPowerOfTwo(qMax(2, slotCount)))
+    , m_mask(m_slots.size() - 1)
+    , m_cursor(0)
+    , m_count(0)
+{
+    for (int i = 0; i < m_slots.size(); ++i) {
+        m_slots[i].prev = &m_slots[i];
+        m_slots[i].next = &m_slots[i];
+    }
+}
+
+void TimingWheel::schedule(TimerNode *node, int ticks)
+{
+    if (node->isArmed()) {
+        unlink(node);
+    }
+
+    ticks = qMax(1, ticks);
+    TimerNode *head = &m_slots[(m_cursor + ticks) & m_mask];
+    node->rounds = (ticks - 1) / m_slots.size();
+
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+    ++m_count;
+}
+
+void TimingWheel::cancel(TimerNode *node)
+{
+    if (node->isArmed()) {
+        unlink(node);
+    }
+}
+
+void TimingWheel::unlink(TimerNode *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = nullptr;
+    node->next = nullptr;
+    --m_count;
+}
+
+void TimingWheel::tick(QVector<quint64> &expired)
+{
+    m_cursor = (m_cursor + 1) & m_mask;
+    TimerNode *head = &m_slots[m_cursor];
+
+    TimerNode *node = head->next;
+    while (node != head) {
+        TimerNode *next = node->next;
+        if (node->rounds > 0) {
+            --node->rounds;
+        } else {
+            unlink(node);
+            expired.append(node->id);
+        }
+        node = next;
+    }
+}
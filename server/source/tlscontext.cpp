@@ -0,0 +1,93 @@
+#include "tlscontext.h"
+#include <QFile>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QDebug>
+
+// QSslSocketPrivate::checkSettingSslContext() hands a socket the context
+// its handshake would otherwise create. Qt 5 only: Qt 6 moved TLS into
+// backend plugins and the hook is gone.
+#if defined(TLS_SHARED_CONTEXT) && QT_VERSION >= QT_VERSION_CHECK(5, 4, 0) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+#define TLS_CONTEXT_HOOK
+#include <QtNetwork/private/qsslsocket_p.h>
+#include <QtNetwork/private/qsslcontext_openssl_p.h>
+#endif
+
+static bool readFile(const QString &path, QByteArray &data, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = QString("Cannot read %1: %2").arg(path, file.errorString());
+        return false;
+    }
+    data = file.readAll();
+    return true;
+}
+
+bool TlsContext::load(const QString &certificatePath, const QString &keyPath, QString *error)
+{
+    if (!QSslSocket::supportsSsl()) {
+        if (error) *error = "No TLS backend available, Qt was built or deployed without OpenSSL";
+        return false;
+    }
+    
+    QByteArray certificateData;
+    QByteArray keyData;
+    if (!readFile(certificatePath, certificateData, error) || !readFile(keyPath, keyData, error)) {
+        return false;
+    }
+    
+    QList<QSslCertificate> chain = QSslCertificate::fromData(certificateData, QSsl::Pem);
+    if (chain.isEmpty()) {
+        if (error) *error = QString("No PEM certificate in %1").arg(certificatePath);
+        return false;
+    }
+    
+    QSslKey key(keyData, QSsl::Rsa, QSsl::Pem);
+    if (key.isNull()) {
+        key = QSslKey(keyData, QSsl::Ec, QSsl::Pem);
+    }
+    if (key.isNull()) {
+        if (error) *error = QString("No unencrypted RSA or EC key in %1").arg(keyPath);
+        return false;
+    }
+    
+    QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+    configuration.setLocalCertificateChain(chain);
+    configuration.setPrivateKey(key);
+    configuration.setProtocol(QSsl::TlsV1_2OrLater);
+    // No client certificates: asking for one costs a round trip, and a
+    // verifying server context cannot resume sessions without an ID context
+    configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+    configuration.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    m_configuration = configuration;
+    
+#ifdef TLS_CONTEXT_HOOK
+    m_context = QSslContext::sharedFromConfiguration(QSslSocket::SslServerMode, m_configuration, false);
+    if (!m_context || m_context->error() != QSslError::NoError) {
+        qWarning() << "Shared TLS context unavailable, sessions will not resume:"
+                   << (m_context ? m_context->errorString() : QString());
+        m_context.clear();
+    }
+#endif
+    
+    m_enabled = true;
+    return true;
+}
+
+bool TlsContext::resumesSessions() const
+{
+    return !m_context.isNull();
+}
+
+void TlsContext::prepare(QSslSocket *socket) const
+{
+    socket->setSslConfiguration(m_configuration);
+#ifdef TLS_CONTEXT_HOOK
+    // Only taken while the socket has no context yet, before startServerEncryption()
+    if (m_context) {
+        QSslSocketPrivate::checkSettingSslContext(socket, m_context);
+    }
+#endif
+}
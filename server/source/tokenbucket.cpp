@@ -0,0 +1,38 @@
+#include "tokenbucket.h"
+#include <cmath>
+
+int RateLimits::indexOf(quint8 type) const
+{
+    for (int i = 0; i < types.size(); ++i) {
+        if (types.at(i).type == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+double TokenBucket::tokensAt(const RateLimit &limit, qint64 nowMs) const
+{
+    if (!m_started) {
+        return limit.burst;
+    }
+    double refilled = m_tokens + (nowMs - m_updatedMs) * limit.rate / 1000.0;
+    return qMin(refilled, limit.burst);
+}
+
+bool TokenBucket::consume(const RateLimit &limit, double amount, qint64 nowMs)
+{
+    m_tokens = tokensAt(limit, nowMs) - amount;
+    m_updatedMs = nowMs;
+    m_started = true;
+    return m_tokens >= 0;
+}
+
+qint64 TokenBucket::msUntilClear(const RateLimit &limit, qint64 nowMs) const
+{
+    double tokens = tokensAt(limit, nowMs);
+    if (tokens >= 0 || limit.rate <= 0) {
+        return 0;
+    }
+    return static_cast<qint64>(std::ceil(-tokens * 1000.0 / limit.rate));
+}
@@ -0,0 +1,28 @@
+#include "transport.h"
+#include "qttransport.h"
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include "epolltransport.h"
+#endif
+
+Transport *createTransport(TransportType type, const TlsContext &tls, TransportHandler *handler,
+                           QObject *parent)
+{
+    if (type == TRANSPORT_EPOLL && tls.isEnabled()) {
+        qWarning() << "TLS needs the Qt transport, not using epoll";
+    } else if (type == TRANSPORT_EPOLL) {
+#ifdef Q_OS_LINUX
+        EpollTransport *transport = new EpollTransport(handler, parent);
+        if (transport->isValid()) {
+            return transport;
+        }
+        delete transport;
+        qWarning() << "epoll unavailable, falling back to the Qt transport";
+#else
+        qWarning() << "The epoll transport needs Linux, falling back to the Qt transport";
+#endif
+    }
+    
+    return new QtTransport(handler, tls, parent);
+}
@@ -1,15 +1,48 @@
 #include "videocallserver.h"
 #include "tcpserver.h"
+#include "mediarelay.h"
+#include "audiomixer.h"
 #include <QDebug>
 #include <QDateTime>
-#include <QDataStream>
+#include "wirecodec.h"
 #include <QUuid>
 
 VideoCallServer::VideoCallServer(TcpServer *tcpServer, QObject *parent)
-    : QObject(parent), m_tcpServer(tcpServer)
+    : QObject(parent), m_tcpServer(tcpServer), m_mediaRelay(nullptr)
+    , m_nextStreamId(1), m_roomMediaPackets(0), m_roomMediaSends(0)
+    , m_audioFrameMs(20), m_audioFrames(0), m_audioDropped(0), m_mixedFrames(0)
 {
-    connect(m_tcpServer, &TcpServer::messageReceived, 
-            this, &VideoCallServer::onMessageReceived);
+    // Only call and room messages reach us, each already split by type
+    MessageDispatcher *dispatcher = m_tcpServer->dispatcher();
+    dispatcher->registerHandler(MSG_CALL_REQUEST, [this](const MessageHeader &header, const FrameView &payload) {
+        onCallRequest(header, payload);
+    });
+    dispatcher->registerHandler(MSG_CALL_ACCEPT, [this](const MessageHeader &header, const FrameView &payload) {
+        onCallAccept(header, payload);
+    });
+    dispatcher->registerHandler(MSG_CALL_REJECT, [this](const MessageHeader &header, const FrameView &payload) {
+        onCallReject(header, payload);
+    });
+    dispatcher->registerHandler(MSG_CALL_END, [this](const MessageHeader &header, const FrameView &payload) {
+        onCallEnd(header, payload);
+    });
+    dispatcher->registerHandler(MSG_MEDIA_DATA, [this](const MessageHeader &header, const FrameView &payload) {
+        onMediaData(header, payload);
+    });
+    dispatcher->registerHandler(MSG_ROOM, [this](const MessageHeader &header, const FrameView &payload) {
+        onRoom(header, payload);
+    });
+    dispatcher->registerHandler(MSG_ROOM_MEDIA, [this](const MessageHeader &header, const FrameView &payload) {
+        onRoomMedia(header, payload);
+    });
+    dispatcher->registerHandler(MSG_ROOM_AUDIO, [this](const MessageHeader &header, const FrameView &payload) {
+        onRoomAudio(header, payload);
+    });
+    
+    // A late tick is a gap in everyone's audio
+    m_mixTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_mixTimer, &QTimer::timeout, this, &VideoCallServer::onMixTick);
+    
     connect(m_tcpServer, &TcpServer::clientDisconnected,
             this, &VideoCallServer::onClientDisconnected);
 }
@@ -17,6 +50,11 @@ VideoCallServer::VideoCallServer(TcpServer *tcpServer, QObject *parent)
 VideoCallServer::~VideoCallServer()
 {
     qDeleteAll(m_callSessions);
+    qDeleteAll(m_roomMembers);
+    for (Room *room : m_rooms) {
+        delete room->mixer;
+    }
+    qDeleteAll(m_rooms);
 }
 
 QString VideoCallServer::generateCallId()
@@ -46,6 +84,9 @@ bool VideoCallServer::initiateCall(const QString &caller, const QString &callee,
     session->isVideoCall = isVideo;
     session->startTime = QDateTime::currentMSecsSinceEpoch();
     session->endTime = 0;
+    session->relaySessionId = 0;
+    session->callerSession = INVALID_SESSION;
+    session->calleeSession = INVALID_SESSION;
     
     m_callSessions[session->callId] = session;
     m_userToCallId[caller] = session->callId;
@@ -77,10 +118,16 @@ bool VideoCallServer::acceptCall(const QString &callId)
     
     session->status = CALL_ACTIVE;
     session->startTime = QDateTime::currentMSecsSinceEpoch();
+    if (m_mediaRelay && m_mediaRelay->isRunning()) {
+        MediaRelay::Session relaySession = m_mediaRelay->openSession(callId, session->caller, session->callee);
+        session->relaySessionId = relaySession.id;
+        session->relayKey = relaySession.key;
+    }
+    addMediaRoutes(session);
     
     // Notify both parties
-    sendCallResponse(session->caller, callId, true, QString());
-    sendCallResponse(session->callee, callId, true, QString());
+    sendCallResponse(session->caller, callId, true, QString(), session, MediaPacket::PARTY_CALLER);
+    sendCallResponse(session->callee, callId, true, QString(), session, MediaPacket::PARTY_CALLEE);
     
     qInfo() << "Call accepted:" << callId;
     emit callAccepted(callId);
@@ -140,19 +187,55 @@ void VideoCallServer::relayMediaData(const QString &callId, const QString &fromU
     // Determine the recipient
     QString recipient = (fromUser == session->caller) ? session->callee : session->caller;
     
-    // Prepare message
+    // Prepare message: [type][callId][media data to the end of the frame]
+    QByteArray callIdData = callId.toUtf8();
     QByteArray message;
-    QDataStream stream(&message, QIODevice::WriteOnly);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    stream << static_cast<quint8>(MSG_MEDIA_DATA);
-    stream << callId;
-    stream.writeRawData(mediaData.data(), mediaData.size());
+    message.reserve(1 + WireWriter::varintSize(callIdData.size()) + callIdData.size() + mediaData.size());
+    WireWriter(message)
+        .writeByte(MSG_MEDIA_DATA)
+        .writeUtf8(callIdData)
+        .writeRaw(mediaData.constData(), mediaData.size());
     
     // Send to recipient
     m_tcpServer->sendMessage(recipient, message);
 }
 
+bool VideoCallServer::forwardMedia(SessionHandle from, const QByteArray &mediaData)
+{
+    QHash<SessionHandle, MediaRoute>::const_iterator it = m_mediaRoutes.constFind(from);
+    if (it == m_mediaRoutes.constEnd()) {
+        return false;
+    }
+    return m_tcpServer->sendMessage(it->to, it->header, mediaData);
+}
+
+void VideoCallServer::addMediaRoutes(CallSession *session)
+{
+    // Sessions as of now; after a reconnect the handles no longer match and
+    // media takes the lookup path until the call ends
+    session->callerSession = m_tcpServer->sessionOf(session->caller);
+    session->calleeSession = m_tcpServer->sessionOf(session->callee);
+    if (session->callerSession == INVALID_SESSION || session->calleeSession == INVALID_SESSION) {
+        return;
+    }
+    
+    QByteArray header;
+    WireWriter(header)
+        .writeByte(MSG_MEDIA_DATA)
+        .writeString(session->callId);
+    
+    MediaRoute toCallee = { session->calleeSession, header };
+    MediaRoute toCaller = { session->callerSession, header };
+    m_mediaRoutes.insert(session->callerSession, toCallee);
+    m_mediaRoutes.insert(session->calleeSession, toCaller);
+}
+
+void VideoCallServer::removeMediaRoutes(const CallSession &session)
+{
+    m_mediaRoutes.remove(session.callerSession);
+    m_mediaRoutes.remove(session.calleeSession);
+}
+
 CallSession* VideoCallServer::getCallSession(const QString &callId)
 {
     return m_callSessions.value(callId, nullptr);
@@ -180,57 +263,392 @@ bool VideoCallServer::isUserInCall(const QString &userId) const
     return session && (session->status == CALL_ACTIVE || session->status == CALL_REQUESTING);
 }
 
-void VideoCallServer::onMessageReceived(const QString &userId, int msgType, const QByteArray &data)
+void VideoCallServer::onCallRequest(const MessageHeader &header, const FrameView &payload)
 {
-    MessageType type = static_cast<MessageType>(msgType);
+    // [callee][isVideo (1 byte)]
+    WireReader reader(payload);
+    QString callee;
+    quint8 isVideo = 0;
+    if (reader.readString(callee) && reader.readByte(isVideo)) {
+        initiateCall(header.userId, callee, isVideo > 0);
+    }
+}
+
+void VideoCallServer::onCallAccept(const MessageHeader &header, const FrameView &payload)
+{
+    Q_UNUSED(header);
+    WireReader reader(payload);
+    QString callId;
+    if (reader.readString(callId)) {
+        acceptCall(callId);
+    }
+}
+
+void VideoCallServer::onCallReject(const MessageHeader &header, const FrameView &payload)
+{
+    Q_UNUSED(header);
+    WireReader reader(payload);
+    QString callId, reason;
+    if (reader.readString(callId)) {
+        // The reason is optional
+        reader.readString(reason);
+        rejectCall(callId, reason);
+    }
+}
+
+void VideoCallServer::onCallEnd(const MessageHeader &header, const FrameView &payload)
+{
+    Q_UNUSED(header);
+    WireReader reader(payload);
+    QString callId;
+    if (reader.readString(callId)) {
+        endCall(callId);
+    }
+}
+
+void VideoCallServer::onMediaData(const MessageHeader &header, const FrameView &payload)
+{
+    // Hot path. A worker thread already gave the payload a buffer of its own,
+    // on the server thread the view dies with the read and is copied once.
+    QHash<SessionHandle, MediaRoute>::const_iterator route = m_mediaRoutes.constFind(header.session);
+    if (route != m_mediaRoutes.constEnd()) {
+        QByteArray mediaData = header.payloadBuffer.isNull() ? QByteArray(payload.data, payload.size)
+                                                             : header.payloadBuffer;
+        if (m_tcpServer->sendMessage(route->to, route->header, mediaData)) {
+            return;
+        }
+    }
     
-    QDataStream stream(data);
-    stream.setVersion(QDataStream::Qt_5_9);
+    // Reconnected parties: by userId, with the header encoded per packet
+    QString callId = m_userToCallId.value(header.userId, QString());
+    if (!callId.isEmpty()) {
+        relayMediaData(callId, header.userId, QByteArray::fromRawData(payload.data, payload.size));
+    }
+}
+
+void VideoCallServer::onRoom(const MessageHeader &header, const FrameView &payload)
+{
+    WireReader reader(payload);
+    quint8 subtype = 0;
+    if (!reader.readByte(subtype)) {
+        return;
+    }
     
-    switch (type) {
-        case MSG_CALL_REQUEST: {
-            QString callee;
-            quint8 isVideo;
-            stream >> callee >> isVideo;
-            initiateCall(userId, callee, isVideo > 0);
+    switch (subtype) {
+        case ROOM_JOIN: {
+            QString roomId;
+            if (reader.readString(roomId) && !roomId.isEmpty()) {
+                joinRoom(roomId, header.userId, header.session);
+            }
             break;
         }
-        
-        case MSG_CALL_ACCEPT: {
-            QString callId;
-            stream >> callId;
-            acceptCall(callId);
+        case ROOM_LEAVE:
+            leaveRoom(header.userId);
+            break;
+        case ROOM_SUBSCRIBE: {
+            // [All (1 byte)][Count][PublisherId x Count]
+            quint8 all = 0;
+            quint64 count = 0;
+            if (!reader.readByte(all) || !reader.readVarint(count) || count > MAX_ROOM_MEMBERS) {
+                return;
+            }
+            QSet<QString> publishers;
+            WireView publisher;
+            for (quint64 i = 0; i < count && reader.readBytes(publisher); ++i) {
+                publishers.insert(publisher.toString());
+            }
+            if (reader.isValid()) {
+                subscribe(header.userId, all != 0, publishers);
+            }
             break;
         }
-        
-        case MSG_CALL_REJECT: {
-            QString callId, reason;
-            stream >> callId >> reason;
-            rejectCall(callId, reason);
+        default:
             break;
+    }
+}
+
+void VideoCallServer::onRoomMedia(const MessageHeader &header, const FrameView &payload)
+{
+    // Same hot path as onMediaData: the buffer from the worker thread, or
+    // one copy of the view, shared by every subscriber
+    if (!m_roomPublishers.contains(header.session)) {
+        return;
+    }
+    QByteArray mediaData = header.payloadBuffer.isNull() ? QByteArray(payload.data, payload.size)
+                                                         : header.payloadBuffer;
+    publishRoomMedia(header.session, mediaData);
+}
+
+void VideoCallServer::onRoomAudio(const MessageHeader &header, const FrameView &payload)
+{
+    RoomMember *member = m_roomPublishers.value(header.session, nullptr);
+    Room *room = member ? m_rooms.value(member->roomId, nullptr) : nullptr;
+    if (!room) {
+        return;
+    }
+    
+    if (!room->mixer) {
+        room->mixer = new AudioMixer(m_audioFrameMs);
+        for (const RoomMember *listener : room->members) {
+            room->mixer->addParticipant(listener->userId);
         }
-        
-        case MSG_CALL_END: {
-            QString callId;
-            stream >> callId;
-            endCall(callId);
+        WireWriter(room->audioHeader)
+            .writeByte(MSG_ROOM_AUDIO)
+            .writeString(room->roomId);
+    }
+    
+    QByteArray pcm = header.payloadBuffer.isNull() ? QByteArray(payload.data, payload.size)
+                                                   : header.payloadBuffer;
+    switch (room->mixer->pushFrame(member->userId, pcm)) {
+        case AudioMixer::Queued:
+            ++m_audioFrames;
             break;
+        case AudioMixer::DroppedOldest:
+            ++m_audioFrames;
+            ++m_audioDropped;
+            break;
+        case AudioMixer::Rejected:
+            ++m_audioDropped;
+            return;
+    }
+    
+    if (!m_mixTimer.isActive()) {
+        m_mixTimer.start(m_audioFrameMs);
+    }
+}
+
+void VideoCallServer::onMixTick()
+{
+    bool active = false;
+    for (Room *room : m_rooms) {
+        if (!room->mixer) {
+            continue;
         }
         
-        case MSG_MEDIA_DATA: {
-            QString callId = m_userToCallId.value(userId, QString());
-            if (!callId.isEmpty()) {
-                relayMediaData(callId, userId, data);
+        QVector<AudioMixer::Output> outputs = room->mixer->mix();
+        for (const AudioMixer::Output &output : outputs) {
+            // The listener's own stream id, its mix only pushes out its own stale frames
+            const RoomMember *listener = room->members.value(output.userId, nullptr);
+            if (listener && m_tcpServer->sendMessage(listener->session, room->audioHeader, output.pcm,
+                                                     listener->stream)) {
+                ++m_mixedFrames;
             }
-            break;
         }
-        
-        default:
-            // Not a call-related message, ignore
-            break;
+        active = active || !outputs.isEmpty() || room->mixer->hasPendingFrames();
+    }
+    
+    // Restarted by the next frame, silent rooms cost no ticks
+    if (!active) {
+        m_mixTimer.stop();
     }
 }
 
+bool VideoCallServer::setAudioFrameMs(int frameMs)
+{
+    if (frameMs != 10 && frameMs != 20) {
+        return false;
+    }
+    m_audioFrameMs = frameMs;
+    return true;
+}
+
+bool VideoCallServer::joinRoom(const QString &roomId, const QString &userId, SessionHandle session)
+{
+    RoomMember *current = m_roomMembers.value(userId, nullptr);
+    if (current && current->roomId == roomId) {
+        if (current->session != session) {
+            // Rejoined from a new connection: publish from it and forward to it
+            m_roomPublishers.remove(current->session);
+            current->session = session;
+            m_roomPublishers.insert(session, current);
+            Room *room = m_rooms.value(roomId, nullptr);
+            rebuildSubscribers(room);
+            if (room) {
+                sendRoomMembers(*room, userId, session);
+            }
+        }
+        return true;
+    }
+    
+    Room *room = m_rooms.value(roomId, nullptr);
+    if (room && room->members.size() >= MAX_ROOM_MEMBERS) {
+        sendRoomError(userId, roomId, QStringLiteral("Room is full"));
+        return false;
+    }
+    if (current) {
+        leaveRoom(userId);
+    }
+    if (!room) {
+        room = new Room;
+        room->roomId = roomId;
+        m_rooms.insert(roomId, room);
+    }
+    
+    RoomMember *member = new RoomMember;
+    member->userId = userId;
+    member->roomId = roomId;
+    member->session = session;
+    member->stream = m_nextStreamId++;
+    if (m_nextStreamId == 0) {
+        m_nextStreamId = 1;
+    }
+    WireWriter(member->mediaHeader)
+        .writeByte(MSG_ROOM_MEDIA)
+        .writeString(roomId)
+        .writeString(userId);
+    
+    sendRoomEvent(*room, ROOM_JOIN, userId);
+    room->members.insert(userId, member);
+    m_roomMembers.insert(userId, member);
+    m_roomPublishers.insert(session, member);
+    if (room->mixer) {
+        room->mixer->addParticipant(userId);
+    }
+    rebuildSubscribers(room);
+    sendRoomMembers(*room, userId, session);
+    
+    qInfo() << "Room" << roomId << "joined by" << userId << "- members:" << room->members.size();
+    return true;
+}
+
+void VideoCallServer::leaveRoom(const QString &userId)
+{
+    RoomMember *member = m_roomMembers.take(userId);
+    if (!member) {
+        return;
+    }
+    
+    m_roomPublishers.remove(member->session);
+    Room *room = m_rooms.value(member->roomId, nullptr);
+    if (room) {
+        room->members.remove(userId);
+        if (room->mixer) {
+            room->mixer->removeParticipant(userId);
+        }
+        if (room->members.isEmpty()) {
+            qInfo() << "Room closed:" << room->roomId;
+            m_rooms.remove(room->roomId);
+            delete room->mixer;
+            delete room;
+        } else {
+            // Subscriptions naming the member stay, a rejoin picks them up again
+            rebuildSubscribers(room);
+            sendRoomEvent(*room, ROOM_LEAVE, userId);
+        }
+    }
+    delete member;
+}
+
+void VideoCallServer::subscribe(const QString &userId, bool all, const QSet<QString> &publishers)
+{
+    RoomMember *member = m_roomMembers.value(userId, nullptr);
+    if (!member) {
+        return;
+    }
+    
+    member->subscribeAll = all;
+    member->subscriptions = publishers;
+    rebuildSubscribers(m_rooms.value(member->roomId, nullptr));
+}
+
+int VideoCallServer::publishRoomMedia(SessionHandle from, const QByteArray &mediaData)
+{
+    RoomMember *publisher = m_roomPublishers.value(from, nullptr);
+    if (!publisher) {
+        return 0;
+    }
+    
+    // The stream id bounds this publisher's share of each subscriber's
+    // outbound queue, a busy one only drops its own stale frames
+    int sent = 0;
+    for (SessionHandle subscriber : publisher->subscribers) {
+        if (m_tcpServer->sendMessage(subscriber, publisher->mediaHeader, mediaData, publisher->stream)) {
+            ++sent;
+        }
+    }
+    ++m_roomMediaPackets;
+    m_roomMediaSends += sent;
+    return sent;
+}
+
+void VideoCallServer::rebuildSubscribers(Room *room)
+{
+    if (!room) {
+        return;
+    }
+    
+    // At most MAX_ROOM_MEMBERS squared, and only on membership or
+    // subscription changes, so media never looks at subscriptions
+    for (RoomMember *publisher : room->members) {
+        publisher->subscribers.clear();
+        for (const RoomMember *member : room->members) {
+            if (member != publisher
+                    && (member->subscribeAll || member->subscriptions.contains(publisher->userId))) {
+                publisher->subscribers.append(member->session);
+            }
+        }
+    }
+}
+
+void VideoCallServer::sendRoomMembers(const Room &room, const QString &userId, SessionHandle session)
+{
+    // The joiner learns who is already there: [0x0F][0x04][RoomId][Count][UserId x Count]
+    QByteArray message;
+    WireWriter writer(message);
+    writer.writeByte(MSG_ROOM)
+          .writeByte(ROOM_MEMBERS)
+          .writeString(room.roomId)
+          .writeVarint(room.members.size() - 1);
+    for (auto it = room.members.constBegin(); it != room.members.constEnd(); ++it) {
+        if (it.key() != userId) {
+            writer.writeString(it.key());
+        }
+    }
+    m_tcpServer->sendMessage(session, message);
+}
+
+void VideoCallServer::sendRoomEvent(const Room &room, quint8 event, const QString &userId)
+{
+    // [0x0F][Event][RoomId][UserId] to every member but userId
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_ROOM)
+        .writeByte(event)
+        .writeString(room.roomId)
+        .writeString(userId);
+    
+    for (const RoomMember *member : room.members) {
+        if (member->userId != userId) {
+            m_tcpServer->sendMessage(member->session, message);
+        }
+    }
+}
+
+void VideoCallServer::sendRoomError(const QString &userId, const QString &roomId, const QString &reason)
+{
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(MSG_ROOM)
+        .writeByte(ROOM_ERROR)
+        .writeString(roomId)
+        .writeString(reason);
+    
+    m_tcpServer->sendMessage(userId, message);
+}
+
+RoomStatistics VideoCallServer::roomStatistics() const
+{
+    RoomStatistics stats;
+    stats.rooms = m_rooms.size();
+    stats.members = m_roomMembers.size();
+    stats.mediaPackets = m_roomMediaPackets;
+    stats.mediaSends = m_roomMediaSends;
+    stats.audioFrames = m_audioFrames;
+    stats.audioDropped = m_audioDropped;
+    stats.mixedFrames = m_mixedFrames;
+    return stats;
+}
+
 void VideoCallServer::onClientDisconnected(const QString &userId)
 {
     // If user was in a call, end it
@@ -238,33 +656,38 @@ void VideoCallServer::onClientDisconnected(const QString &userId)
     if (!callId.isEmpty()) {
         endCall(callId);
     }
+    leaveRoom(userId);
 }
 
 void VideoCallServer::sendCallRequest(const QString &callee, const CallSession &session)
 {
     QByteArray message;
-    QDataStream stream(&message, QIODevice::WriteOnly);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    stream << static_cast<quint8>(MSG_CALL_REQUEST);
-    stream << session.callId;
-    stream << session.caller;
-    stream << static_cast<quint8>(session.isVideoCall ? 1 : 0);
+    WireWriter(message)
+        .writeByte(MSG_CALL_REQUEST)
+        .writeString(session.callId)
+        .writeString(session.caller)
+        .writeByte(session.isVideoCall ? 1 : 0);
     
     m_tcpServer->sendMessage(callee, message);
 }
 
 void VideoCallServer::sendCallResponse(const QString &userId, const QString &callId, 
-                                       bool accepted, const QString &reason)
+                                       bool accepted, const QString &reason,
+                                       const CallSession *session, quint8 party)
 {
+    // [0x03][CallId] then [RelayPort][SessionId][Key][Party] when the call
+    // has a UDP relay, or [0x04][CallId][Reason]
     QByteArray message;
-    QDataStream stream(&message, QIODevice::WriteOnly);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    stream << static_cast<quint8>(accepted ? MSG_CALL_ACCEPT : MSG_CALL_REJECT);
-    stream << callId;
+    WireWriter writer(message);
+    writer.writeByte(accepted ? MSG_CALL_ACCEPT : MSG_CALL_REJECT);
+    writer.writeString(callId);
     if (!accepted) {
-        stream << reason;
+        writer.writeString(reason);
+    } else if (session && session->relaySessionId != 0) {
+        writer.writeVarint(m_mediaRelay->port());
+        writer.writeVarint(session->relaySessionId);
+        writer.writeBytes(session->relayKey);
+        writer.writeByte(party);
     }
     
     m_tcpServer->sendMessage(userId, message);
@@ -273,11 +696,9 @@ void VideoCallServer::sendCallResponse(const QString &userId, const QString &cal
 void VideoCallServer::notifyCallEnd(const CallSession &session)
 {
     QByteArray message;
-    QDataStream stream(&message, QIODevice::WriteOnly);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    stream << static_cast<quint8>(MSG_CALL_END);
-    stream << session.callId;
+    WireWriter(message)
+        .writeByte(MSG_CALL_END)
+        .writeString(session.callId);
     
     m_tcpServer->sendMessage(session.caller, message);
     m_tcpServer->sendMessage(session.callee, message);
@@ -287,6 +708,10 @@ void VideoCallServer::cleanupCall(const QString &callId)
 {
     CallSession *session = m_callSessions.value(callId, nullptr);
     if (session) {
+        if (session->relaySessionId != 0 && m_mediaRelay) {
+            m_mediaRelay->closeSession(session->relaySessionId);
+        }
+        removeMediaRoutes(*session);
         m_userToCallId.remove(session->caller);
         m_userToCallId.remove(session->callee);
         m_callSessions.remove(callId);
@@ -2,21 +2,53 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QMessageBox>
-#include <QDataStream>
+#include <QTimer>
 #include <QDebug>
 #include "iconhelper.h"
+#include "wirecodec.h"
+#include "framecompression.h"
+#include "batchenvelope.h"
+#include "framebatcher.h"
+
+// Delay before a dropped session is resumed
+static const int RESUME_DELAY_MS = 1000;
+// Messages received within this window share one ack
+static const int ACK_DELAY_MS = 200;
+// Well inside the server's idle timeout (90 s by default)
+static const int HEARTBEAT_INTERVAL_MS = 30 * 1000;
+// Optional features requested at login
+static const quint8 REQUESTED_CAPABILITIES = FrameCompression::CAPABILITY_COMPRESSION
+                                           | BatchEnvelope::CAPABILITY_BATCH
+                                           | AckRanges::CAPABILITY_ACK;
 
 ServerLoginDlg::ServerLoginDlg(QWidget *parent)
     : CBaseDlg(parent)
     , m_socket(nullptr)
+    , m_batcher(nullptr)
     , m_serverHost("127.0.0.1")
     , m_serverPort(8888)
     , m_isRegistering(false)
+    , m_isResuming(false)
+    , m_capabilities(0)
+    , m_lastSequence(0)
+    , m_ackTimer(nullptr)
+    , m_ackPending(false)
+    , m_heartbeatTimer(nullptr)
 {
     createUI();
     
+    m_ackTimer = new QTimer(this);
+    m_ackTimer->setSingleShot(true);
+    m_ackTimer->setInterval(ACK_DELAY_MS);
+    connect(m_ackTimer, &QTimer::timeout, this, &ServerLoginDlg::sendAck);
+    
+    m_heartbeatTimer = new QTimer(this);
+    m_heartbeatTimer->setInterval(HEARTBEAT_INTERVAL_MS);
+    connect(m_heartbeatTimer, &QTimer::timeout, this, &ServerLoginDlg::sendHeartbeat);
+    
     // Initialize socket
     m_socket = new QTcpSocket(this);
+    m_batcher = new FrameBatcher(m_socket, this);
     connect(m_socket, &QTcpSocket::connected, this, &ServerLoginDlg::onServerConnected);
     connect(m_socket, &QTcpSocket::disconnected, this, &ServerLoginDlg::onServerDisconnected);
     connect(m_socket, &QTcpSocket::readyRead, this, &ServerLoginDlg::onServerReadyRead);
@@ -27,6 +59,8 @@ ServerLoginDlg::ServerLoginDlg(QWidget *parent)
 ServerLoginDlg::~ServerLoginDlg()
 {
     if (m_socket) {
+        // A deliberate close, not a network drop to resume from
+        disconnect(m_socket, nullptr, this, nullptr);
         m_socket->disconnectFromHost();
     }
 }
@@ -197,6 +231,7 @@ void ServerLoginDlg::onLoginClicked()
     }
     
     m_isRegistering = false;
+    m_isResuming = false;
     connectToServer();
 }
 
@@ -224,14 +259,31 @@ void ServerLoginDlg::onRegisterClicked()
     }
     
     m_isRegistering = true;
+    m_isResuming = false;
+    connectToServer();
+}
+
+void ServerLoginDlg::resumeSession()
+{
+    if (m_token.isEmpty() || m_socket->state() != QAbstractSocket::UnconnectedState) {
+        return;
+    }
+    
+    m_isResuming = true;
     connectToServer();
 }
 
 void ServerLoginDlg::onServerConnected()
 {
     m_labStatus->setText(tr("已连接，正在验证..."));
-    
-    if (m_isRegistering) {
+    m_decoder.clear();
+    m_batcher->clear();
+    m_batcher->setEnvelopeEnabled(false);
+    m_ackTimer->stop();
+    
+    if (m_isResuming) {
+        sendResumeRequest();
+    } else if (m_isRegistering) {
         sendRegisterRequest();
     } else {
         sendLoginRequest();
@@ -240,29 +292,30 @@ void ServerLoginDlg::onServerConnected()
 
 void ServerLoginDlg::onServerDisconnected()
 {
+    m_heartbeatTimer->stop();
     m_btnLogin->setEnabled(true);
     m_btnRegister->setEnabled(true);
+    
+    // A logged-in session that drops is resumed, not logged in again
+    if (!m_token.isEmpty()) {
+        QTimer::singleShot(RESUME_DELAY_MS, this, &ServerLoginDlg::resumeSession);
+    }
 }
 
 void ServerLoginDlg::sendLoginRequest()
 {
     // Send login request to server
-    // Protocol: [MSG_TYPE][username_len][username][password]
+    // Protocol: [MSG_TYPE][username][password][capabilities], strings as [varint length][UTF-8]
     QByteArray message;
-    QDataStream stream(&message, QIODevice::WriteOnly);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    stream << static_cast<quint8>(0x08);  // Login request message type
-    
-    QByteArray usernameData = m_username.toUtf8();
-    stream << static_cast<quint16>(usernameData.size());
-    stream.writeRawData(usernameData.data(), usernameData.size());
-    
-    QByteArray passwordData = m_editPassword->text().toUtf8();
-    stream << static_cast<quint16>(passwordData.size());
-    stream.writeRawData(passwordData.data(), passwordData.size());
-    
-    m_socket->write(message);
+    WireWriter(message)
+        .writeByte(0x08)  // Login request message type
+        .writeString(m_username)
+        .writeString(m_editPassword->text())
+        .writeByte(REQUESTED_CAPABILITIES);
+    
+    // Nothing else to wait for, the request goes out right away
+    m_batcher->send(message);
+    m_batcher->flush();
     m_socket->flush();
 }
 
@@ -270,54 +323,129 @@ void ServerLoginDlg::sendRegisterRequest()
 {
     // Send register request to server
     QByteArray message;
-    QDataStream stream(&message, QIODevice::WriteOnly);
-    stream.setVersion(QDataStream::Qt_5_9);
-    
-    stream << static_cast<quint8>(0x09);  // Register request message type
-    
-    QByteArray usernameData = m_username.toUtf8();
-    stream << static_cast<quint16>(usernameData.size());
-    stream.writeRawData(usernameData.data(), usernameData.size());
-    
-    QByteArray passwordData = m_editPassword->text().toUtf8();
-    stream << static_cast<quint16>(passwordData.size());
-    stream.writeRawData(passwordData.data(), passwordData.size());
-    
-    m_socket->write(message);
+    WireWriter(message)
+        .writeByte(0x09)  // Register request message type
+        .writeString(m_username)
+        .writeString(m_editPassword->text())
+        .writeByte(REQUESTED_CAPABILITIES);
+    
+    m_batcher->send(message);
+    m_batcher->flush();
+    m_socket->flush();
+}
+
+void ServerLoginDlg::sendResumeRequest()
+{
+    // Protocol: [MSG_TYPE][token][last sequence (varint)][capabilities]
+    QByteArray message;
+    WireWriter(message)
+        .writeByte(0x0D)  // Resume request message type
+        .writeString(m_token)
+        .writeVarint(m_lastSequence)
+        .writeByte(REQUESTED_CAPABILITIES);
+    
+    m_batcher->send(message);
+    m_batcher->flush();
     m_socket->flush();
 }
 
 void ServerLoginDlg::onServerReadyRead()
 {
-    QByteArray data = m_socket->readAll();
-    processServerResponse(data);
+    m_decoder.readFrom(m_socket);
+    
+    FrameView frame;
+    while (m_decoder.next(frame) == FrameDecoder::FrameReady) {
+        processServerResponse(frame);
+    }
 }
 
-void ServerLoginDlg::processServerResponse(const QByteArray &data)
+void ServerLoginDlg::processServerResponse(const FrameView &received)
 {
-    QDataStream stream(data);
-    stream.setVersion(QDataStream::Qt_5_9);
+    // Frames above the server's threshold arrive compressed once negotiated
+    FrameView frame = received;
+    QByteArray inflated;
+    if (received.size > 0 && FrameCompression::isCompressed(static_cast<quint8>(received.data[0]))) {
+        if (!FrameCompression::decompress(received.data, received.size, m_decoder.maxFrameSize(), inflated)) {
+            return;
+        }
+        frame.data = inflated.constData();
+        frame.size = inflated.size();
+    }
+    
+    WireReader reader(frame);
     
-    quint8 msgType;
-    stream >> msgType;
+    quint8 msgType = 0;
+    reader.readByte(msgType);
     
-    if (msgType == 0x0A) {  // Login/Register response
-        quint8 success;
-        stream >> success;
+    if (msgType == BatchEnvelope::MESSAGE_TYPE) {
+        BatchReader batch(frame);
+        FrameView entry;
+        while (batch.next(entry)) {
+            processServerResponse(entry);
+        }
+        return;
+    }
+    
+    if (msgType == 0x00) {  // Text message
+        // [SenderId][Text][Sequence], older servers send no sequence
+        WireView sender;
+        WireView text;
+        quint64 sequence = 0;
+        if (reader.readBytes(sender) && reader.readBytes(text) && !reader.atEnd()
+                && reader.readVarint(sequence)) {
+            noteReceived(sequence);
+        }
+        return;
+    }
+    
+    if (msgType == 0x0B && (m_capabilities & AckRanges::CAPABILITY_ACK)) {  // Offline batch
+        // [Through] ahead of the messages, everything up to it is delivered
+        quint64 through = 0;
+        if (reader.readVarint(through)) {
+            noteReceivedThrough(through);
+        }
+        return;
+    }
+    
+    if (msgType == 0x0A) {  // Login/Register/Resume response
+        quint8 success = 0;
+        reader.readByte(success);
         
         if (success) {
             // Read token and userId
-            quint16 tokenLen;
-            stream >> tokenLen;
-            QByteArray tokenData(tokenLen, 0);
-            stream.readRawData(tokenData.data(), tokenLen);
-            m_token = QString::fromUtf8(tokenData);
+            if (!reader.readString(m_token) || !reader.readString(m_userId)) {
+                return;
+            }
+            
+            // Servers without optional features send no capability byte
+            quint8 capabilities = 0;
+            if (!reader.atEnd()) {
+                reader.readByte(capabilities);
+            }
+            m_capabilities = capabilities;
+            m_batcher->setEnvelopeEnabled((capabilities & BatchEnvelope::CAPABILITY_BATCH) != 0);
+            m_heartbeatTimer->start();
             
-            quint16 userIdLen;
-            stream >> userIdLen;
-            QByteArray userIdData(userIdLen, 0);
-            stream.readRawData(userIdData.data(), userIdLen);
-            m_userId = QString::fromUtf8(userIdData);
+            // Without acks everything up to here is delivered right behind the
+            // response. With acks the backlog frames and replays settle it.
+            quint64 sequence = 0;
+            if (!reader.atEnd() && reader.readVarint(sequence)
+                    && !(capabilities & AckRanges::CAPABILITY_ACK)) {
+                m_lastSequence = sequence;
+                m_received.clear();
+            }
+            
+            if (m_isResuming) {
+                m_isResuming = false;
+                // Acks lost with the old connection
+                if (m_ackPending) {
+                    m_ackTimer->start();
+                }
+                m_labStatus->setText(tr("已重新连接"));
+                m_labStatus->setStyleSheet("QLabel{font: 12px; color:#00AA00;}");
+                emit sessionResumed();
+                return;
+            }
             
             m_labStatus->setText(m_isRegistering ? tr("注册成功!") : tr("登录成功!"));
             m_labStatus->setStyleSheet("QLabel{font: 12px; color:#00AA00;}");
@@ -326,11 +454,18 @@ void ServerLoginDlg::processServerResponse(const QByteArray &data)
             
             QTimer::singleShot(500, this, &ServerLoginDlg::accept);
         } else {
-            quint16 errorLen;
-            stream >> errorLen;
-            QByteArray errorData(errorLen, 0);
-            stream.readRawData(errorData.data(), errorLen);
-            QString error = QString::fromUtf8(errorData);
+            QString error;
+            reader.readString(error);
+            
+            if (m_isResuming) {
+                // Token expired, only a full login gets back in
+                m_isResuming = false;
+                m_token.clear();
+                m_lastSequence = 0;
+                m_received.clear();
+                m_ackPending = false;
+                emit loginFailed(error);
+            }
             
             m_labStatus->setText(error);
             m_labStatus->setStyleSheet("QLabel{font: 12px; color:#FF0000;}");
@@ -341,6 +476,57 @@ void ServerLoginDlg::processServerResponse(const QByteArray &data)
     }
 }
 
+void ServerLoginDlg::noteReceived(quint64 sequence)
+{
+    if (!(m_capabilities & AckRanges::CAPABILITY_ACK)) {
+        m_lastSequence = qMax(m_lastSequence, sequence);
+        return;
+    }
+    
+    if (sequence > m_lastSequence) {
+        m_received.insert(sequence);
+        m_lastSequence = m_received.advance(m_lastSequence);
+    }
+    // Duplicates are acknowledged again, the first ack may have been lost
+    m_ackPending = true;
+    if (!m_ackTimer->isActive()) {
+        m_ackTimer->start();
+    }
+}
+
+void ServerLoginDlg::noteReceivedThrough(quint64 sequence)
+{
+    if (sequence > m_lastSequence) {
+        m_lastSequence = m_received.advance(sequence);
+    }
+    m_ackPending = true;
+    if (!m_ackTimer->isActive()) {
+        m_ackTimer->start();
+    }
+}
+
+void ServerLoginDlg::sendAck()
+{
+    if (!m_ackPending || m_socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+    
+    // [0x0E][Cumulative][RangeCount]([Gap][Length]) × RangeCount
+    m_ackPending = false;
+    m_batcher->send(AckRanges::encodeAck(m_lastSequence, m_received));
+}
+
+void ServerLoginDlg::sendHeartbeat()
+{
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+    
+    // [0x07], the server echoes it
+    m_batcher->send(QByteArray(1, static_cast<char>(0x07)));
+    m_batcher->flush();
+}
+
 void ServerLoginDlg::onServerError(QAbstractSocket::SocketError error)
 {
     QString errorMsg;
@@ -363,4 +549,9 @@ void ServerLoginDlg::onServerError(QAbstractSocket::SocketError error)
     m_labStatus->setStyleSheet("QLabel{font: 12px; color:#FF0000;}");
     m_btnLogin->setEnabled(true);
     m_btnRegister->setEnabled(true);
+    
+    // Server still unreachable, keep trying while the token is valid
+    if (m_isResuming) {
+        QTimer::singleShot(RESUME_DELAY_MS, this, &ServerLoginDlg::resumeSession);
+    }
 }